@@ -78,4 +78,149 @@ public:
   }
 };
 
+// Growable array template - doubles capacity when full
+template <typename T>
+class DynamicArray
+{
+private:
+  T *data;
+  int capacity;
+  int size;
+
+  void grow(int minCapacity)
+  {
+    int newCapacity = capacity > 0 ? capacity : 4;
+    while (newCapacity < minCapacity)
+    {
+      newCapacity *= 2;
+    }
+    T *newData = new T[newCapacity];
+    for (int i = 0; i < size; i++)
+    {
+      newData[i] = data[i];
+    }
+    delete[] data;
+    data = newData;
+    capacity = newCapacity;
+  }
+
+public:
+  DynamicArray(int cap = 4)
+  {
+    capacity = cap > 0 ? cap : 4;
+    size = 0;
+    data = new T[capacity];
+  }
+
+  ~DynamicArray()
+  {
+    delete[] data;
+  }
+
+  DynamicArray(const DynamicArray &other)
+  {
+    capacity = other.capacity;
+    size = other.size;
+    data = new T[capacity];
+    for (int i = 0; i < size; i++)
+    {
+      data[i] = other.data[i];
+    }
+  }
+
+  DynamicArray &operator=(const DynamicArray &other)
+  {
+    if (this != &other)
+    {
+      delete[] data;
+      capacity = other.capacity;
+      size = other.size;
+      data = new T[capacity];
+      for (int i = 0; i < size; i++)
+      {
+        data[i] = other.data[i];
+      }
+    }
+    return *this;
+  }
+
+  void add(T element)
+  {
+    if (size >= capacity)
+    {
+      grow(size + 1);
+    }
+    data[size++] = element;
+  }
+
+  T &operator[](int index) { return data[index]; }
+  const T &operator[](int index) const { return data[index]; }
+
+  T get(int index) const
+  {
+    if (index >= 0 && index < size)
+    {
+      return data[index];
+    }
+    throw "Index out of bounds";
+  }
+
+  void set(int index, T element)
+  {
+    if (index >= 0 && index < size)
+    {
+      data[index] = element;
+    }
+  }
+
+  T removeLast()
+  {
+    if (size == 0)
+    {
+      throw "Array is empty";
+    }
+    return data[--size];
+  }
+
+  void reserve(int cap)
+  {
+    if (cap > capacity)
+    {
+      grow(cap);
+    }
+  }
+
+  // Resizes to newSize, new elements are default constructed values
+  void resize(int newSize, T fill = T())
+  {
+    reserve(newSize);
+    for (int i = size; i < newSize; i++)
+    {
+      data[i] = fill;
+    }
+    size = newSize;
+  }
+
+  // Exchanges contents with another array without copying elements
+  void swap(DynamicArray &other)
+  {
+    T *otherData = other.data;
+    other.data = data;
+    data = otherData;
+    int otherCapacity = other.capacity;
+    other.capacity = capacity;
+    capacity = otherCapacity;
+    int otherSize = other.size;
+    other.size = size;
+    size = otherSize;
+  }
+
+  int getSize() const { return size; }
+  int getCapacity() const { return capacity; }
+  bool isEmpty() const { return size == 0; }
+  void clear() { size = 0; }
+  T *raw() { return data; }
+  const T *raw() const { return data; }
+};
+
 #endif
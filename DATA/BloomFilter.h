@@ -0,0 +1,93 @@
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <iostream>
+#include <string>
+#include "Array.h"
+#include "HashMap.h"
+using namespace std;
+
+// Bloom filter: a set that answers "certainly not in it" in O(1), and
+// "probably in it" wrongly for about 1% of other keys at 10 bits a key.
+// All HASHES bits of a key are in one 512-bit block (a cache line), so a
+// lookup reads one block however large the filter is. Keys cannot be
+// taken out; the owner rebuilds the filter from its set instead.
+class BloomFilter
+{
+private:
+  static const int HASHES = 7;
+  static const int BITS_PER_KEY = 10;
+  static const int BLOCK_WORDS = 8; // 512 bits, 9 bits of hash per bit set
+
+  DynamicArray<unsigned long long> words;
+  int blockMask;
+  int count;    // Keys added, repeats included
+  int capacity; // Keys it was sized for
+
+  // The key's block; bits gets its HASHES bit positions, 9 bits each.
+  // FNV-1a leaves short keys' high bits weak, so it is mixed first.
+  unsigned long long *blockFor(unsigned long long hash, unsigned long long &bits)
+  {
+    unsigned long long h = hashKey(hash);
+    bits = hashKey(h);
+    return &words[(int)(h & (unsigned long long)blockMask) * BLOCK_WORDS];
+  }
+
+public:
+  BloomFilter(int expectedKeys = 0)
+  {
+    reset(expectedKeys);
+  }
+
+  // Empties the filter, sized for expectedKeys (one block at least)
+  void reset(int expectedKeys)
+  {
+    int blocks = 1;
+    while ((long long)blocks * BLOCK_WORDS * 64 < (long long)expectedKeys * BITS_PER_KEY)
+    {
+      blocks <<= 1;
+    }
+    words.resize(0);
+    words.resize(blocks * BLOCK_WORDS, 0);
+    blockMask = blocks - 1;
+    count = 0;
+    capacity = blocks * BLOCK_WORDS * 64 / BITS_PER_KEY;
+  }
+
+  void add(const string &key) { addHash(hashKey(key)); }
+
+  void addHash(unsigned long long hash)
+  {
+    unsigned long long bits;
+    unsigned long long *block = blockFor(hash, bits);
+    for (int i = 0; i < HASHES; i++, bits >>= 9)
+    {
+      block[(bits >> 6) & 7] |= 1ULL << (bits & 63);
+    }
+    count++;
+  }
+
+  // False: the key was never added. True: it probably was.
+  bool mightContain(const string &key) { return mightContainHash(hashKey(key)); }
+
+  bool mightContainHash(unsigned long long hash)
+  {
+    unsigned long long bits;
+    unsigned long long *block = blockFor(hash, bits);
+    for (int i = 0; i < HASHES; i++, bits >>= 9)
+    {
+      if ((block[(bits >> 6) & 7] & (1ULL << (bits & 63))) == 0)
+        return false;
+    }
+    return true;
+  }
+
+  // More keys than it was sized for: rebuild it larger, or the false
+  // positive rate climbs
+  bool isOverCapacity() const { return count > capacity; }
+
+  int getCount() const { return count; }
+  int getBitCount() const { return words.getSize() * 64; }
+};
+
+#endif
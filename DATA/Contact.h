@@ -43,6 +43,7 @@ public:
   void setName(string n) { name = n; }
   void setEmail(string e) { email = e; }
   void setPhone(string p) { phone = p; }
+  void setInteractionCount(int count) { interactionCount = count; }
 
   void incrementInteraction() { interactionCount++; }
 
@@ -4,103 +4,169 @@
 #include <iostream>
 #include <ctime>
 #include <sstream>
+#include "IdGenerator.h"
+#include "EmailStore.h"
+#include "TextKernels.h"
 using namespace std;
 
+// The six folders of a mailbox
+enum FolderType
+{
+  FOLDER_INBOX = 0,
+  FOLDER_SENT,
+  FOLDER_DRAFTS,
+  FOLDER_SPAM,
+  FOLDER_TRASH,
+  FOLDER_IMPORTANT,
+  FOLDER_COUNT
+};
+
+inline const char *folderTypeName(FolderType type)
+{
+  static const char *names[FOLDER_COUNT] = {"Inbox", "Sent", "Drafts", "Spam", "Trash", "Important"};
+  return type < FOLDER_COUNT ? names[type] : names[FOLDER_INBOX];
+}
+
+// Unknown names map to the Inbox, the default folder
+inline FolderType folderTypeFromName(const string &name)
+{
+  for (int i = 0; i < FOLDER_COUNT; i++)
+  {
+    if (name == folderTypeName((FolderType)i))
+      return (FolderType)i;
+  }
+  return FOLDER_INBOX;
+}
+
+// Labels an email can carry, any number at once. Unlike folders they do
+// not say where the email is stored; folders keep a bitmap per label.
+enum EmailLabel
+{
+  LABEL_READ = 0,
+  LABEL_SPAM,
+  LABEL_IMPORTANT,
+  LABEL_COUNT // At most 8
+};
+
+inline unsigned int labelBit(EmailLabel label) { return 1u << label; }
+
+// Compact email record (56 bytes): addresses are ids in the shared
+// AddressTable, subject and content live in the mailbox TextArena, and
+// folder, labels and priority share the last word. The accessors still
+// take and return strings.
 class Email
 {
 private:
-  string emailId;
-  string sender;
-  string receiver;
-  string subject;
-  string content;
-  time_t timestamp;
-  bool isRead;
-  bool isSpam;
-  int priority;
-  string folder;
+  EmailId emailId;   // 0 until one is assigned
+  EmailId inReplyTo; // Email this one answers, 0 if none
+  long long timestamp;
+  TextRef subject;
+  TextRef content;
+  unsigned int senderId;
+  unsigned int receiverId;
+  unsigned char folder; // FolderType
+  unsigned char labels; // EmailLabel bits
+  signed char priority;
 
 public:
   Email()
   {
-    emailId = "";
-    sender = "";
-    receiver = "";
-    subject = "";
-    content = "";
+    emailId = 0;
+    inReplyTo = 0;
+    senderId = 0;
+    receiverId = 0;
     timestamp = time(0);
-    isRead = false;
-    isSpam = false;
+    labels = 0;
     priority = 0;
-    folder = "Inbox";
+    folder = FOLDER_INBOX;
   }
 
-  Email(string id, string from, string to, string subj, string cont)
+  Email(EmailId id, string from, string to, string subj, string cont)
   {
     emailId = id;
-    sender = from;
-    receiver = to;
-    subject = subj;
-    content = cont;
+    inReplyTo = 0;
+    senderId = AddressTable::shared().intern(from);
+    receiverId = AddressTable::shared().intern(to);
+    subject = TextArena::mailbox().store(subj);
+    content = TextArena::mailbox().store(cont);
     timestamp = time(0);
-    isRead = false;
-    isSpam = false;
+    labels = 0;
     priority = 0;
-    folder = "Inbox";
+    folder = FOLDER_INBOX;
   }
 
   // Getters
-  string getEmailId() const { return emailId; }
-  string getSender() const { return sender; }
-  string getReceiver() const { return receiver; }
-  string getSubject() const { return subject; }
-  string getContent() const { return content; }
-  time_t getTimestamp() const { return timestamp; }
-  bool getIsRead() const { return isRead; }
-  bool getIsSpam() const { return isSpam; }
+  EmailId getId() const { return emailId; }
+  string getEmailId() const { return IdGenerator::toString(emailId); } // "E<id>", display and files
+  EmailId getInReplyTo() const { return inReplyTo; }
+  string getSender() const { return AddressTable::shared().get(senderId); }
+  string getReceiver() const { return AddressTable::shared().get(receiverId); }
+  unsigned int getSenderId() const { return senderId; }
+  unsigned int getReceiverId() const { return receiverId; }
+  string getSubject() const { return TextArena::mailbox().get(subject); }
+  TextRef getSubjectRef() const { return subject; } // In TextArena::mailbox()
+  string getContent() const { return TextArena::mailbox().get(content); }
+  TextRef getContentRef() const { return content; }
+  string getContentPreview(unsigned int maxLength) const { return TextArena::mailbox().get(content, maxLength); }
+  unsigned int getTextSize() const { return subject.length + content.length; } // Without reading the text
+  time_t getTimestamp() const { return (time_t)timestamp; }
+  bool getIsRead() const { return hasLabel(LABEL_READ); }
+  bool getIsSpam() const { return hasLabel(LABEL_SPAM); }
+  bool hasLabel(EmailLabel label) const { return (labels & labelBit(label)) != 0; }
+  unsigned int getLabels() const { return labels; }
   int getPriority() const { return priority; }
-  string getFolder() const { return folder; }
+  string getFolder() const { return folderTypeName((FolderType)folder); }
+  FolderType getFolderType() const { return (FolderType)folder; }
 
   // Setters
-  void setEmailId(string id) { emailId = id; }
-  void setSender(string from) { sender = from; }
-  void setReceiver(string to) { receiver = to; }
-  void setSubject(string subj) { subject = subj; }
-  void setContent(string cont) { content = cont; }
+  void setId(EmailId id) { emailId = id; }
+  void setEmailId(string id) { emailId = IdGenerator::parse(id); }
+  void setInReplyTo(EmailId id) { inReplyTo = id; }
+  void setSender(string from) { senderId = AddressTable::shared().intern(from); }
+  void setReceiver(string to) { receiverId = AddressTable::shared().intern(to); }
+  void setSubject(string subj) { subject = TextArena::mailbox().store(subj); }
+  void setContent(string cont) { content = TextArena::mailbox().store(cont); }
+  // Copies the subject and content across a TextArena compaction
+  void relocateText()
+  {
+    subject = TextArena::mailbox().relocate(subject);
+    content = TextArena::mailbox().relocate(content);
+  }
   void setTimestamp(time_t ts) { timestamp = ts; }
-  void setIsRead(bool read) { isRead = read; }
-  void setIsSpam(bool spam) { isSpam = spam; }
-  void setPriority(int p) { priority = p; }
-  void setFolder(string fld) { folder = fld; }
+  void setIsRead(bool read) { setLabel(LABEL_READ, read); }
+  void setIsSpam(bool spam) { setLabel(LABEL_SPAM, spam); }
+  void setLabels(unsigned int bits) { labels = (unsigned char)(bits & ((1u << LABEL_COUNT) - 1)); }
+  void setLabel(EmailLabel label, bool on)
+  {
+    if (on)
+      labels |= (unsigned char)labelBit(label);
+    else
+      labels &= (unsigned char)~labelBit(label);
+  }
+  void setPriority(int p) { priority = (signed char)p; }
+  void setFolder(string fld) { folder = (unsigned char)folderTypeFromName(fld); }
+  void setFolderType(FolderType type) { folder = (unsigned char)type; }
 
-  void markAsRead() { isRead = true; }
-  void markAsUnread() { isRead = false; }
+  void markAsRead() { setLabel(LABEL_READ, true); }
+  void markAsUnread() { setLabel(LABEL_READ, false); }
 
+  // Searches the subject and content where they are stored, ignoring
+  // case; only the spam words are lower-cased
   bool containsSpamWords(string spamWords[], int size) const
   {
-    string lowerSubject = subject;
-    string lowerContent = content;
-
-    // Convert to lowercase for comparison
-    for (size_t i = 0; i < lowerSubject.length(); i++)
-    {
-      lowerSubject[i] = tolower(lowerSubject[i]);
-    }
-    for (size_t i = 0; i < lowerContent.length(); i++)
-    {
-      lowerContent[i] = tolower(lowerContent[i]);
-    }
+    const TextArena &arena = TextArena::mailbox();
+    const char *subjectText = arena.data(subject);
+    const char *contentText = arena.data(content);
 
+    string lowerSpam;
     for (int i = 0; i < size; i++)
     {
-      string lowerSpam = spamWords[i];
-      for (size_t j = 0; j < lowerSpam.length(); j++)
-      {
-        lowerSpam[j] = tolower(lowerSpam[j]);
-      }
+      lowerSpam.resize(spamWords[i].length());
+      TextKernels::foldCase(spamWords[i].data(), &lowerSpam[0], (int)lowerSpam.length());
 
-      if (lowerSubject.find(lowerSpam) != string::npos ||
-          lowerContent.find(lowerSpam) != string::npos)
+      if (lowerSpam.empty() ||
+          TextKernels::findFolded(subjectText, (int)subject.length, lowerSpam.data(), (int)lowerSpam.length()) != -1 ||
+          TextKernels::findFolded(contentText, (int)content.length, lowerSpam.data(), (int)lowerSpam.length()) != -1)
       {
         return true;
       }
@@ -111,23 +177,24 @@ public:
   string toString() const
   {
     stringstream ss;
-    ss << emailId << "," << sender << "," << receiver << ","
-       << subject << "," << content << "," << timestamp << ","
-       << isRead << "," << isSpam << "," << priority << "," << folder;
+    ss << getEmailId() << "," << getSender() << "," << getReceiver() << ","
+       << getSubject() << "," << getContent() << "," << timestamp << ","
+       << getIsRead() << "," << getIsSpam() << "," << getPriority() << "," << getFolder() << ","
+       << getLabels() << "," << (inReplyTo != 0 ? IdGenerator::toString(inReplyTo) : "");
     return ss.str();
   }
 
   void display() const
   {
     cout << "\n======== EMAIL ========" << endl;
-    cout << "ID: " << emailId << endl;
-    cout << "From: " << sender << endl;
-    cout << "To: " << receiver << endl;
-    cout << "Subject: " << subject << endl;
-    cout << "Content: " << content << endl;
-    cout << "Priority: " << priority << endl;
-    cout << "Status: " << (isRead ? "Read" : "Unread") << endl;
-    cout << "Folder: " << folder << endl;
+    cout << "ID: " << getEmailId() << endl;
+    cout << "From: " << getSender() << endl;
+    cout << "To: " << getReceiver() << endl;
+    cout << "Subject: " << getSubject() << endl;
+    cout << "Content: " << getContent() << endl;
+    cout << "Priority: " << getPriority() << endl;
+    cout << "Status: " << (getIsRead() ? "Read" : "Unread") << endl;
+    cout << "Folder: " << getFolder() << endl;
     cout << "======================" << endl;
   }
 
@@ -2,82 +2,995 @@
 #define EMAILFOLDER_H
 
 #include <iostream>
-#include "LinkedList.h"
+#include <cassert>
+#include "Array.h"
 #include "Heap.h"
-#include "Stack.h"
+#include "SlotBitmap.h"
+#include "RankIndex.h"
+#include "SortedView.h"
+#include "TimeBuckets.h"
 #include "Email.h"
+#include "SearchIndex.h"
+#include "EmailIdIndex.h"
+#include "ThreadIndex.h"
 using namespace std;
 
+// Folder totals for statistics screens, all kept up to date as emails
+// come and go, so reading them is O(1)
+struct FolderStats
+{
+  static const int PRIORITY_LEVELS = 6; // 0-5; other values count at the nearest end
+
+  int total;
+  int unread;
+  int spam;
+  int important;
+  int byPriority[PRIORITY_LEVELS];
+  unsigned long long bytes; // Subject and content text
+
+  FolderStats() : total(0), unread(0), spam(0), important(0), bytes(0)
+  {
+    for (int i = 0; i < PRIORITY_LEVELS; i++)
+    {
+      byPriority[i] = 0;
+    }
+  }
+
+  static int priorityLevel(int priority)
+  {
+    return priority < 0 ? 0 : (priority >= PRIORITY_LEVELS ? PRIORITY_LEVELS - 1 : priority);
+  }
+};
+
+// A folder stores each email once, in a record that keeps its slot number
+// (and address) for as long as the email is in the folder. Records live in
+// fixed pages, so growing never copies them. Arrival order (and so the most
+// recent email, and offsets via a RankIndex) and priority order are indexes
+// over slot numbers, and each label has a bitmap of the slots carrying it;
+// all are updated on every add and remove. Other sort orders are built on
+// first use and then kept current incrementally (see SortedView).
 class EmailFolder
 {
+public:
+  typedef int Handle; // Slot number, -1 for none
+
 private:
+  struct Record
+  {
+    Email email;
+    Handle older, newer; // Arrival order; in free slots, next and previous free slot
+
+    Record() : older(-1), newer(-1) {}
+  };
+
+  static const int PAGE_BITS = 10;
+  static const int PAGE_SIZE = 1 << PAGE_BITS;
+
+  // Everything the folder keeps per slot (76 bytes: a 64-byte Record and
+  // three ints). The priority heap has one entry per email, so its entries
+  // fit in the pages of the slots.
+  struct Page
+  {
+    Record records[PAGE_SIZE];
+    int heapPositions[PAGE_SIZE]; // Slot -> position in the priority heap
+    Handle heap[PAGE_SIZE];       // Heap position -> slot
+    int sequences[PAGE_SIZE];     // Slot -> sequence number in arrivalRanks
+  };
+  static_assert(sizeof(Page) == PAGE_SIZE * 76, "slot size changed, update the comment above");
+
+  // Entry of getByPriority()'s walk over the heap
+  struct Candidate
+  {
+    const Email *email;
+    int position;
+
+    Candidate(const Email *e = nullptr, int p = 0) : email(e), position(p) {}
+    bool operator<(const Candidate &other) const { return *email < *other.email; }
+    bool operator>(const Candidate &other) const { return *email > *other.email; }
+  };
+
   string folderName;
-  LinkedList<Email> *emails;
-  MaxHeap<Email> *priorityHeap;
-  Stack<Email> *recentEmails;
-  int maxRecentSize;
+  DynamicArray<Page *> pages;
+  int slotCount; // Slots handed out so far, used or free
+  Handle freeSlots; // Doubly linked, so compact() can take out any free slot
+  Handle oldest, newest;
+  int count; // Emails in the folder, also the size of the heap
+  SlotBitmap members;                 // Used slots
+  SlotBitmap labelSlots[LABEL_COUNT]; // Slots whose email has the label
+  int priorityCounts[FolderStats::PRIORITY_LEVELS];
+  unsigned long long textBytes;
+  RankIndex arrivalRanks; // Offsets in arrival order
+  SortedView sortedViews[SORT_KEY_COUNT]; // Other orders, built on first use
+  TimeBuckets timeBuckets; // Slots by day, for date ranges
+  unsigned int version;   // Bumped on every change, so cursors can tell
+  SearchIndex *searchIndex; // Shared full-text index, kept in sync on add/remove
+  EmailIdIndex *emailIndex; // Shared id -> slot index, kept in sync on add/remove
+  ThreadIndex *threadIndex; // Shared conversation threads, fed on add
+
+  Record &record(Handle slot) { return pages[slot >> PAGE_BITS]->records[slot & (PAGE_SIZE - 1)]; }
+  const Record &record(Handle slot) const { return pages[slot >> PAGE_BITS]->records[slot & (PAGE_SIZE - 1)]; }
+  int &heapPosition(Handle slot) { return pages[slot >> PAGE_BITS]->heapPositions[slot & (PAGE_SIZE - 1)]; }
+  Handle heapEntry(int position) const { return pages[position >> PAGE_BITS]->heap[position & (PAGE_SIZE - 1)]; }
+  int &sequence(Handle slot) { return pages[slot >> PAGE_BITS]->sequences[slot & (PAGE_SIZE - 1)]; }
+  int sequence(Handle slot) const { return pages[slot >> PAGE_BITS]->sequences[slot & (PAGE_SIZE - 1)]; }
+
+  // Gives the emails consecutive sequence numbers again
+  void renumber()
+  {
+    arrivalRanks.clear();
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
+    {
+      sequence(slot) = arrivalRanks.append(slot);
+    }
+  }
+
+  // Slot of the email, -1 if it is not in this folder
+  Handle findSlot(EmailId emailId)
+  {
+    if (emailIndex != nullptr)
+      return emailIndex->find(emailId, this);
+
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
+    {
+      if (record(slot).email.getId() == emailId)
+        return slot;
+    }
+    return -1;
+  }
+
+  // Priority heap: highest priority first, then newest timestamp
+  void placeInHeap(int position, Handle slot)
+  {
+    pages[position >> PAGE_BITS]->heap[position & (PAGE_SIZE - 1)] = slot;
+    heapPosition(slot) = position;
+  }
+
+  void siftUp(int position)
+  {
+    Handle slot = heapEntry(position);
+    while (position > 0 && record(heapEntry((position - 1) / 2)).email < record(slot).email)
+    {
+      placeInHeap(position, heapEntry((position - 1) / 2));
+      position = (position - 1) / 2;
+    }
+    placeInHeap(position, slot);
+  }
+
+  void siftDown(int position)
+  {
+    Handle slot = heapEntry(position);
+    while (true)
+    {
+      int child = 2 * position + 1;
+      if (child >= count)
+        break;
+      if (child + 1 < count && record(heapEntry(child)).email < record(heapEntry(child + 1)).email)
+        child++;
+      if (!(record(slot).email < record(heapEntry(child)).email))
+        break;
+      placeInHeap(position, heapEntry(child));
+      position = child;
+    }
+    placeInHeap(position, slot);
+  }
+
+  // Makes the label bitmaps match new label bits of a slot
+  void updateLabelSlots(Handle slot, unsigned int oldLabels, unsigned int newLabels)
+  {
+    unsigned int changed = oldLabels ^ newLabels;
+    for (int label = 0; label < LABEL_COUNT; label++)
+    {
+      if (changed & labelBit((EmailLabel)label))
+        labelSlots[label].set(slot, (newLabels & labelBit((EmailLabel)label)) != 0);
+    }
+  }
+
+  // Adds (sign 1) or takes away (sign -1) an email from the running totals.
+  // Label counts come from the label bitmaps.
+  void countEmail(const Email &email, int sign)
+  {
+    priorityCounts[FolderStats::priorityLevel(email.getPriority())] += sign;
+    textBytes += sign > 0 ? email.getTextSize() : -(unsigned long long)email.getTextSize();
+  }
+
+  void unlinkFree(Handle slot)
+  {
+    Handle next = record(slot).older;
+    Handle previous = record(slot).newer;
+    if (previous != -1)
+      record(previous).older = next;
+    else
+      freeSlots = next;
+    if (next != -1)
+      record(next).newer = previous;
+  }
+
+  // Moves the email in slot from to the free (and unlinked) slot to,
+  // keeping its place in every order; from is left empty, off the free list
+  void moveSlot(Handle from, Handle to)
+  {
+    Record &source = record(from);
+    Record &target = record(to);
+    target.email = source.email;
+    target.older = source.older;
+    target.newer = source.newer;
+    if (target.older != -1)
+      record(target.older).newer = to;
+    else
+      oldest = to;
+    if (target.newer != -1)
+      record(target.newer).older = to;
+    else
+      newest = to;
+
+    placeInHeap(heapPosition(from), to);
+    sequence(to) = sequence(from);
+    arrivalRanks.moveSlot(sequence(to), to);
+    members.remove(from);
+    members.add(to);
+    updateLabelSlots(from, target.email.getLabels(), 0);
+    updateLabelSlots(to, 0, target.email.getLabels());
+    for (int key = 0; key < SORT_KEY_COUNT; key++)
+    {
+      sortedViews[key].removed(from);
+      sortedViews[key].added(to);
+    }
+    timeBuckets.remove(from, (long long)target.email.getTimestamp());
+    timeBuckets.add(to, (long long)target.email.getTimestamp());
+    if (emailIndex != nullptr)
+    {
+      emailIndex->remove(target.email.getId(), this, from);
+      emailIndex->add(target.email.getId(), this, to);
+    }
+
+    source.email = Email();
+    source.older = -1;
+    source.newer = -1;
+    version++;
+  }
+
+  // Gives back free slots at the end of the slot range, and the pages
+  // left without slots
+  void trimSlots()
+  {
+    while (slotCount > 0 && !members.contains(slotCount - 1))
+    {
+      unlinkFree(slotCount - 1);
+      slotCount--;
+    }
+    while (pages.getSize() > (slotCount + PAGE_SIZE - 1) >> PAGE_BITS)
+    {
+      delete pages.removeLast();
+    }
+  }
+
+  static SortKey sortKeyOf(SortOrder order)
+  {
+    switch (order)
+    {
+    case SORT_PRIORITY:
+      return SORT_KEY_PRIORITY;
+    case SORT_SENDER:
+      return SORT_KEY_SENDER;
+    case SORT_SUBJECT:
+      return SORT_KEY_SUBJECT;
+    default:
+      return SORT_KEY_DATE;
+    }
+  }
+
+  // Sort key of an email in keyBits bits: the whole order for dates and
+  // priorities (dates clamped to what fits), the first letters for text
+  unsigned long long sortKeyFor(SortKey key, const Email &email, int keyBits) const
+  {
+    unsigned long long timestamp = email.getTimestamp() > 0 ? (unsigned long long)email.getTimestamp() : 0;
+    switch (key)
+    {
+    case SORT_KEY_PRIORITY:
+    {
+      int timeBits = keyBits - 3; // Priority levels take the top 3 bits
+      unsigned long long timeMax = (1ULL << timeBits) - 1;
+      unsigned long long rank = FolderStats::PRIORITY_LEVELS - 1 - FolderStats::priorityLevel(email.getPriority());
+      return (rank << timeBits) | (timeMax - (timestamp < timeMax ? timestamp : timeMax));
+    }
+    case SORT_KEY_SENDER:
+    case SORT_KEY_SUBJECT:
+      return SortedView::textKey(sortText(key, email), 0, keyBits / 8);
+    default:
+    {
+      unsigned long long keyMax = (1ULL << keyBits) - 1;
+      return timestamp < keyMax ? timestamp : keyMax;
+    }
+    }
+  }
+
+  static bool isTextKey(SortKey key) { return key == SORT_KEY_SENDER || key == SORT_KEY_SUBJECT; }
+
+  // The text a text order sorts by, read in place
+  static SortedView::TextSpan sortText(SortKey key, const Email &email)
+  {
+    if (key == SORT_KEY_SENDER)
+    {
+      const string &address = AddressTable::shared().get(email.getSenderId());
+      return SortedView::TextSpan(address.data(), (int)address.length());
+    }
+    TextRef subject = email.getSubjectRef();
+    return SortedView::TextSpan(TextArena::mailbox().data(subject), (int)subject.length);
+  }
+
+  // Whether entry a sorts before entry b: by key, then by the whole text
+  // for text orders, then by arrival
+  bool sortsBefore(SortKey key, const SortedView &view, unsigned long long a, unsigned long long b) const
+  {
+    if ((a >> view.slotBits) != (b >> view.slotBits))
+      return a < b;
+    Handle slotA = (Handle)(a & ((1ULL << view.slotBits) - 1));
+    Handle slotB = (Handle)(b & ((1ULL << view.slotBits) - 1));
+    if (isTextKey(key) && !(key == SORT_KEY_SENDER && record(slotA).email.getSenderId() == record(slotB).email.getSenderId()))
+    {
+      int compared = SortedView::compareText(sortText(key, record(slotA).email), sortText(key, record(slotB).email));
+      if (compared != 0)
+        return compared < 0;
+    }
+    return sequence(slotA) < sequence(slotB);
+  }
+
+  // Sorts runs of equal text keys by the rest of their texts. Stable, so
+  // equal texts stay in the order they came in. Sender runs sort their
+  // distinct addresses, then the emails by the rank of theirs.
+  void orderTies(SortKey key, const SortedView &view, DynamicArray<unsigned long long> &entries)
+  {
+    if (!isTextKey(key))
+      return;
+
+    int n = entries.getSize();
+    unsigned long long slotMask = (1ULL << view.slotBits) - 1;
+    DynamicArray<int> senderRanks; // Address id -> rank within the run, -1 if not in it
+    if (key == SORT_KEY_SENDER)
+      senderRanks.resize(AddressTable::shared().getSize(), -1);
+
+    for (int start = 0; start < n;)
+    {
+      int end = start + 1;
+      while (end < n && (entries[end] >> view.slotBits) == (entries[start] >> view.slotBits))
+      {
+        end++;
+      }
+      if (end - start < 2)
+      {
+        start = end;
+        continue;
+      }
+
+      // Texts to sort: each distinct sender once, or every subject
+      DynamicArray<SortedView::TextSpan> texts(end - start);
+      DynamicArray<unsigned int> senders;
+      for (int i = start; i < end; i++)
+      {
+        const Email &email = record((Handle)(entries[i] & slotMask)).email;
+        if (key == SORT_KEY_SUBJECT)
+        {
+          texts.add(sortText(key, email));
+        }
+        else if (senderRanks[email.getSenderId()] == -1)
+        {
+          senderRanks[email.getSenderId()] = 0;
+          senders.add(email.getSenderId());
+          texts.add(sortText(key, email));
+        }
+      }
+
+      if (texts.getSize() > 1)
+      {
+        DynamicArray<int> order(texts.getSize());
+        for (int i = 0; i < texts.getSize(); i++)
+        {
+          order.add(i);
+        }
+        SortedView::sortTexts(texts, order, view.getKeyBits() / 8);
+
+        DynamicArray<unsigned long long> run(end - start);
+        if (key == SORT_KEY_SUBJECT)
+        {
+          for (int i = 0; i < order.getSize(); i++)
+          {
+            run.add(entries[start + order[i]]);
+          }
+        }
+        else
+        {
+          // Rank each address (equal ones share a rank), then sort the run
+          // by the rank of its sender, stable
+          int rank = 0;
+          for (int i = 0; i < order.getSize(); i++)
+          {
+            if (i > 0 && SortedView::compareText(texts[order[i]], texts[order[i - 1]]) != 0)
+              rank++;
+            senderRanks[senders[order[i]]] = rank;
+          }
+          for (int i = start; i < end; i++)
+          {
+            Handle slot = (Handle)(entries[i] & slotMask);
+            run.add(view.pack(senderRanks[record(slot).email.getSenderId()], slot));
+          }
+          SortedView::radixSort(run, view.slotBits);
+        }
+        for (int i = start; i < end; i++)
+        {
+          entries[i] = (entries[start] & ~slotMask) | (run[i - start] & slotMask);
+        }
+      }
+
+      for (int i = 0; i < senders.getSize(); i++)
+      {
+        senderRanks[senders[i]] = -1;
+      }
+      start = end;
+    }
+  }
+
+  // Sorts the whole folder by a key; arrival order goes in, so the stable
+  // radix sort leaves equal keys in arrival order
+  void buildView(SortKey key)
+  {
+    SortedView &view = sortedViews[key];
+    view.clear();
+    view.slotBits = SortedView::bitsFor(slotCount) + 1; // Room to grow before a rebuild
+    view.entries.reserve(count);
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
+    {
+      view.entries.add(view.pack(sortKeyFor(key, record(slot).email, view.getKeyBits()), slot));
+    }
+    SortedView::radixSort(view.entries, view.slotBits);
+    orderTies(key, view, view.entries);
+    view.built = true;
+  }
+
+  // Brings a view up to date: sorts the pending slots and merges them with
+  // the surviving sorted ones in one pass. Rebuilds instead once most of
+  // the view has changed or slot numbers outgrow the entries.
+  SortedView &currentView(SortKey key)
+  {
+    SortedView &view = sortedViews[key];
+    if (!view.built || view.pending.getSize() + view.deadCount > count / 2 || slotCount > (1 << view.slotBits))
+    {
+      buildView(key);
+      return view;
+    }
+    if (view.isCurrent())
+      return view;
+
+    // Pending slots in arrival order first, so equal keys keep it
+    DynamicArray<unsigned long long> added;
+    for (int i = 0; i < view.pending.getSize(); i++)
+    {
+      Handle slot = view.pending[i];
+      if (view.pendingSlots.contains(slot))
+      {
+        view.pendingSlots.remove(slot); // A slot can be pending twice
+        added.add(view.pack(sequence(slot), slot));
+      }
+    }
+    SortedView::radixSort(added, view.slotBits);
+    for (int i = 0; i < added.getSize(); i++)
+    {
+      Handle slot = (Handle)(added[i] & ((1ULL << view.slotBits) - 1));
+      added[i] = view.pack(sortKeyFor(key, record(slot).email, view.getKeyBits()), slot);
+    }
+    SortedView::radixSort(added, view.slotBits);
+    orderTies(key, view, added);
+
+    DynamicArray<unsigned long long> merged(count);
+    int i = 0, j = 0;
+    while (i < view.entries.getSize() || j < added.getSize())
+    {
+      if (i < view.entries.getSize() && view.dead.contains(view.slotAt(i)))
+        i++;
+      else if (j == added.getSize() || (i < view.entries.getSize() && sortsBefore(key, view, view.entries[i], added[j])))
+        merged.add(view.entries[i++]);
+      else
+        merged.add(added[j++]);
+    }
+
+    view.entries.swap(merged);
+    view.pending.clear();
+    view.pendingSlots.clear();
+    view.dead.clear();
+    view.deadCount = 0;
+    view.positionsValid = false;
+    return view;
+  }
+
+  void reset()
+  {
+    for (int i = 0; i < pages.getSize(); i++)
+    {
+      delete pages[i];
+    }
+    pages = DynamicArray<Page *>();
+    slotCount = 0;
+    freeSlots = -1;
+    oldest = -1;
+    newest = -1;
+    count = 0;
+    members.clear();
+    for (int label = 0; label < LABEL_COUNT; label++)
+    {
+      labelSlots[label].clear();
+    }
+    for (int i = 0; i < FolderStats::PRIORITY_LEVELS; i++)
+    {
+      priorityCounts[i] = 0;
+    }
+    textBytes = 0;
+    arrivalRanks.clear();
+    for (int key = 0; key < SORT_KEY_COUNT; key++)
+    {
+      sortedViews[key].clear();
+    }
+    timeBuckets.clear();
+    version++;
+  }
+
+  // Slots with from <= timestamp < to, or just their number if slots is
+  // nullptr. Buckets inside the range count whole; only the ones at its
+  // ends are read email by email.
+  int collectRange(long long from, long long to, DynamicArray<Handle> *slots, int limit = -1)
+  {
+    int found = 0;
+    int bucketCount = timeBuckets.getBucketCount();
+    if (bucketCount == 0)
+      return 0;
+    int i = from <= timeBuckets.getBucket(0).minTime ? 0 : timeBuckets.lowerBound(TimeBuckets::dayOf(from));
+    for (; i < bucketCount && timeBuckets.getBucket(i).minTime < to && found != limit; i++)
+    {
+      const TimeBucket &bucket = timeBuckets.getBucket(i);
+      if (bucket.maxTime < from)
+        continue;
+      if (bucket.minTime >= from && bucket.maxTime < to && (limit < 0 || found + bucket.slots.getSize() <= limit))
+      {
+        if (slots != nullptr)
+        {
+          for (int j = 0; j < bucket.slots.getSize(); j++)
+          {
+            slots->add(bucket.slots[j]);
+          }
+        }
+        found += bucket.slots.getSize();
+        continue;
+      }
+      for (int j = 0; j < bucket.slots.getSize() && found != limit; j++)
+      {
+        long long time = (long long)record(bucket.slots[j]).email.getTimestamp();
+        if (time >= from && time < to)
+        {
+          if (slots != nullptr)
+            slots->add(bucket.slots[j]);
+          found++;
+        }
+      }
+    }
+    return found;
+  }
+
+  void printEmail(int number, const Email &email)
+  {
+    cout << "\n"
+         << number << ". ";
+    cout << (email.getIsRead() ? "[READ] " : "[UNREAD] ");
+    cout << "From: " << email.getSender() << endl;
+    cout << "   Subject: " << email.getSubject() << endl;
+    cout << "   Priority: " << email.getPriority() << endl;
+  }
 
 public:
   EmailFolder(string name = "Inbox")
   {
     folderName = name;
-    emails = new LinkedList<Email>();
-    priorityHeap = new MaxHeap<Email>(100);
-    recentEmails = new Stack<Email>();
-    maxRecentSize = 10;
+    searchIndex = nullptr;
+    emailIndex = nullptr;
+    threadIndex = nullptr;
+    version = 0;
+    reset();
   }
 
   ~EmailFolder()
   {
-    delete emails;
-    delete priorityHeap;
-    delete recentEmails;
+    for (int i = 0; i < pages.getSize(); i++)
+    {
+      delete pages[i];
+    }
   }
 
   string getFolderName() const { return folderName; }
 
-  void addEmail(Email newEmail)
+  void setSearchIndex(SearchIndex *index) { searchIndex = index; }
+  void setEmailIndex(EmailIdIndex *index) { emailIndex = index; }
+  void setThreadIndex(ThreadIndex *index) { threadIndex = index; }
+
+  Handle addEmail(Email newEmail)
+  {
+    Handle slot;
+    if (freeSlots != -1)
+    {
+      slot = freeSlots;
+      unlinkFree(slot);
+    }
+    else
+    {
+      if ((slotCount & (PAGE_SIZE - 1)) == 0)
+        pages.add(new Page());
+      slot = slotCount++;
+    }
+
+    Record &added = record(slot);
+    added.email = newEmail;
+    added.older = newest;
+    added.newer = -1;
+    if (newest != -1)
+      record(newest).newer = slot;
+    else
+      oldest = slot;
+    newest = slot;
+    count++;
+
+    placeInHeap(count - 1, slot);
+    siftUp(count - 1);
+    members.add(slot);
+    updateLabelSlots(slot, 0, newEmail.getLabels());
+    countEmail(newEmail, 1);
+    sequence(slot) = arrivalRanks.append(slot);
+    for (int key = 0; key < SORT_KEY_COUNT; key++)
+    {
+      sortedViews[key].added(slot);
+    }
+    timeBuckets.add(slot, (long long)newEmail.getTimestamp());
+    version++;
+
+    if (emailIndex != nullptr)
+    {
+      emailIndex->add(newEmail.getId(), this, slot);
+    }
+    if (threadIndex != nullptr)
+    {
+      threadIndex->addEmail(newEmail);
+    }
+    if (searchIndex != nullptr)
+    {
+      searchIndex->addEmail(newEmail, folderName);
+    }
+    checkCounters();
+    return slot;
+  }
+
+  Email removeEmail(EmailId emailId)
+  {
+    Handle slot = findSlot(emailId);
+    if (slot == -1)
+      throw "Email not found";
+    return removeAt(slot);
+  }
+
+  Email removeAt(Handle slot)
+  {
+    EmailId emailId = record(slot).email.getId();
+    if (emailIndex != nullptr)
+    {
+      emailIndex->remove(emailId, this, slot);
+    }
+    if (searchIndex != nullptr)
+    {
+      searchIndex->removeEmail(folderName, emailId);
+    }
+
+    Record &removed = record(slot);
+    if (removed.older != -1)
+      record(removed.older).newer = removed.newer;
+    else
+      oldest = removed.newer;
+    if (removed.newer != -1)
+      record(removed.newer).older = removed.older;
+    else
+      newest = removed.older;
+    int position = heapPosition(slot);
+    count--;
+    if (position < count)
+    {
+      // The last heap entry fills the hole
+      placeInHeap(position, heapEntry(count));
+      siftDown(position);
+      siftUp(position);
+    }
+
+    members.remove(slot);
+    updateLabelSlots(slot, removed.email.getLabels(), 0);
+    countEmail(removed.email, -1);
+    arrivalRanks.remove(sequence(slot));
+    for (int key = 0; key < SORT_KEY_COUNT; key++)
+    {
+      sortedViews[key].removed(slot);
+    }
+    timeBuckets.remove(slot, (long long)removed.email.getTimestamp());
+    version++;
+
+    Email email = removed.email;
+    removed.email = Email();
+    removed.newer = -1;
+    removed.older = freeSlots;
+    if (freeSlots != -1)
+      record(freeSlots).newer = slot;
+    freeSlots = slot;
+    if (arrivalRanks.needsCompaction())
+      renumber();
+    checkCounters();
+    return email;
+  }
+
+  bool findEmail(EmailId emailId, Email &result)
+  {
+    Handle slot = findSlot(emailId);
+    if (slot == -1)
+      return false;
+    result = record(slot).email;
+    return true;
+  }
+
+  // The stored email (nullptr if missing), valid while it stays in the
+  // folder. Changes go through replaceEmail() and setLabels() so the
+  // indexes stay right.
+  const Email *getEmail(EmailId emailId)
+  {
+    Handle slot = findSlot(emailId);
+    return slot != -1 ? &record(slot).email : nullptr;
+  }
+
+  // Overwrites the stored email with the same id in its slot; returns false
+  // if it is not in this folder
+  bool replaceEmail(const Email &updated)
+  {
+    Handle slot = findSlot(updated.getId());
+    if (slot == -1)
+      return false;
+
+    updateLabelSlots(slot, record(slot).email.getLabels(), updated.getLabels());
+    if (updated.getTimestamp() != record(slot).email.getTimestamp())
+    {
+      timeBuckets.remove(slot, (long long)record(slot).email.getTimestamp());
+      timeBuckets.add(slot, (long long)updated.getTimestamp());
+    }
+    countEmail(record(slot).email, -1);
+    countEmail(updated, 1);
+    record(slot).email = updated;
+    record(slot).email.setFolder(folderName);
+    for (int key = 0; key < SORT_KEY_COUNT; key++)
+    {
+      // Re-sorted at its new key
+      sortedViews[key].removed(slot);
+      sortedViews[key].added(slot);
+    }
+    version++;
+    siftDown(heapPosition(slot));
+    siftUp(heapPosition(slot));
+    if (threadIndex != nullptr)
+      threadIndex->addEmail(updated); // A new subject or reply link can join threads
+    checkCounters();
+    return true;
+  }
+
+  // Relabels an email in O(1); returns false if it is not in this folder
+  bool setLabels(EmailId emailId, unsigned int labels)
+  {
+    Handle slot = findSlot(emailId);
+    if (slot == -1)
+      return false;
+
+    Email &email = record(slot).email;
+    unsigned int oldLabels = email.getLabels();
+    email.setLabels(labels);
+    updateLabelSlots(slot, oldLabels, email.getLabels());
+    version++;
+    checkCounters();
+    return true;
+  }
+
+  bool setLabel(EmailId emailId, EmailLabel label, bool on)
   {
-    emails->insert(newEmail);
-    priorityHeap->insert(newEmail);
+    const Email *email = getEmail(emailId);
+    if (email == nullptr)
+      return false;
+    unsigned int labels = email->getLabels();
+    return setLabels(emailId, on ? labels | labelBit(label) : labels & ~labelBit(label));
+  }
 
-    // Maintain recent emails stack
-    recentEmails->push(newEmail);
+  int getLabelCount(EmailLabel label) const { return labelSlots[label].getCount(); }
+
+  // Slots whose email has every label in required and none in excluded
+  // (bit masks of labelBit()), in slot order. One pass over the bitmaps,
+  // a 64-bit word at a time.
+  int getView(unsigned int required, unsigned int excluded, DynamicArray<Handle> &slots) const
+  {
+    int found = 0;
+    for (int i = 0; i < members.getWordCount(); i++)
+    {
+      unsigned long long word = members.word(i);
+      for (int label = 0; label < LABEL_COUNT && word != 0; label++)
+      {
+        if (required & labelBit((EmailLabel)label))
+          word &= labelSlots[label].word(i);
+        else if (excluded & labelBit((EmailLabel)label))
+          word &= ~labelSlots[label].word(i);
+      }
+      while (word != 0)
+      {
+        slots.add((i << 6) + SlotBitmap::lowestBit(word));
+        word &= word - 1;
+        found++;
+      }
+    }
+    return found;
   }
 
-  Email removeEmail(string emailId)
+  // Arrival order: for (Handle h = first(); h != -1; h = next(h)) at(h)
+  Handle first() const { return oldest; }
+  Handle next(Handle slot) const { return record(slot).newer; }
+  Handle previous(Handle slot) const { return record(slot).older; }
+  Handle last() const { return newest; }
+
+  // Slot of an email id, -1 if it is not in this folder
+  Handle getHandle(EmailId emailId) { return findSlot(emailId); }
+
+  // Position in arrival order (0 = oldest) and back, O(log n)
+  Handle slotAt(int offset) const { return arrivalRanks.slotAt(offset); }
+  int offsetOf(Handle slot) const { return arrivalRanks.rankOf(sequence(slot)); }
+
+  // Position in any sort order, with the same meaning as above. The first
+  // read of an order sorts the folder (radix sort, O(n)); later reads after
+  // changes merge them in, O(n) once, then O(1).
+  Handle slotAt(SortOrder order, int offset)
   {
-    for (int i = 0; i < emails->getSize(); i++)
+    if (order == SORT_ARRIVAL)
+      return slotAt(offset);
+    if (offset < 0 || offset >= count)
+      return -1;
+    SortedView &view = currentView(sortKeyOf(order));
+    return view.slotAt(order == SORT_DATE_DESCENDING ? count - 1 - offset : offset);
+  }
+
+  int offsetOf(SortOrder order, Handle slot)
+  {
+    if (order == SORT_ARRIVAL)
+      return offsetOf(slot);
+    SortedView &view = currentView(sortKeyOf(order));
+    if (!view.positionsValid)
     {
-      Email email = emails->get(i);
-      if (email.getEmailId() == emailId)
+      view.positions.clear();
+      view.positions.resize(slotCount, -1);
+      for (int i = 0; i < view.entries.getSize(); i++)
       {
-        emails->removeAt(i);
-        return email;
+        view.positions[view.slotAt(i)] = i;
       }
+      view.positionsValid = true;
     }
-    throw "Email not found";
+    int position = view.positions[slot];
+    return order == SORT_DATE_DESCENDING ? count - 1 - position : position;
   }
 
-  bool findEmail(string emailId, Email &result)
+  // Slots of the emails with from <= timestamp < to, grouped by day,
+  // oldest day first (any order within a day)
+  int getInRange(time_t from, time_t to, DynamicArray<Handle> &slots)
   {
-    for (int i = 0; i < emails->getSize(); i++)
+    return collectRange((long long)from, (long long)to, &slots);
+  }
+
+  int countInRange(time_t from, time_t to)
+  {
+    return collectRange((long long)from, (long long)to, nullptr);
+  }
+
+  // Removes the emails older than cutoff, at most limit of them (-1: all),
+  // oldest day first; days wholly before it are taken as they are. Only
+  // the expired slots are unlinked, the rest keep their slots and index
+  // entries (compact() closes the gaps later). The ids go to removedIds
+  // if given. Returns how many were removed.
+  int removeOlderThan(time_t cutoff, int limit = -1, DynamicArray<EmailId> *removedIds = nullptr)
+  {
+    if (timeBuckets.getBucketCount() == 0)
+      return 0;
+    DynamicArray<Handle> expired;
+    collectRange(timeBuckets.getBucket(0).minTime, (long long)cutoff, &expired, limit);
+    if (removedIds != nullptr)
     {
-      Email email = emails->get(i);
-      if (email.getEmailId() == emailId)
+      for (int i = 0; i < expired.getSize(); i++)
       {
-        result = email;
-        return true;
+        removedIds->add(record(expired[i]).email.getId());
       }
     }
-    return false;
+    for (int i = 0; i < expired.getSize(); i++)
+    {
+      removeAt(expired[i]);
+    }
+    return expired.getSize();
+  }
+
+  // Moves emails from the end of the slot range into free slots, at most
+  // maxMoves of them, and gives back the pages that empties. Orders,
+  // labels and indexes follow the moved emails. Returns the moves made.
+  int compact(int maxMoves)
+  {
+    int moved = 0;
+    trimSlots();
+    while (moved < maxMoves && freeSlots != -1)
+    {
+      // The last slot is in use (trimmed above), every free one is lower
+      Handle to = freeSlots;
+      unlinkFree(to);
+      moveSlot(slotCount - 1, to);
+      slotCount--;
+      moved++;
+      trimSlots();
+    }
+    checkCounters();
+    return moved;
+  }
+
+  // Moves every email's text across a TextArena compaction, oldest
+  // arrival first so a folder's texts end up side by side. Slots, orders
+  // and indexes do not change.
+  void relocateText()
+  {
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
+    {
+      record(slot).email.relocateText();
+    }
+  }
+
+  int getFreeSlotCount() const { return slotCount - count; }
+  int getSlotCount() const { return slotCount; }
+  unsigned long long getStorageBytes() const { return (unsigned long long)pages.getSize() * sizeof(Page); }
+
+  // Slots in a sort order from offset on, at most limit of them (-1: all)
+  int getSorted(SortOrder order, DynamicArray<Handle> &ordered, int offset = 0, int limit = -1)
+  {
+    int added = 0;
+    for (int i = offset < 0 ? 0 : offset; i < count && (limit < 0 || added < limit); i++)
+    {
+      ordered.add(slotAt(order, i));
+      added++;
+    }
+    return added;
+  }
+
+  // Changes whenever an email is added, removed or changed
+  unsigned int getVersion() const { return version; }
+  const Email &at(Handle slot) const { return record(slot).email; }
+
+  // Slots from highest to lowest priority, at most limit of them (-1: all).
+  // Walks the heap best first, so the top k cost O(k log k).
+  int getByPriority(DynamicArray<Handle> &ordered, int limit = -1)
+  {
+    MaxHeap<Candidate> candidates(16);
+    if (count > 0)
+      candidates.insert(Candidate(&record(heapEntry(0)).email, 0));
+
+    int added = 0;
+    while (!candidates.isEmpty() && (limit < 0 || added < limit))
+    {
+      Candidate best = candidates.extractMax();
+      ordered.add(heapEntry(best.position));
+      added++;
+      for (int child = 2 * best.position + 1; child <= 2 * best.position + 2 && child < count; child++)
+      {
+        candidates.insert(Candidate(&record(heapEntry(child)).email, child));
+      }
+    }
+    return added;
   }
 
   Email getRecentEmail()
   {
-    if (!recentEmails->isEmpty())
+    if (newest != -1)
     {
-      return recentEmails->peek();
+      return record(newest).email;
     }
     throw "No recent emails";
   }
@@ -85,88 +998,134 @@ public:
   void displayAllEmails()
   {
     cout << "\n======== " << folderName << " Folder ========" << endl;
-    if (emails->isEmpty())
+    if (count == 0)
     {
       cout << "No emails in this folder." << endl;
       return;
     }
 
-    for (int i = 0; i < emails->getSize(); i++)
+    int number = 1;
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
     {
-      Email email = emails->get(i);
-      cout << "\n"
-           << (i + 1) << ". ";
-      cout << (email.getIsRead() ? "[READ] " : "[UNREAD] ");
-      cout << "From: " << email.getSender() << endl;
-      cout << "   Subject: " << email.getSubject() << endl;
-      cout << "   Priority: " << email.getPriority() << endl;
+      printEmail(number++, record(slot).email);
     }
-    cout << "\nTotal emails: " << emails->getSize() << endl;
+    cout << "\nTotal emails: " << count << endl;
   }
 
   void displayEmailsByPriority()
   {
     cout << "\n======== " << folderName << " (Sorted by Priority) ========" << endl;
 
-    // Create temporary heap copy
-    MaxHeap<Email> tempHeap(100);
-    for (int i = 0; i < emails->getSize(); i++)
+    DynamicArray<Handle> ordered;
+    getByPriority(ordered);
+    for (int i = 0; i < ordered.getSize(); i++)
     {
-      tempHeap.insert(emails->get(i));
+      printEmail(i + 1, record(ordered[i]).email);
     }
+  }
+
+  int getEmailCount() const
+  {
+    return count;
+  }
+
+  int getUnreadCount() const
+  {
+    return count - labelSlots[LABEL_READ].getCount();
+  }
 
-    int count = 1;
-    while (!tempHeap.isEmpty())
+  FolderStats getStats() const
+  {
+    FolderStats stats;
+    stats.total = count;
+    stats.unread = count - labelSlots[LABEL_READ].getCount();
+    stats.spam = labelSlots[LABEL_SPAM].getCount();
+    stats.important = labelSlots[LABEL_IMPORTANT].getCount();
+    for (int i = 0; i < FolderStats::PRIORITY_LEVELS; i++)
     {
-      Email email = tempHeap.extractMax();
-      cout << "\n"
-           << count++ << ". ";
-      cout << (email.getIsRead() ? "[READ] " : "[UNREAD] ");
-      cout << "From: " << email.getSender() << endl;
-      cout << "   Subject: " << email.getSubject() << endl;
-      cout << "   Priority: " << email.getPriority() << endl;
+      stats.byPriority[i] = priorityCounts[i];
     }
+    stats.bytes = textBytes;
+    return stats;
   }
 
-  int getEmailCount() const
+  // Debug builds (EMAIL_DEBUG_CHECKS, set by the Makefile's DEBUG mode)
+  // recount after every change; past 1024 emails every 1024th change, so
+  // loading a large folder stays linear
+  void checkCounters() const
   {
-    return emails->getSize();
+#ifdef EMAIL_DEBUG_CHECKS
+    if (count <= 1024 || (version & 1023) == 0)
+      assert(countersMatch());
+#endif
   }
 
-  int getUnreadCount() const
+  // Recounts everything from the stored emails and compares it with the
+  // running totals and bitmaps. O(n), for consistency checks.
+  bool countersMatch() const
   {
-    int count = 0;
-    for (int i = 0; i < emails->getSize(); i++)
+    FolderStats recount;
+    int labelCounts[LABEL_COUNT] = {0};
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
     {
-      if (!emails->get(i).getIsRead())
+      const Email &email = record(slot).email;
+      recount.total++;
+      recount.unread += email.getIsRead() ? 0 : 1;
+      recount.spam += email.getIsSpam() ? 1 : 0;
+      recount.important += email.hasLabel(LABEL_IMPORTANT) ? 1 : 0;
+      recount.byPriority[FolderStats::priorityLevel(email.getPriority())]++;
+      recount.bytes += email.getTextSize();
+      if (!members.contains(slot))
+        return false;
+      for (int label = 0; label < LABEL_COUNT; label++)
       {
-        count++;
+        if (email.hasLabel((EmailLabel)label) != labelSlots[label].contains(slot))
+          return false;
+        labelCounts[label] += email.hasLabel((EmailLabel)label) ? 1 : 0;
       }
     }
-    return count;
+
+    FolderStats stats = getStats();
+    if (recount.total != stats.total || recount.unread != stats.unread || recount.spam != stats.spam ||
+        recount.important != stats.important || recount.bytes != stats.bytes || members.getCount() != count ||
+        arrivalRanks.getCount() != count)
+      return false;
+    for (int i = 0; i < FolderStats::PRIORITY_LEVELS; i++)
+    {
+      if (recount.byPriority[i] != stats.byPriority[i])
+        return false;
+    }
+    for (int label = 0; label < LABEL_COUNT; label++)
+    {
+      if (labelCounts[label] != labelSlots[label].getCount())
+        return false;
+    }
+    return true;
   }
 
   void markAllAsRead()
   {
-    LinkedList<Email> *newList = new LinkedList<Email>();
-    for (int i = 0; i < emails->getSize(); i++)
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
     {
-      Email email = emails->get(i);
-      email.markAsRead();
-      newList->insert(email);
+      record(slot).email.markAsRead();
+      labelSlots[LABEL_READ].add(slot);
     }
-    delete emails;
-    emails = newList;
+    version++;
+    checkCounters();
   }
 
   void clearFolder()
   {
-    emails->clear();
-    priorityHeap->clear();
-    recentEmails->clear();
+    for (Handle slot = oldest; slot != -1; slot = record(slot).newer)
+    {
+      EmailId emailId = record(slot).email.getId();
+      if (emailIndex != nullptr)
+        emailIndex->remove(emailId, this, slot);
+      if (searchIndex != nullptr)
+        searchIndex->removeEmail(folderName, emailId);
+    }
+    reset();
   }
-
-  LinkedList<Email> *getEmails() { return emails; }
 };
 
 #endif
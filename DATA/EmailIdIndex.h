@@ -0,0 +1,156 @@
+#ifndef EMAILIDINDEX_H
+#define EMAILIDINDEX_H
+
+#include <iostream>
+#include <string>
+#include "Array.h"
+#include "HashMap.h"
+#include "Email.h"
+using namespace std;
+
+class EmailFolder;
+
+// Where one copy of an email lives
+struct EmailLocation
+{
+  EmailFolder *folder;
+  int slot; // Slot of the email in the folder
+
+  EmailLocation() : folder(nullptr), slot(-1) {}
+};
+
+// Email id -> every folder slot holding that email. The same id can be in
+// more than one folder (mail sent to oneself is in Sent and the Inbox, a
+// recovered email in the Inbox and Trash), so each id keeps a short chain
+// of locations. Folders update it on add and remove.
+class EmailIdIndex
+{
+private:
+  struct Slot
+  {
+    EmailLocation location;
+    int next; // Next location of the same id, or next free slot
+  };
+
+  HashMap<EmailId, int> *heads; // Email id -> first slot
+  DynamicArray<Slot> slots;
+  int freeSlots;
+
+public:
+  EmailIdIndex()
+  {
+    heads = new HashMap<EmailId, int>(1024);
+    freeSlots = -1;
+  }
+
+  ~EmailIdIndex()
+  {
+    delete heads;
+  }
+
+  void add(EmailId emailId, EmailFolder *folder, int folderSlot)
+  {
+    int slot;
+    if (freeSlots != -1)
+    {
+      slot = freeSlots;
+      freeSlots = slots[slot].next;
+    }
+    else
+    {
+      slots.add(Slot());
+      slot = slots.getSize() - 1;
+    }
+    slots[slot].location.folder = folder;
+    slots[slot].location.slot = folderSlot;
+
+    int *head = heads->search(emailId);
+    if (head == nullptr)
+    {
+      slots[slot].next = -1;
+      heads->insert(emailId, slot);
+    }
+    else
+    {
+      slots[slot].next = *head;
+      *head = slot;
+    }
+  }
+
+  // Forgets one location; returns false if it was not indexed. Every
+  // folder numbers its slots from 0, so the folder has to match too.
+  bool remove(EmailId emailId, const EmailFolder *folder, int folderSlot)
+  {
+    int *head = heads->search(emailId);
+    if (head == nullptr)
+      return false;
+
+    int previous = -1;
+    for (int slot = *head; slot != -1; slot = slots[slot].next)
+    {
+      if (slots[slot].location.folder == folder && slots[slot].location.slot == folderSlot)
+      {
+        if (previous == -1 && slots[slot].next == -1)
+          heads->remove(emailId);
+        else if (previous == -1)
+          *head = slots[slot].next;
+        else
+          slots[previous].next = slots[slot].next;
+
+        slots[slot].location = EmailLocation();
+        slots[slot].next = freeSlots;
+        freeSlots = slot;
+        return true;
+      }
+      previous = slot;
+    }
+    return false;
+  }
+
+  // Slot of the email in one folder, -1 if it is not there
+  int find(EmailId emailId, const EmailFolder *folder) const
+  {
+    int *head = heads->search(emailId);
+    if (head == nullptr)
+      return -1;
+
+    for (int slot = *head; slot != -1; slot = slots[slot].next)
+    {
+      if (slots[slot].location.folder == folder)
+        return slots[slot].location.slot;
+    }
+    return -1;
+  }
+
+  // All folders holding the email, most recently added first
+  int findAll(EmailId emailId, DynamicArray<EmailLocation> &locations) const
+  {
+    int *head = heads->search(emailId);
+    if (head == nullptr)
+      return 0;
+
+    int found = 0;
+    for (int slot = *head; slot != -1; slot = slots[slot].next)
+    {
+      locations.add(slots[slot].location);
+      found++;
+    }
+    return found;
+  }
+
+  bool contains(EmailId emailId) const
+  {
+    return heads->contains(emailId);
+  }
+
+  int getIdCount() const { return heads->getSize(); }
+
+  void clear()
+  {
+    heads->clear();
+    slots.clear();
+    freeSlots = -1;
+  }
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef EMAILSTORE_H
+#define EMAILSTORE_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include "Array.h"
+#include "HashMap.h"
+using namespace std;
+
+// Shared storage behind the compact Email record. Email keeps only small
+// ids and offsets; the text lives here.
+
+// Every distinct address is stored once and referred to by a 32-bit id.
+// Id 0 is the empty address. Addresses are never removed.
+class AddressTable
+{
+private:
+  HashMap<string, unsigned int> *ids;
+  DynamicArray<string> addresses;
+
+  AddressTable()
+  {
+    ids = new HashMap<string, unsigned int>(1024);
+    addresses.add("");
+    ids->insert("", 0);
+  }
+
+  ~AddressTable()
+  {
+    delete ids;
+  }
+
+public:
+  static AddressTable &shared()
+  {
+    static AddressTable table;
+    return table;
+  }
+
+  unsigned int intern(const string &address)
+  {
+    unsigned int *existing = ids->search(address);
+    if (existing != nullptr)
+      return *existing;
+
+    unsigned int id = (unsigned int)addresses.getSize();
+    addresses.add(address);
+    ids->insert(address, id);
+    return id;
+  }
+
+  const string &get(unsigned int id) const
+  {
+    return id < (unsigned int)addresses.getSize() ? addresses[id] : addresses[0];
+  }
+
+  int getSize() const { return addresses.getSize(); }
+};
+
+// Subject or content of an email: a slice of the mailbox text arena
+struct TextRef
+{
+  unsigned int offset;
+  unsigned int length;
+
+  TextRef() : offset(0), length(0) {}
+};
+
+// Append-only store for the subjects and contents of the logged-in
+// mailbox, in 1 MB chunks so growing never copies. A text never spans
+// chunks; one longer than a chunk gets its own buffer and takes up as
+// many chunk slots. Changing an email's text appends the new text; the
+// old bytes are reclaimed when the mailbox is closed (EmailSystem::logout
+// clears the arena once every email of the session is gone), or earlier
+// by a compaction that copies the texts still referred to into fresh
+// chunks (EmailSystem::compactText).
+class TextArena
+{
+private:
+  static const int CHUNK_BITS = 20;
+  static const unsigned int CHUNK_SIZE = 1u << CHUNK_BITS;
+
+  DynamicArray<char *> chunks; // nullptr for slots covered by a long text
+  unsigned long long size;     // Next free offset
+  unsigned long long used;     // Bytes of text stored
+
+  // The chunks being compacted away, between beginCompaction() and
+  // endCompaction()
+  DynamicArray<char *> oldChunks;
+  unsigned long long oldSize;
+
+  TextArena() : size(0), used(0), oldSize(0) {}
+
+  ~TextArena()
+  {
+    clear();
+  }
+
+  static const char *locate(const DynamicArray<char *> &in, unsigned long long inSize, const TextRef &ref)
+  {
+    int chunk = (int)(ref.offset >> CHUNK_BITS);
+    if (ref.length == 0 || (unsigned long long)ref.offset + ref.length > inSize || in[chunk] == nullptr)
+      return nullptr;
+    return in[chunk] + (ref.offset & (CHUNK_SIZE - 1));
+  }
+
+  static void freeChunks(DynamicArray<char *> &in)
+  {
+    for (int i = 0; i < in.getSize(); i++)
+    {
+      delete[] in[i];
+    }
+    in.clear();
+  }
+
+public:
+  static TextArena &mailbox()
+  {
+    static TextArena arena;
+    return arena;
+  }
+
+  // Address space the offsets can reach; store() throws past it
+  static const unsigned long long CAPACITY = 0xFFFFFFFFULL;
+
+  TextRef store(const string &text)
+  {
+    return store(text.data(), text.length());
+  }
+
+  TextRef store(const char *text, unsigned long long length)
+  {
+    TextRef ref;
+    if (length == 0)
+      return ref;
+
+    unsigned long long chunkEnd = ((size >> CHUNK_BITS) + 1) << CHUNK_BITS;
+    bool fits = (size >> CHUNK_BITS) < (unsigned long long)chunks.getSize() &&
+                chunks[(int)(size >> CHUNK_BITS)] != nullptr && size + length <= chunkEnd;
+    if (!fits)
+    {
+      // Start a new chunk (or a run of slots for a long text)
+      size = (unsigned long long)chunks.getSize() << CHUNK_BITS;
+      unsigned long long slots = (length + CHUNK_SIZE - 1) >> CHUNK_BITS;
+      if (size + (slots << CHUNK_BITS) > CAPACITY)
+        throw "Text arena is full";
+      chunks.add(new char[slots > 1 ? length : CHUNK_SIZE]);
+      for (unsigned long long i = 1; i < slots; i++)
+      {
+        chunks.add(nullptr);
+      }
+    }
+
+    memcpy(chunks[(int)(size >> CHUNK_BITS)] + (size & (CHUNK_SIZE - 1)), text, length);
+    ref.offset = (unsigned int)size;
+    ref.length = (unsigned int)length;
+    size += length;
+    used += length;
+    return ref;
+  }
+
+  // Out of range refs (from before a clear()) read as empty. maxLength
+  // reads only the start of a long text.
+  string get(const TextRef &ref, unsigned int maxLength = 0xFFFFFFFFu) const
+  {
+    const char *text = locate(chunks, size, ref);
+    if (text == nullptr)
+      return "";
+    return string(text, ref.length < maxLength ? ref.length : maxLength);
+  }
+
+  // The text in place (ref.length bytes), for reading without a copy;
+  // nullptr for empty or out of range refs. Valid until clear().
+  const char *data(const TextRef &ref) const
+  {
+    return locate(chunks, size, ref);
+  }
+
+  unsigned long long getSize() const { return used; }
+  unsigned long long getReserved() const { return size; } // Offsets handed out, with chunk ends left unused
+
+  // Compaction: beginCompaction() sets the stored text aside and starts
+  // over empty, relocate() copies one text across and returns its new
+  // ref, endCompaction() frees what was set aside. Every Email kept past
+  // endCompaction() must have been relocated in between; a ref that was
+  // not reads another text (or nothing) afterwards.
+  void beginCompaction()
+  {
+    freeChunks(oldChunks);
+    oldChunks = chunks;
+    oldSize = size;
+    chunks.clear();
+    size = 0;
+    used = 0;
+  }
+
+  TextRef relocate(const TextRef &ref)
+  {
+    const char *text = locate(oldChunks, oldSize, ref);
+    return text != nullptr ? store(text, ref.length) : TextRef();
+  }
+
+  void endCompaction()
+  {
+    freeChunks(oldChunks);
+    oldSize = 0;
+  }
+
+  void clear()
+  {
+    freeChunks(chunks);
+    freeChunks(oldChunks);
+    size = 0;
+    used = 0;
+    oldSize = 0;
+  }
+};
+
+#endif
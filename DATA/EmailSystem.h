@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <chrono>
 #include "User.h"
 #include "Email.h"
 #include "EmailFolder.h"
@@ -12,14 +13,62 @@
 #include "Stack.h"
 #include "Array.h"
 #include "Heap.h"
+#include "SearchIndex.h"
+#include "Trie.h"
+#include "SpamDictionary.h"
+#include "SpamClassifier.h"
+#include "SpamVerdictCache.h"
+#include "SpamScorer.h"
+#include "SenderRank.h"
+#include "RateLimiter.h"
+#include "SpamReclassifier.h"
 using namespace std;
 
+// What the background maintenance has done since login
+struct MaintenanceReport
+{
+  int slices;                      // runMaintenance() calls that found work
+  int expiredDeleted;              // Trash emails past the retention age
+  int quotaMoved;                  // Inbox emails over the quota, moved to Trash
+  int slotsCompacted;              // Emails moved down into free slots
+  unsigned long long textBytes;    // Subject and content no longer stored
+  unsigned long long storageBytes; // Folder pages given back
+  int textCompactions;             // Times the mailbox text arena was compacted
+  unsigned long long arenaBytes;   // Arena space those compactions gave back
+  double milliseconds;             // Time spent in the slices
+
+  MaintenanceReport() : slices(0), expiredDeleted(0), quotaMoved(0), slotsCompacted(0),
+                        textBytes(0), storageBytes(0), textCompactions(0), arenaBytes(0), milliseconds(0) {}
+};
+
+// Progress of the background spam re-check of every user's mail
+struct ReclassifyReport
+{
+  bool running;
+  int users; // In this run
+  int usersDone;
+  long long scanned; // Received Inbox and Spam emails scored
+  long long toSpam;
+  long long toInbox;
+
+  ReclassifyReport() : running(false), users(0), usersDone(0), scanned(0), toSpam(0), toInbox(0) {}
+};
+
 class EmailSystem
 {
 private:
   BST<string, User *> *users;
   Graph *socialGraph;
-  Array<string> *spamWords;
+  SpamDictionary *spamDictionary;       // In use; replaced when a reload finishes
+  SpamDictionaryWatcher *spamWatcher;   // Reloads the file when it changes
+  SpamClassifier *spamClassifier;       // Naive Bayes, trained by markAsSpam/markAsNotSpam
+  SpamVerdictCache *spamVerdicts;       // Content scores, saved per user
+  SpamScorer *spamScorer;               // Content, graph and sender reputation together
+  SenderRank *senderRank;               // PageRank over mail and connections
+  SpamReclassifier *reclassifier;       // Re-checks all users' mail when the rules change
+  ReclassifyReport reclassifyReport;
+  unsigned long long reclassifyRules;      // Rules of the running or last finished re-check
+  DynamicArray<string> reclassifyRetries; // Users whose files were rewritten while read
   FileHandler *fileHandler;
   User *currentUser;
   Stack<string> *navigationHistory;
@@ -28,11 +77,21 @@ private:
   Stack<Email> *redoStack; // Redo functionality
   Queue<Email> *scheduledEmails;
   Queue<Email> *incomingEmailQueue;         // Processing queue for incoming emails
+  Queue<Email> *deferredEmails;             // Held back by the rate limiter
+  RateLimiter *rateLimiter;                 // Per sender and recipient limits on incoming mail
   PriorityQueue<Email> *priorityEmailQueue; // High-importance emails
-  MaxHeap<Email> *timestampHeap;            // Max-heap for organizing by timestamp
   Array<string> *systemConfig;              // System configuration settings
   LinkedList<string> *activityLog;          // Recent activity log (circular)
   int activityLogMaxSize;
+  int maxMutationLogSize; // Logged label changes before a full save at login
+
+  // Maintenance policy, read from the configuration at login
+  bool autoDeleteTrash;
+  int trashRetentionDays;
+  int maxInboxSize; // 0: no quota (also off unless EnforceInboxQuota=true)
+  MaintenanceReport maintenanceReport;
+  unsigned long long textWasteAfterCompaction; // Arena space beyond the live text the last compaction left
+  unsigned int textGeneration;                  // Bumped by every text compaction
 
   // User folders
   EmailFolder *inbox;
@@ -40,9 +99,15 @@ private:
   EmailFolder *drafts;
   EmailFolder *spam;
   EmailFolder *trash;
-  EmailFolder *important;
+  EmailFolder *important; // Stays empty: Important is a label (getLabelView)
+
+  SearchIndex *searchIndex; // Full-text index over all of the user's folders
+  FuzzyMatcher *fuzzyTerms; // Subject, sender and contact name terms for typo lookup
+  AutocompleteTrie *recipientIndex; // Address suggestions for the compose screen
+  EmailIdIndex *emailIndex;         // Email id -> folder and slot, for O(1) lookups
+  ThreadIndex *threadIndex;         // Conversation threads over all folders
 
-  int nextEmailId;
+  IdGenerator *idGenerator;
   int nextUserId;
 
 public:
@@ -50,8 +115,16 @@ public:
   {
     users = new BST<string, User *>();
     socialGraph = new Graph();
-    spamWords = new Array<string>(20);
+    spamWatcher = new SpamDictionaryWatcher();
+    spamDictionary = nullptr;
+    spamClassifier = new SpamClassifier();
+    spamVerdicts = new SpamVerdictCache();
+    spamScorer = new SpamScorer();
+    senderRank = new SenderRank();
+    spamScorer->setSenderRank(senderRank);
     fileHandler = new FileHandler();
+    reclassifier = new SpamReclassifier(fileHandler, spamScorer);
+    reclassifyRules = 0;
     currentUser = nullptr;
     navigationHistory = new Stack<string>();
     deletedEmailsStack = new Stack<Email>();
@@ -59,11 +132,18 @@ public:
     redoStack = new Stack<Email>();
     scheduledEmails = new Queue<Email>();
     incomingEmailQueue = new Queue<Email>();
+    deferredEmails = new Queue<Email>();
+    rateLimiter = new RateLimiter();
     priorityEmailQueue = new PriorityQueue<Email>(100);
-    timestampHeap = new MaxHeap<Email>(100);
-    systemConfig = new Array<string>(10);
+    systemConfig = new Array<string>(16);
     activityLog = new LinkedList<string>();
     activityLogMaxSize = 20; // Keep last 20 activities
+    maxMutationLogSize = 1000;
+    autoDeleteTrash = false;
+    trashRetentionDays = 30;
+    maxInboxSize = 0;
+    textWasteAfterCompaction = 0;
+    textGeneration = 0;
 
     inbox = new EmailFolder("Inbox");
     sent = new EmailFolder("Sent");
@@ -72,19 +152,51 @@ public:
     trash = new EmailFolder("Trash");
     important = new EmailFolder("Important");
 
-    nextEmailId = 1001;
+    searchIndex = new SearchIndex();
+    fuzzyTerms = new FuzzyMatcher();
+    recipientIndex = new AutocompleteTrie();
+    emailIndex = new EmailIdIndex();
+    threadIndex = new ThreadIndex();
+    searchIndex->setVocabulary(fuzzyTerms);
+    searchIndex->setSenderRank(senderRank);
+    EmailFolder *allFolders[] = {inbox, sent, drafts, spam, trash, important};
+    for (int f = 0; f < 6; f++)
+    {
+      allFolders[f]->setSearchIndex(searchIndex);
+      allFolders[f]->setEmailIndex(emailIndex);
+      allFolders[f]->setThreadIndex(threadIndex);
+    }
+
+    idGenerator = new IdGenerator();
     nextUserId = 1;
 
     loadData();
     loadSystemConfig(); // Load system configuration
+    idGenerator->setNode(atoi(getConfigValue("NodeId").c_str()));
+    idGenerator->restore(fileHandler->loadIdReservation());
+    resumeReclassification();
   }
 
   ~EmailSystem()
   {
+    if (currentUser != nullptr)
+    {
+      // As logout does
+      flushDeferredEmails();
+      fileIncomingEmails();
+    }
     saveData();
+    delete reclassifier; // Its progress file lets the next start go on
+
     delete users;
     delete socialGraph;
-    delete spamWords;
+    delete spamWatcher;
+    if (spamDictionary != nullptr)
+      spamDictionary->release();
+    delete spamClassifier;
+    delete spamVerdicts;
+    delete spamScorer;
+    delete senderRank;
     delete fileHandler;
     delete navigationHistory;
     delete deletedEmailsStack;
@@ -92,8 +204,9 @@ public:
     delete redoStack;
     delete scheduledEmails;
     delete incomingEmailQueue;
+    delete deferredEmails;
+    delete rateLimiter;
     delete priorityEmailQueue;
-    delete timestampHeap;
     delete systemConfig;
     delete activityLog;
     delete inbox;
@@ -102,14 +215,63 @@ public:
     delete spam;
     delete trash;
     delete important;
+    delete searchIndex;
+    delete fuzzyTerms;
+    delete recipientIndex;
+    delete emailIndex;
+    delete threadIndex;
+    delete idGenerator;
   }
 
   void loadData()
   {
-    fileHandler->loadSpamWords(spamWords);
+    spamDictionary = spamWatcher->open(fileHandler->getSpamWordsPath());
+    spamClassifier->openShared(fileHandler->getSharedSpamModelPath());
+    spamScorer->load(fileHandler->getSenderReputationPath());
     fileHandler->loadUsers(users);
     loadAllContactsAndConnections();
     fileHandler->loadSocialGraph(socialGraph);
+    loadSenderRank();
+  }
+
+  // Mail counts from the saved mail graph (the first time, from every
+  // user's Sent folder) and connections from the social graph, then the
+  // scores, on all cores
+  void loadSenderRank()
+  {
+    if (!senderRank->load(fileHandler->getMailGraphPath()))
+    {
+      int maxUsers = 1000;
+      string *keys = new string[maxUsers];
+      User **values = new User *[maxUsers];
+      users->getAllEntries(keys, values, maxUsers);
+      for (int i = 0; i < users->getSize() && i < maxUsers; i++)
+      {
+        DynamicArray<string> receivers;
+        fileHandler->loadSentReceivers(values[i]->getEmail(), receivers);
+        for (int j = 0; j < receivers.getSize(); j++)
+        {
+          senderRank->addMail(values[i]->getEmail(), receivers[j]);
+        }
+      }
+      delete[] keys;
+      delete[] values;
+    }
+
+    LinkedList<string> ids = socialGraph->getUserIds();
+    for (LinkedList<string>::Handle id = ids.first(); id != nullptr; id = ids.next(id))
+    {
+      GraphNode *node = socialGraph->getNode(ids.at(id));
+      LinkedList<int>::Handle strength = node->connectionStrengths.first();
+      for (LinkedList<string>::Handle user = node->adjacentUsers.first(); user != nullptr; user = node->adjacentUsers.next(user))
+      {
+        senderRank->setConnection(ids.at(id), node->adjacentUsers.at(user),
+                                  strength != nullptr ? node->connectionStrengths.at(strength) : 1);
+        if (strength != nullptr)
+          strength = node->connectionStrengths.next(strength);
+      }
+    }
+    senderRank->build();
   }
 
   void saveData()
@@ -117,9 +279,41 @@ public:
     fileHandler->saveAllUsers(users);
     fileHandler->saveSocialGraph(socialGraph);
     saveAllEmails();
+    spamClassifier->save(); // Only the models trained since the last save
+    spamScorer->save(fileHandler->getSenderReputationPath());
+    senderRank->save(fileHandler->getMailGraphPath());
+    if (currentUser != nullptr)
+      spamVerdicts->save(fileHandler->getSpamVerdictsPath(currentUser->getEmail()), getSpamVersion());
+    saveScheduledEmails();
     saveAllContactsAndConnections();
   }
 
+  // The logged-in user's scheduled mail, kept until it is sent
+  void saveScheduledEmails()
+  {
+    if (currentUser == nullptr)
+      return;
+    DynamicArray<Email> pending(scheduledEmails->getSize() + 1);
+    int count = scheduledEmails->getSize();
+    for (int i = 0; i < count; i++)
+    {
+      Email email = scheduledEmails->dequeue();
+      pending.add(email);
+      scheduledEmails->enqueue(email);
+    }
+    fileHandler->saveScheduledEmails(currentUser->getEmail(), pending);
+  }
+
+  void loadScheduledEmails()
+  {
+    LinkedList<Email> pending;
+    fileHandler->loadScheduledEmails(currentUser->getEmail(), &pending);
+    for (int i = 0; i < pending.getSize(); i++)
+    {
+      scheduledEmails->enqueue(pending.get(i));
+    }
+  }
+
   void saveAllContactsAndConnections()
   {
     int maxUsers = 1000;
@@ -177,14 +371,12 @@ public:
       return;
 
     // Save all emails to user's folder structure
-    fileHandler->saveUserEmails(
+    long long generation = fileHandler->saveUserEmails(
         currentUser->getEmail(),
-        inbox->getEmails(),
-        sent->getEmails(),
-        drafts->getEmails(),
-        spam->getEmails(),
-        trash->getEmails(),
-        important->getEmails());
+        inbox, sent, drafts, spam, trash, important);
+
+    // The search index is saved for the same generation
+    searchIndex->persist(generation);
   }
 
   string generateUserId()
@@ -194,11 +386,14 @@ public:
     return ss.str();
   }
 
-  string generateEmailId()
+  EmailId generateEmailId()
   {
-    stringstream ss;
-    ss << "E" << nextEmailId++;
-    return ss.str();
+    EmailId id = idGenerator->next();
+    // Persist a reservation ahead of the ids handed out, so a restart
+    // cannot issue them again
+    if (idGenerator->needsReservation())
+      fileHandler->saveIdReservation(idGenerator->reserve());
+    return id;
   }
 
   bool createAccount(string username, string email, string password)
@@ -236,7 +431,15 @@ public:
 
     currentUser = user;
     currentUser->setLastLogin(time(0));
+    spamClassifier->openUser(fileHandler->getSpamModelPath(currentUser->getEmail()));
+    spamVerdicts->load(fileHandler->getSpamVerdictsPath(currentUser->getEmail()));
     loadUserEmails();
+    loadScheduledEmails();
+    loadContactTerms();
+    loadRecipientIndex();
+    loadMaintenancePolicy();
+    maintenanceReport = MaintenanceReport();
+    textWasteAfterCompaction = 0;
 
     cout << "Login successful! Welcome, " << currentUser->getUsername() << endl;
     return true;
@@ -246,9 +449,33 @@ public:
   {
     if (currentUser != nullptr)
     {
+      // Queued mail goes into the folders and scheduled mail to its file
+      // (saveData), as the mailbox text arena is released below
+      flushDeferredEmails();
+      fileIncomingEmails();
       saveData();
+      spamClassifier->save(true);
+      spamVerdicts->clear();
       currentUser = nullptr;
       clearFolders();
+
+      // Marks taught the shared model: everyone's mail is judged again
+      if (!reclassifyReport.running && getSpamRulesKey() != reclassifyRules)
+        startReclassification();
+
+      // Emails held outside the folders belong to this mailbox too; once
+      // they are saved and gone the mailbox text arena can be released
+      undoStack->clear();
+      redoStack->clear();
+      deletedEmailsStack->clear();
+      scheduledEmails->clear();
+      incomingEmailQueue->clear();
+      deferredEmails->clear();
+      while (!priorityEmailQueue->isEmpty())
+      {
+        priorityEmailQueue->dequeue();
+      }
+      TextArena::mailbox().clear();
     }
   }
 
@@ -260,17 +487,36 @@ public:
     LinkedList<Email> allEmails;
     fileHandler->loadUserEmails(currentUser->getEmail(), &allEmails);
 
-    // Prepare spam words array for checking incoming emails
-    string spamArr[20];
-    for (int i = 0; i < spamWords->getSize(); i++)
+    // A saved index that matches the mailbox is used as is, plus the mail
+    // delivered since it was saved; otherwise it is rebuilt while the
+    // emails are added to their folders
+    bool indexLoaded = searchIndex->open(fileHandler->getSearchIndexPath(currentUser->getEmail()),
+                                         fileHandler->loadMailboxGeneration(currentUser->getEmail()));
+    searchIndex->setUpdatesPaused(indexLoaded);
+    HashMap<EmailId, bool> arrivalIds(64);
+    if (indexLoaded)
     {
-      spamArr[i] = spamWords->get(i);
+      DynamicArray<EmailId> logged;
+      fileHandler->loadArrivals(currentUser->getEmail(), logged);
+      for (int i = 0; i < logged.getSize(); i++)
+      {
+        arrivalIds.insert(logged[i], true);
+      }
     }
+    LinkedList<Email> arrived;
+    LinkedList<Email> rerouted;
+    LinkedList<Email> importantCopies;
 
     for (int i = 0; i < allEmails.getSize(); i++)
     {
       Email email = allEmails.get(i);
       string folder = email.getFolder();
+      if (email.getId() == 0)
+        email.setId(generateEmailId());
+      else
+        idGenerator->observe(email.getId());
+      if (indexLoaded && arrivalIds.contains(email.getId()))
+        arrived.insert(email);
 
       // Check for spam ONLY on incoming emails (where receiver is current user)
       // But NOT on sent emails or self-sent emails already in Inbox
@@ -278,8 +524,10 @@ public:
           email.getSender() != currentUser->getEmail() &&
           folder != "Spam" && folder != "Trash")
       {
-        if (email.containsSpamWords(spamArr, spamWords->getSize()))
+        if (isSpamFor(email, currentUser->getEmail()))
         {
+          if (indexLoaded)
+            rerouted.insert(email);
           email.setIsSpam(true);
           email.setFolder("Spam");
           folder = "Spam";
@@ -298,12 +546,98 @@ public:
       else if (folder == "Trash")
         trash->addEmail(email);
       else if (folder == "Important")
-        important->addEmail(email);
+        importantCopies.insert(email);
+    }
+
+    // Arrivals go into the delta, saved as a segment at the next save. The
+    // saved index still has the rerouted ones under their original folder.
+    searchIndex->setUpdatesPaused(false);
+    for (auto it = arrived.begin(); it != arrived.end(); ++it)
+    {
+      searchIndex->addEmail(*it, (*it).getFolder());
+    }
+    for (int i = 0; i < rerouted.getSize(); i++)
+    {
+      Email email = rerouted.get(i);
+      searchIndex->removeEmail(email.getFolder(), email.getId());
+      email.setIsSpam(true);
+      email.setFolder("Spam");
+      searchIndex->addEmail(email, "Spam");
+    }
+
+    mergeImportantCopies(importantCopies, indexLoaded);
+    applyMutations();
+  }
+
+  void logMutation(EmailId emailId, EmailFolder *folder)
+  {
+    const Email *email = folder->getEmail(emailId);
+    if (email != nullptr && currentUser != nullptr)
+      fileHandler->appendMutation(currentUser->getEmail(), emailId, email->getLabels(), folder->getFolderName());
+  }
+
+  // Important used to be a folder of copies: keep the label on the
+  // original, or move a copy without one to the Inbox
+  void mergeImportantCopies(LinkedList<Email> &copies, bool indexLoaded)
+  {
+    for (auto it = copies.begin(); it != copies.end(); ++it)
+    {
+      Email email = *it;
+      if (indexLoaded)
+        searchIndex->removeEmail("Important", email.getId());
+
+      EmailFolder *home = locateEmail(email.getId());
+      if (home != nullptr)
+      {
+        home->setLabel(email.getId(), LABEL_IMPORTANT, true);
+      }
+      else
+      {
+        email.setLabel(LABEL_IMPORTANT, true);
+        email.setFolder("Inbox");
+        inbox->addEmail(email);
+      }
+    }
+  }
+
+  // Replays label and folder changes logged since the last full save
+  void applyMutations()
+  {
+    DynamicArray<EmailMutation> mutations;
+    fileHandler->loadMutations(currentUser->getEmail(), mutations);
+    for (int i = 0; i < mutations.getSize(); i++)
+    {
+      string deleted = EmailMutation::deletedPrefix();
+      if (mutations[i].folder.compare(0, deleted.length(), deleted) == 0)
+      {
+        EmailFolder *from = getFolderByName(mutations[i].folder.substr(deleted.length()));
+        if (from != nullptr && from->getEmail(mutations[i].emailId) != nullptr)
+          from->removeEmail(mutations[i].emailId);
+        continue;
+      }
+
+      EmailFolder *folder = locateEmail(mutations[i].emailId, mutations[i].folder);
+      EmailFolder *target = getFolderByName(mutations[i].folder);
+      if (folder == nullptr || target == nullptr)
+        continue;
+      if (folder != target)
+        moveEmail(mutations[i].emailId, folder->getFolderName(), target->getFolderName());
+      target->setLabels(mutations[i].emailId, mutations[i].labels);
     }
+
+    // A long log is folded into the folder files
+    if (mutations.getSize() >= maxMutationLogSize)
+      saveAllEmails();
   }
 
   void clearFolders()
   {
+    // Index first, so the folders do not tombstone every email one by one
+    searchIndex->clear();
+    fuzzyTerms->clear();
+    recipientIndex->clear();
+    emailIndex->clear();
+    threadIndex->clear();
     inbox->clearFolder();
     sent->clearFolder();
     drafts->clearFolder();
@@ -312,17 +646,406 @@ public:
     important->clearFolder();
   }
 
+  // Contact name words map to the contact's address, so a misspelt name
+  // still finds mail from that person. The contact is also offered as a
+  // recipient on the compose screen.
+  void indexContactTerms(const Contact &contact)
+  {
+    recipientIndex->addAddress(contact.getEmail(), contact.getName(),
+                               1.0 + recipientScore(contact.getInteractionCount(), 0));
+
+    string address = contact.getEmail();
+    for (size_t i = 0; i < address.length(); i++)
+    {
+      address[i] = tolower((unsigned char)address[i]);
+    }
+    if (address.empty())
+      return;
+
+    DynamicArray<string> tokens;
+    SearchIndex::tokenize(contact.getName(), tokens);
+    for (int i = 0; i < tokens.getSize(); i++)
+    {
+      fuzzyTerms->addTerm(tokens[i], address);
+    }
+    fuzzyTerms->addTerm(address);
+  }
+
+  // Frecency of a recipient: a week of recency is worth as much as
+  // doubling the number of emails sent to them
+  static double recipientScore(int interactions, time_t lastUsed)
+  {
+    return log2(1.0 + interactions) + (double)lastUsed / (7 * 86400.0);
+  }
+
+  // Registered users rank lowest, contacts by interaction count (added by
+  // loadContactTerms) and recent recipients above both by recency
+  void loadRecipientIndex()
+  {
+    if (currentUser == nullptr)
+      return;
+
+    int userCount = users->getSize();
+    if (userCount > 0)
+    {
+      string *keys = new string[userCount];
+      User **values = new User *[userCount];
+      users->getAllEntries(keys, values, userCount);
+      for (int i = 0; i < userCount; i++)
+      {
+        if (values[i] != currentUser)
+          recipientIndex->addAddress(values[i]->getEmail(), values[i]->getUsername(), 0);
+      }
+      delete[] keys;
+      delete[] values;
+    }
+
+    // Recent recipients have no timestamps; the newest is last in the array
+    Array<string> *recent = currentUser->getRecentContactsArray();
+    time_t now = time(0);
+    for (int i = 0; i < recent->getSize(); i++)
+    {
+      string address = recent->get(i);
+      Contact *contact = currentUser->searchContact(address);
+      int interactions = contact != nullptr ? contact->getInteractionCount() : 0;
+      recipientIndex->addAddress(address, contact != nullptr ? contact->getName() : "",
+                                 recipientScore(interactions, now - (recent->getSize() - i)));
+    }
+  }
+
+  // Call after sending: updates recent contacts, the contact's interaction
+  // count and the recipient's rank in the suggestions
+  void recordRecipient(string to)
+  {
+    if (currentUser == nullptr)
+      return;
+
+    currentUser->addRecentContact(to);
+    senderRank->addMail(currentUser->getEmail(), to);
+    Contact *contact = currentUser->searchContact(to);
+    int interactions = 0;
+    if (contact != nullptr)
+    {
+      contact->incrementInteraction();
+      interactions = contact->getInteractionCount();
+    }
+    recipientIndex->addAddress(to, contact != nullptr ? contact->getName() : "",
+                               recipientScore(interactions, time(0)));
+  }
+
+  // Best matching recipients for what has been typed so far
+  int suggestRecipients(string prefix, DynamicArray<AddressSuggestion> &suggestions, int maxResults = 5)
+  {
+    if (currentUser == nullptr)
+      return 0;
+    return recipientIndex->complete(prefix, suggestions, maxResults);
+  }
+
+  void loadContactTerms()
+  {
+    if (currentUser == nullptr)
+      return;
+
+    BST<string, Contact> *contacts = currentUser->getContacts();
+    int count = contacts->getSize();
+    if (count == 0)
+      return;
+
+    string *keys = new string[count];
+    Contact *values = new Contact[count];
+    contacts->getAllEntries(keys, values, count);
+    for (int i = 0; i < count; i++)
+    {
+      indexContactTerms(values[i]);
+    }
+    delete[] keys;
+    delete[] values;
+  }
+
   // Helper function to check if email contains spam
+  // Spam by the content alone: the dictionary, or the Bayes models once
+  // they are trained
   bool isSpamEmail(const Email &email)
   {
-    string spamArr[20];
-    for (int i = 0; i < spamWords->getSize(); i++)
+    return spamScorer->isSpam(getContentSpamLogOdds(email));
+  }
+
+  // Spam for this receiver: the content score with the sender's
+  // connection to the receiver and reputation (see SpamScorer). Used on
+  // delivery; an email to oneself is judged by its content.
+  bool isSpamFor(const Email &email, const string &receiver)
+  {
+    return spamScorer->isSpam(getSpamLogOdds(email, receiver));
+  }
+
+  double getSpamLogOdds(const Email &email, const string &receiver)
+  {
+    double content = getContentSpamLogOdds(email, receiver);
+    if (email.getSender() == receiver)
+      return content;
+    return spamScorer->score(content, socialGraph->getPairFeatures(email.getSender(), receiver), email.getSender(),
+                             isContactOf(receiver, email.getSender()));
+  }
+
+  // Whether the sender is one of the receiver's contacts; the receiver's
+  // contact filter rules out most senders without a BST search
+  bool isContactOf(const string &receiver, const string &sender)
+  {
+    if (currentUser != nullptr && currentUser->getEmail() == receiver)
+      return currentUser->hasContact(sender);
+    if (!socialGraph->isUser(receiver))
+      return false;
+    User **user = users->search(receiver);
+    return user != nullptr && (*user)->hasContact(sender);
+  }
+
+  // The same text gets the same score until the dictionary or a model
+  // changes
+  double getContentSpamLogOdds(const Email &email)
+  {
+    unsigned long long fingerprint = SpamVerdictCache::fingerprint(email);
+    unsigned long long version = getSpamVersion();
+    double score;
+    if (spamVerdicts->lookup(fingerprint, version, score))
+      return score;
+    double modelLogOdds = spamClassifier->isTrained() ? spamClassifier->logOdds(email) : 0;
+    score = spamScorer->contentLogOdds(spamDictionary->isSpam(email), modelLogOdds);
+    spamVerdicts->store(fingerprint, version, score);
+    return score;
+  }
+
+  // The content score by the receiver's models rather than the logged-in
+  // user's, as SpamReclassifier scores it later. Mail for another user
+  // stays out of the verdict cache, which holds the logged-in user's.
+  double getContentSpamLogOdds(const Email &email, const string &receiver)
+  {
+    if (currentUser == nullptr || receiver == currentUser->getEmail())
+      return getContentSpamLogOdds(email);
+    double modelLogOdds = spamClassifier->receiverLogOdds(fileHandler->getSpamModelPath(receiver), email);
+    return spamScorer->contentLogOdds(spamDictionary->isSpam(email), modelLogOdds);
+  }
+
+  // Changes with the spam dictionary's content and with every lesson of
+  // the Bayes models
+  unsigned long long getSpamVersion() const
+  {
+    return hashKey(spamDictionary->getVersion() ^ spamClassifier->getVersion());
+  }
+
+  const SpamVerdictCache &getSpamVerdictCache() const { return *spamVerdicts; }
+  const SpamScorer &getSpamScorer() const { return *spamScorer; }
+  const SenderRank &getSenderRank() const { return *senderRank; }
+
+  // Probability of spam from the Bayes models, -1 while untrained
+  double getSpamProbability(const Email &email)
+  {
+    return spamClassifier->spamProbability(email);
+  }
+
+  const SpamClassifier &getSpamClassifier() const { return *spamClassifier; }
+
+  // Sum of the weights of the spam phrases in an email; hits gets their
+  // numbers (see getSpamDictionary())
+  double getSpamScore(const Email &email, DynamicArray<int> *hits = nullptr)
+  {
+    return spamDictionary->score(email, hits);
+  }
+
+  const SpamDictionary &getSpamDictionary() const { return *spamDictionary; }
+
+  // Swaps in the spam dictionary once a reload of a changed file has
+  // finished; cheap enough to call every frame. Returns true on a swap.
+  bool pollSpamDictionary()
+  {
+    SpamDictionary *loaded = spamWatcher->poll();
+    if (loaded == nullptr)
+      return false;
+    spamDictionary->release(); // A re-check may still hold it
+    spamDictionary = loaded;
+    logActivity("Spam dictionary reloaded: " + to_string(loaded->getPhraseCount()) + " phrases");
+    if (getSpamRulesKey() != reclassifyRules)
+      startReclassification();
+    return true;
+  }
+
+  // Identifies the rules all users' mail is judged by: the dictionary and
+  // the shared model (a user's own model only concerns their own mail)
+  unsigned long long getSpamRulesKey() const
+  {
+    return hashKey(spamDictionary->getVersion() ^ spamClassifier->getSharedModel().getVersion());
+  }
+
+  // Re-checks every user's received Inbox and Spam mail against the
+  // current rules in the background (see SpamReclassifier); a re-check
+  // already going is dropped. With resume set, users the progress file
+  // lists as done under the same rules are skipped.
+  void startReclassification(bool resume = false)
+  {
+    reclassifier->stop();
+    reclassifyRetries.clear();
+    spamClassifier->save(); // The workers read the models from their files
+    unsigned long long rules = getSpamRulesKey();
+    reclassifyReport = ReclassifyReport();
+
+    HashMap<string, bool> done(64);
+    unsigned long long savedRules = 0;
+    bool finished = false;
+    DynamicArray<ReclassifyProgress> progress;
+    if (resume && fileHandler->loadReclassifyProgress(savedRules, progress, finished) && savedRules == rules)
+    {
+      for (int i = 0; i < progress.getSize(); i++)
+      {
+        done.insert(progress[i].user, true);
+        addReclassifyProgress(progress[i]);
+      }
+    }
+    else
+    {
+      fileHandler->startReclassifyProgress(rules);
+    }
+
+    int userCount = users->getSize();
+    string *keys = new string[userCount > 0 ? userCount : 1];
+    User **values = new User *[userCount > 0 ? userCount : 1];
+    users->getAllEntries(keys, values, userCount);
+    DynamicArray<string> pending;
+    for (int i = 0; i < userCount; i++)
+    {
+      if (done.search(keys[i]) == nullptr)
+        pending.add(keys[i]);
+    }
+    delete[] keys;
+    delete[] values;
+
+    reclassifyRules = rules;
+    reclassifyReport.running = true;
+    reclassifyReport.users = userCount;
+    reclassifier->start(pending, spamDictionary, spamClassifier->getSharedModel());
+    logActivity("Spam re-check started for " + to_string(pending.getSize()) + " users");
+  }
+
+  // At start: goes on with a re-check that an exit or crash cut short,
+  // or starts one if the rules changed while the program was not running
+  void resumeReclassification()
+  {
+    unsigned long long rules = 0;
+    bool finished = false;
+    DynamicArray<ReclassifyProgress> progress;
+    if (!fileHandler->loadReclassifyProgress(rules, progress, finished))
     {
-      spamArr[i] = spamWords->get(i);
+      // The mail there is was judged by the rules there are
+      reclassifyRules = getSpamRulesKey();
+      fileHandler->startReclassifyProgress(reclassifyRules, true);
+      return;
     }
-    return email.containsSpamWords(spamArr, spamWords->getSize());
+    reclassifyRules = rules;
+    if (!finished || rules != getSpamRulesKey())
+      startReclassification(true);
   }
 
+  // Applies finished users' re-checks in user order, one per call, so it
+  // is cheap enough to call every frame; with wait set, runs the whole
+  // re-check to its end. Returns true while one is going.
+  bool pollReclassification(bool wait = false)
+  {
+    while (reclassifyReport.running)
+    {
+      ReclassifyResult *result = reclassifier->next(wait);
+      if (result != nullptr)
+      {
+        applyReclassification(*result);
+        delete result;
+        if (!wait)
+          return true;
+        continue;
+      }
+      if (!reclassifier->isFinished())
+        return true; // The next user is still being read
+
+      if (reclassifyRetries.getSize() > 0)
+      {
+        DynamicArray<string> retries;
+        retries.swap(reclassifyRetries);
+        reclassifier->start(retries, spamDictionary, spamClassifier->getSharedModel());
+        continue;
+      }
+      fileHandler->finishReclassifyProgress();
+      reclassifyReport.running = false;
+      logActivity("Spam re-check done: " + to_string(reclassifyReport.toSpam) + " to Spam, " +
+                  to_string(reclassifyReport.toInbox) + " to Inbox");
+    }
+    return false;
+  }
+
+  // One user's re-check. The sender part of each score is added here,
+  // where the graph and the reputations live. The moves of a user who is
+  // not logged in go to their mutation log in one append, replayed at
+  // their next login; the logged-in user's folders change at once.
+  void applyReclassification(const ReclassifyResult &result)
+  {
+    bool loggedIn = currentUser != nullptr && currentUser->getEmail() == result.user;
+    if (!loggedIn && fileHandler->loadMailboxGeneration(result.user) != result.generation)
+    {
+      reclassifyRetries.add(result.user); // Its files were rewritten while being read
+      return;
+    }
+
+    // Looked up once: a users search per email costs more than the scoring
+    User *receiver = currentUser;
+    if (!loggedIn)
+    {
+      User **found = users->search(result.user);
+      receiver = found != nullptr ? *found : nullptr;
+    }
+
+    ReclassifyProgress progress;
+    progress.user = result.user;
+    progress.scanned = result.candidates.getSize();
+    DynamicArray<EmailMutation> moves;
+    for (int i = 0; i < result.candidates.getSize(); i++)
+    {
+      const ReclassifyCandidate &candidate = result.candidates[i];
+      bool contact = receiver != nullptr && receiver->hasContact(candidate.sender);
+      double logOdds = spamScorer->score(candidate.contentLogOdds,
+                                         socialGraph->getPairFeatures(candidate.sender, result.user),
+                                         candidate.sender, contact);
+      bool isSpam = spamScorer->isSpam(logOdds);
+      if (isSpam == candidate.inSpam)
+        continue;
+
+      EmailFolder *target = isSpam ? spam : inbox;
+      unsigned int labels = isSpam ? candidate.labels | labelBit(LABEL_SPAM) : candidate.labels & ~labelBit(LABEL_SPAM);
+      if (loggedIn)
+      {
+        EmailFolder *source = isSpam ? inbox : spam;
+        if (source->getEmail(candidate.emailId) == nullptr)
+          continue; // Moved since the files were read
+        source->setLabel(candidate.emailId, LABEL_SPAM, isSpam);
+        moveEmail(candidate.emailId, source->getFolderName(), target->getFolderName());
+        labels = target->getEmail(candidate.emailId)->getLabels();
+      }
+      moves.add(EmailMutation(candidate.emailId, labels, target->getFolderName()));
+      if (isSpam)
+        progress.toSpam++;
+      else
+        progress.toInbox++;
+    }
+
+    fileHandler->appendMutations(result.user, moves);
+    fileHandler->appendReclassifyProgress(progress);
+    addReclassifyProgress(progress);
+  }
+
+  void addReclassifyProgress(const ReclassifyProgress &progress)
+  {
+    reclassifyReport.usersDone++;
+    reclassifyReport.scanned += progress.scanned;
+    reclassifyReport.toSpam += progress.toSpam;
+    reclassifyReport.toInbox += progress.toInbox;
+  }
+
+  const ReclassifyReport &getReclassifyReport() const { return reclassifyReport; }
+
   void composeEmail()
   {
     if (currentUser == nullptr)
@@ -382,7 +1105,7 @@ public:
     case 1:
       newEmail.setFolder("Sent");
       sent->addEmail(newEmail);
-      currentUser->addRecentContact(to);
+      recordRecipient(to);
       cout << "Email sent successfully!" << endl;
       saveData(); // Save all user data
       break;
@@ -395,6 +1118,7 @@ public:
     case 3:
       scheduledEmails->enqueue(newEmail);
       cout << "Email scheduled!" << endl;
+      saveScheduledEmails();
       break;
     default:
       cout << "Invalid choice! Email discarded." << endl;
@@ -417,7 +1141,20 @@ public:
     else if (folderName == "Trash")
       folder = trash;
     else if (folderName == "Important")
-      folder = important;
+    {
+      // A label, not a folder
+      DynamicArray<Email> emails;
+      getLabelView(labelBit(LABEL_IMPORTANT), 0, emails);
+      cout << "\n======== Important ========" << endl;
+      for (int i = 0; i < emails.getSize(); i++)
+      {
+        cout << "\n"
+             << (i + 1) << ". " << (emails[i].getIsRead() ? "[READ] " : "[UNREAD] ");
+        cout << "From: " << emails[i].getSender() << " (" << emails[i].getFolder() << ")" << endl;
+        cout << "   Subject: " << emails[i].getSubject() << endl;
+      }
+      cout << "\nTotal emails: " << emails.getSize() << endl;
+    }
 
     if (folder != nullptr)
     {
@@ -430,74 +1167,137 @@ public:
     inbox->displayEmailsByPriority();
   }
 
+  // Parses the query and replaces words that match nothing with the
+  // closest known terms (edit distance 1 for short words, else 2). A
+  // correction at distance d is weighted 1 / (1 + d).
+  void expandQuery(string query, DynamicArray<string> &queryTerms, DynamicArray<double> &weights)
+  {
+    DynamicArray<string> parsed;
+    SearchIndex::parseQuery(query, parsed);
+    for (int i = 0; i < parsed.getSize(); i++)
+    {
+      if (searchIndex->hasTerm(parsed[i]))
+      {
+        queryTerms.add(parsed[i]);
+        weights.add(1.0);
+        continue;
+      }
+
+      searchIndex->loadVocabulary();
+      int maxDistance = parsed[i].length() <= 4 ? 1 : 2;
+      DynamicArray<FuzzyMatch> matches;
+      fuzzyTerms->lookup(parsed[i], maxDistance, matches, 5);
+      for (int m = 0; m < matches.getSize(); m++)
+      {
+        const string &term = matches[m].payload;
+        bool duplicate = false;
+        for (int j = 0; j < queryTerms.getSize(); j++)
+        {
+          if (queryTerms[j] == term)
+          {
+            duplicate = true;
+            break;
+          }
+        }
+        if (!duplicate && searchIndex->hasTerm(term))
+        {
+          queryTerms.add(term);
+          weights.add(1.0 / (1.0 + matches[m].distance));
+        }
+      }
+    }
+  }
+
+  // Ranked search across all folders. Fills hits with results
+  // [offset, offset + limit) including snippets and returns the number of
+  // candidates that were scored. Pages are ranked from scratch, so page k
+  // keeps the best k * limit: fine for the few pages anyone reads.
+  int rankedSearch(string query, int offset, int limit, DynamicArray<SearchHit> &hits)
+  {
+    if (currentUser == nullptr)
+      return 0;
+
+    DynamicArray<string> queryTerms;
+    DynamicArray<double> weights;
+    expandQuery(query, queryTerms, weights);
+    int candidates = searchIndex->search(queryTerms, weights, offset, limit, hits);
+
+    for (int i = 0; i < hits.getSize(); i++)
+    {
+      EmailFolder *folder = getFolderByName(hits[i].folder);
+      Email email;
+      if (folder != nullptr && folder->findEmail(hits[i].emailId, email))
+      {
+        hits[i].snippet = SearchIndex::makeSnippet(email.getContent(), queryTerms);
+      }
+    }
+    return candidates;
+  }
+
   void searchEmail()
   {
     if (currentUser == nullptr)
       return;
 
     string query;
-    cout << "Enter search query (sender/subject): ";
+    cout << "Enter search query (sender/subject/content): ";
     cin.ignore();
     getline(cin, query);
 
     cout << "\n=== Search Results ===" << endl;
-    bool found = false;
-
-    // Search in all folders
-    EmailFolder *folders[] = {inbox, sent, drafts, spam, trash, important};
-    string folderNames[] = {"Inbox", "Sent", "Drafts", "Spam", "Trash", "Important"};
 
-    for (int f = 0; f < 6; f++)
+    // Show one page at a time, later pages are only ranked when asked for
+    int pageSize = 10;
+    int offset = 0;
+    while (true)
     {
-      LinkedList<Email> *emails = folders[f]->getEmails();
-      for (int i = 0; i < emails->getSize(); i++)
+      DynamicArray<SearchHit> hits;
+      rankedSearch(query, offset, pageSize, hits);
+
+      if (hits.isEmpty())
       {
-        Email email = emails->get(i);
-        if (email.getSender().find(query) != string::npos ||
-            email.getSubject().find(query) != string::npos)
-        {
-          cout << "\nFolder: " << folderNames[f] << endl;
-          email.display();
-          found = true;
-        }
+        if (offset == 0)
+          cout << "No emails found matching the query." << endl;
+        break;
       }
-    }
 
-    if (!found)
-    {
-      cout << "No emails found matching the query." << endl;
+      for (int i = 0; i < hits.getSize(); i++)
+      {
+        Email email;
+        getFolderByName(hits[i].folder)->findEmail(hits[i].emailId, email);
+        cout << "\n"
+             << (offset + i + 1) << ". [" << hits[i].folder << "] "
+             << email.getSubject() << " - From: " << email.getSender() << endl;
+        cout << "   " << hits[i].snippet << endl;
+      }
+
+      if (hits.getSize() < pageSize)
+        break;
+
+      string more;
+      cout << "\nShow more results? (y/n): ";
+      getline(cin, more);
+      if (more != "y" && more != "Y")
+        break;
+      offset += pageSize;
     }
   }
 
-  void deleteEmail(string emailId, string folderName)
+  void deleteEmail(string emailIdText, string folderName)
   {
-    EmailFolder *folder = nullptr;
-    if (folderName == "Inbox")
-      folder = inbox;
-    else if (folderName == "Sent")
-      folder = sent;
-    else if (folderName == "Drafts")
-      folder = drafts;
-    else if (folderName == "Spam")
-      folder = spam;
-    else if (folderName == "Important")
-      folder = important;
-
-    if (folder != nullptr)
+    EmailId emailId = IdGenerator::parse(emailIdText);
+    EmailFolder *folder = locateEmail(emailId, folderName);
+    if (folder == nullptr || folder == trash)
     {
-      try
-      {
-        Email email = folder->removeEmail(emailId);
-        email.setFolder("Trash");
-        trash->addEmail(email);
-        deletedEmailsStack->push(email);
-        cout << "Email moved to trash." << endl;
-      }
-      catch (const char *msg)
-      {
-        cout << msg << endl;
-      }
+      cout << "Email not found" << endl;
+      return;
     }
+
+    Email email = folder->removeEmail(emailId);
+    email.setFolder("Trash");
+    trash->addEmail(email);
+    deletedEmailsStack->push(email);
+    cout << "Email moved to trash." << endl;
   }
 
   void recoverLastDeleted()
@@ -515,40 +1315,222 @@ public:
 
   void updateEmail(const Email &updatedEmail)
   {
-    // Find and update the email in the appropriate folder
-    EmailFolder *folder = nullptr;
-    string folderName = updatedEmail.getFolder();
+    // The email's folder field is only a hint; the id index knows where it is
+    EmailFolder *folder = locateEmail(updatedEmail.getId(), updatedEmail.getFolder());
+    if (folder == nullptr)
+      return;
 
-    if (folderName == "Inbox")
-      folder = inbox;
-    else if (folderName == "Sent")
-      folder = sent;
-    else if (folderName == "Drafts")
-      folder = drafts;
-    else if (folderName == "Spam")
-      folder = spam;
-    else if (folderName == "Trash")
-      folder = trash;
-    else if (folderName == "Important")
-      folder = important;
+    const Email *stored = folder->getEmail(updatedEmail.getId());
+    bool reindex = stored->getSubject() != updatedEmail.getSubject() ||
+                   stored->getContent() != updatedEmail.getContent() ||
+                   stored->getSender() != updatedEmail.getSender() ||
+                   stored->getPriority() != updatedEmail.getPriority();
+    folder->replaceEmail(updatedEmail);
+    if (reindex)
+    {
+      searchIndex->addEmail(*folder->getEmail(updatedEmail.getId()), folder->getFolderName());
+    }
+    // Save the updated email to file
+    saveAllEmails();
+  }
 
-    if (folder != nullptr)
+  // Folder holding the email, preferring folderName when the email is in
+  // several. nullptr if the user has no email with that id.
+  EmailFolder *locateEmail(EmailId emailId, string folderName = "")
+  {
+    DynamicArray<EmailLocation> locations;
+    if (emailIndex->findAll(emailId, locations) == 0)
+      return nullptr;
+
+    for (int i = 0; i < locations.getSize(); i++)
     {
-      // Get all emails from the folder
-      LinkedList<Email> *emails = folder->getEmails();
+      if (locations[i].folder->getFolderName() == folderName)
+        return locations[i].folder;
+    }
+    return locations[locations.getSize() - 1].folder;
+  }
 
-      // Find and update the matching email using iterator
-      for (auto it = emails->begin(); it != emails->end(); ++it)
+  // The stored email (not a copy), nullptr if not found
+  const Email *findEmailById(EmailId emailId, string folderName = "")
+  {
+    EmailFolder *folder = locateEmail(emailId, folderName);
+    return folder != nullptr ? folder->getEmail(emailId) : nullptr;
+  }
+
+  // Moves an email between folders; returns false if it is not in fromFolder
+  bool moveEmail(EmailId emailId, string fromFolder, string toFolder)
+  {
+    EmailFolder *source = getFolderByName(fromFolder);
+    EmailFolder *target = getFolderByName(toFolder);
+    if (source == nullptr || target == nullptr || source->getEmail(emailId) == nullptr)
+      return false;
+
+    Email email = source->removeEmail(emailId);
+    email.setFolder(toFolder);
+    target->addEmail(email);
+    return true;
+  }
+
+  // Adds or removes a label: a bit flip in the email's folder plus one
+  // line in the mutation log, instead of rewriting the folder files
+  bool setEmailLabel(EmailId emailId, EmailLabel label, bool on, string folderName = "")
+  {
+    EmailFolder *folder = locateEmail(emailId, folderName);
+    if (folder == nullptr || !folder->setLabel(emailId, label, on))
+      return false;
+    logMutation(emailId, folder);
+    return true;
+  }
+
+  // Labels the email as spam and moves it to the Spam folder
+  bool markAsSpam(EmailId emailId, string folderName = "")
+  {
+    EmailFolder *folder = locateEmail(emailId, folderName);
+    if (folder == nullptr)
+      return false;
+
+    // Emails already in Spam were taught (or filtered) before
+    if (folder != spam)
+    {
+      spamClassifier->train(*folder->getEmail(emailId), true);
+      spamScorer->report(folder->getEmail(emailId)->getSender(), true);
+    }
+    folder->setLabel(emailId, LABEL_SPAM, true);
+    if (folder != spam)
+      moveEmail(emailId, folder->getFolderName(), "Spam");
+    logMutation(emailId, spam);
+    return true;
+  }
+
+  // Takes an email out of Spam: clears the label, moves it to the Inbox
+  // and teaches the spam models that it was not spam
+  bool markAsNotSpam(EmailId emailId)
+  {
+    const Email *email = spam->getEmail(emailId);
+    if (email == nullptr)
+      return false;
+
+    spamClassifier->train(*email, false);
+    spamScorer->report(email->getSender(), false);
+    spam->setLabel(emailId, LABEL_SPAM, false);
+    moveEmail(emailId, "Spam", "Inbox");
+    logMutation(emailId, inbox);
+    return true;
+  }
+
+  // Emails with every label in required and none in excluded (labelBit()
+  // masks) from Inbox, Sent and Drafts; Spam and Trash are left out
+  int getLabelView(unsigned int required, unsigned int excluded, DynamicArray<Email> &emails)
+  {
+    EmailFolder *viewFolders[] = {inbox, sent, drafts};
+    int found = 0;
+    for (int f = 0; f < 3; f++)
+    {
+      DynamicArray<EmailFolder::Handle> slots;
+      viewFolders[f]->getView(required, excluded, slots);
+      for (int i = 0; i < slots.getSize(); i++)
       {
-        if ((*it).getEmailId() == updatedEmail.getEmailId())
-        {
-          *it = updatedEmail;
-          // Save the updated email to file
-          saveAllEmails();
-          break;
-        }
+        emails.add(viewFolders[f]->at(slots[i]));
+        found++;
       }
     }
+    return found;
+  }
+
+  // Threads the emails of a folder belong to, newest thread first, one
+  // pass over the folder plus a radix sort
+  int getThreads(EmailFolder *folder, DynamicArray<ThreadSummary> &threads)
+  {
+    HashMap<int, int> *positions = new HashMap<int, int>(1024); // Thread -> index in summaries
+    DynamicArray<ThreadSummary> summaries;
+    DynamicArray<long long> latest;
+    for (EmailFolder::Handle slot = folder->first(); slot != -1; slot = folder->next(slot))
+    {
+      const Email &email = folder->at(slot);
+      int thread = threadIndex->threadOf(email.getId());
+      int *position = positions->search(thread);
+      if (position == nullptr)
+      {
+        position = positions->insert(thread, summaries.getSize());
+        summaries.add(ThreadSummary());
+        latest.add(0);
+      }
+      ThreadSummary &summary = summaries[*position];
+      if (summary.count == 0 || (long long)email.getTimestamp() >= latest[*position])
+      {
+        summary.latestId = email.getId();
+        latest[*position] = (long long)email.getTimestamp();
+      }
+      summary.count++;
+      if (!email.getIsRead())
+        summary.unread++;
+    }
+    delete positions;
+
+    // Sort by the newest timestamp (negative ones count as 0)
+    int indexBits = SortedView::bitsFor(summaries.getSize());
+    DynamicArray<unsigned long long> order(summaries.getSize());
+    for (int i = 0; i < summaries.getSize(); i++)
+    {
+      unsigned long long time = latest[i] > 0 ? (unsigned long long)latest[i] : 0;
+      order.add((time << indexBits) | (unsigned long long)i);
+    }
+    SortedView::radixSort(order, indexBits);
+    for (int i = order.getSize() - 1; i >= 0; i--)
+    {
+      threads.add(summaries[(int)(order[i] & ((1ULL << indexBits) - 1))]);
+    }
+    return summaries.getSize();
+  }
+
+  // Stored emails of the thread of an email, oldest first, from any folder
+  int getConversation(EmailId emailId, DynamicArray<Email> &emails)
+  {
+    DynamicArray<EmailId> ids;
+    threadIndex->getThread(emailId, ids);
+    DynamicArray<Email> found;
+    for (int i = 0; i < ids.getSize(); i++)
+    {
+      const Email *email = findEmailById(ids[i]);
+      if (email != nullptr) // Deleted, or a reply to mail never received
+        found.add(*email);
+    }
+
+    int indexBits = SortedView::bitsFor(found.getSize());
+    DynamicArray<unsigned long long> order(found.getSize());
+    for (int i = 0; i < found.getSize(); i++)
+    {
+      long long time = (long long)found[i].getTimestamp();
+      order.add(((unsigned long long)(time > 0 ? time : 0) << indexBits) | (unsigned long long)i);
+    }
+    SortedView::radixSort(order, indexBits);
+    for (int i = 0; i < order.getSize(); i++)
+    {
+      emails.add(found[(int)(order[i] & ((1ULL << indexBits) - 1))]);
+    }
+    return found.getSize();
+  }
+
+  // Builds the threads again from every stored email, in one pass
+  void rebuildThreads()
+  {
+    threadIndex->clear();
+    EmailFolder *allFolders[] = {inbox, sent, drafts, spam, trash, important};
+    for (int f = 0; f < 6; f++)
+    {
+      for (EmailFolder::Handle slot = allFolders[f]->first(); slot != -1; slot = allFolders[f]->next(slot))
+      {
+        threadIndex->addEmail(allFolders[f]->at(slot));
+      }
+    }
+  }
+
+  ThreadIndex *getThreadIndex() { return threadIndex; }
+
+  int getImportantCount()
+  {
+    return inbox->getLabelCount(LABEL_IMPORTANT) + sent->getLabelCount(LABEL_IMPORTANT) +
+           drafts->getLabelCount(LABEL_IMPORTANT);
   }
   void emptyTrash()
   {
@@ -556,6 +1538,221 @@ public:
     cout << "Trash emptied successfully!" << endl;
   }
 
+  // Permanently deletes a folder's emails older than days; whole days of
+  // mail go at once through the folder's time buckets
+  int deleteOlderThan(string folderName, int days)
+  {
+    EmailFolder *folder = getFolderByName(folderName);
+    if (folder == nullptr || days < 0)
+      return 0;
+
+    int removed = folder->removeOlderThan(time(0) - (time_t)days * TimeBuckets::SECONDS_PER_DAY);
+    if (removed > 0)
+    {
+      saveAllEmails();
+      logActivity("Deleted " + to_string(removed) + " emails older than " + to_string(days) + " days from " + folderName);
+    }
+    return removed;
+  }
+
+  void loadMaintenancePolicy()
+  {
+    autoDeleteTrash = getConfigValue("AutoDeleteTrash") == "true";
+    trashRetentionDays = atoi(getConfigValue("TrashRetentionDays").c_str());
+    maxInboxSize = getConfigValue("EnforceInboxQuota") == "true" ? atoi(getConfigValue("MaxInboxSize").c_str()) : 0;
+  }
+
+  // One slice of background upkeep, at most budget emails of work, so the
+  // UI can call it every frame. If EnforceInboxQuota is on, moves the
+  // Inbox emails with the oldest timestamps over MaxInboxSize to Trash
+  // (and logs how many), deletes Trash emails older than
+  // TrashRetentionDays if AutoDeleteTrash is on, then compacts folders
+  // that deletions left sparse. Changes go to the mutation log, not a full
+  // save. Returns false if there was nothing to do.
+  bool runMaintenance(int budget)
+  {
+    if (currentUser == nullptr || budget <= 0)
+      return false;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int work = 0;
+    DynamicArray<EmailMutation> logged;
+
+    if (maxInboxSize > 0 && inbox->getEmailCount() > maxInboxSize)
+    {
+      // Oldest timestamps first, not oldest arrivals: mail imported or
+      // delivered late must not push out newer mail
+      int excess = inbox->getEmailCount() - maxInboxSize;
+      DynamicArray<EmailFolder::Handle> over;
+      inbox->getSorted(SORT_DATE_ASCENDING, over, 0, excess < budget ? excess : budget);
+      for (int i = 0; i < over.getSize(); i++)
+      {
+        Email email = inbox->removeAt(over[i]);
+        email.setFolder("Trash");
+        trash->addEmail(email);
+        logged.add(EmailMutation(email.getId(), email.getLabels(), "Trash"));
+      }
+      maintenanceReport.quotaMoved += over.getSize();
+      work += over.getSize();
+      logActivity("Moved " + to_string(over.getSize()) + " Inbox emails over MaxInboxSize=" + to_string(maxInboxSize) + " to Trash");
+    }
+
+    if (autoDeleteTrash && work < budget)
+    {
+      unsigned long long bytes = trash->getStats().bytes;
+      DynamicArray<EmailId> deleted;
+      trash->removeOlderThan(time(0) - (time_t)trashRetentionDays * TimeBuckets::SECONDS_PER_DAY, budget - work, &deleted);
+      for (int i = 0; i < deleted.getSize(); i++)
+      {
+        logged.add(EmailMutation(deleted[i], 0, string(EmailMutation::deletedPrefix()) + "Trash"));
+      }
+      maintenanceReport.expiredDeleted += deleted.getSize();
+      maintenanceReport.textBytes += bytes - trash->getStats().bytes;
+      work += deleted.getSize();
+    }
+
+    // A folder is compacted once over a quarter of its slots (and at
+    // least a page of them) are free
+    EmailFolder *allFolders[] = {inbox, sent, drafts, spam, trash, important};
+    for (int f = 0; f < 6 && work < budget; f++)
+    {
+      int free = allFolders[f]->getFreeSlotCount();
+      if (free < 1024 || free * 4 < allFolders[f]->getSlotCount())
+        continue;
+      unsigned long long bytes = allFolders[f]->getStorageBytes();
+      int moved = allFolders[f]->compact(budget - work);
+      maintenanceReport.slotsCompacted += moved;
+      maintenanceReport.storageBytes += bytes - allFolders[f]->getStorageBytes();
+      work += moved;
+    }
+
+    // Text no email refers to any more (edited or deleted mail) is
+    // reclaimed once it outweighs the live text, or sooner when the
+    // arena's offsets run low. The copy is O(live text) in one slice,
+    // paid for by at least as many bytes appended since the last one.
+    if (work < budget && isTextCompactionDue())
+    {
+      unsigned long long bytes = TextArena::mailbox().getReserved();
+      compactText();
+      maintenanceReport.textCompactions++;
+      maintenanceReport.arenaBytes += bytes - TextArena::mailbox().getReserved();
+      work++;
+    }
+
+    fileHandler->appendMutations(currentUser->getEmail(), logged);
+    if (work == 0)
+      return false;
+    maintenanceReport.slices++;
+    maintenanceReport.milliseconds +=
+        chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return true;
+  }
+
+  const MaintenanceReport &getMaintenanceReport() const { return maintenanceReport; }
+
+  // Text held by the folders. The stacks and queues hold few emails and
+  // mostly share text with the folders, so they are left out.
+  unsigned long long getLiveTextBytes() const
+  {
+    const EmailFolder *allFolders[] = {inbox, sent, drafts, spam, trash, important};
+    unsigned long long bytes = 0;
+    for (int f = 0; f < 6; f++)
+    {
+      bytes += allFolders[f]->getStats().bytes;
+    }
+    return bytes;
+  }
+
+  bool isTextCompactionDue() const
+  {
+    const unsigned long long MIN_WASTE = 16ULL << 20;
+    unsigned long long reserved = TextArena::mailbox().getReserved();
+    unsigned long long live = getLiveTextBytes();
+    if (reserved <= live + textWasteAfterCompaction + MIN_WASTE)
+      return false;
+    unsigned long long waste = reserved - live;
+    return waste > live || (reserved > TextArena::CAPACITY / 4 * 3 && waste > reserved / 8);
+  }
+
+  // Relocates the text of a held stack's or queue's emails, keeping their order
+  void relocateText(Stack<Email> *stack)
+  {
+    DynamicArray<Email> held(stack->getSize());
+    while (!stack->isEmpty())
+    {
+      held.add(stack->pop());
+    }
+    for (int i = held.getSize() - 1; i >= 0; i--)
+    {
+      held[i].relocateText();
+      stack->push(held[i]);
+    }
+  }
+
+  void relocateText(Queue<Email> *queue)
+  {
+    for (int i = queue->getSize(); i > 0; i--)
+    {
+      Email email = queue->dequeue();
+      email.relocateText();
+      queue->enqueue(email);
+    }
+  }
+
+  // Copies the text that the session's emails still refer to into fresh
+  // arena chunks and frees the rest. Copies of emails held outside
+  // EmailSystem must be fetched again afterwards; getTextGeneration()
+  // changes to tell them.
+  void compactText()
+  {
+    TextArena &arena = TextArena::mailbox();
+    arena.beginCompaction();
+    EmailFolder *allFolders[] = {inbox, sent, drafts, spam, trash, important};
+    for (int f = 0; f < 6; f++)
+    {
+      allFolders[f]->relocateText();
+    }
+    relocateText(undoStack);
+    relocateText(redoStack);
+    relocateText(deletedEmailsStack);
+    relocateText(scheduledEmails);
+    relocateText(incomingEmailQueue);
+    relocateText(deferredEmails);
+
+    DynamicArray<Email> prioritized(priorityEmailQueue->getSize());
+    while (!priorityEmailQueue->isEmpty())
+    {
+      prioritized.add(priorityEmailQueue->dequeue());
+    }
+    for (int i = 0; i < prioritized.getSize(); i++)
+    {
+      prioritized[i].relocateText();
+      priorityEmailQueue->enqueue(prioritized[i], prioritized[i].getPriority());
+    }
+
+    arena.endCompaction();
+    textWasteAfterCompaction = arena.getReserved() > getLiveTextBytes() ? arena.getReserved() - getLiveTextBytes() : 0;
+    textGeneration++;
+  }
+
+  unsigned int getTextGeneration() const { return textGeneration; }
+
+  // Copies of a folder's emails with from <= timestamp < to, oldest day
+  // first; only the days in the range are read
+  int getEmailsInRange(string folderName, time_t from, time_t to, DynamicArray<Email> &emails)
+  {
+    EmailFolder *folder = getFolderByName(folderName);
+    if (folder == nullptr)
+      return 0;
+
+    DynamicArray<EmailFolder::Handle> slots;
+    folder->getInRange(from, to, slots);
+    for (int i = 0; i < slots.getSize(); i++)
+    {
+      emails.add(folder->at(slots[i]));
+    }
+    return slots.getSize();
+  }
+
   void addContact()
   {
     if (currentUser == nullptr)
@@ -583,6 +1780,7 @@ public:
 
     Contact newContact("C" + to_string(time(0)), name, email, phone);
     currentUser->addContact(newContact);
+    indexContactTerms(newContact);
     cout << "Contact added successfully!" << endl;
   }
 
@@ -609,7 +1807,7 @@ public:
 
     if (users->contains(userEmail))
     {
-      socialGraph->addConnection(currentUser->getEmail(), userEmail, 1);
+      connectUsers(currentUser->getEmail(), userEmail, 1);
       cout << "Connection added successfully!" << endl;
     }
     else
@@ -618,6 +1816,19 @@ public:
     }
   }
 
+  // Social connections go through these so the sender ranks follow
+  void connectUsers(const string &user1, const string &user2, int strength)
+  {
+    socialGraph->addConnection(user1, user2, strength);
+    senderRank->setConnection(user1, user2, strength);
+  }
+
+  void disconnectUsers(const string &user1, const string &user2)
+  {
+    socialGraph->removeConnection(user1, user2);
+    senderRank->setConnection(user1, user2, 0);
+  }
+
   void viewMutualConnections(string userEmail)
   {
     if (currentUser == nullptr)
@@ -643,12 +1854,23 @@ public:
   {
     cout << "\n=== System Statistics ===" << endl;
     cout << "Total Users: " << users->getSize() << endl;
-    cout << "Inbox: " << inbox->getEmailCount() << " (" << inbox->getUnreadCount() << " unread)" << endl;
-    cout << "Sent: " << sent->getEmailCount() << endl;
-    cout << "Drafts: " << drafts->getEmailCount() << endl;
-    cout << "Spam: " << spam->getEmailCount() << endl;
-    cout << "Trash: " << trash->getEmailCount() << endl;
-    cout << "Important: " << important->getEmailCount() << endl;
+    // Folder counters are kept up to date, so this is O(1) per folder
+    EmailFolder *folders[] = {inbox, sent, drafts, spam, trash};
+    for (int f = 0; f < 5; f++)
+    {
+      FolderStats stats = folders[f]->getStats();
+      cout << folders[f]->getFolderName() << ": " << stats.total << " (" << stats.unread << " unread, "
+           << stats.bytes << " bytes)" << endl;
+    }
+    cout << "Important: " << getImportantCount() << endl;
+
+    FolderStats inboxStats = inbox->getStats();
+    cout << "Inbox by priority:";
+    for (int i = 0; i < FolderStats::PRIORITY_LEVELS; i++)
+    {
+      cout << " " << i << "=" << inboxStats.byPriority[i];
+    }
+    cout << endl;
     cout << "Scheduled: " << scheduledEmails->getSize() << endl;
     cout << "========================" << endl;
   }
@@ -668,39 +1890,28 @@ public:
       return false; // User doesn't exist
     }
 
-    // Load recipient's emails
-    LinkedList<Email> recipientInbox;
-    fileHandler->loadFolderEmails(recipientEmail, "Inbox", &recipientInbox);
-
     // Create a copy for recipient's inbox
     Email inboxEmail = email;
     inboxEmail.setIsRead(false);
 
-    // Check for spam
-    if (isSpamEmail(inboxEmail))
+    // Over the sender's or the recipient's rate it goes to Spam: delivery
+    // cannot wait. Otherwise what the graph knows about sender and
+    // recipient decides with the content.
+    RateDecision decision = rateLimiter->admit(email.getSenderId(), AddressTable::shared().intern(recipientEmail),
+                                               RateLimiter::nowMs());
+    if (decision != RATE_ACCEPT || isSpamFor(inboxEmail, recipientEmail))
     {
       inboxEmail.setFolder("Spam");
       inboxEmail.setIsSpam(true);
-
-      // Load spam folder instead
-      LinkedList<Email> recipientSpam;
-      fileHandler->loadFolderEmails(recipientEmail, "Spam", &recipientSpam);
-      recipientSpam.insert(inboxEmail);
-
-      // Save spam folder
-      LinkedList<Email> empty;
-      fileHandler->saveUserEmails(recipientEmail, &empty, &empty, &empty, &recipientSpam, &empty, &empty);
     }
     else
     {
       inboxEmail.setFolder("Inbox");
-      recipientInbox.insert(inboxEmail);
-
-      // Save inbox folder
-      LinkedList<Email> empty;
-      fileHandler->saveUserEmails(recipientEmail, &recipientInbox, &empty, &empty, &empty, &empty, &empty);
     }
 
+    // One line appended: rewriting every folder from the two loaded
+    // here used to empty the recipient's other folders
+    fileHandler->appendFolderEmail(recipientEmail, inboxEmail.getFolder(), inboxEmail);
     return true;
   }
 
@@ -748,12 +1959,11 @@ public:
     Email email = undoStack->pop();
     redoStack->push(email);
 
-    // Remove from current folder and add back to original
-    string currentFolder = email.getFolder();
-    EmailFolder *folder = getFolderByName(currentFolder);
-    if (folder != nullptr)
+    // The stack holds the email as it was; move it back from wherever it is now
+    EmailFolder *current = locateEmail(email.getId(), "Trash");
+    if (current != nullptr && current->getFolderName() != email.getFolder())
     {
-      folder->removeEmail(email.getEmailId());
+      moveEmail(email.getId(), current->getFolderName(), email.getFolder());
     }
 
     logActivity("Undone operation on email: " + email.getSubject());
@@ -771,13 +1981,8 @@ public:
     Email email = redoStack->pop();
     undoStack->push(email);
 
-    // Add back to folder
-    string folder = email.getFolder();
-    EmailFolder *targetFolder = getFolderByName(folder);
-    if (targetFolder != nullptr)
-    {
-      targetFolder->addEmail(email);
-    }
+    // Delete it again
+    moveEmail(email.getId(), email.getFolder(), "Trash");
 
     logActivity("Redone operation on email: " + email.getSubject());
     cout << "Operation redone successfully!" << endl;
@@ -801,25 +2006,19 @@ public:
     return email;
   }
 
-  // Timestamp Heap Organization
+  // Newest inbox emails, from the inbox's date-sorted view
   void organizeByTimestamp()
   {
     cout << "\n=== Organizing Emails by Timestamp ===" << endl;
 
-    // Add all inbox emails to heap
-    LinkedList<Email> *emails = inbox->getEmails();
-    for (int i = 0; i < emails->getSize(); i++)
-    {
-      timestampHeap->insert(emails->get(i));
-    }
+    DynamicArray<EmailFolder::Handle> newest;
+    inbox->getSorted(SORT_DATE_DESCENDING, newest, 0, 10);
 
-    // Extract and display in order
     cout << "Emails in chronological order (most recent first):" << endl;
-    int count = 0;
-    while (!timestampHeap->isEmpty() && count < 10)
+    for (int i = 0; i < newest.getSize(); i++)
     {
-      Email email = timestampHeap->extractMax();
-      cout << ++count << ". " << email.getSubject() << " - From: " << email.getSender() << endl;
+      const Email &email = inbox->at(newest[i]);
+      cout << i + 1 << ". " << email.getSubject() << " - From: " << email.getSender() << endl;
     }
   }
 
@@ -838,6 +2037,7 @@ public:
       Email email = scheduledEmails->dequeue();
       email.setFolder("Sent");
       sent->addEmail(email);
+      senderRank->addMail(email.getSender(), email.getReceiver());
 
       // Deliver to recipient
       deliverEmailToUser(email, email.getReceiver());
@@ -847,11 +2047,13 @@ public:
     }
 
     saveAllEmails();
+    saveScheduledEmails(); // Or they would be sent again at the next login
   }
 
   // Incoming Email Queue Processing
   void processIncomingEmails()
   {
+    releaseDeferredEmails();
     if (incomingEmailQueue->isEmpty())
     {
       cout << "No incoming emails to process." << endl;
@@ -859,12 +2061,19 @@ public:
     }
 
     cout << "\n=== Processing Incoming Emails ===" << endl;
+    fileIncomingEmails();
+    saveAllEmails();
+  }
+
+  // Puts the queued incoming emails in the Inbox or Spam
+  void fileIncomingEmails()
+  {
     while (!incomingEmailQueue->isEmpty())
     {
       Email email = incomingEmailQueue->dequeue();
 
-      // Check for spam
-      if (isSpamEmail(email))
+      // Check for spam; mail from a flooding sender is already marked
+      if (email.getIsSpam() || isSpamFor(email, email.getReceiver()))
       {
         email.setFolder("Spam");
         email.setIsSpam(true);
@@ -884,22 +2093,68 @@ public:
         }
       }
     }
-
-    saveAllEmails();
   }
 
+  // Over the sender's or the recipient's rate an email waits in
+  // deferredEmails; from a flooding sender it goes in marked as spam
   void addToIncomingQueue(Email email)
   {
+    RateDecision decision = rateLimiter->admit(email.getSenderId(), email.getReceiverId(), RateLimiter::nowMs());
+    if (decision == RATE_DEFER)
+    {
+      deferredEmails->enqueue(email);
+      return;
+    }
+    if (decision == RATE_FLOOD)
+      email.setIsSpam(true);
     incomingEmailQueue->enqueue(email);
   }
 
+  // Moves the deferred emails whose sender and recipient have tokens again
+  // to the incoming queue, in order; the rest keep waiting
+  void releaseDeferredEmails()
+  {
+    int count = deferredEmails->getSize();
+    unsigned long long now = RateLimiter::nowMs();
+    for (int i = 0; i < count; i++)
+    {
+      Email email = deferredEmails->dequeue();
+      RateDecision decision = rateLimiter->readmit(email.getSenderId(), email.getReceiverId(), now);
+      if (decision == RATE_DEFER)
+      {
+        deferredEmails->enqueue(email);
+        continue;
+      }
+      if (decision == RATE_FLOOD)
+        email.setIsSpam(true);
+      incomingEmailQueue->enqueue(email);
+    }
+  }
+
+  // Deferred emails cannot wait past the mailbox's logout: those with
+  // tokens again go in as usual, the rest marked as spam (as delivery
+  // does with mail over the rate)
+  void flushDeferredEmails()
+  {
+    releaseDeferredEmails();
+    while (!deferredEmails->isEmpty())
+    {
+      Email email = deferredEmails->dequeue();
+      email.setIsSpam(true);
+      incomingEmailQueue->enqueue(email);
+    }
+  }
+
   // System Configuration Management
   void loadSystemConfig()
   {
     systemConfig->add("AutoSaveInterval=300");
+    systemConfig->add("NodeId=0"); // Email id generator node, 0-1023
     systemConfig->add("MaxInboxSize=1000");
+    systemConfig->add("EnforceInboxQuota=false"); // Move the oldest Inbox mail over MaxInboxSize to Trash
     systemConfig->add("SpamFilterEnabled=true");
     systemConfig->add("AutoDeleteTrash=false");
+    systemConfig->add("TrashRetentionDays=30"); // Age at which AutoDeleteTrash drops mail
     systemConfig->add("EnableNotifications=true");
     systemConfig->add("Theme=Dark");
     systemConfig->add("FontSize=14");
@@ -932,6 +2187,23 @@ public:
     return "";
   }
 
+  // Changes (or adds) a setting; maintenance picks it up at once
+  void setConfigValue(string key, string value)
+  {
+    bool found = false;
+    for (int i = 0; i < systemConfig->getSize() && !found; i++)
+    {
+      if (systemConfig->get(i).compare(0, key.length() + 1, key + "=") == 0)
+      {
+        systemConfig->set(i, key + "=" + value);
+        found = true;
+      }
+    }
+    if (!found)
+      systemConfig->add(key + "=" + value);
+    loadMaintenancePolicy();
+  }
+
   // Helper method to get folder by name
   EmailFolder *getFolderByName(string folderName)
   {
@@ -951,31 +2223,30 @@ public:
   }
 
   // Enhanced delete with undo support
-  void deleteEmailWithUndo(string emailId, string folderName)
+  void deleteEmailWithUndo(EmailId emailId, string folderName)
   {
-    EmailFolder *folder = getFolderByName(folderName);
-    if (folder != nullptr)
+    EmailFolder *folder = locateEmail(emailId, folderName);
+    if (folder == nullptr)
     {
-      try
-      {
-        Email email = folder->removeEmail(emailId);
-        undoStack->push(email); // Save for undo
-        email.setFolder("Trash");
-        trash->addEmail(email);
-        deletedEmailsStack->push(email);
-        logActivity("Deleted email: " + email.getSubject());
-        cout << "Email moved to trash. (Undo available)" << endl;
-      }
-      catch (const char *msg)
-      {
-        cout << msg << endl;
-      }
+      cout << "Email not found" << endl;
+      return;
     }
+
+    Email email = folder->removeEmail(emailId);
+    email.setFolder(folder->getFolderName());
+    undoStack->push(email); // Save for undo
+    email.setFolder("Trash");
+    trash->addEmail(email);
+    deletedEmailsStack->push(email);
+    logActivity("Deleted email: " + email.getSubject());
+    cout << "Email moved to trash. (Undo available)" << endl;
   }
 
   // Get statistics
   int getScheduledEmailCount() { return scheduledEmails->getSize(); }
   int getIncomingQueueCount() { return incomingEmailQueue->getSize(); }
+  int getDeferredCount() { return deferredEmails->getSize(); }
+  const RateLimiter &getRateLimiter() const { return *rateLimiter; }
   int getPriorityQueueCount() { return priorityEmailQueue->getSize(); }
   bool canUndo() { return !undoStack->isEmpty(); }
   bool canRedo() { return !redoStack->isEmpty(); }
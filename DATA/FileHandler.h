@@ -7,10 +7,118 @@
 #include <direct.h>
 #include "User.h"
 #include "Email.h"
+#include "EmailFolder.h"
 #include "Graph.h"
 #include "Array.h"
 using namespace std;
 
+// Label or folder change of one email, logged instead of rewriting the
+// folder files
+struct EmailMutation
+{
+  EmailId emailId;
+  unsigned int labels;
+  string folder; // Folder the email is in now, or "Deleted:<folder>" once deleted from it
+
+  EmailMutation() : emailId(0), labels(0) {}
+  EmailMutation(EmailId id, unsigned int l, const string &f) : emailId(id), labels(l), folder(f) {}
+
+  static const char *deletedPrefix() { return "Deleted:"; }
+};
+
+// One user's line in the spam re-check progress file
+struct ReclassifyProgress
+{
+  string user;
+  long long scanned; // Inbox and Spam emails scored
+  long long toSpam;
+  long long toInbox;
+
+  ReclassifyProgress() : scanned(0), toSpam(0), toInbox(0) {}
+};
+
+// Reads a file's lines in 1 MB blocks, finding line ends with
+// TextKernels::findByte instead of a stream read per line. Only one block
+// and a partial line are held, however large the file.
+class LineReader
+{
+private:
+  static const int BLOCK_SIZE = 1 << 20;
+
+  ifstream file;
+  char *block;
+  string pending; // Read but not yet returned
+  int start;      // First byte of the next line in pending
+  bool ended;
+
+public:
+  LineReader() : block(nullptr), start(0), ended(true) {}
+
+  ~LineReader()
+  {
+    close();
+  }
+
+  bool open(const string &path)
+  {
+    close();
+    file.open(path);
+    if (!file.is_open())
+      return false;
+    block = new char[BLOCK_SIZE];
+    ended = false;
+    return true;
+  }
+
+  // The next non-empty line, without its newline; valid until the next
+  // call. False at the end of the file.
+  bool next(const char *&line, int &length)
+  {
+    while (true)
+    {
+      int newline = TextKernels::findByte(pending.data() + start, (int)pending.length() - start, '\n');
+      if (newline != -1)
+      {
+        line = pending.data() + start;
+        length = newline;
+        start += newline + 1;
+        if (length > 0)
+          return true;
+        continue;
+      }
+      if (ended)
+      {
+        if (start >= (int)pending.length())
+          return false;
+        line = pending.data() + start; // Last line, no newline after it
+        length = (int)pending.length() - start;
+        start = (int)pending.length();
+        return true;
+      }
+
+      pending.erase(0, start);
+      start = 0;
+      file.read(block, BLOCK_SIZE);
+      int got = (int)file.gcount();
+      if (got <= 0)
+        ended = true;
+      else
+        pending.append(block, got);
+    }
+  }
+
+  void close()
+  {
+    if (file.is_open())
+      file.close();
+    delete[] block;
+    block = nullptr;
+    pending.clear();
+    start = 0;
+    ended = true;
+  }
+};
+
 class FileHandler
 {
 private:
@@ -18,6 +126,7 @@ private:
   string usersFile;
   string spamWordsFile;
   string socialGraphFile;
+  string idReservationFile;
 
   void createDirectory(const string &path)
   {
@@ -44,6 +153,26 @@ private:
     return getUserFolderPath(userEmail) + "/connections.txt";
   }
 
+  string getGenerationFilePath(const string &userEmail)
+  {
+    return getUserFolderPath(userEmail) + "/generation.txt";
+  }
+
+  string getMutationLogPath(const string &userEmail)
+  {
+    return getUserFolderPath(userEmail) + "/mutations.txt";
+  }
+
+  string getArrivalLogPath(const string &userEmail)
+  {
+    return getUserFolderPath(userEmail) + "/arrivals.txt";
+  }
+
+  string getReclassifyProgressPath()
+  {
+    return databaseFolder + "/reclassify_progress.txt";
+  }
+
 public:
   FileHandler()
   {
@@ -51,36 +180,19 @@ public:
     usersFile = databaseFolder + "/users.txt";
     spamWordsFile = databaseFolder + "/spam_words.txt";
     socialGraphFile = databaseFolder + "/social_graph.txt";
+    idReservationFile = databaseFolder + "/email_ids.txt";
 
     createDirectory(databaseFolder);
   }
 
-  void loadSpamWords(Array<string> *spamWords)
+  // The spam dictionary file (see SpamDictionary), created with the
+  // default words if missing
+  string getSpamWordsPath()
   {
     ifstream file(spamWordsFile);
     if (!file.is_open())
-    {
       createDefaultSpamWords();
-      file.open(spamWordsFile);
-    }
-
-    string line;
-    if (getline(file, line))
-    {
-      stringstream ss(line);
-      string word;
-      while (getline(ss, word, ','))
-      {
-        word.erase(0, word.find_first_not_of(" \t\n\r"));
-        word.erase(word.find_last_not_of(" \t\n\r") + 1);
-
-        if (!word.empty() && !spamWords->isFull())
-        {
-          spamWords->add(word);
-        }
-      }
-    }
-    file.close();
+    return spamWordsFile;
   }
 
   void createDefaultSpamWords()
@@ -181,48 +293,360 @@ public:
     }
   }
 
+  static const int EMAIL_FIELD_COUNT = 12;
+
+  // One line of a folder file: id, sender, receiver, subject, content,
+  // timestamp, isRead, isSpam, priority, folder, labels, inReplyTo. Missing
+  // trailing fields are empty.
+  static void splitEmailLine(const char *line, int length, string fields[EMAIL_FIELD_COUNT])
+  {
+    int start = 0;
+    for (int i = 0; i < EMAIL_FIELD_COUNT; i++)
+    {
+      if (start >= length)
+      {
+        fields[i].clear();
+        continue;
+      }
+      int comma = TextKernels::findByte(line + start, length - start, ',');
+      int end = comma != -1 ? start + comma : length;
+      fields[i].assign(line + start, end - start);
+      start = end + 1;
+    }
+  }
+
+  // Labels of a split line; older files only have isRead and isSpam
+  static unsigned int emailLineLabels(const string fields[EMAIL_FIELD_COUNT])
+  {
+    if (!fields[10].empty())
+      return (unsigned int)atoi(fields[10].c_str());
+    return (fields[6] == "1" ? labelBit(LABEL_READ) : 0) | (fields[7] == "1" ? labelBit(LABEL_SPAM) : 0);
+  }
+
+  void parseEmailLine(const char *line, int length, LinkedList<Email> *emailList)
+  {
+    string fields[EMAIL_FIELD_COUNT];
+    splitEmailLine(line, length, fields);
+
+    const string &labelsStr = fields[10];
+    const string &inReplyToStr = fields[11];
+
+    // Unparsable legacy ids load as 0 and get a new id when routed
+    Email email(IdGenerator::parse(fields[0]), fields[1], fields[2], fields[3], fields[4]);
+    email.setTimestamp(atol(fields[5].c_str()));
+    email.setIsRead(fields[6] == "1");
+    email.setIsSpam(fields[7] == "1");
+    email.setPriority(atoi(fields[8].c_str()));
+    email.setFolder(fields[9]);
+    if (!labelsStr.empty())
+      email.setLabels((unsigned int)atoi(labelsStr.c_str())); // Older files have no labels field
+    if (!inReplyToStr.empty())
+      email.setInReplyTo(IdGenerator::parse(inReplyToStr));
+
+    emailList->insert(email);
+  }
+
+  // Reads the file in 1 MB blocks and splits lines and fields with
+  // TextKernels::findByte instead of a stream per line
   void loadFolderEmails(const string &userEmail, const string &folderName, LinkedList<Email> *emailList)
   {
-    string filePath = getFolderFilePath(userEmail, folderName);
-    ifstream file(filePath);
+    LineReader reader;
+    if (!reader.open(getFolderFilePath(userEmail, folderName)))
+      return;
 
-    if (!file.is_open())
+    const char *line;
+    int length;
+    while (reader.next(line, length))
     {
+      parseEmailLine(line, length, emailList);
+    }
+  }
+
+  // Streams a folder file's lines (see splitEmailLine) without building
+  // emails, so it may run off the main thread
+  bool openFolderFile(const string &userEmail, const string &folderName, LineReader &reader)
+  {
+    return reader.open(getFolderFilePath(userEmail, folderName));
+  }
+
+  // Receivers of the emails in the user's Sent folder, without loading
+  // the emails themselves
+  void loadSentReceivers(const string &userEmail, DynamicArray<string> &receivers)
+  {
+    ifstream file(getFolderFilePath(userEmail, "Sent"));
+    if (!file.is_open())
       return;
+
+    string line;
+    while (getline(file, line))
+    {
+      size_t first = line.find(',');
+      size_t second = first != string::npos ? line.find(',', first + 1) : string::npos;
+      size_t third = second != string::npos ? line.find(',', second + 1) : string::npos;
+      if (third != string::npos && third > second + 1)
+        receivers.add(line.substr(second + 1, third - second - 1));
+    }
+    file.close();
+  }
+
+  // Mailbox generation, bumped every time the user's email files are
+  // rewritten (appends are logged instead, see appendFolderEmail).
+  // Persisted indexes record it to detect stale data.
+  long long loadMailboxGeneration(const string &userEmail)
+  {
+    ifstream file(getGenerationFilePath(userEmail));
+    long long generation = 0;
+    if (file.is_open())
+    {
+      file >> generation;
+      file.close();
     }
+    return generation;
+  }
 
+  // Email id time reservation (see IdGenerator), 0 if never saved
+  unsigned long long loadIdReservation()
+  {
+    ifstream file(idReservationFile);
+    unsigned long long reservation = 0;
+    if (file.is_open())
+    {
+      file >> reservation;
+      file.close();
+    }
+    return reservation;
+  }
+
+  void saveIdReservation(unsigned long long reservation)
+  {
+    ofstream file(idReservationFile, ios::trunc);
+    if (file.is_open())
+    {
+      file << reservation << endl;
+      file.close();
+    }
+  }
+
+  // Adds one email to the end of a folder file of a user who is not
+  // logged in, leaving the other folders alone. The generation stays:
+  // the id goes to the arrival log, and the saved search index takes the
+  // logged arrivals in at login rather than being rebuilt. The id is
+  // logged first, so a crash in between leaves no unindexed email.
+  void appendFolderEmail(const string &userEmail, const string &folderName, const Email &email)
+  {
+    createDirectory(getUserFolderPath(userEmail));
+    ofstream arrivals(getArrivalLogPath(userEmail), ios::app);
+    if (arrivals.is_open())
+    {
+      arrivals << IdGenerator::toString(email.getId()) << endl;
+      arrivals.close();
+    }
+    ofstream file(getFolderFilePath(userEmail, folderName), ios::app);
+    if (file.is_open())
+    {
+      file << email.toString() << endl;
+      file.close();
+    }
+  }
+
+  // Ids appended to the user's folder files since they were last written
+  void loadArrivals(const string &userEmail, DynamicArray<EmailId> &emailIds)
+  {
+    ifstream file(getArrivalLogPath(userEmail));
     string line;
     while (getline(file, line))
     {
-      if (line.empty())
-        continue;
+      EmailId emailId = IdGenerator::parse(line);
+      if (emailId != 0)
+        emailIds.add(emailId);
+    }
+  }
 
-      stringstream ss(line);
-      string id, sender, receiver, subject, content, timestampStr, isReadStr, isSpamStr, priorityStr, folder;
+  // Mail scheduled and not sent yet, in the folder line format. It is not
+  // a folder: loadUserEmails skips it and the generation stays as it is.
+  void saveScheduledEmails(const string &userEmail, const DynamicArray<Email> &emails)
+  {
+    createDirectory(getUserFolderPath(userEmail));
+    ofstream file(getFolderFilePath(userEmail, "Scheduled"), ios::trunc);
+    if (file.is_open())
+    {
+      for (int i = 0; i < emails.getSize(); i++)
+      {
+        file << emails[i].toString() << endl;
+      }
+      file.close();
+    }
+  }
+
+  void loadScheduledEmails(const string &userEmail, LinkedList<Email> *emailList)
+  {
+    loadFolderEmails(userEmail, "Scheduled", emailList);
+  }
+
+  // Appends one email's labels and folder to the user's mutation log
+  void appendMutation(const string &userEmail, EmailId emailId, unsigned int labels, const string &folder)
+  {
+    createDirectory(getUserFolderPath(userEmail));
+    ofstream file(getMutationLogPath(userEmail), ios::app);
+    if (file.is_open())
+    {
+      file << IdGenerator::toString(emailId) << "," << labels << "," << folder << endl;
+      file.close();
+    }
+  }
+
+  // Appends several mutations with one open of the log
+  void appendMutations(const string &userEmail, const DynamicArray<EmailMutation> &mutations)
+  {
+    if (mutations.getSize() == 0)
+      return;
+    createDirectory(getUserFolderPath(userEmail));
+    ofstream file(getMutationLogPath(userEmail), ios::app);
+    if (file.is_open())
+    {
+      for (int i = 0; i < mutations.getSize(); i++)
+      {
+        file << IdGenerator::toString(mutations[i].emailId) << "," << mutations[i].labels << ","
+             << mutations[i].folder << "\n";
+      }
+      file.close();
+    }
+  }
+
+  // Mutations since the folder files were last written, oldest first
+  void loadMutations(const string &userEmail, DynamicArray<EmailMutation> &mutations)
+  {
+    ifstream file(getMutationLogPath(userEmail));
+    if (!file.is_open())
+      return;
 
+    string line;
+    while (getline(file, line))
+    {
+      stringstream ss(line);
+      string id, labels;
+      EmailMutation mutation;
       getline(ss, id, ',');
-      getline(ss, sender, ',');
-      getline(ss, receiver, ',');
-      getline(ss, subject, ',');
-      getline(ss, content, ',');
-      getline(ss, timestampStr, ',');
-      getline(ss, isReadStr, ',');
-      getline(ss, isSpamStr, ',');
-      getline(ss, priorityStr, ',');
-      getline(ss, folder, ',');
-
-      Email email(id, sender, receiver, subject, content);
-      email.setTimestamp(atol(timestampStr.c_str()));
-      email.setIsRead(isReadStr == "1");
-      email.setIsSpam(isSpamStr == "1");
-      email.setPriority(atoi(priorityStr.c_str()));
-      email.setFolder(folder);
-
-      emailList->insert(email);
+      getline(ss, labels, ',');
+      getline(ss, mutation.folder, ',');
+      mutation.emailId = IdGenerator::parse(id);
+      mutation.labels = (unsigned int)atoi(labels.c_str());
+      if (mutation.emailId != 0)
+        mutations.add(mutation);
     }
     file.close();
   }
 
+  // The spam re-check progress file: the rules' key, then one line per
+  // user done, then "done" once every user is. False if there is none.
+  bool loadReclassifyProgress(unsigned long long &rules, DynamicArray<ReclassifyProgress> &usersDone, bool &finished)
+  {
+    ifstream file(getReclassifyProgressPath());
+    if (!file.is_open())
+      return false;
+
+    string line;
+    finished = false;
+    rules = getline(file, line) ? strtoull(line.c_str(), nullptr, 10) : 0;
+    while (getline(file, line))
+    {
+      if (line == "done")
+      {
+        finished = true;
+        continue;
+      }
+      stringstream ss(line);
+      string scanned, toSpam, toInbox;
+      ReclassifyProgress progress;
+      getline(ss, progress.user, ',');
+      getline(ss, scanned, ',');
+      getline(ss, toSpam, ',');
+      getline(ss, toInbox, ',');
+      progress.scanned = atoll(scanned.c_str());
+      progress.toSpam = atoll(toSpam.c_str());
+      progress.toInbox = atoll(toInbox.c_str());
+      if (!progress.user.empty())
+        usersDone.add(progress);
+    }
+    file.close();
+    return true;
+  }
+
+  // Starts a new progress file for the rules, finished at once if set
+  void startReclassifyProgress(unsigned long long rules, bool finished = false)
+  {
+    ofstream file(getReclassifyProgressPath(), ios::trunc);
+    if (file.is_open())
+    {
+      file << rules << "\n";
+      if (finished)
+        file << "done\n";
+      file.close();
+    }
+  }
+
+  // Appended after the user's moves are in their mutation log, so a user
+  // listed here is never redone after a crash
+  void appendReclassifyProgress(const ReclassifyProgress &progress)
+  {
+    ofstream file(getReclassifyProgressPath(), ios::app);
+    if (file.is_open())
+    {
+      file << progress.user << "," << progress.scanned << "," << progress.toSpam << "," << progress.toInbox << "\n";
+      file.close();
+    }
+  }
+
+  void finishReclassifyProgress()
+  {
+    ofstream file(getReclassifyProgressPath(), ios::app);
+    if (file.is_open())
+    {
+      file << "done\n";
+      file.close();
+    }
+  }
+
+  // Spam model shared by all users (see SpamClassifier)
+  string getSharedSpamModelPath()
+  {
+    return databaseFolder + "/spam_model.bin";
+  }
+
+  // Spam and not spam marks per sender (see SpamScorer)
+  string getSenderReputationPath()
+  {
+    return databaseFolder + "/sender_reputation.txt";
+  }
+
+  // Emails between addresses (see SenderRank)
+  string getMailGraphPath()
+  {
+    return databaseFolder + "/mail_graph.txt";
+  }
+
+  // The user's own spam model, next to their mailbox
+  string getSpamModelPath(const string &userEmail)
+  {
+    createDirectory(getUserFolderPath(userEmail));
+    return getUserFolderPath(userEmail) + "/spam_model.bin";
+  }
+
+  string getSpamVerdictsPath(const string &userEmail)
+  {
+    createDirectory(getUserFolderPath(userEmail));
+    return getUserFolderPath(userEmail) + "/spam_verdicts.bin";
+  }
+
+  // Directory holding the user's persisted search index
+  string getSearchIndexPath(const string &userEmail)
+  {
+    string path = getUserFolderPath(userEmail) + "/search";
+    createDirectory(getUserFolderPath(userEmail));
+    createDirectory(path);
+    return path;
+  }
+
   void loadUserEmails(string userEmail, LinkedList<Email> *emailList)
   {
     string folders[] = {"Inbox", "Sent", "Drafts", "Spam", "Trash", "Important"};
@@ -233,7 +657,8 @@ public:
     }
   }
 
-  void saveUserEmails(const string &userEmail,
+  // Returns the new mailbox generation
+  long long saveUserEmails(const string &userEmail,
                       LinkedList<Email> *inbox,
                       LinkedList<Email> *sent,
                       LinkedList<Email> *drafts,
@@ -254,13 +679,68 @@ public:
 
       if (file.is_open())
       {
-        for (int i = 0; i < folderLists[f]->getSize(); i++)
+        for (auto it = folderLists[f]->begin(); it != folderLists[f]->end(); ++it)
+        {
+          file << (*it).toString() << endl;
+        }
+        file.close();
+      }
+    }
+
+    return nextMailboxGeneration(userEmail);
+  }
+
+  // Same for the logged-in user's folders, written in arrival order
+  long long saveUserEmails(const string &userEmail,
+                      EmailFolder *inbox,
+                      EmailFolder *sent,
+                      EmailFolder *drafts,
+                      EmailFolder *spam,
+                      EmailFolder *trash,
+                      EmailFolder *important)
+  {
+    string userFolder = getUserFolderPath(userEmail);
+    createDirectory(userFolder.c_str());
+
+    EmailFolder *folders[] = {inbox, sent, drafts, spam, trash, important};
+
+    for (int f = 0; f < 6; f++)
+    {
+      string filePath = getFolderFilePath(userEmail, folders[f]->getFolderName());
+      ofstream file(filePath, ios::trunc);
+
+      if (file.is_open())
+      {
+        for (EmailFolder::Handle slot = folders[f]->first(); slot != -1; slot = folders[f]->next(slot))
         {
-          file << folderLists[f]->get(i).toString() << endl;
+          file << folders[f]->at(slot).toString() << endl;
         }
         file.close();
       }
     }
+
+    // The files now include every logged mutation
+    ofstream mutationLog(getMutationLogPath(userEmail), ios::trunc);
+    mutationLog.close();
+
+    return nextMailboxGeneration(userEmail);
+  }
+
+  // Bumps and saves the mailbox generation after the folders were written;
+  // the arrival log is empty again, since an index saved for the new
+  // generation has every email in the files
+  long long nextMailboxGeneration(const string &userEmail)
+  {
+    ofstream arrivals(getArrivalLogPath(userEmail), ios::trunc);
+    arrivals.close();
+    long long generation = loadMailboxGeneration(userEmail) + 1;
+    ofstream generationFile(getGenerationFilePath(userEmail), ios::trunc);
+    if (generationFile.is_open())
+    {
+      generationFile << generation << endl;
+      generationFile.close();
+    }
+    return generation;
   }
 
   void loadSocialGraph(Graph *graph)
@@ -349,6 +829,8 @@ public:
       getline(ss, interactionStr);
 
       Contact contact(contactId, name, email, phone);
+      if (!interactionStr.empty())
+        contact.setInteractionCount(atoi(interactionStr.c_str()));
       contacts->insert(email, contact);
     }
     file.close();
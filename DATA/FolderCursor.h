@@ -0,0 +1,152 @@
+#ifndef FOLDERCURSOR_H
+#define FOLDERCURSOR_H
+
+#include <iostream>
+#include <string>
+#include "Array.h"
+#include "Email.h"
+#include "EmailFolder.h"
+using namespace std;
+
+// One line of an email list: what the list shows, without the full email
+struct EmailRow
+{
+  EmailId emailId;
+  string sender;
+  string subject;
+  string preview; // Start of the content
+  time_t timestamp;
+  unsigned int labels;
+  int priority;
+
+  EmailRow() : emailId(0), timestamp(0), labels(0), priority(0) {}
+
+  bool hasLabel(EmailLabel label) const { return (labels & labelBit(label)) != 0; }
+};
+
+// Position in one of a folder's sort orders (arrival order by default) for
+// paging through it without copying the folder. The cursor stands before
+// the email at getOffset(); nextPage() reads forward from there and
+// previousPage() reads the rows before it. Seeking is O(log n) and a page
+// of k rows O(k log n) in arrival order, O(k) in sorted orders. If the
+// folder changes, the cursor finds its place again from the email it stood
+// at, or from its offset if that email is gone.
+class FolderCursor
+{
+private:
+  EmailFolder *folder;
+  SortOrder order;
+  EmailFolder::Handle slot; // Email at the cursor, -1 at the end
+  EmailId anchor;           // Its id, 0 at the end
+  int offset;
+  unsigned int version; // Folder version the slot belongs to
+
+  void standAt(EmailFolder::Handle newSlot, int newOffset)
+  {
+    slot = newSlot;
+    offset = newOffset;
+    anchor = slot != -1 ? folder->at(slot).getId() : 0;
+    version = folder->getVersion();
+  }
+
+  void revalidate()
+  {
+    if (version == folder->getVersion())
+      return;
+
+    EmailFolder::Handle found = anchor != 0 ? folder->getHandle(anchor) : -1;
+    if (found != -1)
+      standAt(found, folder->offsetOf(order, found));
+    else
+      seek(offset);
+  }
+
+public:
+  static const unsigned int PREVIEW_LENGTH = 80;
+
+  FolderCursor(EmailFolder *emailFolder, SortOrder sortOrder = SORT_ARRIVAL)
+  {
+    folder = emailFolder;
+    order = sortOrder;
+    standAt(folder->slotAt(order, 0), 0);
+  }
+
+  static EmailRow toRow(const Email &email)
+  {
+    EmailRow row;
+    row.emailId = email.getId();
+    row.sender = email.getSender();
+    row.subject = email.getSubject();
+    row.preview = email.getContentPreview(PREVIEW_LENGTH);
+    row.timestamp = email.getTimestamp();
+    row.labels = email.getLabels();
+    row.priority = email.getPriority();
+    return row;
+  }
+
+  // Moves to an offset, clamped to 0..total; false if no email is there
+  bool seek(int newOffset)
+  {
+    int total = folder->getEmailCount();
+    if (newOffset < 0)
+      newOffset = 0;
+    if (newOffset > total)
+      newOffset = total;
+    standAt(folder->slotAt(order, newOffset), newOffset);
+    return slot != -1;
+  }
+
+  // Moves to an email; false (and no move) if it is not in the folder
+  bool seekTo(EmailId emailId)
+  {
+    EmailFolder::Handle found = folder->getHandle(emailId);
+    if (found == -1)
+      return false;
+    standAt(found, folder->offsetOf(order, found));
+    return true;
+  }
+
+  // Up to count rows from the cursor on; the cursor moves past them
+  int nextPage(int count, DynamicArray<EmailRow> &rows)
+  {
+    revalidate();
+    int added = 0;
+    EmailFolder::Handle current = slot;
+    while (current != -1 && added < count)
+    {
+      rows.add(toRow(folder->at(current)));
+      added++;
+      current = folder->slotAt(order, offset + added);
+    }
+    standAt(current, offset + added);
+    return added;
+  }
+
+  // Up to count rows before the cursor, oldest first; the cursor moves to
+  // the first of them
+  int previousPage(int count, DynamicArray<EmailRow> &rows)
+  {
+    revalidate();
+    int start = offset - count > 0 ? offset - count : 0;
+    for (int i = start; i < offset; i++)
+    {
+      rows.add(toRow(folder->at(folder->slotAt(order, i))));
+    }
+    int read = offset - start;
+    if (read > 0)
+      standAt(folder->slotAt(order, start), start);
+    return read;
+  }
+
+  int getOffset()
+  {
+    revalidate();
+    return offset;
+  }
+
+  int getTotal() const { return folder->getEmailCount(); }
+  SortOrder getOrder() const { return order; }
+  EmailFolder *getFolder() const { return folder; }
+};
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef FUZZYMATCHER_H
+#define FUZZYMATCHER_H
+
+#include <iostream>
+#include <string>
+#include "Array.h"
+#include "HashMap.h"
+using namespace std;
+
+// One typo-tolerant match: the vocabulary term and what it stands for
+struct FuzzyMatch
+{
+  string term;
+  string payload;
+  int distance;
+
+  FuzzyMatch() : distance(0) {}
+};
+
+// BK-trees over a vocabulary of lowercase terms, one tree per term length
+// so a lookup only visits lengths within maxDistance of the query. Each
+// term carries one or more payloads (the search term it should be replaced
+// with). Distances are computed with Myers' bit-parallel Levenshtein.
+class FuzzyMatcher
+{
+private:
+  struct Node
+  {
+    string term;
+    DynamicArray<string> payloads;
+    int firstChild;
+    int nextSibling;
+    int distanceToParent;
+
+    Node() : payloads(1), firstChild(-1), nextSibling(-1), distanceToParent(0) {}
+  };
+
+  // Match bit-vectors of a pattern (at most 64 characters)
+  struct Pattern
+  {
+    unsigned long long peq[256];
+    int length; // 0 until built; terms over 64 characters have none
+
+    Pattern() : length(0) {}
+  };
+
+  DynamicArray<Node> nodes;
+  DynamicArray<int> roots;         // one tree per term length
+  HashMap<string, int> *termIndex; // term -> node
+
+  static string toLower(const string &text)
+  {
+    string lower = text;
+    for (size_t i = 0; i < lower.length(); i++)
+    {
+      lower[i] = tolower((unsigned char)lower[i]);
+    }
+    return lower;
+  }
+
+  static void buildPattern(const string &text, Pattern &pattern)
+  {
+    for (int c = 0; c < 256; c++)
+    {
+      pattern.peq[c] = 0;
+    }
+    pattern.length = (int)text.length();
+    for (int i = 0; i < pattern.length; i++)
+    {
+      pattern.peq[(unsigned char)text[i]] |= 1ULL << i;
+    }
+  }
+
+  // Myers/Hyyro bit-parallel edit distance, pattern length 1..64. Returns
+  // maxDistance + 1 as soon as the distance is known to exceed the bound.
+  static int myers(const Pattern &pattern, const string &text, int maxDistance)
+  {
+    int m = pattern.length;
+    int n = (int)text.length();
+    unsigned long long highBit = 1ULL << (m - 1);
+    unsigned long long pv = m == 64 ? ~0ULL : ((1ULL << m) - 1);
+    unsigned long long mv = 0;
+    int score = m;
+
+    for (int j = 0; j < n; j++)
+    {
+      unsigned long long eq = pattern.peq[(unsigned char)text[j]];
+      unsigned long long xv = eq | mv;
+      unsigned long long xh = (((eq & pv) + pv) ^ pv) | eq;
+      unsigned long long ph = mv | ~(xh | pv);
+      unsigned long long mh = pv & xh;
+
+      if (ph & highBit)
+        score++;
+      else if (mh & highBit)
+        score--;
+
+      // Remaining characters can lower the score by at most one each
+      if (score - (n - j - 1) > maxDistance)
+        return maxDistance + 1;
+
+      ph = (ph << 1) | 1;
+      mh <<= 1;
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+    }
+    return score;
+  }
+
+  // Plain dynamic programming fallback for patterns longer than 64
+  static int dynamicDistance(const string &a, const string &b, int maxDistance)
+  {
+    int n = (int)b.length();
+    int *previous = new int[n + 1];
+    int *current = new int[n + 1];
+    for (int j = 0; j <= n; j++)
+    {
+      previous[j] = j;
+    }
+
+    for (size_t i = 1; i <= a.length(); i++)
+    {
+      current[0] = (int)i;
+      int rowMin = current[0];
+      for (int j = 1; j <= n; j++)
+      {
+        int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+        int best = previous[j - 1] + cost;
+        if (previous[j] + 1 < best)
+          best = previous[j] + 1;
+        if (current[j - 1] + 1 < best)
+          best = current[j - 1] + 1;
+        current[j] = best;
+        if (best < rowMin)
+          rowMin = best;
+      }
+      int *temp = previous;
+      previous = current;
+      current = temp;
+
+      if (rowMin > maxDistance)
+      {
+        delete[] previous;
+        delete[] current;
+        return maxDistance + 1;
+      }
+    }
+
+    int result = previous[n];
+    delete[] previous;
+    delete[] current;
+    return result > maxDistance ? maxDistance + 1 : result;
+  }
+
+  static int distance(const Pattern &pattern, const string &patternText, const string &text, int maxDistance)
+  {
+    int lengthGap = (int)patternText.length() - (int)text.length();
+    if (lengthGap < 0)
+      lengthGap = -lengthGap;
+    if (lengthGap > maxDistance)
+      return maxDistance + 1;
+    if (patternText.empty())
+      return (int)text.length();
+    if (patternText.length() > 64)
+      return dynamicDistance(patternText, text, maxDistance);
+    return myers(pattern, text, maxDistance);
+  }
+
+  // Terms longer than 64 characters share the last tree
+  static int lengthBucket(const string &term)
+  {
+    return term.length() > 65 ? 65 : (int)term.length();
+  }
+
+  static void addPayload(Node &node, const string &payload)
+  {
+    for (int i = 0; i < node.payloads.getSize(); i++)
+    {
+      if (node.payloads[i] == payload)
+        return;
+    }
+    node.payloads.add(payload);
+  }
+
+public:
+  FuzzyMatcher()
+  {
+    termIndex = new HashMap<string, int>(1024);
+  }
+
+  ~FuzzyMatcher()
+  {
+    delete termIndex;
+  }
+
+  // Bounded edit distance between two strings (maxDistance + 1 if over)
+  static int editDistance(const string &a, const string &b, int maxDistance)
+  {
+    Pattern pattern;
+    if (a.length() <= 64)
+      buildPattern(a, pattern);
+    return distance(pattern, a, b, maxDistance);
+  }
+
+  // Adds a vocabulary term; payload defaults to the term itself
+  void addTerm(const string &rawTerm, const string &payload = "")
+  {
+    string term = toLower(rawTerm);
+    if (term.empty())
+      return;
+    string value = payload.empty() ? term : payload;
+
+    int *existing = termIndex->search(term);
+    if (existing != nullptr)
+    {
+      addPayload(nodes[*existing], value);
+      return;
+    }
+
+    Node node;
+    node.term = term;
+    node.payloads.add(value);
+    int newIndex = nodes.getSize();
+
+    int bucket = lengthBucket(term);
+    if (bucket >= roots.getSize())
+      roots.resize(bucket + 1, -1);
+
+    if (roots[bucket] == -1)
+    {
+      roots[bucket] = newIndex;
+    }
+    else
+    {
+      Pattern pattern;
+      if (term.length() <= 64)
+        buildPattern(term, pattern);
+
+      int current = roots[bucket];
+      while (true)
+      {
+        int d = distance(pattern, term, nodes[current].term, 1 << 20);
+        int child = nodes[current].firstChild;
+        while (child != -1 && nodes[child].distanceToParent != d)
+        {
+          child = nodes[child].nextSibling;
+        }
+        if (child == -1)
+        {
+          node.distanceToParent = d;
+          node.nextSibling = nodes[current].firstChild;
+          nodes[current].firstChild = newIndex;
+          break;
+        }
+        current = child;
+      }
+    }
+
+    nodes.add(node);
+    termIndex->insert(term, newIndex);
+  }
+
+  bool containsTerm(const string &term) const
+  {
+    return termIndex->contains(toLower(term));
+  }
+
+  // Collects up to maxMatches payloads within maxDistance of the query,
+  // closest first. Returns the number of matches found.
+  int lookup(const string &rawQuery, int maxDistance, DynamicArray<FuzzyMatch> &matches, int maxMatches = 10)
+  {
+    if (nodes.isEmpty() || maxMatches <= 0)
+      return 0;
+
+    string query = toLower(rawQuery);
+    Pattern pattern;
+    if (query.length() <= 64)
+      buildPattern(query, pattern);
+
+    int minLength = (int)query.length() - maxDistance;
+    int maxLength = (int)query.length() + maxDistance;
+    if (minLength < 1)
+      minLength = 1;
+    if (minLength > 65)
+      minLength = 65;
+    if (maxLength > 65)
+      maxLength = 65;
+
+    // Bucket results by distance so closer matches come first
+    DynamicArray<FuzzyMatch> found;
+    DynamicArray<int> stack;
+    for (int length = minLength; length <= maxLength && length < roots.getSize(); length++)
+    {
+      if (roots[length] != -1)
+        stack.add(roots[length]);
+    }
+
+    while (!stack.isEmpty())
+    {
+      int index = stack.removeLast();
+      Node &node = nodes[index];
+
+      // Exact distances keep the child window narrow; Myers is cheap enough
+      int d = distance(pattern, query, node.term, 1 << 20);
+      if (d <= maxDistance)
+      {
+        for (int p = 0; p < node.payloads.getSize(); p++)
+        {
+          FuzzyMatch match;
+          match.term = node.term;
+          match.payload = node.payloads[p];
+          match.distance = d;
+          found.add(match);
+        }
+      }
+
+      for (int child = node.firstChild; child != -1; child = nodes[child].nextSibling)
+      {
+        int edge = nodes[child].distanceToParent;
+        if (edge >= d - maxDistance && edge <= d + maxDistance)
+        {
+          stack.add(child);
+        }
+      }
+    }
+
+    int added = 0;
+    for (int d = 0; d <= maxDistance && added < maxMatches; d++)
+    {
+      for (int i = 0; i < found.getSize() && added < maxMatches; i++)
+      {
+        if (found[i].distance == d)
+        {
+          matches.add(found[i]);
+          added++;
+        }
+      }
+    }
+    return added;
+  }
+
+  int getTermCount() const { return nodes.getSize(); }
+
+  void clear()
+  {
+    nodes.clear();
+    roots.clear();
+    termIndex->clear();
+  }
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include "LinkedList.h"
+#include "HashMap.h"
+#include "BloomFilter.h"
 using namespace std;
 
 // Graph Node structure
@@ -11,10 +13,21 @@ struct GraphNode
   string userId;
   LinkedList<string> adjacentUsers;
   LinkedList<int> connectionStrengths;
+  BloomFilter connectionFilter; // adjacentUsers, for O(1) "not connected"
 
   GraphNode(string id) : userId(id) {}
 };
 
+// What the graph says about a sender-receiver pair, for spam scoring
+struct PairFeatures
+{
+  bool connected;
+  int strength;    // Of the direct connection, 0 if none
+  int mutualCount; // Users connected to both
+
+  PairFeatures() : connected(false), strength(0), mutualCount(0) {}
+};
+
 // Graph class for social connections
 class Graph
 {
@@ -30,19 +43,87 @@ private:
 
   GraphEntry *head;
   int size;
+  HashMap<string, GraphNode *> *nodeIndex; // User id -> node, for O(1) findNode
+  BloomFilter *userFilter;                 // Every user id: most senders are not users
+
+  // "sender\nreceiver" -> features, filled on first use and dropped when
+  // a connection changes, so scoring a message walks no adjacency lists
+  HashMap<string, PairFeatures> *pairCache;
+  static const int MAX_CACHED_PAIRS = 1 << 16;
 
-  GraphNode *findNode(string userId)
+  PairFeatures computePairFeatures(const string &sender, const string &receiver)
   {
-    GraphEntry *current = head;
-    while (current != nullptr)
+    PairFeatures features;
+    GraphNode *node1 = findNode(sender);
+    GraphNode *node2 = findNode(receiver);
+    if (node1 == nullptr || node2 == nullptr)
+      return features;
+
+    if (node1->connectionFilter.mightContain(receiver))
     {
-      if (current->userId == userId)
+      LinkedList<int>::Handle strength = node1->connectionStrengths.first();
+      for (LinkedList<string>::Handle user = node1->adjacentUsers.first(); user != nullptr; user = node1->adjacentUsers.next(user))
       {
-        return current->node;
+        if (node1->adjacentUsers.at(user) == receiver)
+        {
+          features.connected = true;
+          features.strength = strength != nullptr ? node1->connectionStrengths.at(strength) : 1;
+          break;
+        }
+        if (strength != nullptr)
+          strength = node1->connectionStrengths.next(strength);
       }
-      current = current->next;
     }
-    return nullptr;
+
+    // Mutuals are counted exactly only if the sender's filter may hold one
+    // of the receiver's connections
+    bool mayHaveMutuals = false;
+    for (LinkedList<string>::Handle user = node2->adjacentUsers.first(); user != nullptr && !mayHaveMutuals; user = node2->adjacentUsers.next(user))
+    {
+      mayHaveMutuals = node1->connectionFilter.mightContain(node2->adjacentUsers.at(user));
+    }
+    if (!mayHaveMutuals)
+      return features;
+
+    HashMap<string, bool> senderConnections(64);
+    for (LinkedList<string>::Handle user = node1->adjacentUsers.first(); user != nullptr; user = node1->adjacentUsers.next(user))
+    {
+      senderConnections.insert(node1->adjacentUsers.at(user), false);
+    }
+    for (LinkedList<string>::Handle user = node2->adjacentUsers.first(); user != nullptr; user = node2->adjacentUsers.next(user))
+    {
+      bool *counted = senderConnections.search(node2->adjacentUsers.at(user));
+      if (counted != nullptr && !*counted)
+      {
+        *counted = true; // Listed twice after a repeated addConnection
+        features.mutualCount++;
+      }
+    }
+    return features;
+  }
+
+  GraphNode *findNode(const string &userId)
+  {
+    GraphNode **node = nodeIndex->search(userId);
+    return node != nullptr ? *node : nullptr;
+  }
+
+  // Adds to a node's connection filter, rebuilt larger once it is full
+  void addToConnectionFilter(GraphNode *node, const string &userId)
+  {
+    node->connectionFilter.add(userId);
+    if (node->connectionFilter.isOverCapacity())
+      rebuildConnectionFilter(node);
+  }
+
+  // Bloom filters cannot drop a key: a removal rebuilds from the list
+  void rebuildConnectionFilter(GraphNode *node)
+  {
+    node->connectionFilter.reset(node->adjacentUsers.getSize() * 2);
+    for (LinkedList<string>::Handle user = node->adjacentUsers.first(); user != nullptr; user = node->adjacentUsers.next(user))
+    {
+      node->connectionFilter.add(node->adjacentUsers.at(user));
+    }
   }
 
 public:
@@ -50,6 +131,9 @@ public:
   {
     head = nullptr;
     size = 0;
+    nodeIndex = new HashMap<string, GraphNode *>(256);
+    pairCache = new HashMap<string, PairFeatures>(256);
+    userFilter = new BloomFilter(256);
   }
 
   ~Graph()
@@ -62,6 +146,9 @@ public:
       delete temp->node;
       delete temp;
     }
+    delete nodeIndex;
+    delete pairCache;
+    delete userFilter;
   }
 
   void addUser(string userId)
@@ -73,7 +160,18 @@ public:
     GraphEntry *newEntry = new GraphEntry(userId, newNode);
     newEntry->next = head;
     head = newEntry;
+    nodeIndex->insert(userId, newNode);
     size++;
+
+    userFilter->add(userId);
+    if (userFilter->isOverCapacity())
+    {
+      userFilter->reset(size * 2);
+      for (GraphEntry *entry = head; entry != nullptr; entry = entry->next)
+      {
+        userFilter->add(entry->userId);
+      }
+    }
   }
 
   void addConnection(string user1, string user2, int strength = 1)
@@ -86,9 +184,12 @@ public:
 
     node1->adjacentUsers.insert(user2);
     node1->connectionStrengths.insert(strength);
+    addToConnectionFilter(node1, user2);
 
     node2->adjacentUsers.insert(user1);
     node2->connectionStrengths.insert(strength);
+    addToConnectionFilter(node2, user1);
+    pairCache->clear();
   }
 
   void removeConnection(string user1, string user2)
@@ -99,15 +200,67 @@ public:
     if (node1 == nullptr || node2 == nullptr)
       return;
 
-    node1->adjacentUsers.remove(user2);
-    node2->adjacentUsers.remove(user1);
+    removeAdjacent(node1, user2);
+    removeAdjacent(node2, user1);
+    rebuildConnectionFilter(node1);
+    rebuildConnectionFilter(node2);
+    pairCache->clear();
   }
 
-  bool areConnected(string user1, string user2)
+  // Removes a neighbour and its strength (the lists run in parallel)
+  void removeAdjacent(GraphNode *node, const string &userId)
+  {
+    LinkedList<int>::Handle strength = node->connectionStrengths.first();
+    for (LinkedList<string>::Handle user = node->adjacentUsers.first(); user != nullptr; user = node->adjacentUsers.next(user))
+    {
+      if (node->adjacentUsers.at(user) == userId)
+      {
+        node->adjacentUsers.removeNode(user);
+        if (strength != nullptr)
+          node->connectionStrengths.removeNode(strength);
+        return;
+      }
+      if (strength != nullptr)
+        strength = node->connectionStrengths.next(strength);
+    }
+  }
+
+  // Connection, strength and mutual count of a pair; O(1) once cached
+  PairFeatures getPairFeatures(const string &sender, const string &receiver)
+  {
+    if (!isUser(sender) || !isUser(receiver))
+      return PairFeatures(); // No key built and nothing cached for strangers
+    string key = sender + "\n" + receiver;
+    PairFeatures *cached = pairCache->search(key);
+    if (cached != nullptr)
+      return *cached;
+    if (pairCache->getSize() >= MAX_CACHED_PAIRS)
+      pairCache->clear();
+    return *pairCache->insert(key, computePairFeatures(sender, receiver));
+  }
+
+  int getCachedPairCount() const { return pairCache->getSize(); }
+
+  // False for certain when either is not a user; true means probably
+  bool isUser(const string &userId)
   {
+    return userFilter->mightContain(userId);
+  }
+
+  // False for certain unless user1 lists user2, without walking the list
+  bool mightBeConnected(const string &user1, const string &user2)
+  {
+    if (!isUser(user1))
+      return false;
     GraphNode *node = findNode(user1);
-    if (node == nullptr)
+    return node != nullptr && node->connectionFilter.mightContain(user2);
+  }
+
+  bool areConnected(string user1, string user2)
+  {
+    if (!mightBeConnected(user1, user2))
       return false;
+    GraphNode *node = findNode(user1);
 
     for (int i = 0; i < node->adjacentUsers.getSize(); i++)
     {
@@ -121,9 +274,9 @@ public:
 
   int getConnectionStrength(string user1, string user2)
   {
-    GraphNode *node = findNode(user1);
-    if (node == nullptr)
+    if (!mightBeConnected(user1, user2))
       return 0;
+    GraphNode *node = findNode(user1);
 
     for (int i = 0; i < node->adjacentUsers.getSize(); i++)
     {
@@ -161,16 +314,15 @@ public:
 
   int calculateSpamProbability(string sender, string receiver)
   {
-    if (areConnected(sender, receiver))
+    PairFeatures features = getPairFeatures(sender, receiver);
+    if (features.connected)
     {
-      int strength = getConnectionStrength(sender, receiver);
-      return max(0, 100 - (strength * 20)); // Lower spam probability for stronger connections
+      return max(0, 100 - (features.strength * 20)); // Lower spam probability for stronger connections
     }
 
-    LinkedList<string> mutuals = getMutualConnections(sender, receiver);
-    if (mutuals.getSize() > 0)
+    if (features.mutualCount > 0)
     {
-      return 50 - (mutuals.getSize() * 10); // Reduce spam probability based on mutual connections
+      return max(0, 50 - (features.mutualCount * 10)); // Reduce spam probability based on mutual connections
     }
 
     return 80; // High spam probability for unknown senders
@@ -181,6 +333,17 @@ public:
     return findNode(userId);
   }
 
+  // Every user in the graph
+  LinkedList<string> getUserIds()
+  {
+    LinkedList<string> ids;
+    for (GraphEntry *entry = head; entry != nullptr; entry = entry->next)
+    {
+      ids.insert(entry->userId);
+    }
+    return ids;
+  }
+
   int getSize() { return size; }
 };
 
@@ -0,0 +1,245 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Hash functions used by HashMap (FNV-1a for strings, splitmix for integers)
+inline unsigned long long hashKey(const string &key)
+{
+  unsigned long long h = 1469598103934665603ULL;
+  for (size_t i = 0; i < key.length(); i++)
+  {
+    h ^= (unsigned char)key[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+inline unsigned long long hashKey(unsigned long long key)
+{
+  key += 0x9E3779B97F4A7C15ULL;
+  key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+  return key ^ (key >> 31);
+}
+
+inline unsigned long long hashKey(long long key) { return hashKey((unsigned long long)key); }
+inline unsigned long long hashKey(int key) { return hashKey((unsigned long long)(long long)key); }
+
+// Hash Map template - separate chaining, doubles capacity at load factor 1
+template <typename K, typename V>
+class HashMap
+{
+private:
+  struct Entry
+  {
+    K key;
+    V value;
+    Entry *next;
+
+    Entry(K k, V v) : key(k), value(v), next(nullptr) {}
+  };
+
+  Entry **buckets;
+  int capacity;
+  int size;
+
+  int bucketFor(const K &key, int cap) const
+  {
+    return (int)(hashKey(key) & (unsigned long long)(cap - 1));
+  }
+
+  void rehash(int newCapacity)
+  {
+    Entry **newBuckets = new Entry *[newCapacity];
+    for (int i = 0; i < newCapacity; i++)
+    {
+      newBuckets[i] = nullptr;
+    }
+
+    for (int i = 0; i < capacity; i++)
+    {
+      Entry *current = buckets[i];
+      while (current != nullptr)
+      {
+        Entry *next = current->next;
+        int b = bucketFor(current->key, newCapacity);
+        current->next = newBuckets[b];
+        newBuckets[b] = current;
+        current = next;
+      }
+    }
+
+    delete[] buckets;
+    buckets = newBuckets;
+    capacity = newCapacity;
+  }
+
+public:
+  HashMap(int cap = 16)
+  {
+    // Capacity is kept a power of two so the bucket index is a mask
+    capacity = 1;
+    while (capacity < cap)
+    {
+      capacity *= 2;
+    }
+    size = 0;
+    buckets = new Entry *[capacity];
+    for (int i = 0; i < capacity; i++)
+    {
+      buckets[i] = nullptr;
+    }
+  }
+
+  ~HashMap()
+  {
+    clear();
+    delete[] buckets;
+  }
+
+  // Inserts or updates, returns pointer to the stored value
+  V *insert(K key, V value)
+  {
+    V *existing = search(key);
+    if (existing != nullptr)
+    {
+      *existing = value;
+      return existing;
+    }
+
+    if (size >= capacity)
+    {
+      rehash(capacity * 2);
+    }
+
+    int b = bucketFor(key, capacity);
+    Entry *newEntry = new Entry(key, value);
+    newEntry->next = buckets[b];
+    buckets[b] = newEntry;
+    size++;
+    return &(newEntry->value);
+  }
+
+  V *search(const K &key) const
+  {
+    Entry *current = buckets[bucketFor(key, capacity)];
+    while (current != nullptr)
+    {
+      if (current->key == key)
+      {
+        return &(current->value);
+      }
+      current = current->next;
+    }
+    return nullptr;
+  }
+
+  bool contains(const K &key) const
+  {
+    return search(key) != nullptr;
+  }
+
+  bool remove(const K &key)
+  {
+    int b = bucketFor(key, capacity);
+    Entry *current = buckets[b];
+    Entry *previous = nullptr;
+
+    while (current != nullptr)
+    {
+      if (current->key == key)
+      {
+        if (previous == nullptr)
+          buckets[b] = current->next;
+        else
+          previous->next = current->next;
+        delete current;
+        size--;
+        return true;
+      }
+      previous = current;
+      current = current->next;
+    }
+    return false;
+  }
+
+  int getSize() const { return size; }
+  bool isEmpty() const { return size == 0; }
+
+  void clear()
+  {
+    for (int i = 0; i < capacity; i++)
+    {
+      Entry *current = buckets[i];
+      while (current != nullptr)
+      {
+        Entry *temp = current;
+        current = current->next;
+        delete temp;
+      }
+      buckets[i] = nullptr;
+    }
+    size = 0;
+  }
+
+  void getAllEntries(K *keys, V *values, int maxSize)
+  {
+    int index = 0;
+    for (int i = 0; i < capacity && index < maxSize; i++)
+    {
+      for (Entry *current = buckets[i]; current != nullptr && index < maxSize; current = current->next)
+      {
+        keys[index] = current->key;
+        values[index] = current->value;
+        index++;
+      }
+    }
+  }
+
+  // Iterator support (unordered) for range-based loops
+  class Iterator
+  {
+  private:
+    Entry **buckets;
+    int capacity;
+    int bucket;
+    Entry *current;
+
+    void skipEmpty()
+    {
+      while (current == nullptr && bucket + 1 < capacity)
+      {
+        bucket++;
+        current = buckets[bucket];
+      }
+    }
+
+  public:
+    Iterator(Entry **b, int cap, int start) : buckets(b), capacity(cap), bucket(start), current(nullptr)
+    {
+      if (bucket < capacity)
+      {
+        current = buckets[bucket];
+        skipEmpty();
+      }
+    }
+    K &key() { return current->key; }
+    V &value() { return current->value; }
+    Iterator &operator*() { return *this; }
+    Iterator &operator++()
+    {
+      current = current->next;
+      skipEmpty();
+      return *this;
+    }
+    bool operator!=(const Iterator &other) { return current != other.current; }
+  };
+
+  Iterator begin() { return Iterator(buckets, capacity, 0); }
+  Iterator end() { return Iterator(buckets, capacity, capacity); }
+};
+
+#endif
@@ -71,9 +71,18 @@ public:
 
   void insert(T element)
   {
+    // Grows like DynamicArray; folders hold far more than the initial 100
     if (size >= capacity)
     {
-      throw "Heap is full";
+      int newCapacity = capacity > 0 ? capacity * 2 : 16;
+      T *newData = new T[newCapacity];
+      for (int i = 0; i < size; i++)
+      {
+        newData[i] = data[i];
+      }
+      delete[] data;
+      data = newData;
+      capacity = newCapacity;
     }
     data[size] = element;
     heapifyUp(size);
@@ -109,6 +118,128 @@ public:
   void clear() { size = 0; }
 };
 
+// Min Heap template - fixed capacity, used for bounded top-k selection
+template <typename T>
+class MinHeap
+{
+private:
+  T *data;
+  int capacity;
+  int size;
+
+  int parent(int i) { return (i - 1) / 2; }
+  int leftChild(int i) { return 2 * i + 1; }
+  int rightChild(int i) { return 2 * i + 2; }
+
+  void heapifyUp(int index)
+  {
+    while (index > 0 && data[index] < data[parent(index)])
+    {
+      swap(data[index], data[parent(index)]);
+      index = parent(index);
+    }
+  }
+
+  void heapifyDown(int index)
+  {
+    while (true)
+    {
+      int minIndex = index;
+      int left = leftChild(index);
+      int right = rightChild(index);
+
+      if (left < size && data[left] < data[minIndex])
+      {
+        minIndex = left;
+      }
+
+      if (right < size && data[right] < data[minIndex])
+      {
+        minIndex = right;
+      }
+
+      if (minIndex == index)
+      {
+        return;
+      }
+      swap(data[index], data[minIndex]);
+      index = minIndex;
+    }
+  }
+
+  void swap(T &a, T &b)
+  {
+    T temp = a;
+    a = b;
+    b = temp;
+  }
+
+public:
+  MinHeap(int cap = 100)
+  {
+    capacity = cap > 0 ? cap : 1;
+    size = 0;
+    data = new T[capacity];
+  }
+
+  ~MinHeap()
+  {
+    delete[] data;
+  }
+
+  void insert(T element)
+  {
+    if (size >= capacity)
+    {
+      throw "Heap is full";
+    }
+    data[size] = element;
+    heapifyUp(size);
+    size++;
+  }
+
+  T extractMin()
+  {
+    if (size == 0)
+    {
+      throw "Heap is empty";
+    }
+
+    T min = data[0];
+    data[0] = data[size - 1];
+    size--;
+    heapifyDown(0);
+    return min;
+  }
+
+  T peekMin()
+  {
+    if (size == 0)
+    {
+      throw "Heap is empty";
+    }
+    return data[0];
+  }
+
+  // Replaces the minimum in O(log n); used to keep only the k largest items
+  void replaceMin(T element)
+  {
+    if (size == 0)
+    {
+      throw "Heap is empty";
+    }
+    data[0] = element;
+    heapifyDown(0);
+  }
+
+  bool isEmpty() { return size == 0; }
+  bool isFull() { return size == capacity; }
+  int getSize() { return size; }
+  int getCapacity() { return capacity; }
+
+  void clear() { size = 0; }
+};
+
 // Priority Queue using Max Heap
 template <typename T>
 class PriorityQueue
@@ -0,0 +1,136 @@
+#ifndef IDGENERATOR_H
+#define IDGENERATOR_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+using namespace std;
+
+// Emails are identified by a 64-bit integer. The "E<number>" string form
+// is only used for display and in the email files.
+typedef unsigned long long EmailId;
+
+// Snowflake-style id generator: 41 bits of milliseconds since 2024-01-01,
+// 10 bits of node number and a 12 bit sequence within the millisecond, so
+// ids from one node are unique and increase with time.
+//
+// Restarts are safe without writing every id to disk: the generator hands
+// out a time reservation (a minute ahead) that the caller persists, and
+// after a restart it never issues ids below the last saved reservation.
+class IdGenerator
+{
+private:
+  static const unsigned long long EPOCH_MS = 1704067200000ULL; // 2024-01-01 UTC
+  static const int NODE_BITS = 10;
+  static const int SEQUENCE_BITS = 12;
+  static const unsigned long long RESERVATION_MS = 60000;
+
+  int node;
+  unsigned long long lastMs; // Milliseconds since EPOCH_MS of the last id
+  int sequence;              // Sequence of the last id, -1 before the first
+  unsigned long long reservedMs;
+
+  static unsigned long long nowMs()
+  {
+    unsigned long long ms = (unsigned long long)chrono::duration_cast<chrono::milliseconds>(
+                                chrono::system_clock::now().time_since_epoch())
+                                .count();
+    return ms > EPOCH_MS ? ms - EPOCH_MS : 0;
+  }
+
+public:
+  IdGenerator(int nodeId = 0)
+  {
+    setNode(nodeId);
+    lastMs = 0;
+    sequence = -1;
+    reservedMs = 0;
+  }
+
+  void setNode(int nodeId)
+  {
+    node = nodeId & ((1 << NODE_BITS) - 1);
+  }
+
+  EmailId next()
+  {
+    unsigned long long ms = nowMs();
+    if (ms <= lastMs)
+    {
+      // Same millisecond, or the clock went back: keep counting from the last id
+      ms = lastMs;
+      sequence++;
+      if (sequence >= (1 << SEQUENCE_BITS))
+      {
+        ms++;
+        sequence = 0;
+      }
+    }
+    else
+    {
+      sequence = 0;
+    }
+    lastMs = ms;
+    return (ms << (NODE_BITS + SEQUENCE_BITS)) | ((EmailId)node << SEQUENCE_BITS) | (EmailId)sequence;
+  }
+
+  // Makes sure later ids sort after an id that is already in use
+  void observe(EmailId id)
+  {
+    unsigned long long ms = id >> (NODE_BITS + SEQUENCE_BITS);
+    int idSequence = (int)(id & ((1 << SEQUENCE_BITS) - 1));
+    if (ms > lastMs || (ms == lastMs && idSequence > sequence))
+    {
+      lastMs = ms;
+      sequence = idSequence;
+    }
+  }
+
+  // True when the last id passed the saved reservation; call reserve() and
+  // persist its result before handing the id out
+  bool needsReservation() const { return lastMs >= reservedMs; }
+
+  unsigned long long reserve()
+  {
+    reservedMs = lastMs + RESERVATION_MS;
+    return reservedMs;
+  }
+
+  // Continues after a reservation saved by an earlier run
+  void restore(unsigned long long savedReservation)
+  {
+    if (savedReservation > lastMs)
+    {
+      lastMs = savedReservation;
+      sequence = -1;
+    }
+    reservedMs = savedReservation;
+  }
+
+  static string toString(EmailId id)
+  {
+    return "E" + to_string(id);
+  }
+
+  // Accepts "E1234" or "1234"; returns 0 (no id) for anything else
+  static EmailId parse(const string &text)
+  {
+    size_t start = (!text.empty() && (text[0] == 'E' || text[0] == 'e')) ? 1 : 0;
+    if (start >= text.length() || text.length() - start > 20)
+      return 0;
+
+    EmailId id = 0;
+    for (size_t i = start; i < text.length(); i++)
+    {
+      if (text[i] < '0' || text[i] > '9')
+        return 0;
+      EmailId digit = (EmailId)(text[i] - '0');
+      if (id > (~0ULL - digit) / 10)
+        return 0;
+      id = id * 10 + digit;
+    }
+    return id;
+  }
+};
+
+#endif
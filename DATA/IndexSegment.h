@@ -0,0 +1,685 @@
+#ifndef INDEXSEGMENT_H
+#define INDEXSEGMENT_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include "Array.h"
+#include "Heap.h"
+#include "IdGenerator.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOGDI
+#define NOGDI // Keeps windows.h from clashing with raylib names
+#endif
+#ifndef NOUSER
+#define NOUSER
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Term frequencies of one term in one document, per field
+struct IndexPosting
+{
+  int docId;
+  unsigned short subjectTf;
+  unsigned short bodyTf;
+  unsigned short senderTf;
+
+  IndexPosting() : docId(0), subjectTf(0), bodyTf(0), senderTf(0) {}
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+private:
+  const char *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+
+public:
+  MappedFile() : data(nullptr), size(0)
+  {
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#else
+    fd = -1;
+#endif
+  }
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  bool open(const string &path)
+  {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+      close();
+      return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+      close();
+      return false;
+    }
+    data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+      close();
+      return false;
+    }
+    size = (size_t)info.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    data = mapped == MAP_FAILED ? nullptr : (const char *)mapped;
+#endif
+    if (data == nullptr)
+    {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if (data != nullptr)
+      UnmapViewOfFile(data);
+    if (mapping != NULL)
+      CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+      CloseHandle(file);
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data != nullptr)
+      munmap((void *)data, size);
+    if (fd >= 0)
+      ::close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+  const char *getData() const { return data; }
+  size_t getSize() const { return size; }
+};
+
+// On-disk layout of a segment file (native little-endian):
+//
+//   SegmentHeader
+//   postings   - per term, blocks of up to 128 postings
+//   doc table  - SegmentDoc per document
+//   key table  - doc ids sorted by email id, then folder
+//   term table - SegmentTerm per term, sorted by term bytes
+//   string pool
+//
+// A postings block is: unsigned short count, unsigned short unused,
+// unsigned int previous doc id, unsigned int data bytes, then count control
+// bytes followed by the data bytes. Every posting is four values (doc id
+// delta, subject tf, body tf, sender tf) and its control byte holds the
+// byte length - 1 of each value in two bits, as in Stream VByte. Keeping
+// the control bytes apart from the data lets a decoder work on whole
+// control bytes at a time.
+struct SegmentHeader
+{
+  char magic[8];
+  unsigned int version;
+  unsigned int docCount;
+  unsigned int termCount;
+  unsigned int reserved;
+  double totalLength;
+  unsigned long long postingsOffset;
+  unsigned long long docTableOffset;
+  unsigned long long keyTableOffset;
+  unsigned long long termTableOffset;
+  unsigned long long poolOffset;
+  unsigned long long poolSize;
+  unsigned long long fileSize;
+};
+
+struct SegmentDoc
+{
+  long long timestamp;
+  unsigned long long emailId;
+  unsigned int folderOffset;
+  unsigned short folderLength;
+  unsigned short senderLength;
+  int priority;
+  float length;
+  unsigned int senderOffset;
+  unsigned int reserved;
+};
+
+struct SegmentTerm
+{
+  unsigned long long postingsOffset;
+  unsigned int termOffset;
+  unsigned int docFreq;
+  unsigned int postingsBytes;
+  float maxWeightedTf;
+  unsigned short termLength;
+  unsigned short flags; // SEGMENT_TERM_VOCABULARY
+  unsigned int reserved;
+};
+
+const char SEGMENT_MAGIC[8] = {'Y', 'R', 'S', 'E', 'G', 'M', 'N', 'T'};
+const unsigned int SEGMENT_VERSION = 4; // 2: tables 8-byte aligned, 3: integer email ids, 4: senders
+const int SEGMENT_BLOCK_SIZE = 128;
+const unsigned short SEGMENT_TERM_VOCABULARY = 1; // Seen in a subject or sender
+
+// Writes a segment file. Documents are added first, then terms in sorted
+// order with their postings in increasing doc id order.
+class SegmentWriter
+{
+private:
+  struct KeyEntry
+  {
+    EmailId emailId;
+    string folder;
+    unsigned int docId;
+
+    bool operator<(const KeyEntry &other) const
+    {
+      if (emailId != other.emailId)
+        return emailId < other.emailId;
+      return folder < other.folder;
+    }
+  };
+
+  ofstream out;
+  string path;
+  string pool;
+  DynamicArray<SegmentDoc> docs;
+  DynamicArray<string> docFolders;
+  DynamicArray<SegmentTerm> termTable;
+  DynamicArray<IndexPosting> current;
+  string currentTerm;
+  unsigned long long offset;
+  double totalLength;
+  bool failed;
+
+  unsigned int addString(const string &text)
+  {
+    unsigned int start = (unsigned int)pool.length();
+    pool += text;
+    return start;
+  }
+
+  static int byteLength(unsigned int value)
+  {
+    if (value < (1u << 8))
+      return 1;
+    if (value < (1u << 16))
+      return 2;
+    if (value < (1u << 24))
+      return 3;
+    return 4;
+  }
+
+  void writeBytes(const void *bytes, size_t count)
+  {
+    out.write((const char *)bytes, count);
+    offset += count;
+  }
+
+  // Tables are read in place from the mapping, so they start 8-aligned
+  void alignOffset()
+  {
+    static const char zeros[8] = {0};
+    if (offset % 8 != 0)
+      writeBytes(zeros, 8 - offset % 8);
+  }
+
+  // Encodes current[start, start + count) as one block
+  void writeBlock(int start, int count, unsigned int previousDocId)
+  {
+    unsigned char controls[SEGMENT_BLOCK_SIZE];
+    unsigned char dataBytes[SEGMENT_BLOCK_SIZE * 16];
+    int dataSize = 0;
+
+    unsigned int previous = previousDocId;
+    for (int i = 0; i < count; i++)
+    {
+      const IndexPosting &p = current[start + i];
+      unsigned int values[4] = {(unsigned int)p.docId - previous, p.subjectTf, p.bodyTf, p.senderTf};
+      previous = (unsigned int)p.docId;
+
+      unsigned char control = 0;
+      for (int v = 0; v < 4; v++)
+      {
+        int length = byteLength(values[v]);
+        control |= (unsigned char)((length - 1) << (2 * v));
+        for (int b = 0; b < length; b++)
+        {
+          dataBytes[dataSize++] = (unsigned char)(values[v] >> (8 * b));
+        }
+      }
+      controls[i] = control;
+    }
+
+    unsigned short header[2] = {(unsigned short)count, 0};
+    unsigned int blockInfo[2] = {previousDocId, (unsigned int)dataSize};
+    writeBytes(header, sizeof(header));
+    writeBytes(blockInfo, sizeof(blockInfo));
+    writeBytes(controls, count);
+    writeBytes(dataBytes, dataSize);
+  }
+
+public:
+  SegmentWriter() : offset(0), totalLength(0), failed(false) {}
+
+  bool open(const string &filePath)
+  {
+    path = filePath;
+    out.open(path.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open())
+      return false;
+
+    // Header is rewritten once the table offsets are known
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    writeBytes(&header, sizeof(header));
+    return true;
+  }
+
+  // Returns the new document's id within this segment
+  int addDocument(EmailId emailId, const string &folder, const string &sender, double length,
+                  long long timestamp, int priority)
+  {
+    SegmentDoc doc;
+    memset(&doc, 0, sizeof(doc));
+    doc.emailId = emailId;
+    doc.folderOffset = addString(folder);
+    doc.folderLength = (unsigned short)folder.length();
+    doc.senderOffset = addString(sender);
+    doc.senderLength = (unsigned short)(sender.length() < 65535 ? sender.length() : 65535);
+    doc.timestamp = timestamp;
+    doc.priority = priority;
+    doc.length = (float)length;
+    docs.add(doc);
+    docFolders.add(folder);
+    totalLength += length;
+    return docs.getSize() - 1;
+  }
+
+  void startTerm(const string &term)
+  {
+    currentTerm = term;
+    current.clear();
+  }
+
+  void addPosting(const IndexPosting &posting)
+  {
+    current.add(posting);
+  }
+
+  // Terms left without postings (all documents deleted) are dropped
+  void endTerm(double maxWeightedTf, bool vocabularyTerm)
+  {
+    if (current.isEmpty())
+      return;
+
+    SegmentTerm term;
+    memset(&term, 0, sizeof(term));
+    term.termOffset = addString(currentTerm);
+    term.termLength = (unsigned short)currentTerm.length();
+    term.docFreq = (unsigned int)current.getSize();
+    term.maxWeightedTf = (float)maxWeightedTf;
+    term.flags = vocabularyTerm ? SEGMENT_TERM_VOCABULARY : 0;
+    term.postingsOffset = offset;
+
+    unsigned int previous = 0;
+    for (int start = 0; start < current.getSize(); start += SEGMENT_BLOCK_SIZE)
+    {
+      int count = current.getSize() - start;
+      if (count > SEGMENT_BLOCK_SIZE)
+        count = SEGMENT_BLOCK_SIZE;
+      writeBlock(start, count, previous);
+      previous = (unsigned int)current[start + count - 1].docId;
+    }
+
+    term.postingsBytes = (unsigned int)(offset - term.postingsOffset);
+    termTable.add(term);
+  }
+
+  int getDocumentCount() const { return docs.getSize(); }
+
+  bool finish()
+  {
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEGMENT_MAGIC, 8);
+    header.version = SEGMENT_VERSION;
+    header.docCount = (unsigned int)docs.getSize();
+    header.termCount = (unsigned int)termTable.getSize();
+    header.totalLength = totalLength;
+    header.postingsOffset = sizeof(SegmentHeader);
+
+    alignOffset();
+    header.docTableOffset = offset;
+    if (!docs.isEmpty())
+      writeBytes(docs.raw(), sizeof(SegmentDoc) * docs.getSize());
+
+    // Key table: doc ids ordered by key so removals can binary search
+    header.keyTableOffset = offset;
+    if (!docs.isEmpty())
+    {
+      MinHeap<KeyEntry> sorter(docs.getSize());
+      for (int i = 0; i < docs.getSize(); i++)
+      {
+        KeyEntry entry;
+        entry.emailId = docs[i].emailId;
+        entry.folder = docFolders[i];
+        entry.docId = (unsigned int)i;
+        sorter.insert(entry);
+      }
+      while (!sorter.isEmpty())
+      {
+        unsigned int docId = sorter.extractMin().docId;
+        writeBytes(&docId, sizeof(docId));
+      }
+    }
+
+    alignOffset();
+    header.termTableOffset = offset;
+    if (!termTable.isEmpty())
+      writeBytes(termTable.raw(), sizeof(SegmentTerm) * termTable.getSize());
+
+    header.poolOffset = offset;
+    header.poolSize = pool.length();
+    writeBytes(pool.data(), pool.length());
+    header.fileSize = offset;
+
+    out.seekp(0);
+    out.write((const char *)&header, sizeof(header));
+    failed = failed || !out.good();
+    out.close();
+    return !failed;
+  }
+
+  void abandon()
+  {
+    if (out.is_open())
+      out.close();
+    remove(path.c_str());
+  }
+};
+
+// A memory-mapped, read-only segment. Deletions after the segment was
+// written are kept as tombstones in memory and saved in the manifest.
+class IndexSegment
+{
+private:
+  MappedFile file;
+  string name;
+  const SegmentHeader *header;
+  const SegmentDoc *docTable;
+  const unsigned int *keyTable;
+  const SegmentTerm *termTable;
+  const char *pool;
+
+  DynamicArray<bool> deleted;
+  int deletedCount;
+  double deletedLength;
+
+  string poolString(unsigned int start, unsigned int length) const
+  {
+    return string(pool + start, length);
+  }
+
+  // Compares a term table entry with a term, like strcmp
+  int compareTerm(int index, const string &term) const
+  {
+    const SegmentTerm &entry = termTable[index];
+    size_t common = entry.termLength < term.length() ? entry.termLength : term.length();
+    int result = memcmp(pool + entry.termOffset, term.data(), common);
+    if (result != 0)
+      return result;
+    if (entry.termLength == term.length())
+      return 0;
+    return entry.termLength < term.length() ? -1 : 1;
+  }
+
+  // Every string must lie in the pool, every key in the doc table and
+  // every posting list between the header and the doc table
+  bool validateTables() const
+  {
+    unsigned long long poolSize = header->poolSize;
+    for (unsigned int i = 0; i < header->docCount; i++)
+    {
+      const SegmentDoc &doc = docTable[i];
+      if ((unsigned long long)doc.folderOffset + doc.folderLength > poolSize ||
+          (unsigned long long)doc.senderOffset + doc.senderLength > poolSize ||
+          keyTable[i] >= header->docCount)
+        return false;
+    }
+    for (unsigned int i = 0; i < header->termCount; i++)
+    {
+      const SegmentTerm &term = termTable[i];
+      if ((unsigned long long)term.termOffset + term.termLength > poolSize ||
+          term.postingsOffset < sizeof(SegmentHeader) ||
+          term.postingsOffset + term.postingsBytes > header->docTableOffset)
+        return false;
+    }
+    return true;
+  }
+
+public:
+  IndexSegment() : header(nullptr), docTable(nullptr), keyTable(nullptr), termTable(nullptr),
+                   pool(nullptr), deletedCount(0), deletedLength(0) {}
+
+  // Maps the file and validates its layout: the header, then every table
+  // entry's offsets, so lookups never read outside the mapping
+  bool open(const string &path, const string &segmentName)
+  {
+    name = segmentName;
+    if (!file.open(path))
+      return false;
+
+    const char *base = file.getData();
+    size_t size = file.getSize();
+    if (size < sizeof(SegmentHeader))
+      return false;
+
+    header = (const SegmentHeader *)base;
+    if (memcmp(header->magic, SEGMENT_MAGIC, 8) != 0 || header->version != SEGMENT_VERSION ||
+        header->fileSize != size ||
+        header->docTableOffset % 8 != 0 || header->termTableOffset % 8 != 0 ||
+        header->docTableOffset + (unsigned long long)header->docCount * sizeof(SegmentDoc) > size ||
+        header->keyTableOffset + (unsigned long long)header->docCount * sizeof(unsigned int) > size ||
+        header->termTableOffset + (unsigned long long)header->termCount * sizeof(SegmentTerm) > size ||
+        header->poolOffset + header->poolSize > size)
+    {
+      header = nullptr;
+      file.close();
+      return false;
+    }
+
+    docTable = (const SegmentDoc *)(base + header->docTableOffset);
+    keyTable = (const unsigned int *)(base + header->keyTableOffset);
+    termTable = (const SegmentTerm *)(base + header->termTableOffset);
+    pool = base + header->poolOffset;
+    if (!validateTables())
+    {
+      header = nullptr;
+      file.close();
+      return false;
+    }
+    deleted.resize(header->docCount, false);
+    return true;
+  }
+
+  const string &getName() const { return name; }
+  int getDocumentCount() const { return header == nullptr ? 0 : (int)header->docCount; }
+  int getLiveCount() const { return getDocumentCount() - deletedCount; }
+  int getTermCount() const { return header == nullptr ? 0 : (int)header->termCount; }
+  double getLiveLength() const { return header == nullptr ? 0 : header->totalLength - deletedLength; }
+
+  EmailId getEmailId(int docId) const { return docTable[docId].emailId; }
+  string getFolder(int docId) const { return poolString(docTable[docId].folderOffset, docTable[docId].folderLength); }
+  string getSender(int docId) const { return poolString(docTable[docId].senderOffset, docTable[docId].senderLength); }
+  double getLength(int docId) const { return docTable[docId].length; }
+  time_t getTimestamp(int docId) const { return (time_t)docTable[docId].timestamp; }
+  int getPriority(int docId) const { return docTable[docId].priority; }
+
+  bool isDeleted(int docId) const { return deleted[docId]; }
+  const DynamicArray<bool> &getDeletedFlags() const { return deleted; }
+
+  void markDeleted(int docId)
+  {
+    if (docId < 0 || docId >= getDocumentCount() || deleted[docId])
+      return;
+    deleted[docId] = true;
+    deletedCount++;
+    deletedLength += docTable[docId].length;
+  }
+
+  // Binary search of the key table, -1 if the document is not here
+  int findDocument(const string &folder, EmailId emailId) const
+  {
+    int low = 0;
+    int high = getDocumentCount() - 1;
+    while (low <= high)
+    {
+      int mid = (low + high) / 2;
+      unsigned int docId = keyTable[mid];
+      int result;
+      if (docTable[docId].emailId != emailId)
+        result = docTable[docId].emailId < emailId ? -1 : 1;
+      else
+        result = getFolder(docId).compare(folder);
+      if (result == 0)
+        return (int)docId;
+      if (result < 0)
+        low = mid + 1;
+      else
+        high = mid - 1;
+    }
+    return -1;
+  }
+
+  // Binary search of the term table, -1 if missing
+  int findTerm(const string &term) const
+  {
+    int low = 0;
+    int high = getTermCount() - 1;
+    while (low <= high)
+    {
+      int mid = (low + high) / 2;
+      int result = compareTerm(mid, term);
+      if (result == 0)
+        return mid;
+      if (result < 0)
+        low = mid + 1;
+      else
+        high = mid - 1;
+    }
+    return -1;
+  }
+
+  string getTerm(int termIndex) const
+  {
+    return poolString(termTable[termIndex].termOffset, termTable[termIndex].termLength);
+  }
+
+  int getDocFreq(int termIndex) const { return (int)termTable[termIndex].docFreq; }
+  double getMaxWeightedTf(int termIndex) const { return termTable[termIndex].maxWeightedTf; }
+  bool isVocabularyTerm(int termIndex) const { return (termTable[termIndex].flags & SEGMENT_TERM_VOCABULARY) != 0; }
+
+  // Decodes all postings of a term (deleted documents included). A block
+  // that overruns the list or names a document past the doc table stops
+  // the decoding and returns false, keeping the postings read so far.
+  bool readPostings(int termIndex, DynamicArray<IndexPosting> &postings) const
+  {
+    const SegmentTerm &term = termTable[termIndex];
+    const unsigned char *in = (const unsigned char *)file.getData() + term.postingsOffset;
+    const unsigned char *end = in + term.postingsBytes;
+
+    while (in < end)
+    {
+      if (end - in < 12)
+        return false;
+      unsigned short count;
+      unsigned int previous;
+      unsigned int dataSize;
+      memcpy(&count, in, sizeof(count));
+      memcpy(&previous, in + 4, sizeof(previous));
+      memcpy(&dataSize, in + 8, sizeof(dataSize));
+      const unsigned char *controls = in + 12;
+      if ((unsigned long long)count + dataSize > (unsigned long long)(end - controls))
+        return false;
+      const unsigned char *data = controls + count;
+      const unsigned char *dataEnd = data + dataSize;
+
+      for (int i = 0; i < count; i++)
+      {
+        unsigned char control = controls[i];
+        // Each value takes 1-4 bytes, so a group needs 4-16
+        if (dataEnd - data < 4 + (control & 3) + ((control >> 2) & 3) + ((control >> 4) & 3) + (control >> 6))
+          return false;
+        unsigned int values[4];
+        for (int v = 0; v < 4; v++)
+        {
+          int length = ((control >> (2 * v)) & 3) + 1;
+          unsigned int value = 0;
+          for (int b = 0; b < length; b++)
+          {
+            value |= (unsigned int)data[b] << (8 * b);
+          }
+          data += length;
+          values[v] = value;
+        }
+
+        previous += values[0];
+        if (previous >= header->docCount)
+          return false;
+        IndexPosting posting;
+        posting.docId = (int)previous;
+        posting.subjectTf = (unsigned short)values[1];
+        posting.bodyTf = (unsigned short)values[2];
+        posting.senderTf = (unsigned short)values[3];
+        postings.add(posting);
+      }
+      in = dataEnd;
+    }
+    return true;
+  }
+};
+
+#endif
@@ -4,7 +4,8 @@
 #include <iostream>
 using namespace std;
 
-// Singly Linked List
+// Linked List. Nodes also link back and the list keeps its tail, so
+// appending and removing a node through its handle are O(1).
 template <typename T>
 class LinkedList
 {
@@ -12,17 +13,36 @@ private:
   struct Node
   {
     T data;
+    Node *prev;
     Node *next;
-    Node(T d) : data(d), next(nullptr) {}
+    Node(T d) : data(d), prev(nullptr), next(nullptr) {}
   };
 
   Node *head;
+  Node *tail;
   int size;
 
+  void unlink(Node *node)
+  {
+    if (node->prev != nullptr)
+      node->prev->next = node->next;
+    else
+      head = node->next;
+    if (node->next != nullptr)
+      node->next->prev = node->prev;
+    else
+      tail = node->prev;
+    delete node;
+    size--;
+  }
+
 public:
+  // Stable reference to one element, valid until that element is removed
+  typedef Node *Handle;
+
   LinkedList()
   {
-    head = nullptr;
+    head = tail = nullptr;
     size = 0;
   }
 
@@ -31,23 +51,21 @@ public:
     clear();
   }
 
-  void insert(T element)
+  Handle insert(T element)
   {
     Node *newNode = new Node(element);
     if (head == nullptr)
     {
-      head = newNode;
+      head = tail = newNode;
     }
     else
     {
-      Node *temp = head;
-      while (temp->next != nullptr)
-      {
-        temp = temp->next;
-      }
-      temp->next = newNode;
+      tail->next = newNode;
+      newNode->prev = tail;
+      tail = newNode;
     }
     size++;
+    return newNode;
   }
 
   void insertAt(int index, T element)
@@ -55,10 +73,17 @@ public:
     if (index < 0 || index > size)
       return;
 
+    if (index == size)
+    {
+      insert(element);
+      return;
+    }
+
     Node *newNode = new Node(element);
     if (index == 0)
     {
       newNode->next = head;
+      head->prev = newNode;
       head = newNode;
     }
     else
@@ -69,6 +94,8 @@ public:
         temp = temp->next;
       }
       newNode->next = temp->next;
+      newNode->prev = temp;
+      temp->next->prev = newNode;
       temp->next = newNode;
     }
     size++;
@@ -90,33 +117,16 @@ public:
 
   bool remove(T element)
   {
-    if (head == nullptr)
-      return false;
-
-    if (head->data == element)
-    {
-      Node *temp = head;
-      head = head->next;
-      delete temp;
-      size--;
-      return true;
-    }
-
     Node *current = head;
-    while (current->next != nullptr && current->next->data != element)
+    while (current != nullptr && current->data != element)
     {
       current = current->next;
     }
 
-    if (current->next != nullptr)
-    {
-      Node *temp = current->next;
-      current->next = current->next->next;
-      delete temp;
-      size--;
-      return true;
-    }
-    return false;
+    if (current == nullptr)
+      return false;
+    unlink(current);
+    return true;
   }
 
   T removeAt(int index)
@@ -126,30 +136,29 @@ public:
       throw "Index out of bounds";
     }
 
-    T data;
-    if (index == 0)
-    {
-      Node *temp = head;
-      data = head->data;
-      head = head->next;
-      delete temp;
-    }
-    else
+    Node *temp = head;
+    for (int i = 0; i < index; i++)
     {
-      Node *temp = head;
-      for (int i = 0; i < index - 1; i++)
-      {
-        temp = temp->next;
-      }
-      Node *toDelete = temp->next;
-      data = toDelete->data;
-      temp->next = toDelete->next;
-      delete toDelete;
+      temp = temp->next;
     }
-    size--;
+    T data = temp->data;
+    unlink(temp);
+    return data;
+  }
+
+  // Element behind a handle returned by insert()
+  T &at(Handle node) { return node->data; }
+
+  T removeNode(Handle node)
+  {
+    T data = node->data;
+    unlink(node);
     return data;
   }
 
+  Handle first() { return head; }
+  Handle next(Handle node) { return node->next; }
+
   bool isEmpty() { return head == nullptr; }
   int getSize() { return size; }
 
@@ -161,6 +170,7 @@ public:
       head = head->next;
       delete temp;
     }
+    tail = nullptr;
     size = 0;
   }
 
@@ -0,0 +1,115 @@
+#ifndef RANKINDEX_H
+#define RANKINDEX_H
+
+#include <iostream>
+#include "Array.h"
+using namespace std;
+
+// Offsets into an ordered list of slots in O(log n). Every appended slot
+// gets the next sequence number; a Fenwick tree over sequence numbers
+// counts the ones still in the list, so the rank of a sequence is a prefix
+// sum and the slot at an offset is found by walking down the tree.
+// Removed sequence numbers stay behind as zeros until the owner renumbers
+// (clear() and append everything again) once needsCompaction() says so.
+class RankIndex
+{
+private:
+  DynamicArray<int> tree;  // 1-based Fenwick tree, tree[0] unused
+  DynamicArray<int> slots; // Sequence number -> slot, -1 once removed
+  int present;
+
+  static int lowBit(int i) { return i & -i; }
+
+public:
+  RankIndex()
+  {
+    tree.add(0);
+    present = 0;
+  }
+
+  // Appends a slot at the end of the order; returns its sequence number
+  int append(int slot)
+  {
+    int sequence = slots.getSize();
+    slots.add(slot);
+
+    // The new node covers (i - lowBit(i), i]: itself plus the nodes below
+    int i = sequence + 1;
+    int sum = 1;
+    for (int j = i - 1; j > i - lowBit(i); j -= lowBit(j))
+    {
+      sum += tree[j];
+    }
+    tree.add(sum);
+    present++;
+    return sequence;
+  }
+
+  void remove(int sequence)
+  {
+    if (sequence < 0 || sequence >= slots.getSize() || slots[sequence] == -1)
+      return;
+    slots[sequence] = -1;
+    for (int i = sequence + 1; i < tree.getSize(); i += lowBit(i))
+    {
+      tree[i]--;
+    }
+    present--;
+  }
+
+  // Number of present sequences before this one (its offset in the list)
+  int rankOf(int sequence) const
+  {
+    int rank = 0;
+    for (int i = sequence; i > 0; i -= lowBit(i))
+    {
+      rank += tree[i];
+    }
+    return rank;
+  }
+
+  // Slot at a 0-based offset, -1 if out of range
+  int slotAt(int offset) const
+  {
+    if (offset < 0 || offset >= present)
+      return -1;
+
+    int size = tree.getSize() - 1;
+    int step = 1;
+    while (step * 2 <= size)
+    {
+      step *= 2;
+    }
+
+    // Largest position whose prefix sum is <= offset; the next one holds it
+    int position = 0;
+    int remaining = offset;
+    for (; step > 0; step /= 2)
+    {
+      if (position + step <= size && tree[position + step] <= remaining)
+      {
+        position += step;
+        remaining -= tree[position];
+      }
+    }
+    return slots[position];
+  }
+
+  // The email of a sequence moved to another slot
+  void moveSlot(int sequence, int slot) { slots[sequence] = slot; }
+
+  int getCount() const { return present; }
+
+  // Too many removed sequence numbers: time to renumber
+  bool needsCompaction() const { return slots.getSize() > 2 * present + 1024; }
+
+  void clear()
+  {
+    tree = DynamicArray<int>();
+    tree.add(0);
+    slots = DynamicArray<int>();
+    present = 0;
+  }
+};
+
+#endif
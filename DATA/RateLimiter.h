@@ -0,0 +1,352 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <iostream>
+#include <chrono>
+#include "Array.h"
+#include "HashMap.h"
+using namespace std;
+
+// Token buckets in an open-addressing table keyed by a 64-bit hash. Each
+// key may take burst messages at once and earns ratePerSecond tokens a
+// second after that. Buckets are refilled lazily when they are used. When
+// a key's probe run is full, the stalest bucket idle for at least
+// burst / rate seconds is reused: it would be full again anyway, as good
+// as a new one. If every bucket of the run is younger, the key gets none
+// and its message waits, so a burst of new keys cannot hand a fresh
+// allowance to keys that are still refilling.
+class TokenBucketTable
+{
+public:
+  struct Bucket
+  {
+    unsigned long long key; // 0 when empty
+    float tokens;
+    unsigned int lastMs; // Milliseconds since the table's start
+  };
+
+private:
+  static const int MAX_PROBES = 8;
+
+  DynamicArray<Bucket> buckets;
+  int mask;
+  int used;
+  float burst;
+  float tokensPerMs;
+  unsigned int refillMs; // Idle time after which a bucket is full
+
+  // Refills a bucket for the time since its last use
+  void refill(Bucket &bucket, unsigned int nowMs) const
+  {
+    if (nowMs > bucket.lastMs)
+    {
+      float tokens = bucket.tokens + (float)(nowMs - bucket.lastMs) * tokensPerMs;
+      bucket.tokens = tokens < burst ? tokens : burst;
+      bucket.lastMs = nowMs;
+    }
+  }
+
+public:
+  // capacity is rounded up to a power of two
+  TokenBucketTable(int capacity, double burstSize, double ratePerSecond)
+      : used(0), burst((float)burstSize), tokensPerMs((float)(ratePerSecond / 1000.0))
+  {
+    double fullMs = ratePerSecond > 0 ? burstSize * 1000.0 / ratePerSecond : 4e9;
+    refillMs = fullMs < 4e9 ? (unsigned int)(fullMs + 0.999) : 0xFFFFFFFFu;
+    int size = MAX_PROBES;
+    while (size < capacity)
+    {
+      size <<= 1;
+    }
+    Bucket empty;
+    empty.key = 0;
+    empty.tokens = 0;
+    empty.lastMs = 0;
+    buckets.resize(size, empty);
+    mask = size - 1;
+  }
+
+  // The key's bucket, refilled up to nowMs; a new one starts full.
+  // nullptr if the key has none and no bucket of its probe run is free
+  // or idle long enough to reuse.
+  Bucket *find(unsigned long long key, unsigned int nowMs)
+  {
+    unsigned long long h = hashKey(key);
+    key = h | 1; // 0 marks an empty bucket
+    int slot = (int)(h >> 32) & mask;
+    int reusable = -1;
+    for (int probe = 0; probe < MAX_PROBES; probe++)
+    {
+      Bucket &bucket = buckets[(slot + probe) & mask];
+      if (bucket.key == key)
+      {
+        refill(bucket, nowMs);
+        return &bucket;
+      }
+      if (bucket.key == 0)
+      {
+        reusable = (slot + probe) & mask;
+        used++;
+        break;
+      }
+      if (nowMs >= bucket.lastMs && nowMs - bucket.lastMs >= refillMs &&
+          (reusable == -1 || bucket.lastMs < buckets[reusable].lastMs))
+        reusable = (slot + probe) & mask;
+    }
+    if (reusable == -1)
+      return nullptr;
+    Bucket &bucket = buckets[reusable];
+    bucket.key = key;
+    bucket.tokens = burst;
+    bucket.lastMs = nowMs;
+    return &bucket;
+  }
+
+  // Tokens the key has now (0 if it cannot get a bucket)
+  float available(unsigned long long key, unsigned int nowMs)
+  {
+    Bucket *bucket = find(key, nowMs);
+    return bucket != nullptr ? bucket->tokens : 0.0f;
+  }
+
+  // Takes one token; false (and nothing taken) if there is none
+  bool take(unsigned long long key, unsigned int nowMs)
+  {
+    Bucket *bucket = find(key, nowMs);
+    if (bucket == nullptr || bucket->tokens < 1.0f)
+      return false;
+    bucket->tokens -= 1.0f;
+    return true;
+  }
+
+  void clear()
+  {
+    for (int i = 0; i < buckets.getSize(); i++)
+    {
+      buckets[i].key = 0;
+    }
+    used = 0;
+  }
+
+  int getCapacity() const { return buckets.getSize(); }
+  int getUsedCount() const { return used; }
+};
+
+// Count-min sketch: DEPTH rows of counters, each key counted in one
+// counter per row, its count estimated as the smallest of them. Estimates
+// never fall short and only go over when keys collide in every row. It
+// takes a fixed amount of memory however many senders there are. Only
+// the smallest counters of a key are raised (conservative update), which
+// keeps the overcount down, and all counters are halved every window, so
+// an estimate is about the last window's count plus half the one before,
+// and so on.
+class CountMinSketch
+{
+private:
+  static const int DEPTH = 4;
+
+  DynamicArray<unsigned int> counters; // DEPTH rows of width
+  int widthMask;
+  unsigned int windowMs;
+  unsigned int windowStart;
+
+  // Halves every counter once per window passed
+  void decay(unsigned int nowMs)
+  {
+    if (nowMs - windowStart < windowMs)
+      return;
+    unsigned int windows = (nowMs - windowStart) / windowMs;
+    int shift = windows < 32 ? (int)windows : 32;
+    for (int i = 0; i < counters.getSize(); i++)
+    {
+      counters[i] = shift < 32 ? counters[i] >> shift : 0;
+    }
+    windowStart += windows * windowMs;
+  }
+
+public:
+  // width is rounded up to a power of two
+  CountMinSketch(int width, unsigned int windowMilliseconds) : windowMs(windowMilliseconds), windowStart(0)
+  {
+    int size = 64;
+    while (size < width)
+    {
+      size <<= 1;
+    }
+    counters.resize(size * DEPTH, 0);
+    widthMask = size - 1;
+  }
+
+  // Counts one more for key; returns the new estimate
+  unsigned int add(unsigned long long key, unsigned int nowMs)
+  {
+    decay(nowMs);
+    unsigned long long h = hashKey(key);
+    unsigned int h1 = (unsigned int)h;
+    unsigned int h2 = (unsigned int)(h >> 32) | 1;
+    unsigned int *cells[DEPTH];
+    unsigned int smallest = 0xFFFFFFFFu;
+    for (int row = 0; row < DEPTH; row++)
+    {
+      cells[row] = &counters[row * (widthMask + 1) + (int)((h1 + row * h2) & widthMask)];
+      if (*cells[row] < smallest)
+        smallest = *cells[row];
+    }
+    for (int row = 0; row < DEPTH; row++)
+    {
+      if (*cells[row] == smallest)
+        (*cells[row])++;
+    }
+    return smallest + 1;
+  }
+
+  unsigned int estimate(unsigned long long key, unsigned int nowMs)
+  {
+    decay(nowMs);
+    unsigned long long h = hashKey(key);
+    unsigned int h1 = (unsigned int)h;
+    unsigned int h2 = (unsigned int)(h >> 32) | 1;
+    unsigned int smallest = 0xFFFFFFFFu;
+    for (int row = 0; row < DEPTH; row++)
+    {
+      unsigned int count = counters[row * (widthMask + 1) + (int)((h1 + row * h2) & widthMask)];
+      if (count < smallest)
+        smallest = count;
+    }
+    return smallest;
+  }
+
+  void clear()
+  {
+    for (int i = 0; i < counters.getSize(); i++)
+    {
+      counters[i] = 0;
+    }
+    windowStart = 0;
+  }
+};
+
+enum RateDecision
+{
+  RATE_ACCEPT, // Within both limits
+  RATE_DEFER,  // The sender or the recipient is out of tokens: try later
+  RATE_FLOOD   // The sender is a heavy hitter: treat as spam
+};
+
+// Admission control for incoming mail. A sender whose sketch estimate
+// reaches the flood threshold is flooding, whatever its buckets say;
+// otherwise a message needs a token from both the sender's bucket and
+// the recipient's, and waits when either is empty. Keys are address ids
+// (AddressTable), times milliseconds from any fixed start.
+class RateLimiter
+{
+private:
+  TokenBucketTable *senders;
+  TokenBucketTable *recipients;
+  CountMinSketch *volume; // Messages per sender
+  unsigned int floodThreshold;
+  unsigned long long startMs;
+  bool started;
+  long long accepted;
+  long long deferred;
+  long long flooded;
+
+  // Milliseconds since the first message
+  unsigned int elapsed(unsigned long long atMs)
+  {
+    if (!started)
+    {
+      startMs = atMs;
+      started = true;
+    }
+    return (unsigned int)(atMs > startMs ? atMs - startMs : 0);
+  }
+
+  // One token from each bucket, or none taken if either is empty or
+  // there is no bucket to be had yet
+  RateDecision takeTokens(unsigned long long sender, unsigned long long recipient, unsigned int now)
+  {
+    TokenBucketTable::Bucket *senderBucket = senders->find(sender, now);
+    TokenBucketTable::Bucket *recipientBucket = recipients->find(recipient, now);
+    if (senderBucket == nullptr || recipientBucket == nullptr ||
+        senderBucket->tokens < 1.0f || recipientBucket->tokens < 1.0f)
+    {
+      deferred++;
+      return RATE_DEFER;
+    }
+    senderBucket->tokens -= 1.0f;
+    recipientBucket->tokens -= 1.0f;
+    accepted++;
+    return RATE_ACCEPT;
+  }
+
+public:
+  RateLimiter(double senderBurst = 20, double senderRate = 1, double recipientBurst = 100,
+              double recipientRate = 10, unsigned int floodMessages = 200, unsigned int windowMs = 60000)
+      : floodThreshold(floodMessages), startMs(0), started(false), accepted(0), deferred(0), flooded(0)
+  {
+    senders = new TokenBucketTable(1 << 14, senderBurst, senderRate);
+    recipients = new TokenBucketTable(1 << 14, recipientBurst, recipientRate);
+    volume = new CountMinSketch(1 << 14, windowMs);
+  }
+
+  ~RateLimiter()
+  {
+    delete senders;
+    delete recipients;
+    delete volume;
+  }
+
+  static unsigned long long nowMs()
+  {
+    return (unsigned long long)chrono::duration_cast<chrono::milliseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Counts the message against its sender and decides
+  RateDecision admit(unsigned long long sender, unsigned long long recipient, unsigned long long atMs)
+  {
+    unsigned int now = elapsed(atMs);
+    if (volume->add(sender, now) >= floodThreshold)
+    {
+      flooded++;
+      return RATE_FLOOD;
+    }
+    return takeTokens(sender, recipient, now);
+  }
+
+  // A deferred message again: decides without counting it twice
+  RateDecision readmit(unsigned long long sender, unsigned long long recipient, unsigned long long atMs)
+  {
+    unsigned int now = elapsed(atMs);
+    if (volume->estimate(sender, now) >= floodThreshold)
+    {
+      flooded++;
+      return RATE_FLOOD;
+    }
+    return takeTokens(sender, recipient, now);
+  }
+
+  unsigned int getSenderVolume(unsigned long long sender, unsigned long long atMs)
+  {
+    return volume->estimate(sender, elapsed(atMs));
+  }
+
+  void clear()
+  {
+    senders->clear();
+    recipients->clear();
+    volume->clear();
+    started = false;
+    accepted = 0;
+    deferred = 0;
+    flooded = 0;
+  }
+
+  long long getAcceptedCount() const { return accepted; }
+  long long getDeferredCount() const { return deferred; }
+  long long getFloodedCount() const { return flooded; }
+};
+
+#endif
@@ -0,0 +1,1307 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <iostream>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include "Array.h"
+#include "HashMap.h"
+#include "Heap.h"
+#include "FuzzyMatcher.h"
+#include "IndexSegment.h"
+#include "Email.h"
+#include "SenderRank.h"
+using namespace std;
+
+// One ranked search result
+struct SearchHit
+{
+  EmailId emailId;
+  string folder;
+  double score;
+  string snippet;
+
+  SearchHit() : emailId(0), score(0) {}
+};
+
+// Inverted index over subject, content and sender with BM25 ranking.
+// Documents are keyed by folder + email id, so the same message may be
+// indexed once per folder it appears in.
+//
+// When opened on a directory the index is persistent: memory-mapped
+// segment files (see IndexSegment.h) hold everything saved so far, new
+// mail goes to an in-memory delta, and each save writes the delta out as
+// a small segment plus a manifest stamped with the mailbox generation.
+// Small segments are merged by a background thread.
+class SearchIndex
+{
+private:
+  typedef IndexPosting Posting;
+
+  struct PostingList
+  {
+    DynamicArray<Posting> postings;
+    double maxWeightedTf; // Used to bound the term's best possible score
+
+    PostingList() : maxWeightedTf(0) {}
+  };
+
+  struct DocInfo
+  {
+    EmailId emailId;
+    string folder;
+    string sender;
+    double length; // Field-weighted token count
+    time_t timestamp;
+    int priority;
+    bool deleted;
+    int nextSameId; // Next live delta doc with this email id (other folder), -1 if none
+
+    DocInfo() : emailId(0), length(0), timestamp(0), priority(0), deleted(false), nextSameId(-1) {}
+  };
+
+  // A document removed from a segment while it was being merged
+  struct DocKey
+  {
+    EmailId emailId;
+    string folder;
+  };
+
+  // Entry of the bounded top-k heap
+  struct ScoredDoc
+  {
+    double score;
+    int docId;
+
+    ScoredDoc() : score(0), docId(0) {}
+    ScoredDoc(double s, int d) : score(s), docId(d) {}
+
+    bool operator<(const ScoredDoc &other) const
+    {
+      if (score != other.score)
+        return score < other.score;
+      return docId < other.docId;
+    }
+
+    bool operator>(const ScoredDoc &other) const
+    {
+      return other < *this;
+    }
+  };
+
+  struct QueryTerm
+  {
+    PostingList *list;           // Delta postings, may be null
+    DynamicArray<int> segmentTerms; // Term index per segment, -1 if absent
+    double idf;
+    double upperBound;
+
+    QueryTerm() : list(nullptr), idf(0), upperBound(0) {}
+  };
+
+  // A background merge of segments [first, first + count)
+  struct MergeJob
+  {
+    DynamicArray<IndexSegment *> inputs;
+    DynamicArray<DynamicArray<bool> > deletedFlags; // Tombstones when the merge started
+    int first;
+    string outputName;
+    atomic<bool> done;
+    atomic<bool> cancelled;
+    bool succeeded;
+    thread worker;
+
+    MergeJob() : first(0), done(false), cancelled(false), succeeded(false) {}
+  };
+
+  HashMap<string, PostingList *> *terms;
+  HashMap<EmailId, int> *docKeys; // Email id -> first live delta doc (chained by folder)
+  FuzzyMatcher *vocabulary;      // Subject and sender terms for typo lookup
+  DynamicArray<DocInfo> docs;
+  int liveDocs;
+  int deletedDocs; // Deleted but still referenced by postings
+  double totalLength;
+
+  // Ranking parameters
+  double k1;
+  double b;
+  double subjectWeight;
+  double bodyWeight;
+  double senderWeight;
+  double priorityBoost; // Added at priority 5
+  double recencyBoost;  // Added for a message received now
+  double recencyHalfLifeDays;
+  double senderBoost;   // Times the sender's trust (SenderRank), below 1
+  const SenderRank *senderRank; // Not owned, may be null
+
+  // Persistent segments, oldest first
+  string directory; // Empty when the index lives in memory only
+  DynamicArray<IndexSegment *> segments;
+  int nextSegmentNumber;
+  int mergeFanIn; // Merge once this many small segments pile up
+  MergeJob *merge;
+  DynamicArray<DocKey> pendingDeletes; // Removed from merge inputs meanwhile
+  DynamicArray<string> obsoleteFiles;  // Removed after the next manifest is written
+  bool updatesPaused;
+  bool vocabularyLoaded;
+
+  // Per-query scratch space, reused to avoid reallocating per search
+  DynamicArray<double> accumulators;
+  DynamicArray<int> touched;
+  DynamicArray<Posting> decoded;
+
+  // Live delta doc for the email in this folder, -1 if none
+  int findDeltaDoc(const string &folder, EmailId emailId) const
+  {
+    int *head = docKeys->search(emailId);
+    for (int docId = head != nullptr ? *head : -1; docId != -1; docId = docs[docId].nextSameId)
+    {
+      if (docs[docId].folder == folder)
+        return docId;
+    }
+    return -1;
+  }
+
+  void unlinkDeltaDoc(int docId)
+  {
+    int *head = docKeys->search(docs[docId].emailId);
+    if (head == nullptr)
+      return;
+    if (*head == docId)
+    {
+      if (docs[docId].nextSameId == -1)
+        docKeys->remove(docs[docId].emailId);
+      else
+        *head = docs[docId].nextSameId;
+      return;
+    }
+    for (int previous = *head; docs[previous].nextSameId != -1; previous = docs[previous].nextSameId)
+    {
+      if (docs[previous].nextSameId == docId)
+      {
+        docs[previous].nextSameId = docs[docId].nextSameId;
+        return;
+      }
+    }
+  }
+
+  double weightedTf(const Posting &p) const
+  {
+    return subjectWeight * p.subjectTf + bodyWeight * p.bodyTf + senderWeight * p.senderTf;
+  }
+
+  double termScore(double idf, double tf, double docLength, double avgLength) const
+  {
+    double norm = k1 * (1.0 - b + b * docLength / avgLength);
+    return idf * tf * (k1 + 1.0) / (tf + norm);
+  }
+
+  double boostFor(const DocInfo &doc, time_t now) const
+  {
+    int p = doc.priority < 0 ? 0 : (doc.priority > 5 ? 5 : doc.priority);
+    double ageDays = now > doc.timestamp ? (double)(now - doc.timestamp) / 86400.0 : 0.0;
+    double boost = priorityBoost * p / 5.0 + recencyBoost / (1.0 + ageDays / recencyHalfLifeDays);
+    if (senderRank != nullptr)
+      boost += senderBoost * senderRank->getTrust(doc.sender);
+    return boost;
+  }
+
+  static void bump(unsigned short &tf)
+  {
+    if (tf < 65535)
+      tf++;
+  }
+
+  PostingList *getOrCreateList(const string &term)
+  {
+    PostingList **existing = terms->search(term);
+    if (existing != nullptr)
+    {
+      return *existing;
+    }
+    PostingList *list = new PostingList();
+    terms->insert(term, list);
+    return list;
+  }
+
+  // Drops postings of deleted documents once they outnumber live ones
+  void compact()
+  {
+    DynamicArray<string> emptyTerms;
+    for (auto &entry : *terms)
+    {
+      PostingList *list = entry.value();
+      DynamicArray<Posting> &postings = list->postings;
+      int write = 0;
+      list->maxWeightedTf = 0;
+      for (int i = 0; i < postings.getSize(); i++)
+      {
+        if (!docs[postings[i].docId].deleted)
+        {
+          postings[write++] = postings[i];
+          double tf = weightedTf(postings[i]);
+          if (tf > list->maxWeightedTf)
+            list->maxWeightedTf = tf;
+        }
+      }
+      postings.resize(write);
+      if (write == 0)
+      {
+        emptyTerms.add(entry.key());
+      }
+    }
+
+    for (int i = 0; i < emptyTerms.getSize(); i++)
+    {
+      delete *terms->search(emptyTerms[i]);
+      terms->remove(emptyTerms[i]);
+    }
+    deletedDocs = 0;
+  }
+
+  // ---- Layers: segments first, then the in-memory delta ----
+
+  int segmentBase(int segment) const
+  {
+    int base = 0;
+    for (int s = 0; s < segment; s++)
+    {
+      base += segments[s]->getDocumentCount();
+    }
+    return base;
+  }
+
+  // Document fields for a doc id numbered across all layers
+  DocInfo describe(int globalId) const
+  {
+    DocInfo doc;
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      int count = segments[s]->getDocumentCount();
+      if (globalId < count)
+      {
+        doc.emailId = segments[s]->getEmailId(globalId);
+        doc.folder = segments[s]->getFolder(globalId);
+        doc.sender = segments[s]->getSender(globalId);
+        doc.length = segments[s]->getLength(globalId);
+        doc.timestamp = segments[s]->getTimestamp(globalId);
+        doc.priority = segments[s]->getPriority(globalId);
+        doc.deleted = segments[s]->isDeleted(globalId);
+        return doc;
+      }
+      globalId -= count;
+    }
+    return docs[globalId];
+  }
+
+  // Adds one term's scores for the postings of one layer
+  void accumulate(const DynamicArray<Posting> &postings, const IndexSegment *segment, int base,
+                  double idf, double avgLength, bool candidatesClosed)
+  {
+    for (int i = 0; i < postings.getSize(); i++)
+    {
+      const Posting &p = postings[i];
+      double docLength;
+      if (segment != nullptr)
+      {
+        if (segment->isDeleted(p.docId))
+          continue;
+        docLength = segment->getLength(p.docId);
+      }
+      else
+      {
+        if (docs[p.docId].deleted)
+          continue;
+        docLength = docs[p.docId].length;
+      }
+
+      int globalId = base + p.docId;
+      double acc = accumulators[globalId];
+      if (acc == 0.0)
+      {
+        if (candidatesClosed)
+          continue;
+        touched.add(globalId);
+      }
+      accumulators[globalId] = acc + termScore(idf, weightedTf(p), docLength, avgLength);
+    }
+  }
+
+  static void sortStrings(DynamicArray<string> &items)
+  {
+    MinHeap<string> sorter(items.getSize() > 0 ? items.getSize() : 1);
+    for (int i = 0; i < items.getSize(); i++)
+    {
+      sorter.insert(items[i]);
+    }
+    items.clear();
+    while (!sorter.isEmpty())
+    {
+      items.add(sorter.extractMin());
+    }
+  }
+
+  // Writes the live documents of the given segments (and of the delta if
+  // includeDelta) into one new segment file. Runs on the merge thread for
+  // background merges, so it only reads the inputs.
+  bool writeSegment(const string &path, const DynamicArray<IndexSegment *> &inputs,
+                    const DynamicArray<DynamicArray<bool> > &deletedFlags, bool includeDelta,
+                    const atomic<bool> *cancelled)
+  {
+    SegmentWriter writer;
+    if (!writer.open(path))
+      return false;
+
+    // New doc ids, assigned input by input so postings stay in order
+    int sourceCount = inputs.getSize() + (includeDelta ? 1 : 0);
+    DynamicArray<DynamicArray<int> > remap;
+    for (int s = 0; s < inputs.getSize(); s++)
+    {
+      DynamicArray<int> ids;
+      for (int d = 0; d < inputs[s]->getDocumentCount(); d++)
+      {
+        if (deletedFlags[s][d])
+          ids.add(-1);
+        else
+          ids.add(writer.addDocument(inputs[s]->getEmailId(d), inputs[s]->getFolder(d), inputs[s]->getSender(d),
+                                     inputs[s]->getLength(d), (long long)inputs[s]->getTimestamp(d),
+                                     inputs[s]->getPriority(d)));
+      }
+      remap.add(ids);
+    }
+
+    DynamicArray<string> deltaTerms;
+    if (includeDelta)
+    {
+      DynamicArray<int> ids;
+      for (int d = 0; d < docs.getSize(); d++)
+      {
+        if (docs[d].deleted)
+          ids.add(-1);
+        else
+          ids.add(writer.addDocument(docs[d].emailId, docs[d].folder, docs[d].sender, docs[d].length,
+                                     (long long)docs[d].timestamp, docs[d].priority));
+      }
+      remap.add(ids);
+
+      for (auto &entry : *terms)
+      {
+        if (!entry.value()->postings.isEmpty())
+          deltaTerms.add(entry.key());
+      }
+      sortStrings(deltaTerms);
+    }
+
+    // K-way merge of the sorted term lists
+    DynamicArray<int> positions;
+    DynamicArray<string> heads;
+    for (int s = 0; s < sourceCount; s++)
+    {
+      positions.add(0);
+      heads.add("");
+    }
+
+    DynamicArray<Posting> scratch;
+    while (true)
+    {
+      if (cancelled != nullptr && cancelled->load())
+      {
+        writer.abandon();
+        return false;
+      }
+
+      bool any = false;
+      string smallest;
+      for (int s = 0; s < sourceCount; s++)
+      {
+        bool isDelta = s == inputs.getSize();
+        int limit = isDelta ? deltaTerms.getSize() : inputs[s]->getTermCount();
+        if (positions[s] >= limit)
+          continue;
+        heads[s] = isDelta ? deltaTerms[positions[s]] : inputs[s]->getTerm(positions[s]);
+        if (!any || heads[s] < smallest)
+        {
+          smallest = heads[s];
+          any = true;
+        }
+      }
+      if (!any)
+        break;
+
+      writer.startTerm(smallest);
+      double maxTf = 0;
+      bool vocabularyTerm = false;
+      for (int s = 0; s < sourceCount; s++)
+      {
+        bool isDelta = s == inputs.getSize();
+        int limit = isDelta ? deltaTerms.getSize() : inputs[s]->getTermCount();
+        if (positions[s] >= limit || heads[s] != smallest)
+          continue;
+
+        scratch.clear();
+        if (isDelta)
+        {
+          DynamicArray<Posting> &postings = (*terms->search(smallest))->postings;
+          for (int i = 0; i < postings.getSize(); i++)
+          {
+            scratch.add(postings[i]);
+          }
+        }
+        else if (!inputs[s]->readPostings(positions[s], scratch))
+        {
+          // A damaged list would be lost for good once the inputs go
+          writer.abandon();
+          return false;
+        }
+
+        for (int i = 0; i < scratch.getSize(); i++)
+        {
+          Posting p = scratch[i];
+          p.docId = remap[s][p.docId];
+          if (p.docId < 0)
+            continue;
+          writer.addPosting(p);
+          double tf = weightedTf(p);
+          if (tf > maxTf)
+            maxTf = tf;
+          if (p.subjectTf > 0 || p.senderTf > 0)
+            vocabularyTerm = true;
+        }
+        positions[s]++;
+      }
+      writer.endTerm(maxTf, vocabularyTerm);
+    }
+
+    if (!writer.finish())
+    {
+      writer.abandon();
+      return false;
+    }
+    return true;
+  }
+
+  string segmentPath(const string &name) const
+  {
+    return directory + "/" + name;
+  }
+
+  string manifestPath() const
+  {
+    return directory + "/manifest.txt";
+  }
+
+  static void runMerge(SearchIndex *index, MergeJob *job)
+  {
+    job->succeeded = index->writeSegment(index->segmentPath(job->outputName), job->inputs,
+                                         job->deletedFlags, false, &job->cancelled);
+    job->done = true;
+  }
+
+  // Collects segments from the newest backwards while each older one is
+  // at most twice the size collected so far, and merges them once there
+  // are mergeFanIn of them. Large old segments are left alone, so every
+  // document is rewritten only a logarithmic number of times.
+  void maybeStartMerge()
+  {
+    if (merge != nullptr || directory.empty() || segments.getSize() < mergeFanIn)
+      return;
+
+    int first = segments.getSize() - 1;
+    int collected = segments[first]->getDocumentCount();
+    while (first > 0 && segments[first - 1]->getDocumentCount() <= 2 * collected)
+    {
+      first--;
+      collected += segments[first]->getDocumentCount();
+    }
+    if (segments.getSize() - first < mergeFanIn)
+      return;
+
+    merge = new MergeJob();
+    merge->first = first;
+    for (int s = first; s < segments.getSize(); s++)
+    {
+      merge->inputs.add(segments[s]);
+      merge->deletedFlags.add(segments[s]->getDeletedFlags());
+    }
+    merge->outputName = "seg_" + to_string(nextSegmentNumber++) + ".idx";
+    merge->worker = thread(runMerge, this, merge);
+  }
+
+  // Installs a finished merge. With wait set, blocks until it finishes.
+  void finishMerge(bool wait)
+  {
+    if (merge == nullptr || (!wait && !merge->done.load()))
+      return;
+
+    merge->worker.join();
+    IndexSegment *output = nullptr;
+    if (merge->succeeded && !merge->cancelled.load())
+    {
+      output = new IndexSegment();
+      if (!output->open(segmentPath(merge->outputName), merge->outputName))
+      {
+        delete output;
+        output = nullptr;
+      }
+    }
+
+    if (output != nullptr)
+    {
+      for (int i = 0; i < pendingDeletes.getSize(); i++)
+      {
+        output->markDeleted(output->findDocument(pendingDeletes[i].folder, pendingDeletes[i].emailId));
+      }
+
+      // Replace the merged range with the output segment
+      int count = merge->inputs.getSize();
+      DynamicArray<IndexSegment *> updated;
+      for (int s = 0; s < segments.getSize(); s++)
+      {
+        if (s == merge->first)
+          updated.add(output);
+        if (s >= merge->first && s < merge->first + count)
+        {
+          obsoleteFiles.add(segments[s]->getName());
+          delete segments[s];
+          continue;
+        }
+        updated.add(segments[s]);
+      }
+      segments = updated;
+    }
+    else
+    {
+      remove(segmentPath(merge->outputName).c_str());
+    }
+
+    pendingDeletes.clear();
+    delete merge;
+    merge = nullptr;
+  }
+
+  void cancelMerge()
+  {
+    if (merge == nullptr)
+      return;
+    merge->cancelled = true;
+    finishMerge(true);
+  }
+
+  bool isMergeInput(const IndexSegment *segment) const
+  {
+    if (merge == nullptr)
+      return false;
+    for (int i = 0; i < merge->inputs.getSize(); i++)
+    {
+      if (merge->inputs[i] == segment)
+        return true;
+    }
+    return false;
+  }
+
+  void clearDelta()
+  {
+    for (auto &entry : *terms)
+    {
+      delete entry.value();
+    }
+    terms->clear();
+    docKeys->clear();
+    docs.clear();
+    liveDocs = 0;
+    deletedDocs = 0;
+    totalLength = 0;
+  }
+
+  void closeSegments()
+  {
+    cancelMerge();
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      delete segments[s];
+    }
+    segments.clear();
+    obsoleteFiles.clear();
+  }
+
+  bool writeManifest(long long generation)
+  {
+    string tempPath = manifestPath() + ".tmp";
+    ofstream file(tempPath.c_str(), ios::trunc);
+    if (!file.is_open())
+      return false;
+
+    file << "generation=" << generation << endl;
+    file << "next=" << nextSegmentNumber << endl;
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      file << "segment=" << segments[s]->getName() << endl;
+      file << "deleted=";
+      const DynamicArray<bool> &deleted = segments[s]->getDeletedFlags();
+      bool first = true;
+      for (int d = 0; d < deleted.getSize(); d++)
+      {
+        if (deleted[d])
+        {
+          file << (first ? "" : ",") << d;
+          first = false;
+        }
+      }
+      file << endl;
+    }
+    file.close();
+    if (!file)
+      return false;
+
+    // rename() does not replace an existing file on Windows
+    remove(manifestPath().c_str());
+    return rename(tempPath.c_str(), manifestPath().c_str()) == 0;
+  }
+
+public:
+  SearchIndex()
+  {
+    terms = new HashMap<string, PostingList *>(1024);
+    docKeys = new HashMap<EmailId, int>(1024);
+    vocabulary = nullptr;
+    liveDocs = 0;
+    deletedDocs = 0;
+    totalLength = 0;
+    nextSegmentNumber = 1;
+    mergeFanIn = 4;
+    merge = nullptr;
+    updatesPaused = false;
+    vocabularyLoaded = false;
+
+    k1 = 1.2;
+    b = 0.75;
+    subjectWeight = 3.0;
+    bodyWeight = 1.0;
+    senderWeight = 2.0;
+    priorityBoost = 0.5;
+    recencyBoost = 0.5;
+    recencyHalfLifeDays = 30.0;
+    senderBoost = 0.5;
+    senderRank = nullptr;
+  }
+
+  ~SearchIndex()
+  {
+    clear();
+    delete terms;
+    delete docKeys;
+  }
+
+  // Splits text into lowercase alphanumeric tokens
+  static void tokenize(const string &text, DynamicArray<string> &tokens)
+  {
+    string current;
+    for (size_t i = 0; i < text.length(); i++)
+    {
+      unsigned char c = (unsigned char)text[i];
+      if (isalnum(c))
+      {
+        current += (char)tolower(c);
+      }
+      else if (!current.empty())
+      {
+        tokens.add(current);
+        current.clear();
+      }
+    }
+    if (!current.empty())
+    {
+      tokens.add(current);
+    }
+  }
+
+  // Sender field terms: the whole address plus the tokens of its local part
+  static void tokenizeAddress(const string &address, DynamicArray<string> &tokens)
+  {
+    string lower = address;
+    for (size_t i = 0; i < lower.length(); i++)
+    {
+      lower[i] = tolower((unsigned char)lower[i]);
+    }
+    if (lower.empty())
+      return;
+
+    tokens.add(lower);
+    size_t at = lower.find('@');
+    tokenize(at == string::npos ? lower : lower.substr(0, at), tokens);
+  }
+
+  // Query terms: words containing '@' are kept whole as address terms
+  static void parseQuery(const string &query, DynamicArray<string> &queryTerms)
+  {
+    DynamicArray<string> raw;
+    stringstream ss(query);
+    string word;
+    while (ss >> word)
+    {
+      if (word.find('@') != string::npos)
+      {
+        size_t start = word.find_first_not_of(",;:<>\"'()");
+        size_t end = word.find_last_not_of(",;:<>\"'().");
+        if (start != string::npos && end >= start)
+        {
+          string address = word.substr(start, end - start + 1);
+          for (size_t i = 0; i < address.length(); i++)
+          {
+            address[i] = tolower((unsigned char)address[i]);
+          }
+          raw.add(address);
+        }
+      }
+      else
+      {
+        tokenize(word, raw);
+      }
+    }
+
+    for (int i = 0; i < raw.getSize(); i++)
+    {
+      bool duplicate = false;
+      for (int j = 0; j < queryTerms.getSize(); j++)
+      {
+        if (queryTerms[j] == raw[i])
+        {
+          duplicate = true;
+          break;
+        }
+      }
+      if (!duplicate)
+      {
+        queryTerms.add(raw[i]);
+      }
+    }
+  }
+
+  // Short excerpt of content around the first query term occurrence
+  static string makeSnippet(const string &content, const DynamicArray<string> &queryTerms, int width = 80)
+  {
+    // Terms are lower case; the content is searched in place ignoring
+    // case, each later term only where it could start before the best so far
+    size_t best = string::npos;
+    for (int i = 0; i < queryTerms.getSize(); i++)
+    {
+      int termLength = (int)queryTerms[i].length();
+      int length = best == string::npos ? (int)content.length() : (int)best - 1 + termLength;
+      if (length > (int)content.length())
+        length = (int)content.length(); // A long term after a match near the end
+      int pos = TextKernels::findFolded(content.data(), length, queryTerms[i].data(), termLength);
+      if (pos != -1 && termLength > 0)
+      {
+        best = (size_t)pos;
+      }
+    }
+
+    size_t start = 0;
+    if (best != string::npos && best > (size_t)width / 3)
+    {
+      start = best - width / 3;
+      // Do not cut a word in half
+      size_t space = content.find(' ', start);
+      if (space != string::npos && space < best)
+        start = space + 1;
+    }
+
+    string snippet = content.substr(start, width);
+    if (start > 0)
+      snippet = "..." + snippet;
+    if (start + width < content.length())
+      snippet += "...";
+    return snippet;
+  }
+
+  // Indexes (or re-indexes) an email stored in the given folder
+  void addEmail(const Email &email, const string &folder)
+  {
+    if (updatesPaused)
+      return;
+
+    // Drops the older copy, whether in the delta or in a segment
+    removeEmail(folder, email.getId());
+
+    int docId = docs.getSize();
+    DocInfo doc;
+    doc.emailId = email.getId();
+    doc.folder = folder;
+    doc.sender = email.getSender();
+    doc.timestamp = email.getTimestamp();
+    doc.priority = email.getPriority();
+
+    // Count term frequencies per field for this document
+    HashMap<string, Posting> local(32);
+    DynamicArray<string> tokens;
+
+    tokenize(email.getSubject(), tokens);
+    for (int i = 0; i < tokens.getSize(); i++)
+    {
+      Posting *p = local.search(tokens[i]);
+      if (p == nullptr)
+        p = local.insert(tokens[i], Posting());
+      bump(p->subjectTf);
+      if (vocabulary != nullptr)
+        vocabulary->addTerm(tokens[i]);
+    }
+    doc.length += subjectWeight * tokens.getSize();
+
+    tokens.clear();
+    tokenize(email.getContent(), tokens);
+    for (int i = 0; i < tokens.getSize(); i++)
+    {
+      Posting *p = local.search(tokens[i]);
+      if (p == nullptr)
+        p = local.insert(tokens[i], Posting());
+      bump(p->bodyTf);
+    }
+    doc.length += bodyWeight * tokens.getSize();
+
+    tokens.clear();
+    tokenizeAddress(email.getSender(), tokens);
+    for (int i = 0; i < tokens.getSize(); i++)
+    {
+      Posting *p = local.search(tokens[i]);
+      if (p == nullptr)
+        p = local.insert(tokens[i], Posting());
+      bump(p->senderTf);
+      if (vocabulary != nullptr)
+        vocabulary->addTerm(tokens[i]);
+    }
+    doc.length += senderWeight * tokens.getSize();
+
+    for (auto &entry : local)
+    {
+      Posting posting = entry.value();
+      posting.docId = docId;
+      PostingList *list = getOrCreateList(entry.key());
+      list->postings.add(posting);
+      double tf = weightedTf(posting);
+      if (tf > list->maxWeightedTf)
+        list->maxWeightedTf = tf;
+    }
+
+    int *head = docKeys->search(doc.emailId);
+    if (head != nullptr)
+    {
+      doc.nextSameId = *head;
+      *head = docId;
+    }
+    else
+    {
+      docKeys->insert(doc.emailId, docId);
+    }
+    docs.add(doc);
+    liveDocs++;
+    totalLength += doc.length;
+  }
+
+  void removeEmail(const string &folder, EmailId emailId)
+  {
+    if (updatesPaused)
+      return;
+    finishMerge(false);
+
+    int docId = findDeltaDoc(folder, emailId);
+    if (docId == -1)
+    {
+      // Tombstone in the newest segment holding a live copy
+      for (int s = segments.getSize() - 1; s >= 0; s--)
+      {
+        int segmentDoc = segments[s]->findDocument(folder, emailId);
+        if (segmentDoc >= 0 && !segments[s]->isDeleted(segmentDoc))
+        {
+          segments[s]->markDeleted(segmentDoc);
+          if (isMergeInput(segments[s]))
+          {
+            DocKey key;
+            key.emailId = emailId;
+            key.folder = folder;
+            pendingDeletes.add(key);
+          }
+          return;
+        }
+      }
+      return;
+    }
+
+    unlinkDeltaDoc(docId);
+    DocInfo &doc = docs[docId];
+    doc.deleted = true;
+    liveDocs--;
+    deletedDocs++;
+    totalLength -= doc.length;
+
+    if (deletedDocs > 1024 && deletedDocs > liveDocs)
+    {
+      compact();
+    }
+  }
+
+  // Ranked retrieval. Fills hits with results [offset, offset + limit) in
+  // descending score order and returns the number of candidates scored.
+  // Once the k-th best partial score cannot be beaten by documents that
+  // have not been seen yet, later terms only update existing candidates.
+  // There is no cursor: a page at offset scores the candidates again and
+  // keeps the best offset + limit, O(candidates log(offset + limit)).
+  int search(const string &query, int offset, int limit, DynamicArray<SearchHit> &hits)
+  {
+    DynamicArray<string> queryTerms;
+    parseQuery(query, queryTerms);
+    DynamicArray<double> weights;
+    weights.resize(queryTerms.getSize(), 1.0);
+    return search(queryTerms, weights, offset, limit, hits);
+  }
+
+  // Same as above with already parsed terms, each scaled by its weight
+  // (used for typo corrections, which count for less than exact terms)
+  int search(const DynamicArray<string> &queryTerms, const DynamicArray<double> &weights,
+             int offset, int limit, DynamicArray<SearchHit> &hits)
+  {
+    finishMerge(false);
+    int live = getDocumentCount();
+    if (queryTerms.isEmpty() || live == 0 || limit <= 0)
+      return 0;
+
+    // Collection statistics over all layers
+    int k = offset + limit;
+    double totalDocs = liveDocs + deletedDocs;
+    double liveLength = totalLength;
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      totalDocs += segments[s]->getDocumentCount();
+      liveLength += segments[s]->getLiveLength();
+    }
+    double avgLength = liveLength > 0 ? liveLength / live : 1.0;
+    double minNorm = 1.0 - b; // Smallest length normalisation (empty document)
+
+    DynamicArray<QueryTerm> queryLists;
+    for (int i = 0; i < queryTerms.getSize(); i++)
+    {
+      QueryTerm qt;
+      double df = 0;
+      double tf = 0;
+
+      PostingList **list = terms->search(queryTerms[i]);
+      if (list != nullptr && !(*list)->postings.isEmpty())
+      {
+        qt.list = *list;
+        df += qt.list->postings.getSize();
+        tf = qt.list->maxWeightedTf;
+      }
+      for (int s = 0; s < segments.getSize(); s++)
+      {
+        int termIndex = segments[s]->findTerm(queryTerms[i]);
+        qt.segmentTerms.add(termIndex);
+        if (termIndex >= 0)
+        {
+          df += segments[s]->getDocFreq(termIndex);
+          if (segments[s]->getMaxWeightedTf(termIndex) > tf)
+            tf = segments[s]->getMaxWeightedTf(termIndex);
+        }
+      }
+      if (df == 0)
+        continue;
+
+      qt.idf = weights[i] * log(1.0 + (totalDocs - df + 0.5) / (df + 0.5));
+      qt.upperBound = qt.idf * tf * (k1 + 1.0) / (tf + k1 * minNorm);
+      queryLists.add(qt);
+    }
+    if (queryLists.isEmpty())
+      return 0;
+
+    // Highest impact terms first (insertion sort, queries are short)
+    for (int i = 1; i < queryLists.getSize(); i++)
+    {
+      QueryTerm current = queryLists[i];
+      int j = i - 1;
+      while (j >= 0 && queryLists[j].upperBound < current.upperBound)
+      {
+        queryLists[j + 1] = queryLists[j];
+        j--;
+      }
+      queryLists[j + 1] = current;
+    }
+
+    DynamicArray<double> remainingBound;
+    remainingBound.resize(queryLists.getSize() + 1, 0.0);
+    for (int i = queryLists.getSize() - 1; i >= 0; i--)
+    {
+      remainingBound[i] = remainingBound[i + 1] + queryLists[i].upperBound;
+    }
+
+    double boostBound = priorityBoost + recencyBoost + (senderRank != nullptr ? senderBoost : 0.0);
+    int deltaBase = segmentBase(segments.getSize());
+    if (accumulators.getSize() < deltaBase + docs.getSize())
+      accumulators.resize(deltaBase + docs.getSize(), 0.0);
+
+    bool candidatesClosed = false;
+    for (int t = 0; t < queryLists.getSize(); t++)
+    {
+      int base = 0;
+      for (int s = 0; s < segments.getSize(); s++)
+      {
+        int termIndex = queryLists[t].segmentTerms[s];
+        if (termIndex >= 0)
+        {
+          decoded.clear();
+          segments[s]->readPostings(termIndex, decoded); // A damaged list scores what decoded
+          accumulate(decoded, segments[s], base, queryLists[t].idf, avgLength, candidatesClosed);
+        }
+        base += segments[s]->getDocumentCount();
+      }
+      if (queryLists[t].list != nullptr)
+      {
+        accumulate(queryLists[t].list->postings, nullptr, deltaBase, queryLists[t].idf, avgLength, candidatesClosed);
+      }
+
+      // Can a document not seen so far still reach the top k?
+      if (!candidatesClosed && t + 1 < queryLists.getSize() && touched.getSize() >= k)
+      {
+        MinHeap<double> kth(k);
+        for (int i = 0; i < touched.getSize(); i++)
+        {
+          double score = accumulators[touched[i]];
+          if (!kth.isFull())
+            kth.insert(score);
+          else if (score > kth.peekMin())
+            kth.replaceMin(score);
+        }
+        if (kth.peekMin() >= remainingBound[t + 1] + boostBound)
+        {
+          candidatesClosed = true;
+        }
+      }
+    }
+
+    // Final scoring into a bounded min-heap holding the best k documents
+    time_t now = time(0);
+    MinHeap<ScoredDoc> top(k);
+    int candidates = touched.getSize();
+    for (int i = 0; i < candidates; i++)
+    {
+      int docId = touched[i];
+      double partial = accumulators[docId];
+      accumulators[docId] = 0.0;
+
+      if (top.isFull() && partial + boostBound <= top.peekMin().score)
+        continue;
+
+      ScoredDoc scored(partial + boostFor(describe(docId), now), docId);
+      if (!top.isFull())
+        top.insert(scored);
+      else if (top.peekMin() < scored)
+        top.replaceMin(scored);
+    }
+    touched.clear();
+
+    int count = top.getSize();
+    ScoredDoc *sorted = new ScoredDoc[count > 0 ? count : 1];
+    for (int i = count - 1; i >= 0; i--)
+    {
+      sorted[i] = top.extractMin();
+    }
+    for (int i = offset; i < count; i++)
+    {
+      DocInfo doc = describe(sorted[i].docId);
+      SearchHit hit;
+      hit.emailId = doc.emailId;
+      hit.folder = doc.folder;
+      hit.score = sorted[i].score;
+      hits.add(hit);
+    }
+    delete[] sorted;
+
+    return candidates;
+  }
+
+  // Term vocabulary fed with subject and sender terms as they are indexed
+  void setVocabulary(FuzzyMatcher *matcher) { vocabulary = matcher; }
+
+  // Boosts results by their sender's rank
+  void setSenderRank(const SenderRank *rank) { senderRank = rank; }
+
+  // Feeds the subject and sender terms of the opened segments to the
+  // vocabulary. Deferred until the first typo lookup so opening the index
+  // stays cheap.
+  void loadVocabulary()
+  {
+    if (vocabularyLoaded || vocabulary == nullptr)
+      return;
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      for (int t = 0; t < segments[s]->getTermCount(); t++)
+      {
+        if (segments[s]->isVocabularyTerm(t))
+          vocabulary->addTerm(segments[s]->getTerm(t));
+      }
+    }
+    vocabularyLoaded = true;
+  }
+
+  bool hasTerm(const string &term) const
+  {
+    PostingList **list = terms->search(term);
+    if (list != nullptr && !(*list)->postings.isEmpty())
+      return true;
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      if (segments[s]->findTerm(term) >= 0)
+        return true;
+    }
+    return false;
+  }
+
+  // Opens the persisted index in directory. Returns true if it matches
+  // the mailbox generation; otherwise stale files are dropped and the
+  // index starts empty, to be rebuilt as the mailbox is loaded.
+  bool open(const string &indexDirectory, long long generation)
+  {
+    clear();
+    directory = indexDirectory;
+
+    ifstream file(manifestPath().c_str());
+    if (!file.is_open())
+      return false;
+
+    long long savedGeneration = -1;
+    bool valid = true;
+    DynamicArray<string> listed;
+    string line;
+    while (getline(file, line))
+    {
+      size_t equals = line.find('=');
+      if (equals == string::npos)
+        continue;
+      string name = line.substr(0, equals);
+      string value = line.substr(equals + 1);
+
+      if (name == "generation")
+        savedGeneration = atoll(value.c_str());
+      else if (name == "next")
+        nextSegmentNumber = atoi(value.c_str());
+      else if (name == "segment")
+      {
+        listed.add(value);
+        IndexSegment *segment = new IndexSegment();
+        if (!segment->open(segmentPath(value), value))
+          valid = false;
+        segments.add(segment);
+      }
+      else if (name == "deleted" && !segments.isEmpty())
+      {
+        stringstream ss(value);
+        string docId;
+        while (getline(ss, docId, ','))
+        {
+          segments[segments.getSize() - 1]->markDeleted(atoi(docId.c_str()));
+        }
+      }
+    }
+    file.close();
+
+    if (valid && savedGeneration == generation)
+      return true;
+
+    closeSegments();
+    for (int i = 0; i < listed.getSize(); i++)
+    {
+      remove(segmentPath(listed[i]).c_str());
+    }
+    remove(manifestPath().c_str());
+    return false;
+  }
+
+  // Saves the index for the given mailbox generation: the delta becomes a
+  // new segment and the manifest records segments and tombstones. Starts
+  // a background merge when enough small segments have piled up.
+  bool persist(long long generation)
+  {
+    if (directory.empty())
+      return false;
+    finishMerge(false);
+
+    if (liveDocs > 0)
+    {
+      string name = "seg_" + to_string(nextSegmentNumber++) + ".idx";
+      DynamicArray<IndexSegment *> none;
+      DynamicArray<DynamicArray<bool> > noFlags;
+      if (!writeSegment(segmentPath(name), none, noFlags, true, nullptr))
+        return false;
+
+      IndexSegment *segment = new IndexSegment();
+      if (!segment->open(segmentPath(name), name))
+      {
+        delete segment;
+        return false;
+      }
+      segments.add(segment);
+      clearDelta();
+    }
+    else if (deletedDocs > 0)
+    {
+      clearDelta();
+    }
+
+    if (!writeManifest(generation))
+      return false;
+
+    for (int i = 0; i < obsoleteFiles.getSize(); i++)
+    {
+      remove(segmentPath(obsoleteFiles[i]).c_str());
+    }
+    obsoleteFiles.clear();
+
+    maybeStartMerge();
+    return true;
+  }
+
+  // While paused, addEmail and removeEmail are ignored (used while a
+  // mailbox that the opened index already covers is being loaded)
+  void setUpdatesPaused(bool paused) { updatesPaused = paused; }
+
+  int getDocumentCount() const
+  {
+    int count = liveDocs;
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      count += segments[s]->getLiveCount();
+    }
+    return count;
+  }
+
+  // Distinct terms per layer, summed
+  int getTermCount() const
+  {
+    int count = terms->getSize();
+    for (int s = 0; s < segments.getSize(); s++)
+    {
+      count += segments[s]->getTermCount();
+    }
+    return count;
+  }
+
+  int getSegmentCount() const { return segments.getSize(); }
+
+  // Closes all files and empties the index
+  void clear()
+  {
+    closeSegments();
+    clearDelta();
+    accumulators.clear();
+    touched.clear();
+    directory = "";
+    nextSegmentNumber = 1;
+    updatesPaused = false;
+    vocabularyLoaded = false;
+  }
+};
+
+#endif
@@ -0,0 +1,555 @@
+#ifndef SENDERRANK_H
+#define SENDERRANK_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <thread>
+#include "Array.h"
+#include "HashMap.h"
+using namespace std;
+
+// PageRank over the mail graph: an edge from each address to every
+// address it emails, weighted by the number of emails, and both ways
+// along each social connection, weighted by its strength. An address
+// ranks high when addresses that rank high write to it or know it. Scores
+// average 1 per address; one nobody writes to or knows stays at the
+// minimum, 1 - damping.
+//
+// Edges are kept in CSR form (the edges of each address in one run of an
+// array). Edges added since the last compaction are chained per address
+// until there are enough of them to compact again.
+//
+// The scores are an estimate p and a residual r, with
+//   scores = p + (I - d P^T)^-1 r
+// The first build runs power iterations on several threads and pushes
+// what is left of the residual. When an edge of u changes, only the
+// residual of u's neighbours moves (by d p(u) times the change of u's
+// transition row) and it is pushed on from there, so an update touches
+// the part of the graph around it instead of all of it.
+//
+// Given a source address the walk restarts there instead of anywhere,
+// which gives personalized PageRank with the same updates.
+class SenderRank
+{
+private:
+  struct Edge
+  {
+    int target;
+    int mails;    // Emails sent along the edge
+    float social; // Strength of a social connection, 0 if none
+
+    Edge() : target(0), mails(0), social(0) {}
+  };
+
+  struct PendingEdge
+  {
+    Edge edge;
+    int next; // Next pending edge of the same address, -1 at the end
+  };
+
+  // Addresses [first, last) of one power iteration thread
+  struct BuildSlice
+  {
+    SenderRank *rank;
+    int first;
+    int last;
+    double maxChange;
+  };
+
+  static const int MIN_PENDING = 1024;      // Compact after at least this many new edges
+  static const int MIN_PARALLEL = 1 << 12;  // Addresses below which the build runs on one thread
+  static const int MAX_ITERATIONS = 100;
+
+  HashMap<string, int> *ids;
+  DynamicArray<string> addresses;
+
+  // Compacted edges: those of address u are edges[offsets[u]] up to
+  // edges[offsets[u + 1]], for u below compactedCount
+  DynamicArray<int> offsets;
+  DynamicArray<Edge> edges;
+  int compactedCount;
+  DynamicArray<PendingEdge> pending;
+  DynamicArray<int> pendingHead; // Per address, -1 if none
+  DynamicArray<double> outWeight;
+
+  DynamicArray<double> estimate;
+  DynamicArray<double> residual;
+  DynamicArray<bool> queued;
+  DynamicArray<int> work; // Addresses whose residual is to be pushed, FIFO
+  int workHead;
+
+  // Transposed graph for the power iterations, only during build()
+  DynamicArray<int> inOffsets;
+  DynamicArray<int> inSources;
+  DynamicArray<double> inShares; // damping * edge weight / source weight
+  DynamicArray<double> stepped;
+
+  double damping;
+  double epsilon;          // Residuals up to this are left unpushed
+  double connectionWeight; // Emails a connection of strength 1 counts as
+  string source;           // Empty: global PageRank
+  int sourceId;
+  bool built;
+  bool changed; // Mail counts since the last load or save
+  long long pushes;
+
+  double weightOf(const Edge &edge) const
+  {
+    return edge.mails + connectionWeight * edge.social;
+  }
+
+  // Where the walk restarts
+  double restartWeight(int id) const
+  {
+    if (source.empty())
+      return 1.0;
+    return id == sourceId ? 1.0 : 0.0;
+  }
+
+  int idOf(const string &address)
+  {
+    int *id = ids->search(address);
+    if (id != nullptr)
+      return *id;
+
+    int newId = addresses.getSize();
+    ids->insert(address, newId);
+    addresses.add(address);
+    pendingHead.add(-1);
+    outWeight.add(0.0);
+    estimate.add(0.0);
+    residual.add(0.0);
+    queued.add(false);
+    if (!source.empty() && address == source)
+      sourceId = newId;
+    if (built)
+      addResidual(newId, (1.0 - damping) * restartWeight(newId));
+    return newId;
+  }
+
+  Edge *findEdge(int from, int to)
+  {
+    if (from < compactedCount)
+    {
+      for (int i = offsets[from]; i < offsets[from + 1]; i++)
+      {
+        if (edges[i].target == to)
+          return &edges[i];
+      }
+    }
+    for (int p = pendingHead[from]; p != -1; p = pending[p].next)
+    {
+      if (pending[p].edge.target == to)
+        return &pending[p].edge;
+    }
+    return nullptr;
+  }
+
+  void addResidual(int id, double amount)
+  {
+    residual[id] += amount;
+    if (!queued[id] && fabs(residual[id]) > epsilon)
+    {
+      queued[id] = true;
+      work.add(id);
+    }
+  }
+
+  // Adds share * weight to the residual of every address u links to
+  void spread(int from, double share)
+  {
+    if (from < compactedCount)
+    {
+      for (int i = offsets[from]; i < offsets[from + 1]; i++)
+      {
+        addResidual(edges[i].target, share * weightOf(edges[i]));
+      }
+    }
+    for (int p = pendingHead[from]; p != -1; p = pending[p].next)
+    {
+      addResidual(pending[p].edge.target, share * weightOf(pending[p].edge));
+    }
+  }
+
+  // Moves residual into the estimate until none is above epsilon
+  void push()
+  {
+    while (workHead < work.getSize())
+    {
+      int id = work[workHead++];
+      queued[id] = false;
+      double amount = residual[id];
+      if (fabs(amount) <= epsilon)
+        continue;
+      residual[id] = 0;
+      estimate[id] += amount;
+      pushes++;
+      if (outWeight[id] > 0)
+        spread(id, damping * amount / outWeight[id]);
+    }
+    work.clear();
+    workHead = 0;
+  }
+
+  // Adds mails and social strength to the edge from -> to and corrects the
+  // residuals for the new transition row of from
+  void changeEdge(int from, int to, int mails, double social)
+  {
+    if (mails == 0 && social == 0)
+      return;
+    // Before build() repeated mail edges are merged by compact() rather
+    // than looked up: a lookup walks the pending chain of the address
+    Edge *edge = built || social != 0 ? findEdge(from, to) : nullptr;
+    if (edge == nullptr)
+    {
+      PendingEdge added;
+      added.edge.target = to;
+      added.next = pendingHead[from];
+      pending.add(added);
+      pendingHead[from] = pending.getSize() - 1;
+      edge = &pending[pending.getSize() - 1].edge;
+    }
+
+    double delta = mails + connectionWeight * social;
+    double oldWeight = outWeight[from];
+    double newWeight = oldWeight + delta;
+    if (newWeight < 1e-9)
+      newWeight = 0;
+    if (built && estimate[from] != 0)
+    {
+      // Every edge keeps its weight but its share changes with the total;
+      // the changed edge also gets delta / total
+      double before = oldWeight > 0 ? 1.0 / oldWeight : 0.0;
+      double after = newWeight > 0 ? 1.0 / newWeight : 0.0;
+      spread(from, damping * estimate[from] * (after - before));
+      addResidual(to, damping * estimate[from] * delta * after);
+    }
+    edge->mails += mails;
+    edge->social += (float)social;
+    outWeight[from] = newWeight;
+
+    if (pending.getSize() >= MIN_PENDING && pending.getSize() * 4 >= edges.getSize())
+      compact();
+    if (built)
+      push();
+  }
+
+  // Adds an edge to the run being compacted, merged with an earlier one
+  // to the same address
+  void mergeEdge(const Edge &edge, DynamicArray<Edge> &run, DynamicArray<int> &position, int runStart)
+  {
+    int &at = position[edge.target];
+    if (at >= runStart)
+    {
+      run[at].mails += edge.mails;
+      run[at].social += edge.social;
+      return;
+    }
+    at = run.getSize();
+    run.add(edge);
+  }
+
+  // Merges the pending edges into the CSR arrays, one edge per address
+  // pair, dropping edges whose weight went back to 0
+  void compact()
+  {
+    int count = addresses.getSize();
+    DynamicArray<int> newOffsets;
+    newOffsets.resize(count + 1, 0);
+    DynamicArray<Edge> newEdges;
+    newEdges.reserve(edges.getSize() + pending.getSize());
+    DynamicArray<int> position; // Target -> index in newEdges, stale below the run
+    position.resize(count, -1);
+    for (int u = 0; u < count; u++)
+    {
+      int runStart = newEdges.getSize();
+      newOffsets[u] = runStart;
+      if (u < compactedCount)
+      {
+        for (int i = offsets[u]; i < offsets[u + 1]; i++)
+        {
+          mergeEdge(edges[i], newEdges, position, runStart);
+        }
+      }
+      for (int p = pendingHead[u]; p != -1; p = pending[p].next)
+      {
+        mergeEdge(pending[p].edge, newEdges, position, runStart);
+      }
+      pendingHead[u] = -1;
+
+      // Sums the weights again, without the drift of the updates
+      double weight = 0;
+      int kept = runStart;
+      for (int i = runStart; i < newEdges.getSize(); i++)
+      {
+        if (weightOf(newEdges[i]) > 1e-9)
+        {
+          newEdges[kept++] = newEdges[i];
+          weight += weightOf(newEdges[i]);
+        }
+      }
+      newEdges.resize(kept);
+      outWeight[u] = weight;
+    }
+    newOffsets[count] = newEdges.getSize();
+    offsets.swap(newOffsets);
+    edges.swap(newEdges);
+    compactedCount = count;
+    pending.clear();
+  }
+
+  // One power iteration step for a slice: stepped = (1 - d) s + d P^T estimate
+  void iterate(BuildSlice &slice)
+  {
+    double maxChange = 0;
+    for (int v = slice.first; v < slice.last; v++)
+    {
+      double sum = (1.0 - damping) * restartWeight(v);
+      for (int i = inOffsets[v]; i < inOffsets[v + 1]; i++)
+      {
+        sum += inShares[i] * estimate[inSources[i]];
+      }
+      double change = fabs(sum - estimate[v]);
+      if (change > maxChange)
+        maxChange = change;
+      stepped[v] = sum;
+    }
+    slice.maxChange = maxChange;
+  }
+
+  static void runSlice(BuildSlice *slice)
+  {
+    slice->rank->iterate(*slice);
+  }
+
+  // Runs one step over all slices, the first on this thread; returns the
+  // largest change of a score
+  double step(DynamicArray<BuildSlice> &slices)
+  {
+    int extra = slices.getSize() - 1;
+    thread *workers = extra > 0 ? new thread[extra] : nullptr;
+    for (int i = 0; i < extra; i++)
+    {
+      workers[i] = thread(runSlice, &slices[i + 1]);
+    }
+    runSlice(&slices[0]);
+    double maxChange = slices[0].maxChange;
+    for (int i = 0; i < extra; i++)
+    {
+      workers[i].join();
+      if (slices[i + 1].maxChange > maxChange)
+        maxChange = slices[i + 1].maxChange;
+    }
+    delete[] workers;
+    return maxChange;
+  }
+
+public:
+  // source: address to personalize for, empty for global PageRank
+  SenderRank(const string &sourceAddress = "")
+      : compactedCount(0), workHead(0), damping(0.85), epsilon(1e-4), connectionWeight(5.0),
+        source(sourceAddress), sourceId(-1), built(false), changed(false), pushes(0)
+  {
+    ids = new HashMap<string, int>(1024);
+    offsets.add(0);
+  }
+
+  ~SenderRank()
+  {
+    delete ids;
+  }
+
+  // Counts one email from -> to
+  void addMail(const string &from, const string &to)
+  {
+    if (from == to)
+      return;
+    int u = idOf(from);
+    int v = idOf(to);
+    changeEdge(u, v, 1, 0);
+    changed = true;
+  }
+
+  // Sets the social connection between two addresses, both ways; strength
+  // 0 removes it
+  void setConnection(const string &user1, const string &user2, int strength)
+  {
+    if (user1 == user2)
+      return;
+    int u = idOf(user1);
+    int v = idOf(user2);
+    Edge *edge = findEdge(u, v);
+    changeEdge(u, v, 0, strength - (edge != nullptr ? edge->social : 0));
+    edge = findEdge(v, u);
+    changeEdge(v, u, 0, strength - (edge != nullptr ? edge->social : 0));
+  }
+
+  // Computes all scores: power iterations split over threadCount threads
+  // (0: one per core), then pushes of the remaining residual. Later edge
+  // changes update the scores as they come.
+  void build(int threadCount = 0)
+  {
+    compact();
+    int count = addresses.getSize();
+
+    // Transposed graph, each edge with its share of its source's weight
+    inOffsets.clear();
+    inOffsets.resize(count + 1, 0);
+    for (int i = 0; i < edges.getSize(); i++)
+    {
+      inOffsets[edges[i].target + 1]++;
+    }
+    for (int v = 0; v < count; v++)
+    {
+      inOffsets[v + 1] += inOffsets[v];
+    }
+    DynamicArray<int> fill = inOffsets;
+    inSources.resize(edges.getSize(), 0);
+    inShares.resize(edges.getSize(), 0.0);
+    for (int u = 0; u < count; u++)
+    {
+      for (int i = offsets[u]; i < offsets[u + 1]; i++)
+      {
+        int position = fill[edges[i].target]++;
+        inSources[position] = u;
+        inShares[position] = damping * weightOf(edges[i]) / outWeight[u];
+      }
+    }
+
+    // Slices of about equal work (addresses plus incoming edges)
+    if (threadCount <= 0)
+      threadCount = (int)thread::hardware_concurrency();
+    if (threadCount <= 0 || count < MIN_PARALLEL)
+      threadCount = 1;
+    DynamicArray<BuildSlice> slices;
+    long long total = (long long)count + edges.getSize();
+    int first = 0;
+    for (int t = 0; t < threadCount; t++)
+    {
+      long long target = total * (t + 1) / threadCount;
+      int last = first;
+      while (last < count && (long long)last + inOffsets[last] < target)
+      {
+        last++;
+      }
+      if (t == threadCount - 1)
+        last = count;
+      BuildSlice slice;
+      slice.rank = this;
+      slice.first = first;
+      slice.last = last;
+      slice.maxChange = 0;
+      slices.add(slice);
+      first = last;
+    }
+
+    for (int v = 0; v < count; v++)
+    {
+      estimate[v] = restartWeight(v);
+      residual[v] = 0;
+      queued[v] = false;
+    }
+    stepped.resize(count, 0.0);
+    for (int i = 0; i < MAX_ITERATIONS; i++)
+    {
+      double maxChange = step(slices);
+      estimate.swap(stepped);
+      if (maxChange < epsilon)
+        break;
+    }
+
+    // What one more step would add is the residual: (1 - d) s - p + d P^T p
+    step(slices);
+    work.clear();
+    workHead = 0;
+    built = true;
+    for (int v = 0; v < count; v++)
+    {
+      addResidual(v, stepped[v] - estimate[v]);
+    }
+    push();
+
+    inOffsets.clear();
+    inSources.clear();
+    inShares.clear();
+    stepped.clear();
+  }
+
+  // Score of an address, 0 if it is not in the graph
+  double getScore(const string &address) const
+  {
+    const int *id = ids->search(address);
+    return id != nullptr ? estimate[*id] : 0.0;
+  }
+
+  // Score mapped to [0, 1): score / (score + 1), 0.5 for an average address
+  double getTrust(const string &address) const
+  {
+    double score = getScore(address);
+    return score > 0 ? score / (score + 1.0) : 0.0;
+  }
+
+  // Score of an address nothing points at
+  double getMinimumScore() const { return 1.0 - damping; }
+
+  // One "from,to,emails" line per address pair that mail went between
+  bool save(const string &path)
+  {
+    if (!changed)
+      return true;
+    ofstream file(path, ios::trunc);
+    if (!file.is_open())
+      return false;
+    for (int u = 0; u < addresses.getSize(); u++)
+    {
+      if (u < compactedCount)
+      {
+        for (int i = offsets[u]; i < offsets[u + 1]; i++)
+        {
+          if (edges[i].mails > 0)
+            file << addresses[u] << "," << addresses[edges[i].target] << "," << edges[i].mails << endl;
+        }
+      }
+      for (int p = pendingHead[u]; p != -1; p = pending[p].next)
+      {
+        if (pending[p].edge.mails > 0)
+          file << addresses[u] << "," << addresses[pending[p].edge.target] << "," << pending[p].edge.mails << endl;
+      }
+    }
+    file.close();
+    changed = false;
+    return true;
+  }
+
+  // Adds the mail counts of a saved file; false if there is none
+  bool load(const string &path)
+  {
+    ifstream file(path);
+    if (!file.is_open())
+      return false;
+    string line;
+    while (getline(file, line))
+    {
+      size_t first = line.find(',');
+      size_t second = first != string::npos ? line.find(',', first + 1) : string::npos;
+      if (second == string::npos)
+        continue;
+      string from = line.substr(0, first);
+      string to = line.substr(first + 1, second - first - 1);
+      int mails = atoi(line.substr(second + 1).c_str());
+      if (from != to && mails > 0)
+        changeEdge(idOf(from), idOf(to), mails, 0);
+    }
+    file.close();
+    return true;
+  }
+
+  int getAddressCount() const { return addresses.getSize(); }
+  int getEdgeCount() const { return edges.getSize() + pending.getSize(); }
+  long long getPushCount() const { return pushes; }
+  bool isBuilt() const { return built; }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SLOTBITMAP_H
+#define SLOTBITMAP_H
+
+#include <iostream>
+#include "Array.h"
+using namespace std;
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Set of folder slot numbers, one bit per slot. Folders reuse freed slots,
+// so slot numbers stay dense and a plain bitmap is as small as a
+// compressed set would be. Sets are combined a 64-bit word at a time.
+class SlotBitmap
+{
+private:
+  DynamicArray<unsigned long long> words;
+  int count;
+
+public:
+  SlotBitmap()
+  {
+    count = 0;
+  }
+
+  void add(int slot)
+  {
+    int word = slot >> 6;
+    if (word >= words.getSize())
+      words.resize(word + 1, 0);
+    unsigned long long bit = 1ULL << (slot & 63);
+    if ((words[word] & bit) == 0)
+    {
+      words[word] |= bit;
+      count++;
+    }
+  }
+
+  void remove(int slot)
+  {
+    int word = slot >> 6;
+    if (word >= words.getSize())
+      return;
+    unsigned long long bit = 1ULL << (slot & 63);
+    if ((words[word] & bit) != 0)
+    {
+      words[word] &= ~bit;
+      count--;
+    }
+  }
+
+  void set(int slot, bool on)
+  {
+    if (on)
+      add(slot);
+    else
+      remove(slot);
+  }
+
+  bool contains(int slot) const
+  {
+    int word = slot >> 6;
+    return word < words.getSize() && (words[word] & (1ULL << (slot & 63))) != 0;
+  }
+
+  // Word i of the bitmap, 0 past the end
+  unsigned long long word(int i) const
+  {
+    return i < words.getSize() ? words[i] : 0;
+  }
+
+  int getWordCount() const { return words.getSize(); }
+  int getCount() const { return count; }
+
+  void clear()
+  {
+    words = DynamicArray<unsigned long long>();
+    count = 0;
+  }
+
+  // Index of the lowest set bit of a non-zero word
+  static int lowestBit(unsigned long long word)
+  {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+  }
+};
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef SORTEDVIEW_H
+#define SORTEDVIEW_H
+
+#include <iostream>
+#include <cctype>
+#include "Array.h"
+#include "SlotBitmap.h"
+using namespace std;
+
+// Orders a folder can be listed in. Ties keep arrival order.
+enum SortOrder
+{
+  SORT_ARRIVAL,         // Oldest arrival first (the folder's own order)
+  SORT_DATE_ASCENDING,  // Oldest timestamp first
+  SORT_DATE_DESCENDING, // Newest timestamp first
+  SORT_PRIORITY,        // Highest priority first, then newest
+  SORT_SENDER,          // Sender address A-Z, ignoring case
+  SORT_SUBJECT,         // Subject A-Z, ignoring case
+  SORT_ORDER_COUNT
+};
+
+inline const char *sortOrderName(SortOrder order)
+{
+  switch (order)
+  {
+  case SORT_DATE_ASCENDING:
+    return "Oldest";
+  case SORT_DATE_DESCENDING:
+    return "Newest";
+  case SORT_PRIORITY:
+    return "Priority";
+  case SORT_SENDER:
+    return "Sender";
+  case SORT_SUBJECT:
+    return "Subject";
+  default:
+    return "Arrival";
+  }
+}
+
+// The sort keys behind the orders; both date orders read the same view
+enum SortKey
+{
+  SORT_KEY_DATE,
+  SORT_KEY_PRIORITY,
+  SORT_KEY_SENDER,
+  SORT_KEY_SUBJECT,
+  SORT_KEY_COUNT
+};
+
+// A folder's slots sorted by one key, kept between calls. Each entry packs
+// the key above the slot number, (key << slotBits) | slot, so sorting and
+// merging move one 64-bit word per email. Emails added (or changed) after
+// the sort wait in pending and removed ones are marked dead; the owner
+// merges both in the next time the view is read, instead of sorting
+// everything again.
+struct SortedView
+{
+  bool built;
+  int slotBits;                             // Low bits of an entry holding the slot
+  DynamicArray<unsigned long long> entries; // Sorted
+  DynamicArray<int> positions;              // Slot -> index in entries, built when first needed
+  bool positionsValid;
+  DynamicArray<int> pending; // Slots to merge in
+  SlotBitmap pendingSlots;   // Which pending entries are still wanted
+  SlotBitmap dead;           // Slots whose sorted entry is gone
+  int deadCount;
+
+  SortedView()
+  {
+    built = false;
+    slotBits = 1;
+    positionsValid = false;
+    deadCount = 0;
+  }
+
+  bool isCurrent() const { return pending.getSize() == 0 && deadCount == 0; }
+  int getKeyBits() const { return 64 - slotBits; }
+  int slotAt(int i) const { return (int)(entries[i] & ((1ULL << slotBits) - 1)); }
+  unsigned long long pack(unsigned long long key, int slot) const { return (key << slotBits) | (unsigned long long)slot; }
+
+  void added(int slot)
+  {
+    if (!built)
+      return;
+    pending.add(slot);
+    pendingSlots.add(slot);
+  }
+
+  void removed(int slot)
+  {
+    if (!built)
+      return;
+    if (pendingSlots.contains(slot))
+    {
+      pendingSlots.remove(slot);
+    }
+    else if (!dead.contains(slot))
+    {
+      dead.add(slot);
+      deadCount++;
+    }
+  }
+
+  void clear()
+  {
+    built = false;
+    entries = DynamicArray<unsigned long long>();
+    positions = DynamicArray<int>();
+    positionsValid = false;
+    pending = DynamicArray<int>();
+    pendingSlots.clear();
+    dead.clear();
+    deadCount = 0;
+  }
+
+  // Bits needed to store the numbers 0..n-1 (at least 1)
+  static int bitsFor(long long n)
+  {
+    int bits = 1;
+    while ((1LL << bits) < n)
+    {
+      bits++;
+    }
+    return bits;
+  }
+
+  // Stable LSD radix sort of 64-bit values by their bits from lowBit up,
+  // 11 bits per pass. Digits that are the same in every value are skipped,
+  // so a date sort takes three passes.
+  static void radixSort(DynamicArray<unsigned long long> &values, int lowBit)
+  {
+    const int DIGIT_BITS = 11;
+    const int BUCKETS = 1 << DIGIT_BITS;
+    int n = values.getSize();
+    if (n <= 32)
+    {
+      // Too few for the count tables to pay off: stable insertion sort
+      for (int i = 1; i < n; i++)
+      {
+        unsigned long long moving = values[i];
+        int j = i;
+        while (j > 0 && (values[j - 1] >> lowBit) > (moving >> lowBit))
+        {
+          values[j] = values[j - 1];
+          j--;
+        }
+        values[j] = moving;
+      }
+      return;
+    }
+
+    // Only digits where some values differ need a pass
+    unsigned long long *value = values.raw();
+    unsigned long long differing = 0;
+    for (int i = 1; i < n; i++)
+    {
+      differing |= value[i] ^ value[0];
+    }
+    int shifts[8];
+    int passes = 0;
+    for (int shift = lowBit; shift < 64; shift += DIGIT_BITS)
+    {
+      if (((differing >> shift) & (BUCKETS - 1)) != 0)
+        shifts[passes++] = shift;
+    }
+    if (passes == 0)
+      return;
+
+    DynamicArray<int> counts;
+    counts.resize(passes * BUCKETS, 0);
+    for (int i = 0; i < n; i++)
+    {
+      for (int p = 0; p < passes; p++)
+      {
+        counts[p * BUCKETS + (int)((value[i] >> shifts[p]) & (BUCKETS - 1))]++;
+      }
+    }
+
+    DynamicArray<unsigned long long> buffer;
+    buffer.resize(n, 0);
+    unsigned long long *from = values.raw(), *to = buffer.raw();
+    for (int p = 0; p < passes; p++)
+    {
+      int shift = shifts[p];
+      int *count = counts.raw() + p * BUCKETS;
+      int start = 0;
+      for (int bucket = 0; bucket < BUCKETS; bucket++)
+      {
+        int c = count[bucket];
+        count[bucket] = start;
+        start += c;
+      }
+      for (int i = 0; i < n; i++)
+      {
+        to[count[(from[i] >> shift) & (BUCKETS - 1)]++] = from[i];
+      }
+      unsigned long long *swap = from;
+      from = to;
+      to = swap;
+    }
+
+    // An odd number of passes leaves the result in the buffer
+    if (from != values.raw())
+      values.swap(buffer);
+  }
+
+  // A text where it is stored (mailbox arena or address table), read in
+  // place while sorting
+  struct TextSpan
+  {
+    const char *data;
+    int length;
+
+    TextSpan(const char *d = nullptr, int l = 0) : data(d), length(d != nullptr ? l : 0) {}
+  };
+
+  // Bytes of a text from offset on, lower-cased, as a big-endian number (0
+  // past the end), so numbers compare like the texts do over those bytes
+  static unsigned long long textKey(const TextSpan &text, int offset, int bytes)
+  {
+    unsigned long long key = 0;
+    for (int i = offset; i < offset + bytes; i++)
+    {
+      unsigned char c = i < text.length ? (unsigned char)tolower((unsigned char)text.data[i]) : 0;
+      key = (key << 8) | c;
+    }
+    return key;
+  }
+
+  // Compares texts ignoring case, from byte from on: <0, 0 or >0
+  static int compareText(const TextSpan &a, const TextSpan &b, int from = 0)
+  {
+    int length = a.length < b.length ? a.length : b.length;
+    for (int i = from; i < length; i++)
+    {
+      int ca = tolower((unsigned char)a.data[i]);
+      int cb = tolower((unsigned char)b.data[i]);
+      if (ca != cb)
+        return ca - cb;
+    }
+    return a.length - b.length;
+  }
+
+  // Stable sort of order (indexes into texts, all equal up to byte depth)
+  // by the rest of the texts, ignoring case: radix sorts on the next bytes,
+  // then again inside each group that is still equal, until the texts end
+  static void sortTexts(const DynamicArray<TextSpan> &texts, DynamicArray<int> &order, int depth)
+  {
+    int n = order.getSize();
+    if (n <= 16)
+    {
+      // Small groups: insertion sort, stable as well
+      for (int i = 1; i < n; i++)
+      {
+        int moving = order[i];
+        int j = i;
+        while (j > 0 && compareText(texts[order[j - 1]], texts[moving], depth) > 0)
+        {
+          order[j] = order[j - 1];
+          j--;
+        }
+        order[j] = moving;
+      }
+      return;
+    }
+
+    int indexBits = bitsFor(texts.getSize());
+    int bytes = (64 - indexBits) / 8;
+
+    DynamicArray<unsigned long long> packed(n);
+    bool longer = false;
+    for (int i = 0; i < n; i++)
+    {
+      const TextSpan &text = texts[order[i]];
+      packed.add((textKey(text, depth, bytes) << indexBits) | (unsigned long long)order[i]);
+      longer = longer || text.length > depth + bytes;
+    }
+    radixSort(packed, indexBits);
+    for (int i = 0; i < n; i++)
+    {
+      order[i] = (int)(packed[i] & ((1ULL << indexBits) - 1));
+    }
+    if (!longer)
+      return;
+
+    for (int start = 0; start < n;)
+    {
+      int end = start + 1;
+      while (end < n && (packed[end] >> indexBits) == (packed[start] >> indexBits))
+      {
+        end++;
+      }
+      if (end - start > 1)
+      {
+        DynamicArray<int> group(end - start);
+        for (int i = start; i < end; i++)
+        {
+          group.add(order[i]);
+        }
+        sortTexts(texts, group, depth + bytes);
+        for (int i = start; i < end; i++)
+        {
+          order[i] = group[i - start];
+        }
+      }
+      start = end;
+    }
+  }
+};
+
+#endif
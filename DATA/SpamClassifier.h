@@ -0,0 +1,438 @@
+#ifndef SPAMCLASSIFIER_H
+#define SPAMCLASSIFIER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include "Array.h"
+#include "HashMap.h"
+#include "Email.h"
+using namespace std;
+
+// Tokens of a text for the spam model: runs of ASCII letters and digits,
+// lower-cased and hashed as they are read, so nothing is copied. Subject
+// tokens are hashed with another seed and count as separate features.
+class TokenHasher
+{
+private:
+  const char *text;
+  int length;
+  int position;
+  unsigned long long seed;
+
+public:
+  TokenHasher(const char *t, int l, unsigned long long s) : text(t), length(t != nullptr ? l : 0), position(0), seed(s) {}
+
+  // Hash of the next token; false at the end of the text
+  bool next(unsigned long long &hash)
+  {
+    while (position < length && !isTokenByte(text[position]))
+    {
+      position++;
+    }
+    if (position == length)
+      return false;
+
+    unsigned long long h = seed;
+    while (position < length && isTokenByte(text[position]))
+    {
+      char c = text[position++];
+      h ^= (unsigned char)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+      h *= 1099511628211ULL;
+    }
+    hash = h ^ (h >> 29);
+    return true;
+  }
+
+  static bool isTokenByte(char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+  }
+};
+
+// Multinomial naive Bayes over hashed tokens, trained one email at a time.
+// Tokens hash into a fixed number of features, so memory does not grow
+// with the vocabulary. Next to the counts each feature keeps
+// log(spam + 1) - log(ham + 1), updated when it is trained; the token
+// totals only add the same amount for every token, so scoring is one
+// table read per token plus a few logs per email.
+class BayesModel
+{
+private:
+  static const int FEATURE_BITS = 16;
+  static const int FEATURE_COUNT = 1 << FEATURE_BITS;
+  static const unsigned int FILE_MAGIC = 0x53424D31; // "SBM1"
+
+  DynamicArray<unsigned int> spamCounts; // Token occurrences per feature
+  DynamicArray<unsigned int> hamCounts;
+  DynamicArray<float> weights; // log(spam + 1) - log(ham + 1)
+  unsigned long long spamTokens;
+  unsigned long long hamTokens;
+  int spamEmails;
+  int hamEmails;
+  bool changed; // Since the last load or save
+
+  static const unsigned long long SUBJECT_SEED = 0x9E3779B97F4A7C15ULL;
+  static const unsigned long long CONTENT_SEED = 1469598103934665603ULL;
+
+  void updateWeight(int feature)
+  {
+    weights[feature] = (float)(log(spamCounts[feature] + 1.0) - log(hamCounts[feature] + 1.0));
+  }
+
+  // Adds one text's tokens to a class
+  void count(const char *text, int length, unsigned long long seed, bool spam)
+  {
+    DynamicArray<unsigned int> &counts = spam ? spamCounts : hamCounts;
+    unsigned long long &tokens = spam ? spamTokens : hamTokens;
+    TokenHasher hasher(text, length, seed);
+    unsigned long long hash;
+    while (hasher.next(hash))
+    {
+      int feature = (int)(hash & (FEATURE_COUNT - 1));
+      counts[feature]++;
+      tokens++;
+      updateWeight(feature);
+    }
+  }
+
+  // Sum of the feature weights of a text's tokens; counts them in tokens
+  double sumWeights(const char *text, int length, unsigned long long seed, int &tokens) const
+  {
+    const float *weight = weights.raw();
+    TokenHasher hasher(text, length, seed);
+    unsigned long long hash;
+    double sum = 0;
+    while (hasher.next(hash))
+    {
+      sum += weight[hash & (FEATURE_COUNT - 1)];
+      tokens++;
+    }
+    return sum;
+  }
+
+public:
+  // Emails of each class needed before the model is trusted
+  static const int MIN_TRAINING_EMAILS = 5;
+
+  BayesModel()
+  {
+    clear();
+  }
+
+  // Learns one email as spam or not
+  void train(const Email &email, bool spam)
+  {
+    const TextArena &arena = TextArena::mailbox();
+    TextRef subject = email.getSubjectRef();
+    TextRef content = email.getContentRef();
+    count(arena.data(subject), (int)subject.length, SUBJECT_SEED, spam);
+    count(arena.data(content), (int)content.length, CONTENT_SEED, spam);
+    if (spam)
+      spamEmails++;
+    else
+      hamEmails++;
+    changed = true;
+  }
+
+  // log P(spam | email) - log P(ham | email), with add-one smoothing over
+  // the features. One pass over the tokens.
+  double logOdds(const Email &email) const
+  {
+    const TextArena &arena = TextArena::mailbox();
+    TextRef subject = email.getSubjectRef();
+    TextRef content = email.getContentRef();
+    return logOdds(arena.data(subject), (int)subject.length, arena.data(content), (int)content.length);
+  }
+
+  // The same from plain text
+  double logOdds(const char *subject, int subjectLength, const char *content, int contentLength) const
+  {
+    int tokens = 0;
+    double sum = sumWeights(subject, subjectLength, SUBJECT_SEED, tokens) +
+                 sumWeights(content, contentLength, CONTENT_SEED, tokens);
+    double prior = log(spamEmails + 1.0) - log(hamEmails + 1.0);
+    double totals = log((double)hamTokens + FEATURE_COUNT) - log((double)spamTokens + FEATURE_COUNT);
+    return prior + sum + tokens * totals;
+  }
+
+  double spamProbability(const Email &email) const
+  {
+    return toProbability(logOdds(email));
+  }
+
+  static double toProbability(double logOdds)
+  {
+    if (logOdds > 40)
+      return 1.0;
+    if (logOdds < -40)
+      return 0.0;
+    return 1.0 / (1.0 + exp(-logOdds));
+  }
+
+  bool isTrained() const { return spamEmails >= MIN_TRAINING_EMAILS && hamEmails >= MIN_TRAINING_EMAILS; }
+  int getSpamEmails() const { return spamEmails; }
+  int getHamEmails() const { return hamEmails; }
+  bool hasChanged() const { return changed; }
+
+  // Changes whenever the model is trained: training only adds, so the
+  // totals identify what it has learned
+  unsigned long long getVersion() const
+  {
+    unsigned long long h = hashKey((unsigned long long)spamEmails << 32 | (unsigned int)hamEmails);
+    h = hashKey(h ^ spamTokens);
+    return hashKey(h ^ hamTokens);
+  }
+
+  unsigned long long getMemoryBytes() const
+  {
+    return (unsigned long long)FEATURE_COUNT * (2 * sizeof(unsigned int) + sizeof(float));
+  }
+
+  // Binary file: magic, feature bits, email and token totals, then the
+  // spam and ham counts. The weights are recomputed on load.
+  bool save(const string &path)
+  {
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open())
+      return false;
+    unsigned int header[2] = {FILE_MAGIC, (unsigned int)FEATURE_BITS};
+    int emails[2] = {spamEmails, hamEmails};
+    unsigned long long tokens[2] = {spamTokens, hamTokens};
+    out.write((const char *)header, sizeof(header));
+    out.write((const char *)emails, sizeof(emails));
+    out.write((const char *)tokens, sizeof(tokens));
+    out.write((const char *)spamCounts.raw(), FEATURE_COUNT * sizeof(unsigned int));
+    out.write((const char *)hamCounts.raw(), FEATURE_COUNT * sizeof(unsigned int));
+    out.close();
+    if (out.fail())
+      return false;
+    changed = false;
+    return true;
+  }
+
+  // An empty model if the file is missing or from another layout
+  bool load(const string &path)
+  {
+    clear();
+    ifstream in(path.c_str(), ios::binary);
+    if (!in.is_open())
+      return false;
+    unsigned int header[2] = {0, 0};
+    int emails[2] = {0, 0};
+    unsigned long long tokens[2] = {0, 0};
+    in.read((char *)header, sizeof(header));
+    if (!in || header[0] != FILE_MAGIC || header[1] != (unsigned int)FEATURE_BITS)
+      return false;
+    in.read((char *)emails, sizeof(emails));
+    in.read((char *)tokens, sizeof(tokens));
+    in.read((char *)spamCounts.raw(), FEATURE_COUNT * sizeof(unsigned int));
+    in.read((char *)hamCounts.raw(), FEATURE_COUNT * sizeof(unsigned int));
+    if (!in)
+    {
+      clear();
+      return false;
+    }
+    spamEmails = emails[0];
+    hamEmails = emails[1];
+    spamTokens = tokens[0];
+    hamTokens = tokens[1];
+    for (int feature = 0; feature < FEATURE_COUNT; feature++)
+    {
+      updateWeight(feature);
+    }
+    return true;
+  }
+
+  void clear()
+  {
+    spamCounts = DynamicArray<unsigned int>();
+    hamCounts = DynamicArray<unsigned int>();
+    weights = DynamicArray<float>();
+    spamCounts.resize(FEATURE_COUNT, 0);
+    hamCounts.resize(FEATURE_COUNT, 0);
+    weights.resize(FEATURE_COUNT, 0.0f);
+    spamTokens = 0;
+    hamTokens = 0;
+    spamEmails = 0;
+    hamEmails = 0;
+    changed = false;
+  }
+};
+
+// A user's model and the model shared by all users, trained together.
+// The user's model takes over from the shared one as it learns: its share
+// of the log odds is emails / (emails + USER_WEIGHT_EMAILS).
+class SpamClassifier
+{
+private:
+  // Other users' models (768 KB each), least recently used one replaced
+  static const int RECEIVER_MODELS = 4;
+
+  BayesModel *sharedModel;
+  BayesModel *userModel;
+  BayesModel *receiverModels[RECEIVER_MODELS]; // Loaded on first use
+  string sharedPath;
+  string userPath;                          // Empty while no user is logged in
+  string receiverPaths[RECEIVER_MODELS];    // Empty for a free slot
+  unsigned long long receiverUses[RECEIVER_MODELS]; // Last use, for the LRU choice
+  unsigned long long useClock;
+
+  // Slot holding the model saved at path, loading it into the least
+  // recently used slot if none does
+  int receiverSlot(const string &path)
+  {
+    int victim = 0;
+    for (int i = 0; i < RECEIVER_MODELS; i++)
+    {
+      if (receiverPaths[i] == path)
+      {
+        receiverUses[i] = ++useClock;
+        return i;
+      }
+      if (receiverUses[i] < receiverUses[victim])
+        victim = i;
+    }
+    if (receiverModels[victim] == nullptr)
+      receiverModels[victim] = new BayesModel();
+    receiverModels[victim]->load(path);
+    receiverPaths[victim] = path;
+    receiverUses[victim] = ++useClock;
+    return victim;
+  }
+
+public:
+  static const int USER_WEIGHT_EMAILS = 20;
+
+  SpamClassifier()
+  {
+    sharedModel = new BayesModel();
+    userModel = new BayesModel();
+    for (int i = 0; i < RECEIVER_MODELS; i++)
+    {
+      receiverModels[i] = nullptr;
+      receiverUses[i] = 0;
+    }
+    useClock = 0;
+  }
+
+  ~SpamClassifier()
+  {
+    delete sharedModel;
+    delete userModel;
+    for (int i = 0; i < RECEIVER_MODELS; i++)
+    {
+      delete receiverModels[i];
+    }
+  }
+
+  void openShared(const string &path)
+  {
+    sharedPath = path;
+    sharedModel->load(path);
+  }
+
+  void openUser(const string &path)
+  {
+    userPath = path;
+    userModel->load(path);
+    for (int i = 0; i < RECEIVER_MODELS; i++)
+    {
+      if (receiverPaths[i] == path)
+      {
+        receiverPaths[i] = ""; // Trained from now on; reloaded once saved
+        receiverUses[i] = 0;
+      }
+    }
+  }
+
+  // Saves what changed; the user's model is dropped when closeUser is set
+  void save(bool closeUser = false)
+  {
+    if (!sharedPath.empty() && sharedModel->hasChanged())
+      sharedModel->save(sharedPath);
+    if (!userPath.empty() && userModel->hasChanged())
+      userModel->save(userPath);
+    if (closeUser)
+    {
+      userPath = "";
+      userModel->clear();
+    }
+  }
+
+  void train(const Email &email, bool spam)
+  {
+    sharedModel->train(email, spam);
+    if (!userPath.empty())
+      userModel->train(email, spam);
+  }
+
+  double logOdds(const Email &email) const
+  {
+    int userEmails = userModel->getSpamEmails() + userModel->getHamEmails();
+    if (!userModel->isTrained())
+      return sharedModel->logOdds(email);
+    double share = (double)userEmails / (userEmails + USER_WEIGHT_EMAILS);
+    return share * userModel->logOdds(email) + (1 - share) * sharedModel->logOdds(email);
+  }
+
+  // logOdds() for any pair of models and plain text, for scoring other
+  // users' mail off the main thread
+  static double blendLogOdds(const BayesModel &shared, const BayesModel &user, const char *subject,
+                             int subjectLength, const char *content, int contentLength)
+  {
+    if (!user.isTrained())
+      return shared.logOdds(subject, subjectLength, content, contentLength);
+    int userEmails = user.getSpamEmails() + user.getHamEmails();
+    double share = (double)userEmails / (userEmails + USER_WEIGHT_EMAILS);
+    return share * user.logOdds(subject, subjectLength, content, contentLength) +
+           (1 - share) * shared.logOdds(subject, subjectLength, content, contentLength);
+  }
+
+  bool isTrained() const { return sharedModel->isTrained() || userModel->isTrained(); }
+
+  // logOdds() as another user would judge the email: the model saved at
+  // path blended with the shared one, 0 while neither is trained. The last
+  // RECEIVER_MODELS such models stay loaded, so mail to a few people in
+  // turn loads each model once; the logged-in user's own path uses
+  // logOdds().
+  double receiverLogOdds(const string &path, const Email &email)
+  {
+    if (path == userPath)
+      return isTrained() ? logOdds(email) : 0;
+    const BayesModel &receiverModel = *receiverModels[receiverSlot(path)];
+    if (!sharedModel->isTrained() && !receiverModel.isTrained())
+      return 0;
+    const TextArena &arena = TextArena::mailbox();
+    TextRef subject = email.getSubjectRef();
+    TextRef content = email.getContentRef();
+    return blendLogOdds(*sharedModel, receiverModel, arena.data(subject), (int)subject.length, arena.data(content),
+                        (int)content.length);
+  }
+
+  // Probability of spam, -1 while neither model has enough training
+  double spamProbability(const Email &email) const
+  {
+    if (!isTrained())
+      return -1;
+    return BayesModel::toProbability(logOdds(email));
+  }
+
+  // Spam by the models alone: at least 99% sure once trained
+  bool isSpam(const Email &email) const
+  {
+    return spamProbability(email) >= 0.99;
+  }
+
+  // Identifies the models' state, for cached verdicts
+  unsigned long long getVersion() const
+  {
+    return hashKey(sharedModel->getVersion() ^ hashKey(userPath) ^ userModel->getVersion() * 3);
+  }
+
+  const BayesModel &getSharedModel() const { return *sharedModel; }
+  const BayesModel &getUserModel() const { return *userModel; }
+};
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef SPAMDICTIONARY_H
+#define SPAMDICTIONARY_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <atomic>
+#include <sys/stat.h>
+#include "Array.h"
+#include "HashMap.h"
+#include "Email.h"
+#include "SpamMatcher.h"
+using namespace std;
+
+// Weighted spam phrases, compiled into one SpamMatcher. An email's score
+// is the sum of the weights of the distinct phrases it contains, and it
+// is spam from the threshold up. With the defaults (weight 1, threshold
+// 1) one phrase is enough, as with the old word list.
+//
+// The file may list one phrase per line or comma-separated phrases per
+// line (the older format). A phrase can end in "=<weight>", and a line
+// "# threshold = <value>" sets the threshold; other '#' lines are comments.
+class SpamDictionary
+{
+private:
+  SpamMatcher matcher;
+  DynamicArray<double> weights;  // By phrase number
+  HashMap<string, int> *numbers; // Lower-cased phrase -> phrase number
+  double threshold;
+  bool onePhraseIsSpam; // Every weight reaches the threshold
+  unsigned long long version;
+  mutable int owners;   // See retain()
+
+  static string trim(const string &text)
+  {
+    size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == string::npos)
+      return "";
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(start, end - start + 1);
+  }
+
+  // "phrase" or "phrase=weight"; a '=' not followed by a number is part
+  // of the phrase
+  static void parseEntry(const string &entry, string &phrase, double &weight)
+  {
+    phrase = trim(entry);
+    weight = 1.0;
+    size_t equals = phrase.rfind('=');
+    if (equals == string::npos)
+      return;
+    string number = trim(phrase.substr(equals + 1));
+    char *end = nullptr;
+    double value = strtod(number.c_str(), &end);
+    if (number.empty() || *end != '\0')
+      return;
+    weight = value;
+    phrase = trim(phrase.substr(0, equals));
+  }
+
+  // FNV-1a over the compiled content, as ThreadIndex::subjectKey
+  static unsigned long long mix(unsigned long long h, const void *data, size_t length)
+  {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < length; i++)
+    {
+      h ^= bytes[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+public:
+  SpamDictionary() : threshold(1.0), onePhraseIsSpam(true), version(0), owners(1)
+  {
+    numbers = new HashMap<string, int>(1024);
+  }
+
+  ~SpamDictionary()
+  {
+    delete numbers;
+  }
+
+  // A loaded dictionary is only read, so the system and a re-check job
+  // share one. Each owner but the creator calls retain(), and every owner
+  // calls release() instead of delete; the last one deletes it. Both are
+  // called on the main thread only.
+  void retain() const { owners++; }
+
+  void release() const
+  {
+    if (--owners == 0)
+      delete this;
+  }
+
+  // Adds a phrase, or sets the weight of one already there (ignoring case).
+  // Takes effect at compile().
+  void addPhrase(const string &phrase, double weight = 1.0)
+  {
+    string key = phrase;
+    TextKernels::foldCase(key.data(), &key[0], (int)key.length());
+    int *number = numbers->search(key);
+    if (number != nullptr)
+    {
+      weights[*number] = weight;
+      return;
+    }
+    int added = matcher.addPhrase(phrase);
+    if (added == -1)
+      return;
+    weights.add(weight);
+    numbers->insert(key, added);
+  }
+
+  // Reads and compiles a dictionary file; false if it cannot be opened.
+  // Slow for large files (about 0.4 s for 50k phrases), so reloads run
+  // on a SpamDictionaryWatcher thread.
+  bool load(const string &path)
+  {
+    ifstream file(path);
+    if (!file.is_open())
+      return false;
+
+    string line;
+    while (getline(file, line))
+    {
+      string trimmed = trim(line);
+      if (trimmed.empty())
+        continue;
+      if (trimmed[0] == '#')
+      {
+        string directive = trim(trimmed.substr(1));
+        string phrase;
+        double value;
+        parseEntry(directive, phrase, value);
+        if (phrase == "threshold" && directive.find('=') != string::npos)
+          threshold = value;
+        continue;
+      }
+
+      size_t start = 0;
+      while (start <= trimmed.length())
+      {
+        size_t comma = trimmed.find(',', start);
+        if (comma == string::npos)
+          comma = trimmed.length();
+        string phrase;
+        double weight;
+        parseEntry(trimmed.substr(start, comma - start), phrase, weight);
+        if (!phrase.empty())
+          addPhrase(phrase, weight);
+        start = comma + 1;
+      }
+    }
+    file.close();
+    compile();
+    return true;
+  }
+
+  // Compiles the matcher and stamps the version: a hash of the phrases,
+  // weights and threshold, so it only changes with the content
+  void compile()
+  {
+    matcher.compile();
+    onePhraseIsSpam = true;
+    for (int i = 0; i < weights.getSize(); i++)
+    {
+      onePhraseIsSpam = onePhraseIsSpam && weights[i] >= threshold;
+    }
+
+    unsigned long long h = 1469598103934665603ULL;
+    h = mix(h, &threshold, sizeof(threshold));
+    for (int i = 0; i < matcher.getPhraseCount(); i++)
+    {
+      const string &phrase = matcher.getPhrase(i);
+      h = mix(h, phrase.data(), phrase.length() + 1);
+      h = mix(h, &weights[i], sizeof(double));
+    }
+    version = h != 0 ? h : 1;
+  }
+
+  // Sum of the weights of the phrases the email contains
+  double score(const Email &email, DynamicArray<int> *hits = nullptr) const
+  {
+    DynamicArray<int> found;
+    DynamicArray<int> &phrases = hits != nullptr ? *hits : found;
+    int first = phrases.getSize();
+    matcher.findAll(email, phrases);
+    double total = 0;
+    for (int i = first; i < phrases.getSize(); i++)
+    {
+      total += weights[phrases[i]];
+    }
+    return total;
+  }
+
+  bool isSpam(const Email &email) const
+  {
+    // Plain lists (every weight 1, threshold 1) stop at the first phrase
+    if (onePhraseIsSpam)
+      return matcher.matches(email);
+    return score(email) >= threshold;
+  }
+
+  // The same for text outside the mailbox arena (the batch re-check reads
+  // folder files on other threads)
+  bool isSpam(const char *subject, int subjectLength, const char *content, int contentLength) const
+  {
+    if (onePhraseIsSpam)
+      return matcher.matches(subject, subjectLength, content, contentLength);
+    DynamicArray<int> phrases;
+    matcher.findAll(subject, subjectLength, content, contentLength, phrases);
+    double total = 0;
+    for (int i = 0; i < phrases.getSize(); i++)
+    {
+      total += weights[phrases[i]];
+    }
+    return total >= threshold;
+  }
+
+  const SpamMatcher &getMatcher() const { return matcher; }
+  const string &getPhrase(int phrase) const { return matcher.getPhrase(phrase); }
+  double getWeight(int phrase) const { return weights[phrase]; }
+  int getPhraseCount() const { return matcher.getPhraseCount(); }
+  double getThreshold() const { return threshold; }
+  unsigned long long getVersion() const { return version; }
+};
+
+// Reloads a dictionary file when it changes on disk. poll() is cheap and
+// meant to be called every frame: at most once a second it compares the
+// file's time and size with the last load, and a change starts a load on
+// a background thread. The caller keeps using its current dictionary until
+// poll() hands over the new one, so mail is never held up by a reload.
+class SpamDictionaryWatcher
+{
+private:
+  struct LoadJob
+  {
+    SpamDictionary *dictionary;
+    string path;
+    atomic<bool> done;
+    bool succeeded;
+    thread worker;
+
+    LoadJob() : dictionary(nullptr), done(false), succeeded(false) {}
+  };
+
+  string path;
+  long long fileTime; // Of the last load, -1 if the file was missing
+  long long fileSize;
+  time_t lastCheck;
+  LoadJob *job;
+
+  static void runLoad(LoadJob *job)
+  {
+    job->succeeded = job->dictionary->load(job->path);
+    job->done = true;
+  }
+
+  // Modification time and size, false if the file is missing
+  static bool fileStamp(const string &path, long long &time, long long &size)
+  {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return false;
+    time = (long long)info.st_mtime;
+    size = (long long)info.st_size;
+    return true;
+  }
+
+public:
+  SpamDictionaryWatcher() : fileTime(-1), fileSize(-1), lastCheck(0), job(nullptr) {}
+
+  ~SpamDictionaryWatcher()
+  {
+    stop();
+  }
+
+  // Loads path now (on this thread) and watches it from then on
+  SpamDictionary *open(const string &filePath)
+  {
+    stop();
+    path = filePath;
+    if (!fileStamp(path, fileTime, fileSize))
+      fileTime = fileSize = -1;
+    lastCheck = time(nullptr);
+    SpamDictionary *dictionary = new SpamDictionary();
+    dictionary->load(path);
+    return dictionary;
+  }
+
+  // A dictionary loaded since the last call (the caller owns it), or
+  // nullptr. With wait set, a running load is finished first.
+  SpamDictionary *poll(bool wait = false)
+  {
+    if (job != nullptr)
+    {
+      if (!wait && !job->done.load())
+        return nullptr;
+      job->worker.join();
+      SpamDictionary *loaded = job->succeeded ? job->dictionary : nullptr;
+      if (loaded == nullptr)
+        delete job->dictionary;
+      delete job;
+      job = nullptr;
+      return loaded;
+    }
+
+    time_t now = time(nullptr);
+    if (path.empty() || now == lastCheck)
+      return nullptr;
+    lastCheck = now;
+    long long modified = -1, size = -1;
+    fileStamp(path, modified, size);
+    if (modified == fileTime && size == fileSize)
+      return nullptr;
+    fileTime = modified;
+    fileSize = size;
+    if (modified == -1)
+      return nullptr; // Removed: keep the dictionary in use
+
+    job = new LoadJob();
+    job->dictionary = new SpamDictionary();
+    job->path = path;
+    job->worker = thread(runLoad, job);
+    return wait ? poll(true) : nullptr;
+  }
+
+  bool isLoading() const { return job != nullptr; }
+
+  // Waits for a running load and drops its result
+  void stop()
+  {
+    if (job == nullptr)
+      return;
+    job->worker.join();
+    delete job->dictionary;
+    delete job;
+    job = nullptr;
+  }
+};
+
+#endif
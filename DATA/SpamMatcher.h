@@ -0,0 +1,307 @@
+#ifndef SPAMMATCHER_H
+#define SPAMMATCHER_H
+
+#include <iostream>
+#include <string>
+#include <cctype>
+#include "Array.h"
+#include "Email.h"
+using namespace std;
+
+// The spam phrases compiled into an Aho-Corasick automaton, ignoring case.
+// Every byte of a text takes one table lookup, however many phrases there
+// are, and the text is read where it is stored. Bytes that occur in no
+// phrase share one column of the table, so a state's row is as wide as
+// the distinct (lower-cased) letters of the phrases, not 256.
+class SpamMatcher
+{
+private:
+  DynamicArray<string> phrases;
+  unsigned char classes[256]; // Byte -> column; 0 for bytes in no phrase
+  int classCount;
+  // Row start + column -> row start of the next state (state * classCount),
+  // negated when some phrase ends there or at one of its suffixes; the root
+  // (row 0) never is. A scan step is one load and one add.
+  DynamicArray<int> transitions;
+  DynamicArray<int> outputs;     // Phrase ending at a state, -1 if none
+  DynamicArray<int> outputLinks; // Longest proper suffix state with an output, -1 if none
+  DynamicArray<bool> accepting;  // While compiling: some phrase ends here or at a suffix
+  bool compiled;
+
+  int addState()
+  {
+    int state = outputs.getSize();
+    if ((long long)(state + 1) * classCount > 0x7FFFFFFF)
+      throw "Too many spam phrases";
+    transitions.resize((state + 1) * classCount, -1);
+    outputs.add(-1);
+    outputLinks.add(-1);
+    accepting.add(false);
+    return state;
+  }
+
+  // Adds phrase to hits unless this scan has reported it already
+  static void report(int phrase, DynamicArray<int> &hits, int first)
+  {
+    for (int i = first; i < hits.getSize(); i++)
+    {
+      if (hits[i] == phrase)
+        return;
+    }
+    hits.add(phrase);
+  }
+
+  // Reports every phrase ending in the text, skipping those already in
+  // hits from first on. Allocates nothing besides growing hits.
+  void scan(const char *text, int length, DynamicArray<int> &hits, int first) const
+  {
+    if (!compiled || text == nullptr)
+      return;
+    const int *table = transitions.raw();
+    int row = 0;
+    for (int i = 0; i < length; i++)
+    {
+      row = table[row + classes[(unsigned char)text[i]]];
+      if (row >= 0)
+        continue;
+      row = -row;
+      int state = row / classCount;
+      for (int match = outputs[state] != -1 ? state : outputLinks[state]; match != -1; match = outputLinks[match])
+      {
+        report(outputs[match], hits, first);
+      }
+    }
+  }
+
+public:
+  SpamMatcher()
+  {
+    classCount = 1;
+    compiled = false;
+    for (int i = 0; i < 256; i++)
+    {
+      classes[i] = 0;
+    }
+  }
+
+  // Phrases are matched as given, ignoring case; empty ones are skipped.
+  // Returns the phrase's number, or -1. Takes effect at compile().
+  int addPhrase(const string &phrase)
+  {
+    if (phrase.empty())
+      return -1;
+    phrases.add(phrase);
+    compiled = false;
+    return phrases.getSize() - 1;
+  }
+
+  // Builds the automaton: the trie of the phrases, then failure links in
+  // breadth-first order, folded into the table so a scan never follows
+  // them. O(total phrase length * columns).
+  void compile()
+  {
+    // Columns: one per distinct lower-case byte, shared with its upper case
+    for (int i = 0; i < 256; i++)
+    {
+      classes[i] = 0;
+    }
+    classCount = 1;
+    for (int p = 0; p < phrases.getSize(); p++)
+    {
+      const string &phrase = phrases[p];
+      for (size_t i = 0; i < phrase.length(); i++)
+      {
+        unsigned char c = (unsigned char)tolower((unsigned char)phrase[i]);
+        if (classes[c] == 0)
+        {
+          if (classCount == 256)
+            throw "Too many distinct characters in spam phrases";
+          classes[c] = (unsigned char)classCount++;
+        }
+      }
+    }
+    for (int i = 0; i < 256; i++)
+    {
+      classes[i] = classes[(unsigned char)tolower(i)];
+    }
+
+    transitions = DynamicArray<int>();
+    outputs = DynamicArray<int>();
+    outputLinks = DynamicArray<int>();
+    accepting = DynamicArray<bool>();
+    addState();
+
+    // Trie; a phrase listed twice keeps its first number
+    for (int p = 0; p < phrases.getSize(); p++)
+    {
+      const string &phrase = phrases[p];
+      int state = 0;
+      for (size_t i = 0; i < phrase.length(); i++)
+      {
+        int column = classes[(unsigned char)phrase[i]];
+        if (transitions[state * classCount + column] == -1)
+        {
+          int next = addState();
+          transitions[state * classCount + column] = next;
+        }
+        state = transitions[state * classCount + column];
+      }
+      if (outputs[state] == -1)
+        outputs[state] = p;
+      accepting[state] = true;
+    }
+
+    // Breadth-first: a state's failure target is always done before it,
+    // so its missing transitions are copied from there
+    DynamicArray<int> failures;
+    failures.resize(outputs.getSize(), 0);
+    DynamicArray<int> queue(outputs.getSize());
+    for (int column = 0; column < classCount; column++)
+    {
+      int next = transitions[column];
+      if (next == -1)
+      {
+        transitions[column] = 0;
+      }
+      else
+      {
+        failures[next] = 0;
+        queue.add(next);
+      }
+    }
+    for (int head = 0; head < queue.getSize(); head++)
+    {
+      int state = queue[head];
+      int failure = failures[state];
+      outputLinks[state] = outputs[failure] != -1 ? failure : outputLinks[failure];
+      accepting[state] = accepting[state] || accepting[failure];
+      for (int column = 0; column < classCount; column++)
+      {
+        int next = transitions[state * classCount + column];
+        if (next == -1)
+        {
+          transitions[state * classCount + column] = transitions[failure * classCount + column];
+        }
+        else
+        {
+          failures[next] = transitions[failure * classCount + column];
+          queue.add(next);
+        }
+      }
+    }
+
+    // Renumber the states in breadth-first order (scans spend most of
+    // their time near the root, and those rows now sit together) and
+    // store the targets as row starts
+    int stateCount = outputs.getSize();
+    DynamicArray<int> renumbered;
+    renumbered.resize(stateCount, 0);
+    for (int i = 0; i < queue.getSize(); i++)
+    {
+      renumbered[queue[i]] = i + 1;
+    }
+    DynamicArray<int> newTransitions;
+    newTransitions.resize(stateCount * classCount, 0);
+    DynamicArray<int> newOutputs, newLinks;
+    newOutputs.resize(stateCount, -1);
+    newLinks.resize(stateCount, -1);
+    for (int state = 0; state < stateCount; state++)
+    {
+      int to = renumbered[state];
+      for (int column = 0; column < classCount; column++)
+      {
+        int next = transitions[state * classCount + column];
+        int row = renumbered[next] * classCount;
+        newTransitions[to * classCount + column] = accepting[next] ? -row : row;
+      }
+      newOutputs[to] = outputs[state];
+      newLinks[to] = outputLinks[state] != -1 ? renumbered[outputLinks[state]] : -1;
+    }
+    transitions.swap(newTransitions);
+    outputs.swap(newOutputs);
+    outputLinks.swap(newLinks);
+    accepting = DynamicArray<bool>();
+    compiled = true;
+  }
+
+  // Whether any phrase occurs in the text; stops at the first one
+  bool containsAny(const char *text, int length) const
+  {
+    if (!compiled || text == nullptr)
+      return false;
+    const int *table = transitions.raw();
+    int row = 0;
+    for (int i = 0; i < length; i++)
+    {
+      row = table[row + classes[(unsigned char)text[i]]];
+      if (row < 0)
+        return true;
+    }
+    return false;
+  }
+
+  // Adds the number of each phrase that occurs in the text to hits, once.
+  // Returns how many were added.
+  int findAll(const char *text, int length, DynamicArray<int> &hits) const
+  {
+    int first = hits.getSize();
+    scan(text, length, hits, first);
+    return hits.getSize() - first;
+  }
+
+  // Subject and content, each scanned on its own (a phrase does not run
+  // from one into the other)
+  bool matches(const char *subject, int subjectLength, const char *content, int contentLength) const
+  {
+    return containsAny(subject, subjectLength) || containsAny(content, contentLength);
+  }
+
+  int findAll(const char *subject, int subjectLength, const char *content, int contentLength,
+              DynamicArray<int> &hits) const
+  {
+    int first = hits.getSize();
+    scan(subject, subjectLength, hits, first);
+    scan(content, contentLength, hits, first);
+    return hits.getSize() - first;
+  }
+
+  // The same, read in place from the text arena
+  bool matches(const Email &email) const
+  {
+    const TextArena &arena = TextArena::mailbox();
+    TextRef subject = email.getSubjectRef();
+    TextRef content = email.getContentRef();
+    return matches(arena.data(subject), (int)subject.length, arena.data(content), (int)content.length);
+  }
+
+  int findAll(const Email &email, DynamicArray<int> &hits) const
+  {
+    const TextArena &arena = TextArena::mailbox();
+    TextRef subject = email.getSubjectRef();
+    TextRef content = email.getContentRef();
+    return findAll(arena.data(subject), (int)subject.length, arena.data(content), (int)content.length, hits);
+  }
+
+  const string &getPhrase(int phrase) const { return phrases[phrase]; }
+  int getPhraseCount() const { return phrases.getSize(); }
+  int getStateCount() const { return outputs.getSize(); }
+  int getColumnCount() const { return classCount; }
+
+  unsigned long long getTableBytes() const
+  {
+    return (unsigned long long)transitions.getSize() * sizeof(int) +
+           (unsigned long long)outputs.getSize() * 2 * sizeof(int);
+  }
+
+  void clear()
+  {
+    phrases = DynamicArray<string>();
+    transitions = DynamicArray<int>();
+    outputs = DynamicArray<int>();
+    outputLinks = DynamicArray<int>();
+    accepting = DynamicArray<bool>();
+    compiled = false;
+  }
+};
+
+#endif
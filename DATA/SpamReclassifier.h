@@ -0,0 +1,250 @@
+#ifndef SPAMRECLASSIFIER_H
+#define SPAMRECLASSIFIER_H
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "Array.h"
+#include "HashMap.h"
+#include "FileHandler.h"
+#include "SpamDictionary.h"
+#include "SpamClassifier.h"
+#include "SpamScorer.h"
+using namespace std;
+
+// One received email in a user's Inbox or Spam, with its content score
+// under the new rules
+struct ReclassifyCandidate
+{
+  EmailId emailId;
+  string sender;
+  bool inSpam; // Else in the Inbox
+  unsigned int labels;
+  double contentLogOdds;
+
+  ReclassifyCandidate() : emailId(0), inSpam(false), labels(0), contentLogOdds(0) {}
+};
+
+// What a worker found in one user's mailbox
+struct ReclassifyResult
+{
+  string user;
+  long long generation; // Of the files read; another one means they were rewritten since
+  DynamicArray<ReclassifyCandidate> candidates;
+
+  ReclassifyResult() : generation(0) {}
+};
+
+// Re-scores the received mail in users' Inbox and Spam against new spam
+// rules on a pool of threads, a user at a time each. A worker streams the
+// user's folder files and mutation log (so it sees moves made since the
+// files were written) and scores the content with the system's compiled
+// dictionary, which nothing changes once loaded, and the job's own copy
+// of the shared model, sharing nothing the main thread changes. The
+// main thread takes the results in user order (next), adds the sender
+// part of the score and writes the moves.
+class SpamReclassifier
+{
+private:
+  FileHandler *files;                  // Not owned
+  const SpamScorer *scorer;            // Not owned; only its fixed content weights are read
+  const SpamDictionary *dictionary;    // Shared with the system (retained), only read
+  BayesModel sharedModel;              // A copy: the main thread keeps training its own
+  DynamicArray<string> users;
+  atomic<ReclassifyResult *> *results; // By user, set by the workers
+  atomic<int> nextUser;
+  atomic<bool> cancelled;
+  thread *workers;
+  int workerCount;
+  int nextResult; // Next result handed to the main thread
+
+  static void runWorker(SpamReclassifier *job)
+  {
+    while (!job->cancelled.load())
+    {
+      int index = job->nextUser.fetch_add(1);
+      if (index >= job->users.getSize())
+        return;
+      job->results[index].store(job->scanUser(job->users[index]));
+    }
+  }
+
+  ReclassifyResult *scanUser(const string &user)
+  {
+    ReclassifyResult *result = new ReclassifyResult();
+    result->user = user;
+    result->generation = files->loadMailboxGeneration(user);
+
+    // The last logged mutation of an email says where it is now
+    DynamicArray<EmailMutation> mutations;
+    files->loadMutations(user, mutations);
+    HashMap<EmailId, int> latest(mutations.getSize() * 2 + 16);
+    for (int i = 0; i < mutations.getSize(); i++)
+    {
+      int *last = latest.search(mutations[i].emailId);
+      if (last != nullptr)
+        *last = i;
+      else
+        latest.insert(mutations[i].emailId, i);
+    }
+
+    BayesModel userModel;
+    userModel.load(files->getSpamModelPath(user));
+    bool trained = sharedModel.isTrained() || userModel.isTrained();
+
+    // Emails moved into Inbox or Spam from another file since the files
+    // were written are left to the next login's check
+    const char *folders[] = {"Inbox", "Spam"};
+    string fields[FileHandler::EMAIL_FIELD_COUNT];
+    for (int f = 0; f < 2 && !cancelled.load(); f++)
+    {
+      LineReader reader;
+      if (!files->openFolderFile(user, folders[f], reader))
+        continue;
+
+      const char *line;
+      int length;
+      while (reader.next(line, length))
+      {
+        FileHandler::splitEmailLine(line, length, fields);
+        ReclassifyCandidate candidate;
+        candidate.emailId = IdGenerator::parse(fields[0]);
+        if (candidate.emailId == 0 || fields[2] != user || fields[1] == user)
+          continue; // Unparsable ids get theirs at login; only received mail is judged
+
+        string folder = fields[9];
+        candidate.labels = FileHandler::emailLineLabels(fields);
+        int *last = latest.search(candidate.emailId);
+        if (last != nullptr)
+        {
+          folder = mutations[*last].folder;
+          candidate.labels = mutations[*last].labels;
+        }
+        if (folder != "Inbox" && folder != "Spam")
+          continue;
+
+        const string &subject = fields[3];
+        const string &content = fields[4];
+        double modelLogOdds = 0;
+        if (trained)
+          modelLogOdds = SpamClassifier::blendLogOdds(sharedModel, userModel, subject.data(), (int)subject.length(),
+                                                      content.data(), (int)content.length());
+        candidate.sender = fields[1];
+        candidate.inSpam = folder == "Spam";
+        candidate.contentLogOdds = scorer->contentLogOdds(
+            dictionary->isSpam(subject.data(), (int)subject.length(), content.data(), (int)content.length()), modelLogOdds);
+        result->candidates.add(candidate);
+      }
+    }
+    return result;
+  }
+
+  void joinWorkers()
+  {
+    for (int i = 0; i < workerCount; i++)
+    {
+      workers[i].join();
+    }
+    delete[] workers;
+    workers = nullptr;
+    workerCount = 0;
+  }
+
+public:
+  SpamReclassifier(FileHandler *fileHandler, const SpamScorer *spamScorer)
+      : files(fileHandler), scorer(spamScorer), dictionary(nullptr), results(nullptr), nextUser(0),
+        cancelled(false), workers(nullptr), workerCount(0), nextResult(0)
+  {
+  }
+
+  ~SpamReclassifier()
+  {
+    stop();
+  }
+
+  // Starts re-checking the users' mail with a loaded dictionary (retained
+  // until stop) and a copy of the shared model, on threadCount threads
+  // (0: one per core)
+  void start(const DynamicArray<string> &userList, const SpamDictionary *spamDictionary, const BayesModel &shared,
+             int threadCount = 0)
+  {
+    stop();
+    spamDictionary->retain();
+    dictionary = spamDictionary;
+    sharedModel = shared;
+    users = userList;
+    results = new atomic<ReclassifyResult *>[users.getSize() > 0 ? users.getSize() : 1];
+    for (int i = 0; i < users.getSize(); i++)
+    {
+      results[i].store(nullptr);
+    }
+    nextUser = 0;
+    cancelled = false;
+    nextResult = 0;
+
+    if (threadCount <= 0)
+      threadCount = (int)thread::hardware_concurrency();
+    if (threadCount <= 0)
+      threadCount = 1;
+    workerCount = threadCount < users.getSize() ? threadCount : users.getSize();
+    workers = workerCount > 0 ? new thread[workerCount] : nullptr;
+    for (int i = 0; i < workerCount; i++)
+    {
+      workers[i] = thread(runWorker, this);
+    }
+  }
+
+  // The next user's result in order (the caller owns it), or nullptr if
+  // it is not ready yet or every result was handed out. With wait set, a
+  // result still being worked on is waited for.
+  ReclassifyResult *next(bool wait = false)
+  {
+    if (results == nullptr || nextResult >= users.getSize())
+      return nullptr;
+    ReclassifyResult *result = results[nextResult].load();
+    while (result == nullptr && wait)
+    {
+      this_thread::sleep_for(chrono::milliseconds(1));
+      result = results[nextResult].load();
+    }
+    if (result == nullptr)
+      return nullptr;
+    results[nextResult].store(nullptr);
+    nextResult++;
+    if (nextResult == users.getSize())
+      joinWorkers();
+    return result;
+  }
+
+  // Every result has been handed out (or nothing was started)
+  bool isFinished() const { return results == nullptr || nextResult >= users.getSize(); }
+
+  // Cancels the workers and drops what they found
+  void stop()
+  {
+    cancelled = true;
+    joinWorkers();
+    if (results != nullptr)
+    {
+      for (int i = 0; i < users.getSize(); i++)
+      {
+        delete results[i].load();
+      }
+      delete[] results;
+      results = nullptr;
+    }
+    if (dictionary != nullptr)
+      dictionary->release();
+    dictionary = nullptr;
+    users.clear();
+    nextResult = 0;
+  }
+
+  int getUserCount() const { return users.getSize(); }
+  int getHandedOutCount() const { return nextResult; }
+  int getThreadCount() const { return workerCount; }
+};
+
+#endif
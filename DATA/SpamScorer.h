@@ -0,0 +1,191 @@
+#ifndef SPAMSCORER_H
+#define SPAMSCORER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include "HashMap.h"
+#include "Graph.h"
+#include "SenderRank.h"
+using namespace std;
+
+// Spam and not-spam marks the users gave a sender's emails
+struct SenderReputation
+{
+  int spamReports;
+  int hamReports;
+
+  SenderReputation() : spamReports(0), hamReports(0) {}
+};
+
+// Blends an email's content score with what is known about its sender,
+// all in log odds of spam (above 0 leans spam):
+//   content     the dictionary and the Bayes models
+//   connection  a direct connection to the receiver, by its strength
+//   contact     one of the receiver's contacts, as a strength 1 connection
+//   mutuals     users connected to both, when there is no direct one
+//   unknown     none of the three adds a little
+//   reputation  log((spam marks + 1) / (not spam marks + 1))
+//   rank        the sender's PageRank over the mail graph (SenderRank)
+// The graph part comes from Graph::getPairFeatures, cached per pair, and
+// the reputation and rank are one hash lookup each, so scoring walks no
+// lists.
+class SpamScorer
+{
+private:
+  HashMap<string, SenderReputation> *reputations;
+  const SenderRank *senderRank; // Not owned, may be null
+  bool changed;                 // Since the last load or save
+
+  // Weights, in log odds
+  double dictionaryWeight; // Above the threshold: the dictionary alone decides
+  double maxModelLogOdds;  // The Bayes score is clipped to +-this
+  double connectionWeight; // Per strength point
+  double mutualWeight;     // Per mutual connection
+  double unknownSenderWeight;
+  double rankWeight;      // Per factor e of rank over the minimum
+  double maxRankLogOdds;  // Trust from rank is capped at this
+  double spamThreshold;
+
+public:
+  static const int MAX_STRENGTH = 5; // Points counted at most
+  static const int MAX_MUTUALS = 5;
+
+  SpamScorer() : senderRank(nullptr), changed(false), dictionaryWeight(6), maxModelLogOdds(15),
+                 connectionWeight(1.5), mutualWeight(0.5), unknownSenderWeight(0.5), rankWeight(0.5),
+                 maxRankLogOdds(1.5)
+  {
+    reputations = new HashMap<string, SenderReputation>(256);
+    spamThreshold = log(99.0); // 99% sure, as SpamClassifier::isSpam
+  }
+
+  ~SpamScorer()
+  {
+    delete reputations;
+  }
+
+  // Content score from the dictionary verdict and the Bayes log odds (0
+  // while untrained). Without a sender part it decides as the two did on
+  // their own: a dictionary hit, or 99% from the models.
+  double contentLogOdds(bool dictionarySpam, double modelLogOdds) const
+  {
+    if (modelLogOdds > maxModelLogOdds)
+      modelLogOdds = maxModelLogOdds;
+    if (modelLogOdds < -maxModelLogOdds)
+      modelLogOdds = -maxModelLogOdds;
+    if (dictionarySpam)
+      return (modelLogOdds > 0 ? modelLogOdds : 0) + dictionaryWeight;
+    return modelLogOdds;
+  }
+
+  // What the graph and the receiver's contacts say about the pair
+  double socialLogOdds(const PairFeatures &pair, bool contact = false) const
+  {
+    if (pair.connected)
+      return -connectionWeight * (pair.strength < MAX_STRENGTH ? pair.strength : MAX_STRENGTH);
+    if (contact)
+      return -connectionWeight;
+    if (pair.mutualCount > 0)
+      return -mutualWeight * (pair.mutualCount < MAX_MUTUALS ? pair.mutualCount : MAX_MUTUALS);
+    return unknownSenderWeight;
+  }
+
+  double reputationLogOdds(const string &sender) const
+  {
+    const SenderReputation *reputation = reputations->search(sender);
+    if (reputation == nullptr)
+      return 0;
+    return log((reputation->spamReports + 1.0) / (reputation->hamReports + 1.0));
+  }
+
+  // Senders that well ranked addresses write to or know lean not spam;
+  // 0 for one nothing points at
+  double rankLogOdds(const string &sender) const
+  {
+    if (senderRank == nullptr)
+      return 0;
+    double rank = senderRank->getScore(sender);
+    double minimum = senderRank->getMinimumScore();
+    if (rank <= minimum)
+      return 0;
+    double trust = rankWeight * log(rank / minimum);
+    return -(trust < maxRankLogOdds ? trust : maxRankLogOdds);
+  }
+
+  // Content score plus the sender's graph, contact, reputation and rank
+  // scores
+  double score(double contentLogOdds, const PairFeatures &pair, const string &sender, bool contact = false) const
+  {
+    return contentLogOdds + socialLogOdds(pair, contact) + reputationLogOdds(sender) + rankLogOdds(sender);
+  }
+
+  void setSenderRank(const SenderRank *rank) { senderRank = rank; }
+
+  bool isSpam(double logOdds) const { return logOdds >= spamThreshold; }
+  double getSpamThreshold() const { return spamThreshold; }
+
+  // Counts a user's spam or not spam mark against the sender
+  void report(const string &sender, bool spam)
+  {
+    SenderReputation *reputation = reputations->search(sender);
+    if (reputation == nullptr)
+      reputation = reputations->insert(sender, SenderReputation());
+    if (spam)
+      reputation->spamReports++;
+    else
+      reputation->hamReports++;
+    changed = true;
+  }
+
+  SenderReputation getReputation(const string &sender) const
+  {
+    const SenderReputation *reputation = reputations->search(sender);
+    return reputation != nullptr ? *reputation : SenderReputation();
+  }
+
+  int getReportedSenderCount() const { return reputations->getSize(); }
+
+  // One "sender,spam marks,not spam marks" line per sender
+  bool save(const string &path)
+  {
+    if (!changed)
+      return true;
+    ofstream file(path, ios::trunc);
+    if (!file.is_open())
+      return false;
+    for (auto &entry : *reputations)
+    {
+      file << entry.key() << "," << entry.value().spamReports << "," << entry.value().hamReports << endl;
+    }
+    file.close();
+    changed = false;
+    return true;
+  }
+
+  bool load(const string &path)
+  {
+    reputations->clear();
+    changed = false;
+    ifstream file(path);
+    if (!file.is_open())
+      return false;
+    string line;
+    while (getline(file, line))
+    {
+      size_t second = line.rfind(',');
+      size_t first = second != string::npos && second > 0 ? line.rfind(',', second - 1) : string::npos;
+      if (first == string::npos || first == 0)
+        continue;
+      SenderReputation reputation;
+      reputation.spamReports = atoi(line.substr(first + 1, second - first - 1).c_str());
+      reputation.hamReports = atoi(line.substr(second + 1).c_str());
+      reputations->insert(line.substr(0, first), reputation);
+    }
+    file.close();
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef SPAMVERDICTCACHE_H
+#define SPAMVERDICTCACHE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include "Array.h"
+#include "HashMap.h"
+#include "Email.h"
+using namespace std;
+
+// Content spam scores by content fingerprint, so an email is classified
+// once per dictionary and model rather than at every login, and bulk mail
+// with the same text once for all its copies. Each score is stored with
+// the version of the classifiers that gave it and only a matching version
+// reuses it. Four-way set associative: a fingerprint can only be in one
+// set of four slots, and when they are all taken by current verdicts a new
+// one replaces one of them, so the cache never grows.
+class SpamVerdictCache
+{
+private:
+  struct Entry
+  {
+    unsigned long long fingerprint; // 0 when empty
+    unsigned long long version;
+    float score; // Log odds of spam
+
+    Entry() : fingerprint(0), version(0), score(0) {}
+  };
+
+  // Normalized text is collected in a buffer and hashed eight bytes at a
+  // time. Most 8-byte blocks of text need nothing but case folding: their
+  // only blanks are single spaces, so at most a space from the block before
+  // goes in front and a space at the end waits for the next kept byte.
+  // Those are checked and folded as one 64-bit word; other blocks go byte
+  // by byte.
+  struct Hasher
+  {
+    static const int BUFFER_SIZE = 256;
+    static const unsigned long long ONES = 0x0101010101010101ULL;
+    static const unsigned long long HIGH = 0x8080808080808080ULL;
+
+    unsigned char buffer[BUFFER_SIZE + 16]; // A block adds at most 16 bytes
+    int filled;
+    unsigned long long h;
+    unsigned long long length;
+
+    Hasher() : filled(0), h(0x6A09E667F3BCC908ULL), length(0) {}
+
+    // Hashes the whole words of the buffer; the rest moves to the front
+    void flush()
+    {
+      int words = filled / 8;
+      for (int i = 0; i < words; i++)
+      {
+        unsigned long long word;
+        memcpy(&word, buffer + i * 8, 8);
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 32;
+      }
+      length += words * 8;
+      filled -= words * 8;
+      memmove(buffer, buffer + words * 8, filled);
+    }
+
+    // High bit of each byte of x that is at least limit (below 0x80):
+    // setting the high bit first means the subtraction never borrows
+    static unsigned long long atLeast(unsigned long long x, unsigned int limit)
+    {
+      return ((((x | HIGH) - limit * ONES) & HIGH) | x) & HIGH;
+    }
+
+    // ASCII letters lower-cased; runs of spaces, line breaks and other
+    // bytes up to 0x20 become one space, dropped at the start and the end
+    void addText(const char *text, int textLength)
+    {
+      unsigned int started = 0;
+      unsigned int pending = 0; // A space goes before the next kept byte
+      int position = filled;     // A local: the buffer's stores could alias a member
+      int i = 0;
+      while (i < textLength)
+      {
+        if (i + 8 <= textLength)
+        {
+          unsigned long long block;
+          memcpy(&block, text + i, 8);
+          unsigned long long kept = atLeast(block, 0x21);
+          unsigned long long blank = ~kept & HIGH;
+          unsigned long long notSpace = block ^ (0x20 * ONES);
+          unsigned long long space = ~((((notSpace & ~HIGH) + ~HIGH) | notSpace)) & HIGH;
+          unsigned int firstBlank = (blank & 0x80) != 0; // Same test either byte order
+          unsigned int lastBlank = (blank >> 63) != 0;
+          bool plain = (blank & ~space) == 0 && (blank & (blank << 8)) == 0 &&
+                       (firstBlank == 0 || (started == 1 && pending == 0));
+          if (plain)
+          {
+            unsigned long long upper = atLeast(block, 'A') & ~atLeast(block, 'Z' + 1) & ~block;
+            block += upper >> 2; // 0x80 >> 2 is the 0x20 between the cases
+            buffer[position] = ' ';
+            memcpy(buffer + position + pending, &block, 8);
+            position += (int)(pending + 8 - lastBlank);
+            pending = lastBlank;
+            started = 1;
+            i += 8;
+            if (position >= BUFFER_SIZE)
+            {
+              filled = position;
+              flush();
+              position = filled;
+            }
+            continue;
+          }
+        }
+
+        // Branch-free: a byte's output is stored where the position only
+        // advances if it is kept
+        int end = i + 8 < textLength ? i + 8 : textLength;
+        for (; i < end; i++)
+        {
+          unsigned int c = (unsigned char)text[i];
+          unsigned int kept = c > ' ';
+          unsigned int space = pending & kept;
+          buffer[position] = ' ';
+          buffer[position + space] = (unsigned char)(c + ((c - 'A' < 26u) << 5));
+          position += (int)((kept + space) & (0u - kept));
+          started |= kept;
+          pending = started & (kept ^ 1);
+        }
+        if (position >= BUFFER_SIZE)
+        {
+          filled = position;
+          flush();
+          position = filled;
+        }
+      }
+      filled = position;
+    }
+
+    void add(unsigned char byte)
+    {
+      buffer[filled++] = byte;
+      if (filled >= BUFFER_SIZE)
+        flush();
+    }
+
+    unsigned long long finish()
+    {
+      flush();
+      length += filled;
+      memset(buffer + filled, 0, 8 - filled);
+      unsigned long long word;
+      memcpy(&word, buffer, 8);
+      unsigned long long result = hashKey((h ^ word) * 0x9E3779B97F4A7C15ULL ^ length);
+      return result != 0 ? result : 1;
+    }
+  };
+
+  static const unsigned int FILE_MAGIC = 0x53564332; // "SVC2"
+
+  static const int WAYS = 4;
+
+  DynamicArray<Entry> entries;
+  int setMask;
+  int stored;
+  long long hits;
+  long long misses;
+  bool changed; // Since the last load or save
+
+public:
+  static const int DEFAULT_CAPACITY = 1 << 16;
+
+  // capacity is rounded up to a power of two (at least WAYS)
+  SpamVerdictCache(int capacity = DEFAULT_CAPACITY) : stored(0), hits(0), misses(0), changed(false)
+  {
+    int size = WAYS;
+    while (size < capacity)
+    {
+      size <<= 1;
+    }
+    entries.resize(size, Entry());
+    setMask = size / WAYS - 1;
+  }
+
+  // 64-bit hash of the normalized subject and content (never 0). Case and
+  // whitespace differences do not change it.
+  static unsigned long long fingerprint(const Email &email)
+  {
+    const TextArena &arena = TextArena::mailbox();
+    TextRef subject = email.getSubjectRef();
+    TextRef content = email.getContentRef();
+    Hasher hasher;
+    hasher.addText(arena.data(subject), (int)subject.length);
+    hasher.add(0); // Keeps "a b" + "c" apart from "a" + "b c"
+    hasher.addText(arena.data(content), (int)content.length);
+    return hasher.finish();
+  }
+
+  // Stored score for version; false if there is none
+  bool lookup(unsigned long long fingerprint, unsigned long long version, double &score)
+  {
+    const Entry *set = entries.raw() + (int)(fingerprint & setMask) * WAYS;
+    for (int way = 0; way < WAYS; way++)
+    {
+      if (set[way].fingerprint == fingerprint && set[way].version == version)
+      {
+        hits++;
+        score = set[way].score;
+        return true;
+      }
+    }
+    misses++;
+    return false;
+  }
+
+  // Takes the fingerprint's slot if it has one, else an empty slot or one
+  // of an older version, else evicts the slot picked by the fingerprint's
+  // high bits
+  void store(unsigned long long fingerprint, unsigned long long version, double score)
+  {
+    Entry *set = &entries[(int)(fingerprint & setMask) * WAYS];
+    int target = -1;
+    for (int way = 0; way < WAYS && target == -1; way++)
+    {
+      if (set[way].fingerprint == fingerprint)
+        target = way;
+    }
+    for (int way = 0; way < WAYS && target == -1; way++)
+    {
+      if (set[way].fingerprint == 0 || set[way].version != version)
+        target = way;
+    }
+    if (target == -1)
+      target = (int)(fingerprint >> 62);
+    Entry &entry = set[target];
+    if (entry.fingerprint == 0)
+      stored++;
+    entry.fingerprint = fingerprint;
+    entry.version = version;
+    entry.score = (float)score;
+    changed = true;
+  }
+
+  // Binary file: magic, entry count, then fingerprint, version and score
+  // of each entry of version (older ones would never be used again)
+  bool save(const string &path, unsigned long long version)
+  {
+    if (!changed)
+      return true;
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open())
+      return false;
+    int count = 0;
+    for (int i = 0; i < entries.getSize(); i++)
+    {
+      if (entries[i].fingerprint != 0 && entries[i].version == version)
+        count++;
+    }
+    unsigned int header[2] = {FILE_MAGIC, (unsigned int)count};
+    out.write((const char *)header, sizeof(header));
+    for (int i = 0; i < entries.getSize(); i++)
+    {
+      const Entry &entry = entries[i];
+      if (entry.fingerprint == 0 || entry.version != version)
+        continue;
+      unsigned long long record[2] = {entry.fingerprint, entry.version};
+      out.write((const char *)record, sizeof(record));
+      out.write((const char *)&entry.score, sizeof(float));
+    }
+    out.close();
+    if (out.fail())
+      return false;
+    changed = false;
+    return true;
+  }
+
+  // Replaces the cache with a saved one; empty if the file is missing or
+  // from another layout
+  bool load(const string &path)
+  {
+    clear();
+    ifstream in(path.c_str(), ios::binary);
+    if (!in.is_open())
+      return false;
+    unsigned int header[2] = {0, 0};
+    in.read((char *)header, sizeof(header));
+    if (!in || header[0] != FILE_MAGIC)
+      return false;
+    for (unsigned int i = 0; i < header[1]; i++)
+    {
+      unsigned long long record[2];
+      float score;
+      in.read((char *)record, sizeof(record));
+      in.read((char *)&score, sizeof(float));
+      if (!in)
+        break;
+      if (record[0] != 0)
+        store(record[0], record[1], score);
+    }
+    changed = false;
+    return true;
+  }
+
+  void clear()
+  {
+    for (int i = 0; i < entries.getSize(); i++)
+    {
+      entries[i] = Entry();
+    }
+    stored = 0;
+    hits = 0;
+    misses = 0;
+    changed = false;
+  }
+
+  int getCapacity() const { return entries.getSize(); }
+  int getStoredCount() const { return stored; }
+  long long getHits() const { return hits; }
+  long long getMisses() const { return misses; }
+};
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef TEXTKERNELS_H
+#define TEXTKERNELS_H
+
+#include <iostream>
+#include "SlotBitmap.h"
+using namespace std;
+
+// SSE2 is part of every x86-64 CPU; AVX2 is checked for at run time, with
+// GCC/Clang only (they can compile single functions for AVX2)
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define TEXTKERNELS_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define TEXTKERNELS_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+enum TextIsa
+{
+  TEXT_ISA_SCALAR,
+  TEXT_ISA_SSE2,
+  TEXT_ISA_AVX2
+};
+
+// Byte scanning used by spam checks, search snippets and the folder file
+// reader, in scalar, SSE2 and AVX2 versions. The best one the CPU runs is
+// picked on first use. Case folding is ASCII only, like tolower() in the
+// "C" locale: bytes from 0x80 up are left as they are.
+class TextKernels
+{
+private:
+  struct Table
+  {
+    TextIsa isa;
+    void (*foldCase)(const char *, char *, int);
+    int (*findFolded)(const char *, int, const char *, int);
+    int (*findByte)(const char *, int, char);
+  };
+
+  static char foldByte(char c)
+  {
+    return c >= 'A' && c <= 'Z' ? (char)(c + ('a' - 'A')) : c;
+  }
+
+  // Whether text (any case) holds needle (lower case) over length bytes
+  static bool equalFolded(const char *text, const char *needle, int length)
+  {
+    for (int i = 0; i < length; i++)
+    {
+      if (foldByte(text[i]) != needle[i])
+        return false;
+    }
+    return true;
+  }
+
+  static void foldCaseScalar(const char *source, char *target, int length)
+  {
+    for (int i = 0; i < length; i++)
+    {
+      target[i] = foldByte(source[i]);
+    }
+  }
+
+  // Candidates are positions whose first and last bytes match; only those
+  // compare the bytes between
+  static int findFoldedScalar(const char *text, int length, const char *needle, int needleLength)
+  {
+    char first = needle[0];
+    char last = needle[needleLength - 1];
+    for (int i = 0; i + needleLength <= length; i++)
+    {
+      if (foldByte(text[i]) == first && foldByte(text[i + needleLength - 1]) == last &&
+          equalFolded(text + i + 1, needle + 1, needleLength - 2 > 0 ? needleLength - 2 : 0))
+        return i;
+    }
+    return -1;
+  }
+
+  static int findByteScalar(const char *text, int length, char byte)
+  {
+    for (int i = 0; i < length; i++)
+    {
+      if (text[i] == byte)
+        return i;
+    }
+    return -1;
+  }
+
+#ifdef TEXTKERNELS_SSE2
+  // Adds 0x20 to the bytes 'A'..'Z'. Signed compares leave bytes from 0x80
+  // up (negative) alone.
+  static __m128i foldSse2(__m128i bytes)
+  {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+  }
+
+  static void foldCaseSse2(const char *source, char *target, int length)
+  {
+    int i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+      __m128i bytes = _mm_loadu_si128((const __m128i *)(source + i));
+      _mm_storeu_si128((__m128i *)(target + i), foldSse2(bytes));
+    }
+    foldCaseScalar(source + i, target + i, length - i);
+  }
+
+  // 16 positions at a time: fold the bytes at i and at i + needleLength - 1,
+  // compare them with the needle's first and last byte, and check only the
+  // positions where both match
+  static int findFoldedSse2(const char *text, int length, const char *needle, int needleLength)
+  {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    int i = 0;
+    for (; i + needleLength - 1 + 16 <= length; i += 16)
+    {
+      __m128i atFirst = foldSse2(_mm_loadu_si128((const __m128i *)(text + i)));
+      __m128i atLast = foldSse2(_mm_loadu_si128((const __m128i *)(text + i + needleLength - 1)));
+      unsigned long long mask = (unsigned int)_mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(atFirst, first), _mm_cmpeq_epi8(atLast, last)));
+      while (mask != 0)
+      {
+        int position = i + SlotBitmap::lowestBit(mask);
+        if (needleLength <= 2 || equalFolded(text + position + 1, needle + 1, needleLength - 2))
+          return position;
+        mask &= mask - 1;
+      }
+    }
+    int rest = findFoldedScalar(text + i, length - i, needle, needleLength);
+    return rest != -1 ? i + rest : -1;
+  }
+
+  static int findByteSse2(const char *text, int length, char byte)
+  {
+    __m128i wanted = _mm_set1_epi8(byte);
+    int i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+      unsigned long long mask = (unsigned int)_mm_movemask_epi8(
+          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(text + i)), wanted));
+      if (mask != 0)
+        return i + SlotBitmap::lowestBit(mask);
+    }
+    int rest = findByteScalar(text + i, length - i, byte);
+    return rest != -1 ? i + rest : -1;
+  }
+#endif
+
+#ifdef TEXTKERNELS_AVX2
+  // The SSE2 kernels over 32 bytes
+  __attribute__((target("avx2"))) static __m256i foldAvx2(__m256i bytes)
+  {
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+    return _mm256_add_epi8(bytes, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+  }
+
+  __attribute__((target("avx2"))) static void foldCaseAvx2(const char *source, char *target, int length)
+  {
+    int i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+      __m256i bytes = _mm256_loadu_si256((const __m256i *)(source + i));
+      _mm256_storeu_si256((__m256i *)(target + i), foldAvx2(bytes));
+    }
+    foldCaseSse2(source + i, target + i, length - i);
+  }
+
+  __attribute__((target("avx2"))) static int findFoldedAvx2(const char *text, int length, const char *needle, int needleLength)
+  {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+    int i = 0;
+    for (; i + needleLength - 1 + 32 <= length; i += 32)
+    {
+      __m256i atFirst = foldAvx2(_mm256_loadu_si256((const __m256i *)(text + i)));
+      __m256i atLast = foldAvx2(_mm256_loadu_si256((const __m256i *)(text + i + needleLength - 1)));
+      unsigned long long mask = (unsigned int)_mm256_movemask_epi8(
+          _mm256_and_si256(_mm256_cmpeq_epi8(atFirst, first), _mm256_cmpeq_epi8(atLast, last)));
+      while (mask != 0)
+      {
+        int position = i + SlotBitmap::lowestBit(mask);
+        if (needleLength <= 2 || equalFolded(text + position + 1, needle + 1, needleLength - 2))
+          return position;
+        mask &= mask - 1;
+      }
+    }
+    int rest = findFoldedSse2(text + i, length - i, needle, needleLength);
+    return rest != -1 ? i + rest : -1;
+  }
+
+  __attribute__((target("avx2"))) static int findByteAvx2(const char *text, int length, char byte)
+  {
+    __m256i wanted = _mm256_set1_epi8(byte);
+    int i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+      unsigned long long mask = (unsigned int)_mm256_movemask_epi8(
+          _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(text + i)), wanted));
+      if (mask != 0)
+        return i + SlotBitmap::lowestBit(mask);
+    }
+    int rest = findByteSse2(text + i, length - i, byte);
+    return rest != -1 ? i + rest : -1;
+  }
+#endif
+
+  static bool supports(TextIsa isa)
+  {
+    switch (isa)
+    {
+    case TEXT_ISA_SCALAR:
+      return true;
+#ifdef TEXTKERNELS_SSE2
+    case TEXT_ISA_SSE2:
+      return true;
+#endif
+#ifdef TEXTKERNELS_AVX2
+    case TEXT_ISA_AVX2:
+      return __builtin_cpu_supports("avx2") != 0;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  static Table tableFor(TextIsa isa)
+  {
+    Table table;
+    table.isa = TEXT_ISA_SCALAR;
+    table.foldCase = foldCaseScalar;
+    table.findFolded = findFoldedScalar;
+    table.findByte = findByteScalar;
+#ifdef TEXTKERNELS_SSE2
+    if (isa == TEXT_ISA_SSE2)
+    {
+      table.isa = TEXT_ISA_SSE2;
+      table.foldCase = foldCaseSse2;
+      table.findFolded = findFoldedSse2;
+      table.findByte = findByteSse2;
+    }
+#endif
+#ifdef TEXTKERNELS_AVX2
+    if (isa == TEXT_ISA_AVX2)
+    {
+      table.isa = TEXT_ISA_AVX2;
+      table.foldCase = foldCaseAvx2;
+      table.findFolded = findFoldedAvx2;
+      table.findByte = findByteAvx2;
+    }
+#endif
+    return table;
+  }
+
+  static Table &table()
+  {
+    static Table current = tableFor(supports(TEXT_ISA_AVX2) ? TEXT_ISA_AVX2 : supports(TEXT_ISA_SSE2) ? TEXT_ISA_SSE2
+                                                                                                      : TEXT_ISA_SCALAR);
+    return current;
+  }
+
+public:
+  // Lower-cases length bytes of source into target (may be the same)
+  static void foldCase(const char *source, char *target, int length)
+  {
+    table().foldCase(source, target, length);
+  }
+
+  // First position of needle in text ignoring case, -1 if none. needle
+  // must be lower case already; text can be anything.
+  static int findFolded(const char *text, int length, const char *needle, int needleLength)
+  {
+    if (needleLength <= 0)
+      return 0;
+    if (text == nullptr || needleLength > length)
+      return -1;
+    return table().findFolded(text, length, needle, needleLength);
+  }
+
+  // First position of byte in text, -1 if none
+  static int findByte(const char *text, int length, char byte)
+  {
+    if (text == nullptr)
+      return -1;
+    return table().findByte(text, length, byte);
+  }
+
+  // Switches to the kernels of isa (for benchmarks and tests); false if
+  // the CPU or the build does not have them
+  static bool useIsa(TextIsa isa)
+  {
+    if (!supports(isa))
+      return false;
+    table() = tableFor(isa);
+    return true;
+  }
+
+  static TextIsa getIsa() { return table().isa; }
+
+  static const char *getIsaName()
+  {
+    switch (getIsa())
+    {
+    case TEXT_ISA_AVX2:
+      return "AVX2";
+    case TEXT_ISA_SSE2:
+      return "SSE2";
+    default:
+      return "Scalar";
+    }
+  }
+};
+
+#endif
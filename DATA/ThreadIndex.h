@@ -0,0 +1,294 @@
+#ifndef THREADINDEX_H
+#define THREADINDEX_H
+
+#include <iostream>
+#include <string>
+#include <cctype>
+#include <cstring>
+#include "Array.h"
+#include "HashMap.h"
+#include "Email.h"
+using namespace std;
+
+// One thread of a folder's thread list
+struct ThreadSummary
+{
+  EmailId latestId; // Newest email of the thread in the folder
+  int count;        // Emails of the thread in the folder
+  int unread;
+
+  ThreadSummary() : latestId(0), count(0), unread(0) {}
+};
+
+// Conversation threads over every email of the mailbox. Emails are nodes
+// of a union-find forest: a reply joins the thread of the email it answers
+// (inReplyTo), and a "Re:"/"Fwd:" email without one joins the thread of
+// its normalized subject. Each thread also keeps its nodes in a circular
+// list, so listing a thread walks only its own emails. Folders add emails
+// as they store them; nothing is ever split, so a deleted email stays in
+// its thread (callers skip ids that are no longer stored).
+class ThreadIndex
+{
+private:
+  // First emails seen with one normalized subject
+  struct SubjectThread
+  {
+    int original; // Node of an email without a reply prefix, -1 if none yet
+    int reply;    // Node of an email with one, -1 if none yet
+
+    SubjectThread() : original(-1), reply(-1) {}
+  };
+
+  // Email id -> node, open addressing with linear probing: one probe
+  // usually finds the id, and nothing is allocated per email. Id 0 (no id)
+  // marks a free cell; at most half the cells are used.
+  DynamicArray<EmailId> cellIds;
+  DynamicArray<int> cellNodes;
+  int cellMask;
+
+  DynamicArray<EmailId> ids;    // Node -> email id
+  DynamicArray<int> parents;    // Union-find parent; a root is its own
+  DynamicArray<int> sizes;      // Thread size, kept at the root
+  DynamicArray<int> nextNodes;  // Circular list of each thread's nodes
+  HashMap<unsigned long long, SubjectThread> *subjects; // Normalized subject hash -> first emails
+
+  // Cell of an id, or the free cell where it would go
+  int cellOf(EmailId emailId) const
+  {
+    int cell = (int)(hashKey(emailId) & (unsigned long long)cellMask);
+    while (cellIds[cell] != 0 && cellIds[cell] != emailId)
+    {
+      cell = (cell + 1) & cellMask;
+    }
+    return cell;
+  }
+
+  void resizeCells(int capacity)
+  {
+    DynamicArray<EmailId> oldIds;
+    DynamicArray<int> oldNodes;
+    oldIds.swap(cellIds);
+    oldNodes.swap(cellNodes);
+    cellIds.resize(capacity, 0);
+    cellNodes.resize(capacity, -1);
+    cellMask = capacity - 1;
+    for (int i = 0; i < oldIds.getSize(); i++)
+    {
+      if (oldIds[i] != 0)
+      {
+        int cell = cellOf(oldIds[i]);
+        cellIds[cell] = oldIds[i];
+        cellNodes[cell] = oldNodes[i];
+      }
+    }
+  }
+
+  // Node of an id, created on first sight. Replies can arrive before the
+  // email they answer; its node is made then and filled in when it comes.
+  int nodeFor(EmailId emailId)
+  {
+    int cell = cellOf(emailId);
+    if (cellIds[cell] == emailId)
+      return cellNodes[cell];
+
+    int node = ids.getSize();
+    ids.add(emailId);
+    parents.add(node);
+    sizes.add(1);
+    nextNodes.add(node);
+    cellIds[cell] = emailId;
+    cellNodes[cell] = node;
+    if (ids.getSize() * 2 > cellMask + 1)
+      resizeCells((cellMask + 1) * 2);
+    return node;
+  }
+
+  // Node of an id, -1 if it was never added
+  int nodeOf(EmailId emailId) const
+  {
+    int cell = cellOf(emailId);
+    return cellIds[cell] == emailId && emailId != 0 ? cellNodes[cell] : -1;
+  }
+
+  int find(int node)
+  {
+    int root = node;
+    while (parents[root] != root)
+    {
+      root = parents[root];
+    }
+    while (parents[node] != root)
+    {
+      int next = parents[node];
+      parents[node] = root;
+      node = next;
+    }
+    return root;
+  }
+
+  // Joins two threads: the smaller tree goes under the larger one, and the
+  // two circular lists are spliced by swapping one link each
+  void unite(int a, int b)
+  {
+    a = find(a);
+    b = find(b);
+    if (a == b)
+      return;
+    if (sizes[a] < sizes[b])
+    {
+      int swap = a;
+      a = b;
+      b = swap;
+    }
+    parents[b] = a;
+    sizes[a] += sizes[b];
+    int next = nextNodes[a];
+    nextNodes[a] = nextNodes[b];
+    nextNodes[b] = next;
+  }
+
+public:
+  ThreadIndex()
+  {
+    resizeCells(1024);
+    subjects = new HashMap<unsigned long long, SubjectThread>(1024);
+  }
+
+  ~ThreadIndex()
+  {
+    delete subjects;
+  }
+
+  // Hash of a subject without leading "Re:", "Fw:" and "Fwd:" (any case,
+  // repeated) and surrounding spaces, ignoring case; 0 if nothing is left.
+  // replied tells whether any prefix was removed. Reads the text in place.
+  static unsigned long long subjectKey(const char *text, int length, bool &replied)
+  {
+    replied = false;
+    int start = 0;
+    while (true)
+    {
+      while (start < length && isspace((unsigned char)text[start]))
+      {
+        start++;
+      }
+      int colon = start;
+      while (colon < length && colon - start <= 3 && text[colon] != ':')
+      {
+        colon++;
+      }
+      if (colon >= length || colon - start > 3 || text[colon] != ':')
+        break;
+      char prefix[4] = {0, 0, 0, 0};
+      for (int i = start; i < colon; i++)
+      {
+        prefix[i - start] = (char)tolower((unsigned char)text[i]);
+      }
+      if (strcmp(prefix, "re") != 0 && strcmp(prefix, "fw") != 0 && strcmp(prefix, "fwd") != 0)
+        break;
+      replied = true;
+      start = colon + 1;
+    }
+
+    int end = length;
+    while (end > start && isspace((unsigned char)text[end - 1]))
+    {
+      end--;
+    }
+    if (end == start)
+      return 0;
+    unsigned long long h = 1469598103934665603ULL; // FNV-1a, as hashKey()
+    for (int i = start; i < end; i++)
+    {
+      h ^= (unsigned char)tolower((unsigned char)text[i]);
+      h *= 1099511628211ULL;
+    }
+    return h != 0 ? h : 1;
+  }
+
+  // Adds an email (again, after a move, is harmless). O(1) amortized.
+  void addEmail(const Email &email)
+  {
+    if (email.getId() == 0)
+      return;
+    int node = nodeFor(email.getId());
+
+    if (email.getInReplyTo() != 0)
+      unite(node, nodeFor(email.getInReplyTo()));
+
+    // Same normalized subject: replies join the original (or the first
+    // reply), and an original joins replies that came before it
+    bool replied;
+    TextRef subject = email.getSubjectRef();
+    unsigned long long key = subjectKey(TextArena::mailbox().data(subject), (int)subject.length, replied);
+    if (key == 0)
+      return;
+    SubjectThread *first = subjects->search(key);
+    if (first == nullptr)
+      first = subjects->insert(key, SubjectThread());
+    if (replied && email.getInReplyTo() == 0)
+    {
+      if (first->original != -1)
+        unite(node, first->original);
+      else if (first->reply != -1)
+        unite(node, first->reply);
+    }
+    else if (!replied && first->reply != -1 && first->original == -1)
+    {
+      unite(node, first->reply);
+    }
+    if (replied && first->reply == -1)
+      first->reply = node;
+    if (!replied && first->original == -1)
+      first->original = node;
+  }
+
+  // Thread of an email: the same number for every email of one thread,
+  // -1 if the email is unknown. Stable until the next addEmail().
+  int threadOf(EmailId emailId)
+  {
+    int node = nodeOf(emailId);
+    return node != -1 ? find(node) : -1;
+  }
+
+  // Number of emails in the thread of an email (0 if unknown)
+  int getThreadSize(EmailId emailId)
+  {
+    int thread = threadOf(emailId);
+    return thread != -1 ? sizes[thread] : 0;
+  }
+
+  // Every id in the thread of an email, including ids not stored anymore
+  // and replied-to ids never seen
+  int getThread(EmailId emailId, DynamicArray<EmailId> &thread)
+  {
+    int start = nodeOf(emailId);
+    if (start == -1)
+      return 0;
+    int node = start;
+    int count = 0;
+    do
+    {
+      thread.add(ids[node]);
+      count++;
+      node = nextNodes[node];
+    } while (node != start);
+    return count;
+  }
+
+  int getEmailCount() const { return ids.getSize(); }
+
+  void clear()
+  {
+    subjects->clear();
+    cellIds = DynamicArray<EmailId>();
+    cellNodes = DynamicArray<int>();
+    resizeCells(1024);
+    ids = DynamicArray<EmailId>();
+    parents = DynamicArray<int>();
+    sizes = DynamicArray<int>();
+    nextNodes = DynamicArray<int>();
+  }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef TIMEBUCKETS_H
+#define TIMEBUCKETS_H
+
+#include <iostream>
+#include "Array.h"
+using namespace std;
+
+// The slots of a folder whose emails carry timestamps of one day
+struct TimeBucket
+{
+  long long day;     // Days since 1970-01-01 (UTC)
+  long long minTime; // Bounds of the timestamps added; after removals they
+  long long maxTime; // can be wider than what is left, never narrower
+  DynamicArray<int> slots;
+
+  TimeBucket(long long d = 0) : day(d), minTime(0), maxTime(0) {}
+};
+
+// A folder's slots partitioned by day, buckets kept in day order. A date
+// range touches only the buckets it overlaps (found by binary search), and
+// a bucket that lies inside the range is taken whole without reading its
+// emails. Removing a slot is O(1) plus the search for its day.
+class TimeBuckets
+{
+private:
+  DynamicArray<TimeBucket *> buckets; // Ascending day, none empty
+  DynamicArray<int> positions;        // Slot -> index in its bucket, -1 if not in one
+
+public:
+  static const long long SECONDS_PER_DAY = 86400;
+
+  TimeBuckets() {}
+
+  ~TimeBuckets()
+  {
+    clear();
+  }
+
+  static long long dayOf(long long time)
+  {
+    // Rounds down for times before 1970 too
+    return time >= 0 ? time / SECONDS_PER_DAY : -((-time + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
+  }
+
+  // Index of the first bucket on or after day (getBucketCount() if none)
+  int lowerBound(long long day) const
+  {
+    int low = 0, high = buckets.getSize();
+    while (low < high)
+    {
+      int middle = (low + high) / 2;
+      if (buckets[middle]->day < day)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    return low;
+  }
+
+  void add(int slot, long long time)
+  {
+    long long day = dayOf(time);
+    int index = lowerBound(day);
+    if (index == buckets.getSize() || buckets[index]->day != day)
+    {
+      // New day; mail mostly arrives in time order, so this is an append
+      buckets.add(nullptr);
+      for (int i = buckets.getSize() - 1; i > index; i--)
+      {
+        buckets[i] = buckets[i - 1];
+      }
+      buckets[index] = new TimeBucket(day);
+      buckets[index]->minTime = time;
+      buckets[index]->maxTime = time;
+    }
+
+    TimeBucket *bucket = buckets[index];
+    if (time < bucket->minTime)
+      bucket->minTime = time;
+    if (time > bucket->maxTime)
+      bucket->maxTime = time;
+    if (slot >= positions.getSize())
+      positions.resize(slot + 1, -1);
+    positions[slot] = bucket->slots.getSize();
+    bucket->slots.add(slot);
+  }
+
+  // time must be the one the slot was added with
+  void remove(int slot, long long time)
+  {
+    if (slot >= positions.getSize() || positions[slot] == -1)
+      return;
+    int index = lowerBound(dayOf(time));
+    if (index == buckets.getSize() || buckets[index]->day != dayOf(time))
+      return;
+
+    // The bucket's last slot fills the hole
+    TimeBucket *bucket = buckets[index];
+    int position = positions[slot];
+    int moved = bucket->slots.removeLast();
+    if (moved != slot)
+    {
+      bucket->slots[position] = moved;
+      positions[moved] = position;
+    }
+    positions[slot] = -1;
+
+    if (bucket->slots.getSize() == 0)
+    {
+      delete bucket;
+      for (int i = index; i < buckets.getSize() - 1; i++)
+      {
+        buckets[i] = buckets[i + 1];
+      }
+      buckets.removeLast();
+    }
+  }
+
+  int getBucketCount() const { return buckets.getSize(); }
+  const TimeBucket &getBucket(int index) const { return *buckets[index]; }
+
+  void clear()
+  {
+    for (int i = 0; i < buckets.getSize(); i++)
+    {
+      delete buckets[i];
+    }
+    buckets = DynamicArray<TimeBucket *>();
+    positions = DynamicArray<int>();
+  }
+};
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef TRIE_H
+#define TRIE_H
+
+#include <iostream>
+#include <string>
+#include "Array.h"
+#include "HashMap.h"
+using namespace std;
+
+// One autocomplete result
+struct AddressSuggestion
+{
+  string address;
+  string label; // Display name, may be empty
+  double score;
+
+  AddressSuggestion() : score(0) {}
+};
+
+// Ternary search tree for prefix autocomplete of email addresses. An
+// address is reachable through its own text and through the words of its
+// label (contact or user name). Nodes whose subtree is large keep a short
+// list of the best scoring entries below them, so a lookup is one walk
+// down the prefix plus reading that list; small subtrees are scanned.
+class AutocompleteTrie
+{
+private:
+  struct Node
+  {
+    char c;
+    int lo, eq, hi;
+    int keys;  // Head of the list of entries whose key ends here
+    int count; // Keys ending at or below this node
+    int cache; // Offset of the top entries in cachePool, -1 if none
+
+    Node() : c(0), lo(-1), eq(-1), hi(-1), keys(-1), count(0), cache(-1) {}
+  };
+
+  struct KeyLink
+  {
+    int entry;
+    int next;
+
+    KeyLink() : entry(-1), next(-1) {}
+  };
+
+  struct Entry
+  {
+    string address;
+    string label;
+    double score;
+    DynamicArray<string> keys;
+
+    Entry() : score(0), keys(1) {}
+  };
+
+  static const int TOP_K = 8;
+  static const int CACHE_THRESHOLD = 32; // Smaller subtrees are scanned
+
+  DynamicArray<Node> nodes;
+  DynamicArray<KeyLink> links;
+  DynamicArray<Entry> entries;
+  DynamicArray<int> cachePool; // TOP_K entry slots per cache, -1 when empty
+  HashMap<string, int> *entryIndex; // Lowercase address -> entry
+  int root;
+
+  static string toLower(const string &text)
+  {
+    string lower = text;
+    for (size_t i = 0; i < lower.length(); i++)
+    {
+      lower[i] = tolower((unsigned char)lower[i]);
+    }
+    return lower;
+  }
+
+  bool better(int a, int b) const
+  {
+    if (entries[a].score != entries[b].score)
+      return entries[a].score > entries[b].score;
+    return entries[a].address < entries[b].address;
+  }
+
+  int newNode(char c)
+  {
+    Node node;
+    node.c = c;
+    nodes.add(node);
+    return nodes.getSize() - 1;
+  }
+
+  // Puts an entry into a node's top list, keeping it sorted best first
+  void offer(int cache, int entry)
+  {
+    int *slots = cachePool.raw() + cache;
+    int position = -1;
+    for (int i = 0; i < TOP_K; i++)
+    {
+      if (slots[i] == entry || slots[i] == -1)
+      {
+        position = i;
+        break;
+      }
+    }
+    if (position == -1)
+    {
+      if (!better(entry, slots[TOP_K - 1]))
+        return;
+      position = TOP_K - 1;
+    }
+
+    slots[position] = entry;
+    while (position > 0 && (slots[position - 1] == -1 || better(slots[position], slots[position - 1])))
+    {
+      int temp = slots[position - 1];
+      slots[position - 1] = slots[position];
+      slots[position] = temp;
+      position--;
+    }
+  }
+
+  // Entries whose key ends at node or anywhere in its eq subtree
+  void collect(int node, DynamicArray<int> &found) const
+  {
+    for (int link = nodes[node].keys; link != -1; link = links[link].next)
+    {
+      found.add(links[link].entry);
+    }
+
+    DynamicArray<int> stack;
+    if (nodes[node].eq != -1)
+      stack.add(nodes[node].eq);
+    while (!stack.isEmpty())
+    {
+      int current = stack.removeLast();
+      const Node &n = nodes[current];
+      for (int link = n.keys; link != -1; link = links[link].next)
+      {
+        found.add(links[link].entry);
+      }
+      if (n.lo != -1)
+        stack.add(n.lo);
+      if (n.eq != -1)
+        stack.add(n.eq);
+      if (n.hi != -1)
+        stack.add(n.hi);
+    }
+  }
+
+  void buildCache(int node)
+  {
+    int cache = cachePool.getSize();
+    for (int i = 0; i < TOP_K; i++)
+    {
+      cachePool.add(-1);
+    }
+    nodes[node].cache = cache;
+
+    DynamicArray<int> found;
+    collect(node, found);
+    for (int i = 0; i < found.getSize(); i++)
+    {
+      offer(cache, found[i]);
+    }
+  }
+
+  // Walks (and extends) the tree along key. Returns the node of its last
+  // character and fills path with the nodes whose prefix the key shares.
+  int walk(const string &key, DynamicArray<int> &path, bool create)
+  {
+    if (root == -1)
+    {
+      if (!create)
+        return -1;
+      root = newNode(key[0]);
+    }
+
+    int current = root;
+    size_t i = 0;
+    while (true)
+    {
+      char c = key[i];
+      if (c < nodes[current].c)
+      {
+        if (nodes[current].lo == -1)
+        {
+          if (!create)
+            return -1;
+          int child = newNode(c);
+          nodes[current].lo = child;
+        }
+        current = nodes[current].lo;
+      }
+      else if (c > nodes[current].c)
+      {
+        if (nodes[current].hi == -1)
+        {
+          if (!create)
+            return -1;
+          int child = newNode(c);
+          nodes[current].hi = child;
+        }
+        current = nodes[current].hi;
+      }
+      else
+      {
+        path.add(current);
+        if (i + 1 == key.length())
+          return current;
+        if (nodes[current].eq == -1)
+        {
+          if (!create)
+            return -1;
+          int child = newNode(key[i + 1]);
+          nodes[current].eq = child;
+        }
+        current = nodes[current].eq;
+        i++;
+      }
+    }
+  }
+
+  void addKey(const string &key, int entry)
+  {
+    if (key.empty())
+      return;
+
+    // Popular label words end at nodes with long lists, so check the
+    // entry's own (short) key list for duplicates instead
+    for (int k = 0; k < entries[entry].keys.getSize(); k++)
+    {
+      if (entries[entry].keys[k] == key)
+        return;
+    }
+
+    DynamicArray<int> path;
+    int last = walk(key, path, true);
+
+    KeyLink link;
+    link.entry = entry;
+    link.next = nodes[last].keys;
+    links.add(link);
+    nodes[last].keys = links.getSize() - 1;
+    entries[entry].keys.add(key);
+
+    for (int i = 0; i < path.getSize(); i++)
+    {
+      Node &node = nodes[path[i]];
+      node.count++;
+      if (node.cache != -1)
+        offer(node.cache, entry);
+      else if (node.count > CACHE_THRESHOLD)
+        buildCache(path[i]);
+    }
+  }
+
+public:
+  AutocompleteTrie()
+  {
+    entryIndex = new HashMap<string, int>(1024);
+    root = -1;
+  }
+
+  ~AutocompleteTrie()
+  {
+    delete entryIndex;
+  }
+
+  // Adds an address, or raises the score of a known one (scores never
+  // go down). The address and every word of the label become keys.
+  void addAddress(const string &address, const string &label, double score)
+  {
+    string key = toLower(address);
+    if (key.empty())
+      return;
+
+    int *existing = entryIndex->search(key);
+    int entry;
+    if (existing == nullptr)
+    {
+      Entry newEntry;
+      newEntry.address = address;
+      newEntry.label = label;
+      newEntry.score = score;
+      entries.add(newEntry);
+      entry = entries.getSize() - 1;
+      entryIndex->insert(key, entry);
+      addKey(key, entry);
+    }
+    else
+    {
+      entry = *existing;
+      if (entries[entry].label.empty())
+        entries[entry].label = label;
+      if (score > entries[entry].score)
+      {
+        entries[entry].score = score;
+        // Move it up in the top lists along all of its keys
+        for (int k = 0; k < entries[entry].keys.getSize(); k++)
+        {
+          DynamicArray<int> path;
+          walk(entries[entry].keys[k], path, false);
+          for (int i = 0; i < path.getSize(); i++)
+          {
+            if (nodes[path[i]].cache != -1)
+              offer(nodes[path[i]].cache, entry);
+          }
+        }
+      }
+    }
+
+    // Label words, so "jon" finds jonathan.smith@...
+    string word;
+    string lowerLabel = toLower(label) + " ";
+    for (size_t i = 0; i < lowerLabel.length(); i++)
+    {
+      if (isalnum((unsigned char)lowerLabel[i]))
+      {
+        word += lowerLabel[i];
+      }
+      else if (!word.empty())
+      {
+        addKey(word, entry);
+        word.clear();
+      }
+    }
+  }
+
+  // Best scoring addresses that have a key starting with prefix
+  int complete(const string &rawPrefix, DynamicArray<AddressSuggestion> &results, int maxResults = 5)
+  {
+    string prefix = toLower(rawPrefix);
+    if (prefix.empty() || maxResults <= 0)
+      return 0;
+
+    DynamicArray<int> path;
+    int node = walk(prefix, path, false);
+    if (node == -1)
+      return 0;
+
+    int ranked[TOP_K];
+    int count = 0;
+    if (nodes[node].cache != -1)
+    {
+      const int *slots = cachePool.raw() + nodes[node].cache;
+      while (count < TOP_K && slots[count] != -1)
+      {
+        ranked[count] = slots[count];
+        count++;
+      }
+    }
+    else
+    {
+      // Small subtree: select the best entries directly
+      DynamicArray<int> found;
+      collect(node, found);
+      for (int i = 0; i < found.getSize(); i++)
+      {
+        bool duplicate = false;
+        for (int j = 0; j < count; j++)
+        {
+          if (ranked[j] == found[i])
+            duplicate = true;
+        }
+        if (duplicate)
+          continue;
+
+        int position;
+        if (count < TOP_K)
+          position = count++;
+        else if (better(found[i], ranked[TOP_K - 1]))
+          position = TOP_K - 1;
+        else
+          continue;
+        ranked[position] = found[i];
+        while (position > 0 && better(ranked[position], ranked[position - 1]))
+        {
+          int temp = ranked[position - 1];
+          ranked[position - 1] = ranked[position];
+          ranked[position] = temp;
+          position--;
+        }
+      }
+    }
+
+    int added = 0;
+    for (int i = 0; i < count && added < maxResults; i++)
+    {
+      AddressSuggestion suggestion;
+      suggestion.address = entries[ranked[i]].address;
+      suggestion.label = entries[ranked[i]].label;
+      suggestion.score = entries[ranked[i]].score;
+      results.add(suggestion);
+      added++;
+    }
+    return added;
+  }
+
+  bool contains(const string &address) const
+  {
+    return entryIndex->contains(toLower(address));
+  }
+
+  int getAddressCount() const { return entries.getSize(); }
+  int getNodeCount() const { return nodes.getSize(); }
+
+  void clear()
+  {
+    nodes.clear();
+    links.clear();
+    entries.clear();
+    cachePool.clear();
+    entryIndex->clear();
+    root = -1;
+  }
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "BST.h"
 #include "Contact.h"
 #include "Array.h"
+#include "BloomFilter.h"
 using namespace std;
 
 class User
@@ -20,6 +21,29 @@ private:
   time_t lastLogin;
   BST<string, Contact> *contacts;
   Array<string> *recentContacts; // Last 10 contacted users
+  BloomFilter *contactFilter;    // Contact addresses, see hasContact
+  int filteredContacts;          // Contacts in it, -1 once one is removed
+
+  // Contacts are also added to the BST directly (getContacts), so a size
+  // the filter has not seen means a rebuild
+  void rebuildContactFilter()
+  {
+    int count = contacts->getSize();
+    contactFilter->reset(count * 2);
+    if (count > 0)
+    {
+      string *keys = new string[count];
+      Contact *values = new Contact[count];
+      contacts->getAllEntries(keys, values, count);
+      for (int i = 0; i < count; i++)
+      {
+        contactFilter->add(keys[i]);
+      }
+      delete[] keys;
+      delete[] values;
+    }
+    filteredContacts = count;
+  }
 
 public:
   User()
@@ -32,6 +56,8 @@ public:
     lastLogin = time(0);
     contacts = new BST<string, Contact>();
     recentContacts = new Array<string>(10);
+    contactFilter = new BloomFilter();
+    filteredContacts = 0;
   }
 
   User(string id, string uname, string mail, string pass)
@@ -44,12 +70,15 @@ public:
     lastLogin = time(0);
     contacts = new BST<string, Contact>();
     recentContacts = new Array<string>(10);
+    contactFilter = new BloomFilter();
+    filteredContacts = 0;
   }
 
   ~User()
   {
     delete contacts;
     delete recentContacts;
+    delete contactFilter;
   }
 
   // Getters
@@ -82,9 +111,19 @@ public:
     return contacts->search(email);
   }
 
+  // Whether the address is a contact. Most senders are not, and the
+  // filter says so without a BST search.
+  bool hasContact(const string &email)
+  {
+    if (filteredContacts != contacts->getSize())
+      rebuildContactFilter();
+    return contactFilter->mightContain(email) && contacts->search(email) != nullptr;
+  }
+
   void removeContact(string email)
   {
     contacts->remove(email);
+    filteredContacts = -1;
   }
 
   void addRecentContact(string contactEmail)
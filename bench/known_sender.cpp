@@ -0,0 +1,136 @@
+// Known-sender check: the Bloom filter's false positive rate at 10 bits a
+// key, then the check made for each incoming message (graph features and
+// contact lookup) for a user with 100 contacts in a 200-user graph, with
+// senders 90% strangers, 5% users and 5% contacts. The contact answers
+// are compared with a plain BST search.
+// Build with "make bench", run from the bench directory.
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../DATA/Graph.h"
+#include "../DATA/User.h"
+using namespace std;
+
+const int USERS = 200;
+const int CONTACTS = 100;
+const int MESSAGES = 200000;
+
+string userAddress(int i)
+{
+  return "u" + to_string(i) + "@x";
+}
+
+double nanosecondsPerMessage(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / MESSAGES;
+}
+
+int main()
+{
+  srand(49);
+
+  BloomFilter filter(10000);
+  for (int i = 0; i < 10000; i++)
+  {
+    filter.add("in" + to_string(i) + "@x");
+  }
+  int falseNegatives = 0;
+  for (int i = 0; i < 10000; i++)
+  {
+    falseNegatives += !filter.mightContain("in" + to_string(i) + "@x");
+  }
+  const int queries = 1000000;
+  int falsePositives = 0;
+  for (int i = 0; i < queries; i++)
+  {
+    falsePositives += filter.mightContain("out" + to_string(i) + "@y");
+  }
+  printf("Bloom filter, 10000 keys in %d bits: %d false negatives, %.2f%% false positives\n\n",
+         filter.getBitCount(), falseNegatives, 100.0 * falsePositives / queries);
+
+  Graph graph;
+  for (int i = 0; i < USERS; i++)
+  {
+    graph.addUser(userAddress(i));
+  }
+  for (int i = 0; i < USERS; i++)
+  {
+    for (int k = 0; k < 5; k++)
+    {
+      int j = rand() % USERS;
+      if (j != i)
+        graph.addConnection(userAddress(i), userAddress(j), 1 + rand() % 3);
+    }
+  }
+
+  User receiver("1", "u0", userAddress(0), "pw");
+  for (int i = 0; i < CONTACTS; i++)
+  {
+    receiver.addContact(Contact("c" + to_string(i), "C", "contact" + to_string(i) + "@ext"));
+  }
+
+  DynamicArray<string> senders;
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    int kind = rand() % 100;
+    if (kind < 90)
+      senders.add("stranger" + to_string(rand() % 100000) + "@spam.example");
+    else if (kind < 95)
+      senders.add(userAddress(1 + rand() % (USERS - 1)));
+    else
+      senders.add("contact" + to_string(rand() % CONTACTS) + "@ext");
+  }
+
+  // Warm the pair cache and the contact filter, then time
+  long long known = 0;
+  double checkNs = 0;
+  for (int round = 0; round < 2; round++)
+  {
+    known = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < MESSAGES; i++)
+    {
+      PairFeatures features = graph.getPairFeatures(senders[i], userAddress(0));
+      if (features.connected || receiver.hasContact(senders[i]))
+        known++;
+    }
+    checkNs = nanosecondsPerMessage(start);
+  }
+
+  int certainlyNotUsers = 0;
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    certainlyNotUsers += !graph.isUser(senders[i]);
+  }
+
+  int filteredContacts = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    filteredContacts += receiver.hasContact(senders[i]);
+  }
+  double filteredNs = nanosecondsPerMessage(start);
+
+  int searchedContacts = 0;
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    searchedContacts += receiver.searchContact(senders[i]) != nullptr;
+  }
+  double searchedNs = nanosecondsPerMessage(start);
+
+  int wrong = 0;
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    if (receiver.hasContact(senders[i]) != (receiver.searchContact(senders[i]) != nullptr))
+      wrong++;
+  }
+
+  printf("%d messages, %lld from known senders\n", MESSAGES, known);
+  printf("known-sender check   %6.0f ns per message\n", checkNs);
+  printf("senders rejected by the user filter  %.1f%%\n", 100.0 * certainlyNotUsers / MESSAGES);
+  printf("hasContact (filter)  %6.0f ns, %d hits\n", filteredNs, filteredContacts);
+  printf("searchContact (BST)  %6.0f ns, %d hits\n", searchedNs, searchedContacts);
+  printf("contact answers that differ  %d\n", wrong);
+  return wrong == 0 && falseNegatives == 0 ? 0 : 1;
+}
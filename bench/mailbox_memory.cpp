@@ -0,0 +1,103 @@
+// Mailbox memory: builds a 1M-message mailbox in a LinkedList and reports
+// sizeof(Email), heap bytes per message and the build and scan times.
+// Heap use is read from mallinfo2, so it is printed on glibc only.
+// Build with "make bench", run from the bench directory.
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../DATA/Email.h"
+#include "../DATA/LinkedList.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+using namespace std;
+
+const int MESSAGES = 1000000;
+const int PEOPLE = 2000;
+
+const char *FIRST_NAMES[] = {"alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi", "ivan", "judy"};
+const char *WORDS[] = {"meeting", "project", "update", "schedule", "report", "budget", "review", "lecture",
+                       "assignment", "deadline", "notes", "question", "thanks", "please", "tomorrow"};
+
+string makeText(int words)
+{
+  string text;
+  for (int i = 0; i < words; i++)
+  {
+    if (i > 0)
+      text += ' ';
+    text += WORDS[rand() % 15];
+  }
+  return text;
+}
+
+long long heapBytes()
+{
+#ifdef __GLIBC__
+  struct mallinfo2 info = mallinfo2();
+  return (long long)(info.uordblks + info.hblkhd);
+#else
+  return 0;
+#endif
+}
+
+double millisecondsSince(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+  DynamicArray<string> people;
+  for (int i = 0; i < PEOPLE; i++)
+  {
+    people.add(string(FIRST_NAMES[i % 10]) + "." + to_string(i) + "@university-mail.edu");
+  }
+
+  // The text is made up front so only the mailbox is measured
+  srand(5);
+  DynamicArray<string> subjects;
+  DynamicArray<string> contents;
+  long long textBytes = 0;
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    subjects.add(makeText(3 + rand() % 4));
+    contents.add(makeText(20 + rand() % 40));
+    textBytes += subjects[i].length() + contents[i].length();
+  }
+
+  long long before = heapBytes();
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  LinkedList<Email> *mailbox = new LinkedList<Email>();
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    Email email((EmailId)i + 1, people[rand() % PEOPLE], people[0], subjects[i], contents[i]);
+    email.setFolder(i % 3 ? "Inbox" : "Sent");
+    email.setPriority(rand() % 5 + 1);
+    mailbox->insert(email);
+  }
+  double buildMs = millisecondsSince(start);
+  long long after = heapBytes();
+
+  start = chrono::steady_clock::now();
+  long long checksum = 0;
+  for (LinkedList<Email>::Iterator it = mailbox->begin(); it != mailbox->end(); ++it)
+  {
+    checksum += (*it).getSubject().length() + (*it).getSender().length();
+  }
+  double scanMs = millisecondsSince(start);
+
+  printf("messages            %d\n", MESSAGES);
+  printf("sizeof(Email)       %d\n", (int)sizeof(Email));
+  printf("text bytes/message  %.1f\n", (double)textBytes / MESSAGES);
+  printf("arena bytes/message %.1f\n", (double)TextArena::mailbox().getSize() / MESSAGES);
+#ifdef __GLIBC__
+  printf("heap bytes/message  %.1f\n", (double)(after - before) / MESSAGES);
+#else
+  printf("heap bytes/message  (needs glibc mallinfo2)\n");
+#endif
+  printf("build               %.0f ms\n", buildMs);
+  printf("full scan           %.0f ms (checksum %lld)\n", scanMs, checksum);
+  delete mailbox;
+  return 0;
+}
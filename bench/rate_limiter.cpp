@@ -0,0 +1,79 @@
+// Rate limiter: 1M messages from 50k Zipf-like senders to 10k recipients
+// through the default RateLimiter, once spread over 1000 simulated
+// seconds and once crowded into one. Reports the cost per message, the
+// decisions and the flood verdicts on senders under the flood threshold.
+// Build with "make bench", run from the bench directory.
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include "../DATA/RateLimiter.h"
+using namespace std;
+
+const int MESSAGES = 1000000;
+const int SENDERS = 50000;
+const int RECIPIENTS = 10000;
+const int FLOOD_THRESHOLD = 200; // The default sketch threshold
+
+void run(const char *name, const DynamicArray<unsigned int> &senders, const DynamicArray<unsigned int> &recipients,
+         const DynamicArray<int> &totals, unsigned long long spanMs)
+{
+  // Two warm-up rounds, then the timed one
+  double ns = 0;
+  RateLimiter *limiter = nullptr;
+  for (int round = 0; round < 3; round++)
+  {
+    delete limiter;
+    limiter = new RateLimiter();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < MESSAGES; i++)
+    {
+      limiter->admit(senders[i], recipients[i], 1000 + (unsigned long long)i * spanMs / MESSAGES);
+    }
+    ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / MESSAGES;
+  }
+
+  // Flood verdicts on senders who stayed under the threshold in total
+  RateLimiter check;
+  long long falseFloods = 0;
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    if (check.admit(senders[i], recipients[i], 1000 + (unsigned long long)i * spanMs / MESSAGES) == RATE_FLOOD &&
+        totals[senders[i]] < FLOOD_THRESHOLD)
+      falseFloods++;
+  }
+
+  printf("%-16s %6.1f ns  %8lld  %8lld  %8lld  %12lld\n", name, ns, limiter->getAcceptedCount(),
+         limiter->getDeferredCount(), limiter->getFloodedCount(), falseFloods);
+  delete limiter;
+}
+
+int main()
+{
+  srand(7);
+  DynamicArray<unsigned int> senders;
+  DynamicArray<unsigned int> recipients;
+  DynamicArray<int> totals;
+  totals.resize(SENDERS + 1, 0);
+  for (int i = 0; i < MESSAGES; i++)
+  {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    unsigned int sender = (unsigned int)(SENDERS * pow(u, 3)); // Low ids send most
+    senders.add(sender);
+    recipients.add((unsigned int)(rand() % RECIPIENTS));
+    totals[sender]++;
+  }
+
+  int heavy = 0;
+  for (int s = 0; s <= SENDERS; s++)
+  {
+    if (totals[s] >= FLOOD_THRESHOLD)
+      heavy++;
+  }
+  printf("%d messages, %d senders (%d over %d messages), %d recipients\n\n", MESSAGES, SENDERS, heavy,
+         FLOOD_THRESHOLD, RECIPIENTS);
+  printf("span             per msg  accepted  deferred   flooded  false floods\n");
+  run("1000 s", senders, recipients, totals, 1000000);
+  run("1 s", senders, recipients, totals, 1000);
+  return 0;
+}
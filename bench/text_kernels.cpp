@@ -0,0 +1,200 @@
+// Text kernels: checks every TextKernels version the CPU has against the
+// scalar std::string equivalent, and makeSnippet against the copy, fold
+// and find version it replaced, then times foldCase, findFolded and
+// findByte over 1 MB of mixed-case text. Exits with 1 on a mismatch.
+// Build with "make bench", run from the bench directory.
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <chrono>
+#include "../DATA/SearchIndex.h"
+#include "../DATA/TextKernels.h"
+using namespace std;
+
+const TextIsa ISAS[3] = {TEXT_ISA_SCALAR, TEXT_ISA_SSE2, TEXT_ISA_AVX2};
+
+string randomText(int length, const char *alphabet)
+{
+  int size = (int)strlen(alphabet);
+  string text;
+  for (int i = 0; i < length; i++)
+  {
+    text += alphabet[rand() % size];
+  }
+  return text;
+}
+
+string lowerCase(string text)
+{
+  for (size_t i = 0; i < text.length(); i++)
+  {
+    text[i] = tolower((unsigned char)text[i]);
+  }
+  return text;
+}
+
+int position(size_t found)
+{
+  return found == string::npos ? -1 : (int)found;
+}
+
+// makeSnippet before the kernels: a lower-cased copy and string::find
+string referenceSnippet(const string &content, const DynamicArray<string> &queryTerms, int width = 80)
+{
+  string lower = lowerCase(content);
+  size_t best = string::npos;
+  for (int i = 0; i < queryTerms.getSize(); i++)
+  {
+    size_t pos = lower.find(queryTerms[i]);
+    if (pos != string::npos && (best == string::npos || pos < best))
+      best = pos;
+  }
+
+  size_t start = 0;
+  if (best != string::npos && best > (size_t)width / 3)
+  {
+    start = best - width / 3;
+    size_t space = content.find(' ', start);
+    if (space != string::npos && space < best)
+      start = space + 1;
+  }
+
+  string snippet = content.substr(start, width);
+  if (start > 0)
+    snippet = "..." + snippet;
+  if (start + width < content.length())
+    snippet += "...";
+  return snippet;
+}
+
+// Each kernel against the scalar std::string result on random text,
+// with bytes around the case ranges and above 0x7F
+int checkKernels()
+{
+  int mismatches = 0;
+  for (int t = 0; t < 20000; t++)
+  {
+    const char *alphabet = t % 3 == 0 ? "aAbB\x80\xC1Zz[@`{" : "abcABC ,\n";
+    string text = randomText(rand() % 150, alphabet);
+    string needle = lowerCase(randomText(1 + rand() % 6, alphabet));
+    if (rand() % 4 == 0 && text.length() > needle.length())
+    {
+      int at = rand() % (int)(text.length() - needle.length() + 1);
+      for (size_t j = 0; j < needle.length(); j++)
+      {
+        text[at + j] = rand() % 2 ? toupper(needle[j]) : needle[j];
+      }
+    }
+
+    string folded(text.length(), '?');
+    TextKernels::foldCase(text.data(), &folded[0], (int)text.length());
+    if (folded != lowerCase(text))
+      mismatches++;
+
+    int found = TextKernels::findFolded(text.data(), (int)text.length(), needle.data(), (int)needle.length());
+    if (found != position(lowerCase(text).find(needle)))
+      mismatches++;
+
+    char byte = alphabet[rand() % strlen(alphabet)];
+    if (TextKernels::findByte(text.data(), (int)text.length(), byte) != position(text.find(byte)))
+      mismatches++;
+  }
+
+  // Every start alignment of a match past the vector loop
+  string base = randomText(5000, "abcdefghij");
+  for (int offset = 0; offset < 40; offset++)
+  {
+    string text = base;
+    text.replace(4000 + offset, 3, "XyZ");
+    if (TextKernels::findFolded(text.data() + offset, (int)text.length() - offset, "xyz", 3) != 4000)
+      mismatches++;
+  }
+  return mismatches;
+}
+
+int checkSnippets()
+{
+  int mismatches = 0;
+
+  // A longer term after a match near the end used to read past the content
+  DynamicArray<string> terms;
+  terms.add("xy");
+  terms.add("longerterm");
+  if (SearchIndex::makeSnippet("a xy", terms) != referenceSnippet("a xy", terms))
+    mismatches++;
+
+  for (int t = 0; t < 20000; t++)
+  {
+    string content = randomText(rand() % 300, "abcAB C");
+    DynamicArray<string> queryTerms;
+    int count = 1 + rand() % 4;
+    for (int i = 0; i < count; i++)
+    {
+      queryTerms.add(lowerCase(randomText(1 + rand() % 12, "abc ")));
+    }
+    if (SearchIndex::makeSnippet(content, queryTerms) != referenceSnippet(content, queryTerms))
+      mismatches++;
+  }
+  return mismatches;
+}
+
+double gigabytesPerSecond(long long bytes, chrono::steady_clock::time_point start)
+{
+  return bytes / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e9;
+}
+
+int main()
+{
+  srand(42);
+  int mismatches = 0;
+  for (int k = 0; k < 3; k++)
+  {
+    if (!TextKernels::useIsa(ISAS[k]))
+      continue;
+    int kernelMismatches = checkKernels();
+    int snippetMismatches = checkSnippets();
+    printf("%-6s kernel mismatches %d, makeSnippet mismatches %d\n", TextKernels::getIsaName(), kernelMismatches,
+           snippetMismatches);
+    mismatches += kernelMismatches + snippetMismatches;
+  }
+
+  string text = randomText(1 << 20, "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ.");
+  string folded(text.length(), ' ');
+  const int rounds = 200;
+  long long bytes = (long long)rounds * text.length();
+  long long checksum = 0;
+
+  printf("\n1 MB of mixed-case text, GB/s\n");
+  printf("          foldCase  findFolded  findByte\n");
+  for (int k = 0; k < 3; k++)
+  {
+    if (!TextKernels::useIsa(ISAS[k]))
+      continue;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+      TextKernels::foldCase(text.data(), &folded[0], (int)text.length());
+      checksum += folded[r];
+    }
+    double fold = gigabytesPerSecond(bytes, start);
+
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+      checksum += TextKernels::findFolded(text.data(), (int)text.length(), "qxjz", 4);
+    }
+    double find = gigabytesPerSecond(bytes, start);
+
+    start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+      checksum += TextKernels::findByte(text.data(), (int)text.length(), '\n');
+    }
+    double findByte = gigabytesPerSecond(bytes, start);
+
+    printf("  %-6s  %7.1f  %10.1f  %8.1f\n", TextKernels::getIsaName(), fold, find, findByte);
+  }
+  printf("(checksum %lld)\n", checksum);
+  return mismatches == 0 ? 0 : 1;
+}
@@ -4,6 +4,10 @@
 #include <ctime>
 #include <cstring>
 
+// Number of ranked search results fetched per page
+const int SEARCH_PAGE_SIZE = 20;
+const int MAINTENANCE_BUDGET = 200; // Emails of background upkeep per frame
+
 EmailUI::EmailUI(int width, int height)
 {
   screenWidth = width;
@@ -36,6 +40,8 @@ EmailUI::EmailUI(int width, int height)
 
   composeButton = nullptr;
   refreshButton = nullptr;
+  sortButton = nullptr;
+  threadsButton = nullptr;
   logoutButton = nullptr;
   searchButton = nullptr;
   searchInput = nullptr;
@@ -79,17 +85,28 @@ EmailUI::EmailUI(int width, int height)
   showAddConnectionModal = false;
   backToDashboardButton = nullptr;
 
-  selectedEmailId = "";
+  selectedEmailId = 0;
   currentEmail = nullptr;
+  folderCursor = nullptr;
+  textGeneration = 0;
+  sortOrder = SORT_ARRIVAL;
   statusMessage = "";
   statusMessageTime = 0.0f;
   isComposingReply = false;
+  replyToId = 0;
+  isThreadView = false;
+  isConversationView = false;
+  isSearchView = false;
+  searchHasMore = false;
+  searchOffset = 0;
+  selectedSuggestion = 0;
 
   Initialize();
 }
 
 EmailUI::~EmailUI()
 {
+  delete folderCursor;
   delete emailSystem;
   delete backgroundManager;
 
@@ -108,6 +125,8 @@ EmailUI::~EmailUI()
 
   delete composeButton;
   delete refreshButton;
+  delete sortButton;
+  delete threadsButton;
   delete logoutButton;
   delete searchButton;
   delete searchInput;
@@ -181,6 +200,8 @@ void EmailUI::Initialize()
   // Initialize dashboard buttons
   composeButton = new Button(Rectangle{100, 100, 180, 50}, "Compose", UIColors::SUCCESS);
   refreshButton = new Button(Rectangle{300, 100, 150, 50}, "Refresh", UIColors::INFO);
+  sortButton = new Button(Rectangle{300, 100, 150, 50}, "Sort: Arrival", UIColors::INFO);
+  threadsButton = new Button(Rectangle{300, 100, 150, 50}, "Threads", UIColors::INFO);
   logoutButton = new Button(Rectangle{screenWidth - 150, 20, 130, 50}, "Logout", UIColors::DANGER);
   searchInput = new TextBox(Rectangle{100, 170, 300, 45}, "Search emails...", false);
   searchButton = new Button(Rectangle{410, 170, 100, 45}, "Search", UIColors::PRIMARY);
@@ -299,6 +320,23 @@ void EmailUI::Update(float deltaTime)
   {
     messageModal->Update();
   }
+
+  // Picks up an edited spam dictionary once its background reload is done
+  emailSystem->pollSpamDictionary();
+
+  // Moves found by the background spam re-check, a user per frame
+  emailSystem->pollReclassification();
+
+  // Retention, quota and compaction, a bounded slice per frame
+  if (emailSystem->isLoggedIn())
+  {
+    emailSystem->runMaintenance(MAINTENANCE_BUDGET);
+    if (emailSystem->getTextGeneration() != textGeneration)
+    {
+      textGeneration = emailSystem->getTextGeneration();
+      RefetchHeldEmails();
+    }
+  }
 }
 
 void EmailUI::Draw()
@@ -585,6 +623,18 @@ void EmailUI::DrawMainDashboard()
   default:
     break;
   }
+  if (isSearchView)
+  {
+    folderTitle = "Search Results";
+  }
+  else if (isConversationView)
+  {
+    folderTitle = "Conversation";
+  }
+  std::string titleText = folderTitle;
+  if (isThreadView)
+    titleText += " Threads";
+  folderTitle = titleText.c_str();
 
   DrawTextSpaced(folderTitle, rightPanelX + 20, contentY + 20, 28, {255, 255, 255, 255});
 
@@ -593,6 +643,22 @@ void EmailUI::DrawMainDashboard()
   refreshButton->SetSize(120, 40);
   refreshButton->Draw();
 
+  // Sort order of folder views (search results stay ranked)
+  if (folderCursor != nullptr)
+  {
+    sortButton->SetPosition(rightPanelX + rightPanelWidth - 320, contentY + 15);
+    sortButton->SetSize(170, 40);
+    sortButton->Draw();
+  }
+
+  // One row per conversation instead of per email
+  if (folderCursor != nullptr || isThreadView)
+  {
+    threadsButton->SetPosition(rightPanelX + rightPanelWidth - 460, contentY + 15);
+    threadsButton->SetSize(130, 40);
+    threadsButton->Draw();
+  }
+
   DrawLine(rightPanelX + 20, contentY + 65, rightPanelX + rightPanelWidth - 20, contentY + 65, UIColors::BORDER);
 
   // Message list area
@@ -602,44 +668,105 @@ void EmailUI::DrawMainDashboard()
   emailList->SetPosition(rightPanelX + 20, listY);
   emailList->SetSize(rightPanelWidth - 40, listHeight);
 
-  emailList->Update(displayedEmails.size());
+  int total = folderCursor != nullptr ? folderCursor->getTotal() : (int)displayedEmails.size();
+  if (isThreadView)
+    total = (int)displayedThreads.size();
+  emailList->Update(total);
   emailList->BeginScissorMode();
 
   int firstVisible = emailList->GetFirstVisibleItem();
-  int lastVisible = emailList->GetLastVisibleItem();
+  int lastVisible = std::min(emailList->GetLastVisibleItem(), total);
 
-  for (int i = firstVisible; i < std::min(lastVisible, (int)displayedEmails.size()); i++)
+  // Rank the next page of search results only once the list reaches the end
+  if (isSearchView && searchHasMore && emailList->GetLastVisibleItem() >= total)
   {
-    Email &email = displayedEmails[i];
+    LoadMoreSearchResults();
+  }
+
+  // Rows on screen: straight from the folder, or from the copied results
+  visibleRows.clear();
+  if (isThreadView)
+  {
+    // A thread shows its newest email and how many it holds
+    for (int i = firstVisible; i < lastVisible; i++)
+    {
+      const ThreadSummary &thread = displayedThreads[i];
+      const Email *latest = emailSystem->findEmailById(thread.latestId);
+      EmailRow row = latest != nullptr ? FolderCursor::toRow(*latest) : EmailRow();
+      if (thread.count > 1)
+        row.subject = "(" + std::to_string(thread.count) + ") " + row.subject;
+      if (thread.unread == 0)
+        row.labels |= labelBit(LABEL_READ);
+      else
+        row.labels &= ~labelBit(LABEL_READ);
+      visibleRows.add(row);
+    }
+  }
+  else if (folderCursor != nullptr)
+  {
+    folderCursor->seek(firstVisible);
+    folderCursor->nextPage(lastVisible - firstVisible, visibleRows);
+  }
+  else
+  {
+    for (int i = firstVisible; i < lastVisible; i++)
+    {
+      visibleRows.add(FolderCursor::toRow(displayedEmails[i]));
+      if (isSearchView && i < (int)displayedSnippets.size())
+        visibleRows[visibleRows.getSize() - 1].preview = displayedSnippets[i];
+    }
+  }
+
+  for (int r = 0; r < visibleRows.getSize(); r++)
+  {
+    int i = firstVisible + r;
+    EmailRow &row = visibleRows[r];
     float y = listY + (i * 85) - emailList->GetScrollOffset();
 
-    std::string preview = TruncateText(email.getContent(), 60);
-    std::string timeStr = FormatTime(email.getTimestamp());
+    std::string preview = TruncateText(row.preview, 60);
+    std::string timeStr = FormatTime(row.timestamp);
 
     EmailListItem item(
         Rectangle{rightPanelX + 20, y, rightPanelWidth - 40, 80},
-        email.getSender().c_str(),
-        email.getSubject().c_str(),
+        row.sender.c_str(),
+        row.subject.c_str(),
         preview.c_str(),
         timeStr.c_str(),
-        email.getIsRead(),
+        row.hasLabel(LABEL_READ),
         false,
-        email.getPriority());
+        row.priority);
 
     item.Update();
     item.Draw();
 
+    if (item.IsClicked() && isThreadView)
+    {
+      // Opens the conversation; its emails open like any others
+      LoadConversation(row.emailId);
+      break;
+    }
+
     if (item.IsClicked())
     {
-      selectedEmailId = email.getEmailId();
-      currentEmail = &displayedEmails[i];
+      selectedEmailId = row.emailId;
+      if (folderCursor != nullptr)
+      {
+        // Only the opened email is copied out of the folder
+        if (!folderCursor->getFolder()->findEmail(row.emailId, openedEmail))
+          continue;
+        currentEmail = &openedEmail;
+      }
+      else
+      {
+        currentEmail = &displayedEmails[i];
+      }
 
       // Mark email as read when clicked
       if (!currentEmail->getIsRead())
       {
         currentEmail->markAsRead();
-        // Update the email in the email system and save to file
-        emailSystem->updateEmail(*currentEmail);
+        // A label flip, logged rather than saving every folder
+        emailSystem->setEmailLabel(currentEmail->getId(), LABEL_READ, true, currentEmail->getFolder());
       }
 
       SetScreen(Screen::EMAIL_DETAIL);
@@ -649,7 +776,7 @@ void EmailUI::DrawMainDashboard()
   emailList->EndScissorMode();
 
   // No emails message
-  if (displayedEmails.empty())
+  if (total == 0)
   {
     const char *msg = "No emails to display";
     int msgWidth = MeasureText(msg, 24);
@@ -700,6 +827,9 @@ void EmailUI::DrawComposeScreen()
   sendButton->Draw();
   draftButton->Draw();
   cancelButton->Draw();
+
+  // Drawn last so the list covers the inputs below the To box
+  DrawRecipientSuggestions();
 }
 
 void EmailUI::DrawEmailDetailScreen()
@@ -723,6 +853,7 @@ void EmailUI::DrawEmailDetailScreen()
   deleteButton->Draw();
   replyButton->Draw();
   markImportantButton->Draw();
+  markSpamButton->SetText(currentEmail != nullptr && currentEmail->getFolder() == "Spam" ? "Not Spam" : "Spam");
   markSpamButton->Draw();
 
   // Email content panel
@@ -989,8 +1120,79 @@ void EmailUI::DrawStatsScreen()
     DrawTextSpaced("System Statistics:", x, y, 24, UIColors::UI_WHITE);
     y += 50;
 
-    // Display stats from email system
-    DrawTextSpaced("Total emails across all folders", x, y, 20, UIColors::UI_WHITE);
+    // Folder counters are maintained incrementally, so reading them every
+    // frame is cheap
+    EmailFolder *folders[] = {emailSystem->getInbox(), emailSystem->getSent(), emailSystem->getDrafts(),
+                              emailSystem->getSpam(), emailSystem->getTrash()};
+    int totalEmails = 0;
+    unsigned long long totalBytes = 0;
+    char line[160];
+    for (int f = 0; f < 5; f++)
+    {
+      FolderStats stats = folders[f]->getStats();
+      int highPriority = stats.byPriority[3] + stats.byPriority[4] + stats.byPriority[5]; // Same cut as the priority queue
+      sprintf(line, "%-8s %6d emails   %6d unread   %4d high priority   %8.1f KB",
+              folders[f]->getFolderName().c_str(), stats.total, stats.unread, highPriority, stats.bytes / 1024.0);
+      DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+      y += 36;
+      totalEmails += stats.total;
+      totalBytes += stats.bytes;
+    }
+
+    sprintf(line, "Important: %d", emailSystem->getImportantCount());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 50;
+
+    sprintf(line, "Total emails across all folders: %d (%.1f KB)", totalEmails, totalBytes / 1024.0);
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    const MaintenanceReport &upkeep = emailSystem->getMaintenanceReport();
+    sprintf(line, "Maintenance: %d expired, %d over quota, %d compacted, %d text compactions, %.1f KB reclaimed in %.1f ms",
+            upkeep.expiredDeleted, upkeep.quotaMoved, upkeep.slotsCompacted, upkeep.textCompactions,
+            (upkeep.arenaBytes + upkeep.storageBytes) / 1024.0, upkeep.milliseconds);
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    const SpamDictionary &dictionary = emailSystem->getSpamDictionary();
+    sprintf(line, "Spam dictionary: %d phrases, threshold %.1f", dictionary.getPhraseCount(), dictionary.getThreshold());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    const SpamClassifier &classifier = emailSystem->getSpamClassifier();
+    sprintf(line, "Spam model: taught %d spam / %d not spam (yours: %d / %d)",
+            classifier.getSharedModel().getSpamEmails(), classifier.getSharedModel().getHamEmails(),
+            classifier.getUserModel().getSpamEmails(), classifier.getUserModel().getHamEmails());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    const SpamVerdictCache &verdicts = emailSystem->getSpamVerdictCache();
+    sprintf(line, "Spam verdicts cached: %d (%lld reused, %lld classified)",
+            verdicts.getStoredCount(), verdicts.getHits(), verdicts.getMisses());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    sprintf(line, "Sender scoring: %d sender pairs cached, %d senders marked",
+            emailSystem->getSocialGraph()->getCachedPairCount(), emailSystem->getSpamScorer().getReportedSenderCount());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    sprintf(line, "Sender ranks: %d addresses, %d mail and connection edges",
+            emailSystem->getSenderRank().getAddressCount(), emailSystem->getSenderRank().getEdgeCount());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    const RateLimiter &limiter = emailSystem->getRateLimiter();
+    sprintf(line, "Rate limits: %lld accepted, %lld deferrals, %lld from flooding senders",
+            limiter.getAcceptedCount(), limiter.getDeferredCount(), limiter.getFloodedCount());
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
+    y += 40;
+
+    const ReclassifyReport &recheck = emailSystem->getReclassifyReport();
+    sprintf(line, "Spam re-check%s: %d of %d users, %lld emails, %lld to Spam, %lld to Inbox",
+            recheck.running ? " (running)" : "", recheck.usersDone, recheck.users, recheck.scanned,
+            recheck.toSpam, recheck.toInbox);
+    DrawTextSpaced(line, x, y, 20, UIColors::UI_WHITE);
     y += 40;
   }
   else
@@ -1071,6 +1273,10 @@ void EmailUI::UpdateMainDashboard()
 {
   composeButton->Update();
   refreshButton->Update();
+  if (folderCursor != nullptr)
+    sortButton->Update();
+  if (folderCursor != nullptr || isThreadView)
+    threadsButton->Update();
   logoutButton->Update();
   searchInput->Update();
   searchButton->Update();
@@ -1145,11 +1351,35 @@ void EmailUI::UpdateMainDashboard()
     ShowMessage("Refreshed!");
   }
 
+  if (folderCursor != nullptr && sortButton->IsClicked())
+  {
+    // Each order is sorted once and then kept up to date by the folder
+    sortOrder = (SortOrder)((sortOrder + 1) % SORT_ORDER_COUNT);
+    EmailFolder *folder = folderCursor->getFolder();
+    delete folderCursor;
+    folderCursor = new FolderCursor(folder, sortOrder);
+    std::string label = std::string("Sort: ") + sortOrderName(sortOrder);
+    sortButton->SetText(label.c_str());
+  }
+
+  if ((folderCursor != nullptr || isThreadView) && threadsButton->IsClicked())
+  {
+    isThreadView = !isThreadView;
+    threadsButton->SetText(isThreadView ? "Emails" : "Threads");
+    LoadEmails(currentFolderName.c_str());
+  }
+
   if (logoutButton->IsClicked())
   {
+    delete folderCursor;
+    folderCursor = nullptr;
     emailSystem->logout();
     SetScreen(Screen::LOGIN);
     displayedEmails.clear();
+    displayedSnippets.clear();
+    displayedThreads.clear();
+    isSearchView = false;
+    isConversationView = false;
     ClearInputs();
     ShowMessage("Logged out successfully");
   }
@@ -1231,7 +1461,12 @@ void EmailUI::UpdateMainDashboard()
 
 void EmailUI::UpdateComposeScreen()
 {
+  // Suggestions cover the subject box, so they get the click first
+  if (AcceptRecipientSuggestion())
+    return;
+
   toInput->Update();
+  RefreshRecipientSuggestions();
   subjectInput->Update();
   contentInput->Update();
   sendButton->Update();
@@ -1265,6 +1500,96 @@ void EmailUI::UpdateComposeScreen()
   }
 }
 
+// Queries the recipient trie whenever the To box text changes
+void EmailUI::RefreshRecipientSuggestions()
+{
+  if (!toInput->IsActive())
+  {
+    recipientSuggestions.clear();
+    lastSuggestionQuery = "";
+    return;
+  }
+
+  std::string text = toInput->GetText();
+  if (text == lastSuggestionQuery)
+    return;
+  lastSuggestionQuery = text;
+  recipientSuggestions.clear();
+  selectedSuggestion = 0;
+
+  DynamicArray<AddressSuggestion> suggestions;
+  emailSystem->suggestRecipients(text, suggestions, 5);
+  for (int i = 0; i < suggestions.getSize(); i++)
+  {
+    recipientSuggestions.push_back(suggestions[i]);
+  }
+
+  // Nothing to suggest once the full address has been typed
+  if (recipientSuggestions.size() == 1 && recipientSuggestions[0].address == text)
+    recipientSuggestions.clear();
+}
+
+// Up/Down move the highlight, Tab or a click fills in the address.
+// Returns true if a suggestion was taken.
+bool EmailUI::AcceptRecipientSuggestion()
+{
+  if (recipientSuggestions.empty())
+    return false;
+
+  if (IsKeyPressed(KEY_DOWN))
+    selectedSuggestion = (selectedSuggestion + 1) % (int)recipientSuggestions.size();
+  if (IsKeyPressed(KEY_UP))
+    selectedSuggestion = (selectedSuggestion + (int)recipientSuggestions.size() - 1) % (int)recipientSuggestions.size();
+
+  int chosen = -1;
+  if (IsKeyPressed(KEY_TAB))
+    chosen = selectedSuggestion;
+
+  Rectangle box = toInput->GetBounds();
+  if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
+  {
+    Vector2 mousePos = GetMousePosition();
+    for (size_t i = 0; i < recipientSuggestions.size(); i++)
+    {
+      Rectangle row = {box.x, box.y + box.height + i * 36, box.width, 36};
+      if (CheckCollisionPointRec(mousePos, row))
+        chosen = (int)i;
+    }
+  }
+
+  if (chosen < 0)
+    return false;
+
+  toInput->SetText(recipientSuggestions[chosen].address.c_str());
+  lastSuggestionQuery = recipientSuggestions[chosen].address;
+  recipientSuggestions.clear();
+  return true;
+}
+
+void EmailUI::DrawRecipientSuggestions()
+{
+  if (recipientSuggestions.empty())
+    return;
+
+  Rectangle box = toInput->GetBounds();
+  Vector2 mousePos = GetMousePosition();
+  for (size_t i = 0; i < recipientSuggestions.size(); i++)
+  {
+    Rectangle row = {box.x, box.y + box.height + i * 36, box.width, 36};
+    bool highlighted = (int)i == selectedSuggestion || CheckCollisionPointRec(mousePos, row);
+    DrawRectangleRec(row, highlighted ? UIColors::PRIMARY_HOVER : UIColors::INPUT_BG);
+    DrawRectangleLinesEx(row, 1, UIColors::BORDER);
+
+    const AddressSuggestion &suggestion = recipientSuggestions[i];
+    DrawTextSpaced(suggestion.address.c_str(), row.x + 12, row.y + 9, 18, UIColors::TEXT_DARK);
+    if (!suggestion.label.empty())
+    {
+      int labelWidth = MeasureText(suggestion.label.c_str(), 16);
+      DrawTextSpaced(suggestion.label.c_str(), row.x + row.width - labelWidth - 16, row.y + 10, 16, Color{120, 120, 120, 255});
+    }
+  }
+}
+
 void EmailUI::UpdateEmailDetailScreen()
 {
   backButton->Update();
@@ -1378,7 +1703,8 @@ void EmailUI::UpdateContactsScreen()
           Contact newContact(contactId, name, email, phone);
 
           // Add to user's contacts BST
-          currentUser->getContacts()->insert(email, newContact);
+          currentUser->addContact(newContact);
+          emailSystem->indexContactTerms(newContact);
 
           // Save to file
           emailSystem->saveData();
@@ -1430,7 +1756,7 @@ void EmailUI::UpdateContactsScreen()
 
           if (CheckCollisionPointRec(GetMousePosition(), deleteBtn) && IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
           {
-            contacts->remove(contact.getEmail());
+            currentUser->removeContact(contact.getEmail());
             emailSystem->saveData();
             ShowMessage("Contact removed!");
             break;
@@ -1523,7 +1849,7 @@ void EmailUI::UpdateConnectionsScreen()
         }
         else if (emailSystem->getUsers()->contains(userEmail))
         {
-          emailSystem->getSocialGraph()->addConnection(currentUser->getEmail(), userEmail, 1);
+          emailSystem->connectUsers(currentUser->getEmail(), userEmail, 1);
           emailSystem->saveData();
           ShowMessage("Connection added successfully!");
           showAddConnectionModal = false;
@@ -1561,7 +1887,7 @@ void EmailUI::UpdateConnectionsScreen()
         if (CheckCollisionPointRec(mousePos, disconnectBtn))
         {
           string connectedEmail = node->adjacentUsers.get(i);
-          emailSystem->getSocialGraph()->removeConnection(emailSystem->getCurrentUser()->getEmail(), connectedEmail);
+          emailSystem->disconnectUsers(emailSystem->getCurrentUser()->getEmail(), connectedEmail);
           emailSystem->saveData();
           ShowMessage(TextFormat("Removed connection with %s", connectedEmail.c_str()));
           break;
@@ -1663,7 +1989,13 @@ void EmailUI::SetScreen(Screen screen)
 
 void EmailUI::LoadEmails(const char *folderName)
 {
+  delete folderCursor;
+  folderCursor = nullptr;
   displayedEmails.clear();
+  displayedSnippets.clear();
+  displayedThreads.clear();
+  isSearchView = false;
+  isConversationView = false;
   currentFolderName = folderName; // Store current folder
 
   if (!emailSystem->isLoggedIn())
@@ -1683,19 +2015,55 @@ void EmailUI::LoadEmails(const char *folderName)
   else if (strcmp(folderName, "Trash") == 0)
     folder = emailSystem->getTrash();
   else if (strcmp(folderName, "Important") == 0)
-    folder = emailSystem->getImportant();
+  {
+    // Important is a label across folders
+    DynamicArray<Email> labeled;
+    emailSystem->getLabelView(labelBit(LABEL_IMPORTANT), 0, labeled);
+    for (int i = 0; i < labeled.getSize(); i++)
+    {
+      displayedEmails.push_back(labeled[i]);
+    }
+  }
 
-  if (folder)
+  // Opening a folder costs the same at any size: rows are read as they scroll in
+  if (folder && isThreadView)
   {
-    LinkedList<Email> *emails = folder->getEmails();
-    for (int i = 0; i < emails->getSize(); i++)
+    DynamicArray<ThreadSummary> threads;
+    emailSystem->getThreads(folder, threads);
+    for (int i = 0; i < threads.getSize(); i++)
     {
-      displayedEmails.push_back(emails->get(i));
+      displayedThreads.push_back(threads[i]);
     }
+
+    char msg[100];
+    sprintf(msg, "Loaded %d conversations from %s", (int)displayedThreads.size(), folderName);
+    ShowMessage(msg);
+    return;
   }
+  if (folder)
+    folderCursor = new FolderCursor(folder, sortOrder);
 
   char msg[100];
-  sprintf(msg, "Loaded %zu emails from %s", displayedEmails.size(), folderName);
+  sprintf(msg, "Loaded %d emails from %s", folderCursor != nullptr ? folderCursor->getTotal() : (int)displayedEmails.size(), folderName);
+  ShowMessage(msg);
+}
+
+void EmailUI::LoadConversation(EmailId emailId)
+{
+  DynamicArray<Email> conversation;
+  emailSystem->getConversation(emailId, conversation);
+  displayedThreads.clear();
+  displayedEmails.clear();
+  for (int i = 0; i < conversation.getSize(); i++)
+  {
+    displayedEmails.push_back(conversation[i]);
+  }
+  isThreadView = false;
+  isConversationView = true;
+  threadsButton->SetText("Threads");
+
+  char msg[100];
+  sprintf(msg, "Conversation of %d emails", (int)displayedEmails.size());
   ShowMessage(msg);
 }
 
@@ -1714,10 +2082,12 @@ void EmailUI::SendEmail()
   std::string senderEmail = emailSystem->getCurrentUser()->getEmail();
 
   // Create and send email
-  Email newEmail("E" + std::to_string(time(0)),
+  Email newEmail(emailSystem->generateEmailId(),
                  senderEmail,
                  to, subject, content);
   newEmail.setPriority(selectedPriority);
+  if (isComposingReply)
+    newEmail.setInReplyTo(replyToId); // Joins the conversation it answers
 
   // Save to sender's Sent folder
   newEmail.setFolder("Sent");
@@ -1751,8 +2121,8 @@ void EmailUI::SendEmail()
   // Log activity
   emailSystem->logActivity("Sent email to " + to + ": " + subject);
 
-  // Add to recent contacts
-  emailSystem->getCurrentUser()->addRecentContact(to);
+  // Add to recent contacts and bump the recipient in the suggestions
+  emailSystem->recordRecipient(to);
 
   emailSystem->saveAllEmails();
 
@@ -1773,7 +2143,7 @@ void EmailUI::SaveDraft()
     return;
   }
 
-  Email draft("E" + std::to_string(time(0)),
+  Email draft(emailSystem->generateEmailId(),
               emailSystem->getCurrentUser()->getEmail(),
               to.empty() ? "" : to,
               subject, content);
@@ -1794,7 +2164,7 @@ void EmailUI::DeleteEmail()
   if (currentEmail)
   {
     // Use enhanced delete with undo support
-    emailSystem->deleteEmailWithUndo(currentEmail->getEmailId(), currentEmail->getFolder());
+    emailSystem->deleteEmailWithUndo(currentEmail->getId(), currentEmail->getFolder());
     emailSystem->saveAllEmails();
 
     ShowMessage("Email moved to trash (Undo available)");
@@ -1825,6 +2195,7 @@ void EmailUI::ReplyToEmail()
     std::string replySubject = "RE: " + currentEmail->getSubject();
     subjectInput->SetText(replySubject.c_str());
     isComposingReply = true;
+    replyToId = currentEmail->getId();
   }
 }
 
@@ -1832,11 +2203,12 @@ void EmailUI::MarkAsImportant()
 {
   if (currentEmail)
   {
-    currentEmail->setFolder("Important");
-    emailSystem->getImportant()->addEmail(*currentEmail);
-    emailSystem->saveAllEmails();
+    // Toggles the label on the stored email; no copy is made
+    bool important = !currentEmail->hasLabel(LABEL_IMPORTANT);
+    if (emailSystem->setEmailLabel(currentEmail->getId(), LABEL_IMPORTANT, important, currentEmail->getFolder()))
+      currentEmail->setLabel(LABEL_IMPORTANT, important);
 
-    ShowMessage("Marked as important");
+    ShowMessage(important ? "Marked as important" : "Removed from important");
   }
 }
 
@@ -1844,12 +2216,18 @@ void EmailUI::MarkAsSpam()
 {
   if (currentEmail)
   {
-    currentEmail->setIsSpam(true);
-    currentEmail->setFolder("Spam");
-    emailSystem->getSpam()->addEmail(*currentEmail);
-    emailSystem->saveAllEmails();
-
-    ShowMessage("Marked as spam");
+    // In Spam the button reads "Not Spam" and moves the email back
+    if (currentEmail->getFolder() == "Spam")
+    {
+      emailSystem->markAsNotSpam(currentEmail->getId());
+      ShowMessage("Moved to Inbox");
+    }
+    else
+    {
+      // Labels it and moves it to Spam, so it leaves the folder it was in
+      emailSystem->markAsSpam(currentEmail->getId(), currentEmail->getFolder());
+      ShowMessage("Marked as spam");
+    }
     SetScreen(previousScreen);
 
     // Reload current folder
@@ -1857,6 +2235,8 @@ void EmailUI::MarkAsSpam()
       LoadEmails("Inbox");
     else if (previousScreen == Screen::SENT)
       LoadEmails("Sent");
+    else if (previousScreen == Screen::SPAM)
+      LoadEmails("Spam");
 
     currentEmail = nullptr;
   }
@@ -1870,9 +2250,69 @@ void EmailUI::SearchEmails(const char *query)
     return;
   }
 
-  // Implement search functionality
-  // displayedEmails = emailSystem->searchEmails(query);
-  ShowMessage("Search completed");
+  delete folderCursor;
+  folderCursor = nullptr;
+  displayedEmails.clear();
+  displayedSnippets.clear();
+  displayedThreads.clear();
+  activeSearchQuery = query;
+  isSearchView = true;
+  isThreadView = false;
+  isConversationView = false;
+  threadsButton->SetText("Threads");
+  searchHasMore = true;
+  searchOffset = 0;
+  currentEmail = nullptr;
+
+  LoadMoreSearchResults();
+
+  ShowMessage(displayedEmails.empty() ? "No matches found" : "Showing best matches");
+}
+
+void EmailUI::LoadMoreSearchResults()
+{
+  DynamicArray<SearchHit> hits;
+  emailSystem->rankedSearch(activeSearchQuery, searchOffset, SEARCH_PAGE_SIZE, hits);
+  searchOffset += hits.getSize();
+
+  for (int i = 0; i < hits.getSize(); i++)
+  {
+    EmailFolder *folder = emailSystem->getFolderByName(hits[i].folder);
+    Email email;
+    if (folder != nullptr && folder->findEmail(hits[i].emailId, email))
+    {
+      displayedEmails.push_back(email);
+      displayedSnippets.push_back(hits[i].snippet);
+    }
+  }
+
+  searchHasMore = hits.getSize() == SEARCH_PAGE_SIZE;
+}
+
+// The copies in displayedEmails and openedEmail point into the mailbox
+// text, which a text compaction has moved: take the stored emails again
+void EmailUI::RefetchHeldEmails()
+{
+  for (size_t i = 0; i < displayedEmails.size(); i++)
+  {
+    RefetchEmail(displayedEmails[i]);
+  }
+  RefetchEmail(openedEmail);
+}
+
+void EmailUI::RefetchEmail(Email &email)
+{
+  const Email *stored = emailSystem->findEmailById(email.getId(), email.getFolder());
+  if (stored != nullptr)
+  {
+    email = *stored;
+  }
+  else
+  {
+    // Deleted since it was copied; its text is gone
+    email.setSubject("");
+    email.setContent("");
+  }
 }
 
 void EmailUI::ShowMessage(const char *message)
@@ -1905,6 +2345,9 @@ void EmailUI::ClearInputs()
     searchInput->Clear();
   selectedPriority = 0;
   isComposingReply = false;
+  replyToId = 0;
+  recipientSuggestions.clear();
+  lastSuggestionQuery = "";
 }
 
 std::string EmailUI::FormatTime(time_t timestamp)
@@ -2000,6 +2443,8 @@ void EmailUI::UpdateScheduledEmailsScreen()
   DrawTextSpaced("Incoming Queue:", 300, 380, 20, WHITE);
   std::string incomingText = "Pending emails: " + std::to_string(emailSystem->getIncomingQueueCount());
   DrawTextSpaced(incomingText.c_str(), 300, 410, 18, LIGHTGRAY);
+  std::string deferredText = "Deferred by rate limits: " + std::to_string(emailSystem->getDeferredCount());
+  DrawTextSpaced(deferredText.c_str(), 300, 440, 18, LIGHTGRAY);
 }
 
 void EmailUI::UpdateActivityLogScreen()
@@ -2046,6 +2491,11 @@ void EmailUI::UpdateSystemConfigScreen()
   std::string spamFilter = "Spam Filter: " + emailSystem->getConfigValue("SpamFilterEnabled");
   DrawTextSpaced(spamFilter.c_str(), 300, 180, 18, WHITE);
 
-  std::string maxInbox = "Max Inbox Size: " + emailSystem->getConfigValue("MaxInboxSize");
+  std::string maxInbox = "Max Inbox Size: " + emailSystem->getConfigValue("MaxInboxSize") +
+                         (emailSystem->getConfigValue("EnforceInboxQuota") == "true" ? " (enforced)" : " (not enforced)");
   DrawTextSpaced(maxInbox.c_str(), 300, 210, 18, WHITE);
+
+  std::string retention = "Auto Delete Trash: " + emailSystem->getConfigValue("AutoDeleteTrash") + " (after " +
+                          emailSystem->getConfigValue("TrashRetentionDays") + " days)";
+  DrawTextSpaced(retention.c_str(), 300, 240, 18, WHITE);
 }
@@ -5,6 +5,7 @@
 #include "UIComponents.h"
 #include "BackgroundManager.h"
 #include "../DATA/EmailSystem.h"
+#include "../DATA/FolderCursor.h"
 #include <string>
 #include <vector>
 
@@ -54,6 +55,8 @@ private:
   // Main dashboard
   Button *composeButton;
   Button *refreshButton;
+  Button *sortButton;
+  Button *threadsButton;
   Button *logoutButton;
   Button *searchButton;
   TextBox *searchInput;
@@ -106,14 +109,41 @@ private:
   Button *changeBgButton;
 
   // State variables
-  std::string selectedEmailId;
+  EmailId selectedEmailId;
   Email *currentEmail;
   std::string statusMessage;
   float statusMessageTime;
   std::vector<Email> displayedEmails;
   bool isComposingReply;
+  EmailId replyToId; // Email being answered while isComposingReply
   std::string currentFolderName;
 
+  // Folder views page through the folder instead of copying it; only the
+  // rows on screen are read each frame. nullptr for search and labels.
+  FolderCursor *folderCursor;
+  DynamicArray<EmailRow> visibleRows;
+  Email openedEmail; // Copy of the email opened from a folder view
+  unsigned int textGeneration; // EmailSystem text generation the copies above read
+  SortOrder sortOrder; // Order folder views are listed in
+
+  // Folders listed one row per conversation; opening one lists the whole
+  // conversation in displayedEmails
+  bool isThreadView;
+  bool isConversationView;
+  std::vector<ThreadSummary> displayedThreads;
+
+  // Ranked search results, fetched one page at a time
+  bool isSearchView;
+  bool searchHasMore;
+  int searchOffset; // Ranks fetched so far; hits whose email is gone are not displayed
+  std::string activeSearchQuery;
+  std::vector<std::string> displayedSnippets;
+
+  // Recipient suggestions under the compose screen's To box
+  std::vector<AddressSuggestion> recipientSuggestions;
+  std::string lastSuggestionQuery;
+  int selectedSuggestion;
+
   // Screen dimensions
   float screenWidth;
   float screenHeight;
@@ -158,6 +188,7 @@ public:
 
   // Email operations
   void LoadEmails(const char *folderName);
+  void LoadConversation(EmailId emailId);
   void SendEmail();
   void SaveDraft();
   void DeleteEmail();
@@ -165,6 +196,12 @@ public:
   void MarkAsImportant();
   void MarkAsSpam();
   void SearchEmails(const char *query);
+  void LoadMoreSearchResults();
+  void RefetchHeldEmails();
+  void RefetchEmail(Email &email);
+  void RefreshRecipientSuggestions();
+  bool AcceptRecipientSuggestion();
+  void DrawRecipientSuggestions();
   void UndoLastOperation();
   void RedoLastOperation();
   void ProcessScheduledEmails();